@@ -8,10 +8,12 @@
 #define CONFIG_H
 
 #include <stdint.h>
+#include <stddef.h>
 #include <string.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/semphr.h>
 #include <esp_adc/adc_oneshot.h>
+#include "versioned.h"
 
 // =============================================================================
 // ENUMERACIONES
@@ -26,6 +28,12 @@ enum OperationMode {
 enum SensorState { NORMAL, ALL_BLACK, ALL_WHITE };
 enum Location { LEFT, RIGHT };
 
+// Ventanas de mediana y media móvil (`set feature 0/1 1 <ventana>`)
+#ifndef FILTER_WINDOW_MAX
+#define FILTER_WINDOW_MAX 15
+#endif
+const uint8_t FILTER_WINDOW_MIN = 3;
+
 // Features configuration class
 class FeaturesConfig {
 public:
@@ -38,6 +46,10 @@ public:
   bool dynamicLinePid : 1;     // 6
   bool speedProfiling : 1;     // 7
   bool turnDirection : 1;      // 8
+  // Bits libres del mismo uint16: largo de ventana guardado como diferencia con 3,
+  // así una configuración guardada antes de estos campos (bits en 0) sigue en 3
+  uint8_t medianTaps : 3;     // Mediana: 3 + 2·medianTaps muestras
+  uint8_t averageTaps : 3;    // Media móvil: 3 + averageTaps muestras
 
   // Serialize to string [0,1,0,...]
   const char* serialize();
@@ -48,8 +60,13 @@ public:
   void setFeature(uint8_t idx, bool value);  // Cambiado de int a uint8_t
 
   bool getFeature(uint8_t idx);  // Cambiado de int a uint8_t
+
+  uint8_t getWindow(uint8_t idx) const;          // 0 si el feature no tiene ventana
+  bool setWindow(uint8_t idx, uint8_t length);   // false si el largo no es válido
 };
 
+static_assert(sizeof(FeaturesConfig) == 2, "FeaturesConfig: es parte del layout guardado");
+
 // =============================================================================
 // CONFIGURACIÓN DE PINES PARA ESP32
 // =============================================================================
@@ -81,6 +98,33 @@ public:
 // UART
 #define UART_NUM UART_NUM_0
 #define BUF_SIZE 1024
+#define SERIAL_DEFAULT_BAUD     115200
+#define SERIAL_MAX_BAUD         3000000  // Límite práctico del puente USB (CP2102N)
+#define BAUD_CONFIRM_TIMEOUT_MS 2000     // Sin `baud ok` a la nueva velocidad se vuelve a la anterior
+
+// Pipeline de control: adquisición en core 0, control en core 1 (WiFi/BT quedan en core 0)
+#define SENSOR_TASK_CORE        0
+#define CONTROL_TASK_CORE       1
+#define SENSOR_TASK_PRIORITY    (configMAX_PRIORITIES - 3)
+#define CONTROL_TASK_PRIORITY   (configMAX_PRIORITIES - 2)
+#define SENSOR_QUEUE_LEN        4
+#define MUX_SETTLE_US           5     // Asentamiento del 74HC4067 antes de cada lectura
+
+// Grabador de vuelo: 20 bytes por muestra, ~4 s a 1 kHz
+#define RECORDER_SAMPLES        4096
+#define DEFAULT_RECORDER_DEVIATION 3.0f   // |posición| que dispara por desvío
+
+// Registro de vueltas en la partición "runlog" (ver partitions.csv)
+#define RUNLOG_PARTITION_LABEL  "runlog"
+#define RUNLOG_PARTITION_SUBTYPE 0x40
+#define RUNLOG_SECTOR_SIZE      4096
+#define RUNLOG_QUEUE_LEN        1024  // Muestras en RAM mientras se escribe/borra flash (~1 s a 1 kHz)
+#define RUNLOG_TASK_PRIORITY    1
+#define RUNLOG_FLUSH_MS         200   // Cada cuánto se escribe a flash lo acumulado
+#define RUNLOG_ERASE_GAP_MS     10    // Pausa entre borrados fuera de carrera (comandos y mutex)
+#define RUNLOG_PREERASE_SECTORS 256   // Borrados fuera de carrera: lo que ocupa una vuelta (~1 min a 1 kHz)
+#define RUNLOG_HOST_FILE        "runlog.bin"  // Respaldo en archivo para el build de Linux
+#define RUNLOG_HOST_SIZE        (256 * RUNLOG_SECTOR_SIZE)
 
 // LEDC
 #define LEDC_TIMER              LEDC_TIMER_0
@@ -115,11 +159,15 @@ const int16_t DEFAULT_RC_DEADZONE = 10;
 const int16_t DEFAULT_RC_MAX_THROTTLE = 2000;
 const int16_t DEFAULT_RC_MAX_STEERING = 1000;
 const int16_t DEFAULT_PULSES_PER_REVOLUTION = 36;
+const uint32_t RPM_STOP_TIMEOUT_US = 100000;  // Sin flancos en este tiempo la rueda está parada
 const float DEFAULT_WHEEL_DIAMETER_MM = 30.0f;
 const float DEFAULT_WHEEL_DISTANCE_MM = 100.0f;
 const uint16_t DEFAULT_LOOP_LINE_MS = 10;
 const uint16_t DEFAULT_LOOP_SPEED_MS = 5;
 const unsigned long DEFAULT_TELEMTRY_INTERVAL_MS = 100;
+const uint16_t DEFAULT_CONTROL_RATE_HZ = 1000;
+const uint16_t LIMIT_MIN_CONTROL_RATE_HZ = 50;
+const uint16_t LIMIT_MAX_CONTROL_RATE_HZ = 2000;
 const float DEFAULT_ROBOT_WEIGHT = 205.0f;
 
 // PID para línea
@@ -139,7 +187,7 @@ const float DEFAULT_RIGHT_KD = 0.050;
 // Configuraciones por defecto
 const bool DEFAULT_CASCADE = true;
 const bool DEFAULT_TELEMETRY_ENABLED = true;
-const FeaturesConfig DEFAULT_FEATURES = {false, false, false, false, false, false, false, false, false};
+const FeaturesConfig DEFAULT_FEATURES = {false, false, false, false, false, false, false, false, false, 0, 0};
 const OperationMode DEFAULT_OPERATION_MODE = MODE_IDLE;
 const int16_t DEFAULT_BASE_PWM = 200;
 const float DEFAULT_BASE_RPM = 600.0f;
@@ -162,6 +210,36 @@ struct TelemetryData {
     float leftSpeedCms, rightSpeedCms;
     float battery;
     uint32_t loopTime;
+    // Latencias por etapa del pipeline (us)
+    uint32_t sensorUs;      // Adquisición + filtros en core 0
+    uint32_t frameAgeUs;    // Edad del frame al ser consumido en core 1
+    uint32_t lineUs;        // PID de línea
+    uint32_t speedUs;       // PIDs de velocidad en cascada
+    uint32_t pwmUs;         // Actualización LEDC
+    uint32_t jitterUs;      // Desviación del periodo de control
+    uint32_t droppedFrames;
+    uint8_t profile;        // Perfil activo (NO_PROFILE = ninguno)
+};
+
+// Frame producido por la tarea de sensores (core 0) para la de control (core 1)
+struct SensorFrame {
+    float linePosition;
+    int16_t sensorValues[16];
+    int16_t rawSensorValues[16];
+    SensorState sensorState;
+    int64_t timestampUs;    // Fin de la adquisición
+    uint32_t acquireUs;     // Duración de la adquisición
+};
+
+// Tiempos medidos por la tarea de control en el último tick
+struct StageTiming {
+    uint32_t sensorUs;
+    uint32_t frameAgeUs;
+    uint32_t lineUs;
+    uint32_t speedUs;
+    uint32_t pwmUs;
+    uint32_t totalUs;
+    uint32_t jitterUs;
 };
 
 struct SharedData {
@@ -176,6 +254,7 @@ struct SharedData {
     bool telemetryEnabled;
     OperationMode operationMode;
     bool cascadeMode;
+    StageTiming timing;
     SemaphoreHandle_t mutex;
 };
 
@@ -218,11 +297,78 @@ public:
    uint16_t loopSpeedMs;
    unsigned long telemetryIntervalMs;
    float robotWeight;                    // Peso del robot en gramos
-   uint32_t checksum;                    // Checksum para verificación
+   uint16_t controlRateHz;               // Frecuencia del lazo de control (core 1)
+   // Campos nuevos siempre al final: una copia más corta del mismo esquema se completa con defaults
 
    void restoreDefaults();
 };
 
+// Esquema guardado en NVS (clave "config"). Se sube cuando un campo cambia de tipo, se
+// mueve o se quita (agregar al final no cuenta) y se agrega el paso en migrateConfig().
+//   1: blob de RobotConfig sin cabecera, terminaba en `uint32_t checksum` (sin usar)
+//   2: ConfigHeader con CRC-32 + RobotConfig; sin checksum
+const uint16_t CONFIG_SCHEMA_VERSION = 2;
+const uint32_t CONFIG_MAGIC = 0x47464352;            // "RCFG" en little-endian
+// v1 terminaba en robotWeight: los campos agregados después no venían en el blob
+const size_t CONFIG_V1_FIELDS = offsetof(RobotConfig, robotWeight) + sizeof(float);
+const size_t CONFIG_V1_SIZE = CONFIG_V1_FIELDS + sizeof(uint32_t);
+const size_t CONFIG_BLOB_MAX = 512;                  // Mayor RobotConfig que se acepta al cargar
+
+// Mismo formato que la cabecera de los slots EEPROM del Nano; aquí `seq` no se usa
+struct ConfigHeader {
+   uint32_t magic;
+   uint16_t version;                     // CONFIG_SCHEMA_VERSION de quien lo escribió
+   uint16_t length;                      // sizeof(RobotConfig) de quien lo escribió
+   uint32_t crc;                         // CRC-32 de los `length` bytes que siguen
+   uint16_t seq;
+};
+
+// Lleva `len` bytes guardados con el esquema `version` a `out`; lo que esa versión no
+// trae queda en su valor por defecto. false si la versión no se conoce o falta contenido.
+bool migrateConfig(uint16_t version, const uint8_t* raw, size_t len, RobotConfig& out);
+
+// Perfiles de ajuste (`profile save/load`), en NVS con las claves "profile0".."profile3".
+// Mismo contenido que en el Nano; se guardan con ConfigHeader (versión PROFILE_SCHEMA_VERSION).
+const uint8_t PROFILE_SLOTS = 4;
+const uint8_t PROFILE_NAME_LEN = 10;                 // Con el '\0'
+const uint8_t NO_PROFILE = 0xFF;
+const uint16_t PROFILE_SCHEMA_VERSION = 1;
+
+struct TuningProfile {
+   char name[PROFILE_NAME_LEN];
+   float lineKp, lineKi, lineKd;
+   float leftKp, leftKi, leftKd;
+   float rightKp, rightKi, rightKd;
+   int16_t basePwm;
+   int16_t maxPwm;
+   float baseRPM;
+   float maxRpm;
+   bool cascadeMode;
+   FeaturesConfig features;
+
+   void capture(const RobotConfig& c);
+   void apply(RobotConfig& c) const;
+};
+
+// Parámetros que consumen las tareas de sensores y control. Se construyen desde
+// `config` en la tarea de comandos y se publican con publishConfig(); cada tarea
+// los adopta al inicio de su tick, sin mutex y sin lecturas a medias.
+struct ControlParams {
+   float lineKp, lineKi, lineKd;
+   float leftKp, leftKi, leftKd;
+   float rightKp, rightKi, rightKd;
+   float baseRPM;
+   float maxRpm;
+   int16_t maxPwm;
+   FeaturesConfig features;
+   int16_t sensorMin[16];
+   int16_t sensorMax[16];
+   // Derivados
+   float rpmToCms;                       // RPM -> cm/s según diámetro de rueda
+
+   void build(const RobotConfig& c);
+};
+
 // =============================================================================
 // ENUMERACIONES
 // =============================================================================
@@ -233,6 +379,10 @@ class Robot;
 // Global config instance
 extern RobotConfig config;
 extern SharedData sharedData;
+extern Versioned<ControlParams> controlParams;
+
+// Publica la versión actual de `config` para el lazo de control
+void publishConfig();
 
 // Other globals
 extern adc_oneshot_unit_handle_t adc_handle;
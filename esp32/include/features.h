@@ -4,20 +4,55 @@
 #include <stdint.h>
 #include "config.h"
 
+// Ventanas deslizantes en enteros sobre la posición de línea; mismas que
+// SlidingMedian/SlidingAverage en server/include/filters.h. Una salida por muestra.
+
+// Reemplaza `old` por `x` en la ventana ordenada sorted[0..n) con un solo recorrido
+inline void medianReplace(int16_t* sorted, uint8_t n, int16_t old, int16_t x) {
+    uint8_t i = 0;
+    while (sorted[i] != old) i++;
+    while (i > 0 && sorted[i - 1] > x) { sorted[i] = sorted[i - 1]; i--; }
+    while (i < n - 1 && sorted[i + 1] < x) { sorted[i] = sorted[i + 1]; i++; }
+    sorted[i] = x;
+}
+
+class SlidingMedian {
+private:
+    int16_t ring[FILTER_WINDOW_MAX];
+    int16_t sorted[FILTER_WINDOW_MAX];
+    uint8_t len;
+    uint8_t head;
+    bool primed;
+
+public:
+    SlidingMedian() : len(FILTER_WINDOW_MIN), head(0), primed(false) {}
+    void setLength(uint8_t n);
+    int16_t process(int16_t x);
+};
+
+class SlidingAverage {
+private:
+    int16_t ring[FILTER_WINDOW_MAX];
+    int32_t sum;
+    uint8_t len;
+    uint8_t head;
+    bool primed;
+
+public:
+    SlidingAverage() : sum(0), len(FILTER_WINDOW_MIN), head(0), primed(false) {}
+    void setLength(uint8_t n);
+    int16_t process(int16_t x);
+};
+
 class Features {
 private:
     FeaturesConfig config;
-    int16_t medianBuffer[3];
-    uint8_t medianCount;
-    int16_t movingBuffer[3];
-    int32_t movingSum;
-    uint8_t movingCount;
+    SlidingMedian median;
+    SlidingAverage average;
     int16_t kalmanX, kalmanP;
     int16_t hysteresisLast;
     int16_t lowPassLast;
 
-    void sort(float arr[], int n);
-
 public:
     Features();
     void setConfig(FeaturesConfig& f);
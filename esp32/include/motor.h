@@ -13,8 +13,9 @@ private:
     Location location;
     volatile int32_t forwardCount;
     volatile int32_t backwardCount;
+    volatile uint32_t lastEdgeUs;  // Tiempo del último flanco, lo escribe la ISR
     int32_t lastCount;
-    uint32_t lastSpeedCheck;
+    uint32_t lastSpeedCheck;       // Flanco que cerró la medición anterior
     float currentRPM;
     float filteredRPM;
     float targetRPM;
@@ -27,6 +28,9 @@ public:
     int getSpeed();
     float getRPM();
     float getFilteredRPM();
+    // Últimos valores calculados, sin abrir una nueva ventana de medición
+    float getCurrentRPM() const;
+    float getCurrentFilteredRPM() const;
     void setTargetRPM(float t);
     float getTargetRPM();
     long getEncForwardCount();
@@ -1,25 +1,156 @@
+// PID de los tres lazos, misma plantilla que server/include/pid.h (sin el biquad de
+// la derivada). PIDController<float> en el ESP32, que tiene FPU; con Q16
+// (fixedpoint.h) sirve igual.
+//
+//   u = kp·(b·r - y) + ki·∫e dt + kd·d/dt(c·r - y),   e = r - y
+//
+// c = 0 por defecto: D solo sobre la medición, sin patada al cambiar el setpoint. D pasa
+// por un pasabajos con Tf = Td / N. Anti-windup por back-calculation con Tt =
+// sqrt(Ti·Td) (o Ti), límite opcional de pendiente y cambio de ganancias sin salto.
+// dtLine cambia con cada frame: los coeficientes se recalculan solo si dt cambió.
+
 #ifndef PID_H
 #define PID_H
 
 #include <stdint.h>
+#include <math.h>
+#include "fixedpoint.h"
 
-class PID {
+template <typename T>
+class PIDController {
 private:
-    float kp, ki, kd;
-    float error, lastError, integral, derivative;
-    float output;
-    float maxOutput, minOutput;
+  T kp, ki, kd;
+  T b, c;                   // Pesos del setpoint en P y en D
+  uint8_t n;                // Filtro de la derivada: Tf = Td / N (0 = sin filtro)
+  float rateLimit;          // Pendiente máxima de la salida [unidades/s], 0 = sin límite
+  float trackTime;          // Tt del anti-windup [s], 0 = automático
+  T maxOutput, minOutput;
+  // Coeficientes para el dt de la última llamada
+  T dt;
+  T dKeep, dGain;           // dTerm = dKeep·dTerm + dGain·Δ(c·r - y)
+  T trackGain;              // dt / (ki·Tt)
+  T maxStep;                // rateLimit·dt
+  bool coeffsValid;
+  // Estado
+  T error, integral, dTerm, output;
+  T feedforward;            // Se suma a la salida antes de saturar
+  T lastDInput, lastSetpoint, lastMeasurement;
+  bool primed;
+
+  void updateCoefficients(T sampleTime) {
+    dt = sampleTime;
+    float h = toFloat(sampleTime);
+    float p = toFloat(kp), i = toFloat(ki), d = toFloat(kd);
+    float tf = (p > 0 && n > 0) ? d / (p * n) : 0;
+    dKeep = T(tf / (tf + h));
+    dGain = T(d / (tf + h));
+    float tt = trackTime;
+    if (tt <= 0 && p > 0 && i > 0) tt = d > 0 ? sqrtf(d / i) : p / i;   // sqrt(Ti·Td) o Ti
+    if (tt <= 0) tt = h;
+    trackGain = T(i > 0 ? h / (i * tt) : 0.0f);
+    maxStep = T(rateLimit * h);
+    coeffsValid = true;
+  }
+
+  T finish(T setpoint, T measurement) {
+    primed = true;
+    error = setpoint - measurement;
+    lastSetpoint = setpoint;
+    lastMeasurement = measurement;
+    T v = feedforward + kp * (b * setpoint - measurement) + ki * integral + dTerm;
+    T u = v;
+    if (u > maxOutput) u = maxOutput;
+    if (u < minOutput) u = minOutput;
+    if (maxStep > T(0)) {
+      if (u > output + maxStep) u = output + maxStep;
+      if (u < output - maxStep) u = output - maxStep;
+    }
+    if (ki != T(0)) integral += dt * error + trackGain * (u - v);
+    output = u;
+    return u;
+  }
 
 public:
-    PID(float p, float i, float d, float maxOut, float minOut);
-    void setGains(float p, float i, float d);
-    float calculate(float setpoint, float measurement, float dt);
-    void reset();
-    float getOutput();
-    float getError();
-    float getIntegral();
-    float getDerivative();
-    float getProportional();
+  PIDController(float p, float i, float d, float maxOut, float minOut)
+    : kp(p), ki(i), kd(d), b(1.0f), c(0.0f), n(10), rateLimit(0), trackTime(0),
+      maxOutput(maxOut), minOutput(minOut), dt(0), dKeep(0), dGain(0), trackGain(0), maxStep(0),
+      coeffsValid(false), error(0), integral(0), dTerm(0), output(0), feedforward(0),
+      lastDInput(0), lastSetpoint(0), lastMeasurement(0), primed(false) {}
+
+  void setGains(float p, float i, float d) {
+    kp = T(p); ki = T(i); kd = T(d);
+    coeffsValid = false;
+  }
+
+  // Cambia ganancias sin salto en la salida: el integrador absorbe la diferencia
+  void setGainsBumpless(float p, float i, float d) {
+    if (T(p) == kp && T(i) == ki && T(d) == kd) return;
+    float oldKd = toFloat(kd);
+    setGains(p, i, d);
+    // El término D guardado es kd·derivada: se escala a la nueva kd
+    dTerm = oldKd != 0 ? T(toFloat(dTerm) * d / oldKd) : T(0);
+    if (primed && i != 0) {
+      float pTerm = p * (toFloat(b) * toFloat(lastSetpoint) - toFloat(lastMeasurement));
+      integral = T((toFloat(output) - toFloat(feedforward) - pTerm - toFloat(dTerm)) / i);
+    }
+  }
+
+  void setOutputLimits(float minOut, float maxOut) { minOutput = T(minOut); maxOutput = T(maxOut); }
+  void setSetpointWeights(float pWeight, float dWeight) { b = T(pWeight); c = T(dWeight); }
+  void setDerivativeFilterN(uint8_t filterN) { n = filterN; coeffsValid = false; }
+  void setRateLimit(float unitsPerSecond) { rateLimit = unitsPerSecond; coeffsValid = false; }
+  void setTrackingTime(float seconds) { trackTime = seconds; coeffsValid = false; }
+  // Término de adelanto del próximo calculate() (modelo de la planta); el anti-windup
+  // trabaja sobre la suma, así que el integrador solo junta lo que el modelo no explica
+  void setFeedforward(T ff) { feedforward = ff; }
+
+  T calculate(T setpoint, T measurement, T sampleTime) {
+    if (!coeffsValid || sampleTime != dt) updateCoefficients(sampleTime);
+    T dInput = c * setpoint - measurement;
+    T delta = primed ? dInput - lastDInput : T(0);
+    lastDInput = dInput;
+    dTerm = dKeep * dTerm + dGain * delta;
+    return finish(setpoint, measurement);
+  }
+
+  // Con la derivada de la medición ya estimada: no diferencia ni filtra
+  T calculate(T setpoint, T measurement, T sampleTime, T measurementRate) {
+    if (!coeffsValid || sampleTime != dt) updateCoefficients(sampleTime);
+    lastDInput = c * setpoint - measurement;
+    dTerm = -(kd * measurementRate);
+    return finish(setpoint, measurement);
+  }
+
+  // Transferencia sin salto desde mando manual: la próxima salida parte de `u`
+  void track(float u) {
+    output = T(u);
+    dTerm = T(0);
+    if (primed && ki != T(0)) {
+      float pTerm = toFloat(kp) * (toFloat(b) * toFloat(lastSetpoint) - toFloat(lastMeasurement));
+      integral = T((u - toFloat(feedforward) - pTerm) / toFloat(ki));
+    }
+  }
+
+  void reset() {
+    error = T(0);
+    integral = T(0);
+    dTerm = T(0);
+    output = T(0);
+    primed = false;
+  }
+
+  float getOutput() const { return toFloat(output); }
+  float getError() const { return toFloat(error); }
+  float getIntegral() const { return toFloat(integral); }
+  float getDerivative() const {
+    float d = toFloat(kd);
+    return d != 0 ? toFloat(dTerm) / d : 0;
+  }
+  float getProportional() const {
+    return toFloat(kp) * (toFloat(b) * toFloat(lastSetpoint) - toFloat(lastMeasurement));
+  }
 };
 
-#endif
\ No newline at end of file
+typedef PIDController<float> PID;
+
+#endif
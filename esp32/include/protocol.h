@@ -0,0 +1,66 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Tramas binarias, mismo formato que el firmware del Nano (server/include/protocol.h):
+//   0x00 | COBS( tipo:u8 | seq:u16 | payload | crc16:u16 ) | 0x00
+// Little-endian, CRC-16/CCITT-FALSE. Decodificador: server/tools/telemetry_decoder.py
+
+const uint8_t FRAME_RECORDER_HEADER = 0x02;   // RecorderHeader
+const uint8_t FRAME_RECORDER_SAMPLES = 0x03;  // índice:u16 | RecorderSample[...]
+const uint8_t FRAME_RUNLOG_CHUNK = 0x04;      // run:u16 | sector_seq:u32 | offset:u16 | bytes del sector
+const uint8_t FRAME_RUNLOG_END = 0x05;        // run:u16 | sectores:u16
+
+// Muestra por tick del grabador de vuelo (`dump log`). El Nano usa una versión de 14
+// bytes (sin tick, RPM / 32); la cabecera lleva sampleSize para distinguirlas.
+struct __attribute__((packed)) RecorderSample {
+    uint16_t tick;            // Contador de ticks de control
+    int16_t linePos;          // x posScale de la cabecera
+    int16_t lineIntegral;     // x1
+    int16_t lineDeriv;        // x1
+    int16_t linePidOut;       // x10
+    int16_t lTargetRpm, rTargetRpm;  // x8
+    int16_t lRpm, rRpm;       // x8
+    int8_t lPwm, rPwm;        // PWM / 2
+};
+
+static_assert(sizeof(RecorderSample) == 20, "RecorderSample: el layout es parte del protocolo");
+
+// Causas de disparo (también sirven como máscara en `log arm`)
+const uint8_t REC_TRIG_COMMAND = 0x01;
+const uint8_t REC_TRIG_LINE_LOST = 0x02;
+const uint8_t REC_TRIG_STATE = 0x04;
+const uint8_t REC_TRIG_DEVIATION = 0x08;
+
+struct __attribute__((packed)) RecorderHeader {
+    uint8_t reason;
+    uint16_t samples;
+    uint16_t triggerIndex;
+    uint16_t periodUs;
+    uint16_t posScale;
+    uint8_t sampleSize;
+};
+
+const uint8_t RECORDER_SAMPLES_PER_FRAME = 12;
+const size_t FRAME_MAX_PAYLOAD = 2 + RECORDER_SAMPLES_PER_FRAME * sizeof(RecorderSample);
+const size_t FRAME_MAX_RAW = 3 + FRAME_MAX_PAYLOAD + 2;
+const size_t FRAME_MAX_WIRE = FRAME_MAX_RAW + FRAME_MAX_RAW / 254 + 1 + 2;
+
+uint16_t crc16Ccitt(const uint8_t* data, size_t len);
+// CRC-32 (IEEE 802.3, el de zlib) para la configuración guardada en NVS
+uint32_t crc32(const uint8_t* data, size_t len);
+size_t cobsEncode(const uint8_t* in, size_t len, uint8_t* out);
+// Arma la trama completa (delimitadores incluidos) en `out`; devuelve su tamaño
+size_t buildFrame(uint8_t type, uint16_t seq, const void* payload, size_t len, uint8_t* out);
+int16_t toFixed16(float v, float scale);
+
+// Zigzag + varint (LEB128) para deltas pequeños con signo
+inline uint32_t zigzagEncode(int32_t v) { return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31); }
+inline int32_t zigzagDecode(uint32_t v) { return (int32_t)(v >> 1) ^ -(int32_t)(v & 1); }
+size_t putVarint(uint8_t* out, uint32_t v);
+// Devuelve los bytes consumidos, 0 si el varint está cortado
+size_t getVarint(const uint8_t* in, size_t len, uint32_t* v);
+
+#endif
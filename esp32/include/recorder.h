@@ -0,0 +1,63 @@
+#ifndef RECORDER_H
+#define RECORDER_H
+
+#include <stdint.h>
+
+// Grabador de vuelo en RAM. Graba una muestra por tick en un buffer circular;
+// al dispararse sigue grabando hasta completar la ventana posterior y se congela
+// con PRE muestras de historia previa al disparo. Lo usa una sola tarea (control);
+// las demás le piden armar/disparar/congelar por medio de tasks.cpp.
+template <typename Sample, uint32_t N>
+class FlightRecorder {
+public:
+    enum State : uint8_t { IDLE, ARMED, TRIGGERED, FROZEN };
+    static const uint32_t PRE = N / 4;
+
+private:
+    Sample samples[N];
+    uint32_t head;
+    uint32_t count;
+    uint32_t postRemaining;
+    uint8_t reason;
+    State state;
+
+public:
+    FlightRecorder() : head(0), count(0), postRemaining(0), reason(0), state(IDLE) {}
+
+    void arm() { head = 0; count = 0; reason = 0; state = ARMED; }
+
+    void trigger(uint8_t why) {
+        if (state != ARMED) return;
+        reason = why;
+        postRemaining = N - PRE;
+        state = TRIGGERED;
+    }
+
+    void freeze() { if (state != FROZEN) { postRemaining = 0; state = FROZEN; } }
+
+    void record(const Sample& s) {
+        if (state != ARMED && state != TRIGGERED) return;
+        samples[head] = s;
+        head = (head + 1 == N) ? 0 : head + 1;
+        if (count < N) count++;
+        if (state == TRIGGERED && --postRemaining == 0) state = FROZEN;
+    }
+
+    State getState() const { return state; }
+    uint8_t getReason() const { return reason; }
+    uint32_t size() const { return count; }
+
+    uint32_t triggerIndex() const {
+        if (!reason) return count;
+        uint32_t post = (N - PRE) - postRemaining;
+        return count > post ? count - post - 1 : 0;
+    }
+
+    // i = 0 es la muestra más antigua
+    const Sample& at(uint32_t i) const {
+        uint32_t idx = (count < N ? 0 : head) + i;
+        return samples[idx >= N ? idx - N : idx];
+    }
+};
+
+#endif
@@ -6,6 +6,7 @@
 #include "pid.h"
 #include "features.h"
 #include "config.h"
+#include <atomic>
 
 class Robot {
 public:
@@ -21,6 +22,14 @@ public:
     void init();
     void loadConfig();
     void saveConfig();
+
+    // Perfiles: se leen todos de NVS al arrancar y `profile load` copia desde RAM
+    TuningProfile profiles[PROFILE_SLOTS];
+    bool profileValid[PROFILE_SLOTS];
+    std::atomic<uint8_t> activeProfile;
+    void loadProfiles();
+    bool saveProfile(uint8_t n, const char* name);
+    bool applyProfile(uint8_t n);
 };
 
 extern Robot robot;
@@ -0,0 +1,117 @@
+#ifndef RUNLOG_H
+#define RUNLOG_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <atomic>
+#include <sdkconfig.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#if !CONFIG_IDF_TARGET_LINUX
+#include <esp_partition.h>
+#endif
+#include "config.h"
+#include "protocol.h"
+#include "spsc_queue.h"
+
+// Almacenamiento crudo del registro: la partición "runlog" o, en el build de
+// Linux, un archivo del mismo formato para probar en el host.
+class LogStorage {
+private:
+#if CONFIG_IDF_TARGET_LINUX
+    FILE* file;
+#else
+    const esp_partition_t* partition;
+#endif
+    uint32_t length;
+
+public:
+    LogStorage();
+    bool open();
+    uint32_t size() const { return length; }
+    bool read(uint32_t offset, void* buf, size_t len);
+    bool write(uint32_t offset, const void* buf, size_t len);
+    bool eraseSector(uint32_t offset);
+};
+
+// Cabecera al inicio de cada sector. Cada sector empieza con una muestra completa
+// (RUNLOG_REC_KEY), así se puede decodificar solo aunque el anillo haya pisado
+// los anteriores. Lo no escrito queda en 0xFF.
+struct __attribute__((packed)) RunLogSectorHeader {
+    uint32_t magic;
+    uint32_t seq;          // Secuencia global de sectores, crece siempre
+    uint16_t runId;
+    uint16_t periodUs;
+};
+
+const uint32_t RUNLOG_MAGIC = 0x474F4C52;  // "RLOG"
+const uint8_t RUNLOG_REC_KEY = 0x01;       // tag | RecorderSample
+const uint8_t RUNLOG_REC_DELTA = 0x02;     // tag | 11 varints zigzag (campo - anterior)
+const uint8_t RUNLOG_REC_EMPTY = 0xFF;
+const size_t RUNLOG_CHUNK = 232;           // Bytes de sector por trama FRAME_RUNLOG_CHUNK
+
+// Elementos de la cola control -> escritor; inicio y fin de vuelta van en orden con las muestras
+enum RunLogItemType : uint8_t { RUNLOG_ITEM_SAMPLE, RUNLOG_ITEM_START, RUNLOG_ITEM_STOP };
+struct RunLogItem {
+    RunLogItemType type;
+    uint16_t periodUs;
+    RecorderSample sample;
+};
+
+// Registro persistente de vueltas: anillo de sectores en flash escrito por una
+// tarea de baja prioridad. El control solo encola (push) y nunca espera a la flash;
+// los borrados se hacen por adelantado mientras no hay vuelta en curso. Durante la
+// vuelta nunca se borra: si se acaban los sectores borrados el resto no se graba.
+class RunLog {
+private:
+    LogStorage storage;
+    SpscQueue<RunLogItem, RUNLOG_QUEUE_LEN> queue;
+    SemaphoreHandle_t mutex;  // Escritor vs. comandos (list/read/erase)
+    bool ready;
+    uint32_t sectorCount;
+    uint32_t headSector;      // Próximo sector a abrir
+    uint32_t erasedAhead;     // Sectores ya borrados desde headSector
+    uint32_t nextSeq;
+    uint16_t nextRunId;
+    uint16_t runId;
+    uint16_t periodUs;
+    bool running;
+    bool full;                // La vuelta gastó los sectores borrados
+    uint32_t lostSamples;     // Muestras de la vuelta que no entraron
+    bool sectorOpen;
+    uint32_t sectorOffset;
+    size_t used;              // Bytes válidos en staging
+    size_t flushed;           // Bytes de staging ya escritos en flash
+    RecorderSample last;
+    uint8_t staging[RUNLOG_SECTOR_SIZE];
+
+    void scan();
+    bool sectorBlank(uint32_t sector);
+    bool openSector();
+    void append(const RecorderSample& s);
+    void flush();
+    bool preErase();
+    static void writerTask(void* arg);
+
+public:
+    RunLog();
+    bool init();
+    void startTask();
+
+    // Productor: solo la tarea de control. Devuelve false si la cola está llena.
+    bool push(const RunLogItem& item) { return ready && queue.push(item); }
+    uint32_t droppedCount() const { return queue.droppedCount(); }
+
+    // Comandos
+    void list();
+    bool read(uint16_t id);
+    void eraseAll();
+
+    // Bytes de registros válidos en un sector leído (cabecera incluida)
+    static size_t usedBytes(const uint8_t* sector, size_t len);
+};
+
+extern RunLog runLog;
+
+#endif
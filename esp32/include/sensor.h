@@ -11,6 +11,7 @@ private:
     int16_t rawSensorValues[16];
     int16_t sensorMin[16];
     int16_t sensorMax[16];
+    int32_t sensorScale[16];  // 1000/(max-min) en Q16, precalculado en setCalibration()
 
 public:
     float linePosition;
@@ -20,6 +21,7 @@ public:
     void setCalibration(int16_t minVals[], int16_t maxVals[]);
     void read();
     void calibrate();
+    void getCalibration(int16_t minVals[], int16_t maxVals[]);
     int16_t* getSensorValues();
     int16_t* getRawSensorValues();
 };
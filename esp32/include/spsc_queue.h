@@ -0,0 +1,55 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+
+// Cola lock-free de un productor y un consumidor (core 0 -> core 1).
+// N debe ser potencia de 2. Cada índice lo escribe un solo lado, así que basta
+// con acquire/release; no hay secciones críticas ni mutex en el camino de control.
+template <typename T, size_t N>
+class SpscQueue {
+    static_assert((N & (N - 1)) == 0, "SpscQueue: N debe ser potencia de 2");
+
+private:
+    T items[N];
+    std::atomic<size_t> head;   // escrito solo por el productor
+    std::atomic<size_t> tail;   // escrito solo por el consumidor
+    std::atomic<uint32_t> dropped;
+
+public:
+    SpscQueue() : head(0), tail(0), dropped(0) {}
+
+    // Productor. Si la cola está llena se descarta el frame nuevo.
+    bool push(const T& item) {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h - tail.load(std::memory_order_acquire) >= N) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        items[h & (N - 1)] = item;
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumidor.
+    bool pop(T& out) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t == head.load(std::memory_order_acquire)) return false;
+        out = items[t & (N - 1)];
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumidor: vacía la cola y se queda con el frame más reciente.
+    bool popLatest(T& out) {
+        bool any = false;
+        while (pop(out)) any = true;
+        return any;
+    }
+
+    uint32_t droppedCount() const { return dropped.load(std::memory_order_relaxed); }
+};
+
+#endif
@@ -2,18 +2,25 @@
 #define TASKS_H
 
 #include <stdint.h>
+#include <stddef.h>
 
 // Function declarations
 void sensorsTask(void* pvParameters);
-void motorsTask(void* pvParameters);
+void controlTask(void* pvParameters);
 void telemetryTask(void* pvParameters);
 void commandTask(void* pvParameters);
 
+// Crea las tareas fijadas a cada core y arranca el esp_timer de control
+void startControlPipeline();
+bool setControlRate(uint16_t hz);
+
 void leftEncoderISR(void* arg);
 void rightEncoderISR(void* arg);
 
 void updateModeLed(unsigned long currentMillis, unsigned long blinkInterval);
 TelemetryData buildTelemetryData();
 void processCommand(const char* cmd);
+// Trama COBS directa al UART (volcados del grabador y del registro de vueltas)
+void sendBinaryFrame(uint8_t type, const void* payload, size_t len);
 
 #endif
\ No newline at end of file
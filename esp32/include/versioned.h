@@ -0,0 +1,47 @@
+#ifndef VERSIONED_H
+#define VERSIONED_H
+
+#include <stdint.h>
+#include <atomic>
+
+// Doble buffer con contador de época (estilo RCU/seqlock) para un solo escritor.
+// El escritor (tarea de comandos) arma la versión siguiente en el buffer inactivo
+// y la publica incrementando la época. Los lectores (tareas de sensores y control)
+// copian el buffer activo y reintentan si la época cambió durante la copia, así
+// nunca ven una mezcla de dos versiones.
+template <typename T>
+class Versioned {
+private:
+    T slots[2];
+    std::atomic<uint32_t> epoch;
+
+public:
+    Versioned() : epoch(0) {}
+
+    void publish(const T& next) {
+        uint32_t e = epoch.load(std::memory_order_relaxed);
+        // Lado escritor del seqlock: el slot que se pisa es el de la época anterior a la
+        // actual, que un lector lento puede seguir copiando. La barrera deja la época
+        // actual visible antes que cualquier byte nuevo del slot, así ese lector siempre
+        // ve el cambio de época en su segunda lectura y reintenta.
+        std::atomic_thread_fence(std::memory_order_release);
+        slots[(e + 1) & 1] = next;
+        epoch.store(e + 1, std::memory_order_release);
+    }
+
+    uint32_t currentEpoch() const {
+        return epoch.load(std::memory_order_acquire);
+    }
+
+    // Copia consistente de la última versión; devuelve su época
+    uint32_t read(T& out) const {
+        while (true) {
+            uint32_t e = epoch.load(std::memory_order_acquire);
+            out = slots[e & 1];
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (epoch.load(std::memory_order_relaxed) == e) return e;
+        }
+    }
+};
+
+#endif
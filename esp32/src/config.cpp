@@ -1,5 +1,6 @@
 #include "config.h"
 #include <string.h>
+#include <math.h>
 
 // Implementations for FeaturesConfig
 const char* FeaturesConfig::serialize() {
@@ -56,6 +57,30 @@ bool FeaturesConfig::getFeature(uint8_t idx) {
     return false;
 }
 
+uint8_t FeaturesConfig::getWindow(uint8_t idx) const {
+    switch(idx) {
+      case 0: return FILTER_WINDOW_MIN + 2 * medianTaps;
+      case 1: return FILTER_WINDOW_MIN + averageTaps;
+      default: return 0;
+    }
+}
+
+bool FeaturesConfig::setWindow(uint8_t idx, uint8_t length) {
+    if (length < FILTER_WINDOW_MIN || length > FILTER_WINDOW_MAX) return false;
+    switch(idx) {
+      case 0:
+        if (length % 2 == 0) return false;
+        medianTaps = (length - FILTER_WINDOW_MIN) / 2;
+        return true;
+      case 1:
+        if (length - FILTER_WINDOW_MIN > 7) return false;
+        averageTaps = length - FILTER_WINDOW_MIN;
+        return true;
+      default:
+        return false;
+    }
+}
+
 // Implementation for RobotConfig
 void RobotConfig::restoreDefaults() {
     lineKp = DEFAULT_LINE_KP;
@@ -87,12 +112,81 @@ void RobotConfig::restoreDefaults() {
     loopSpeedMs = DEFAULT_LOOP_SPEED_MS;
     telemetryIntervalMs = DEFAULT_TELEMTRY_INTERVAL_MS;
     robotWeight = DEFAULT_ROBOT_WEIGHT;
+    controlRateHz = DEFAULT_CONTROL_RATE_HZ;
+}
+
+bool migrateConfig(uint16_t version, const uint8_t* raw, size_t len, RobotConfig& out) {
+    out.restoreDefaults();
+    switch (version) {
+    case 1:
+        // v1 -> v2: se quitó el checksum final; el resto del layout no cambió
+        // Lo agregado después de robotWeight (controlRateHz...) queda en su default
+        if (len < CONFIG_V1_SIZE) return false;
+        memcpy(&out, raw, CONFIG_V1_FIELDS);
+        return true;
+    case CONFIG_SCHEMA_VERSION:
+        // Mismo esquema escrito por un firmware con más o menos campos al final
+        memcpy(&out, raw, len < sizeof(RobotConfig) ? len : sizeof(RobotConfig));
+        return true;
+    default:
+        return false;
+    }
+}
+
+void TuningProfile::capture(const RobotConfig& c) {
+    lineKp = c.lineKp; lineKi = c.lineKi; lineKd = c.lineKd;
+    leftKp = c.leftKp; leftKi = c.leftKi; leftKd = c.leftKd;
+    rightKp = c.rightKp; rightKi = c.rightKi; rightKd = c.rightKd;
+    basePwm = c.basePwm;
+    maxPwm = c.maxPwm;
+    baseRPM = c.baseRPM;
+    maxRpm = c.maxRpm;
+    cascadeMode = c.cascadeMode;
+    features = c.features;
+}
+
+void TuningProfile::apply(RobotConfig& c) const {
+    c.lineKp = lineKp; c.lineKi = lineKi; c.lineKd = lineKd;
+    c.leftKp = leftKp; c.leftKi = leftKi; c.leftKd = leftKd;
+    c.rightKp = rightKp; c.rightKi = rightKi; c.rightKd = rightKd;
+    c.basePwm = basePwm;
+    c.maxPwm = maxPwm;
+    c.baseRPM = baseRPM;
+    c.maxRpm = maxRpm;
+    c.cascadeMode = cascadeMode;
+    c.features = features;
+}
+
+void ControlParams::build(const RobotConfig& c) {
+    lineKp = c.lineKp;
+    lineKi = c.lineKi;
+    lineKd = c.lineKd;
+    leftKp = c.leftKp;
+    leftKi = c.leftKi;
+    leftKd = c.leftKd;
+    rightKp = c.rightKp;
+    rightKi = c.rightKi;
+    rightKd = c.rightKd;
+    baseRPM = c.baseRPM;
+    maxRpm = c.maxRpm;
+    maxPwm = c.maxPwm;
+    features = c.features;
+    memcpy(sensorMin, c.sensorMin, sizeof(sensorMin));
+    memcpy(sensorMax, c.sensorMax, sizeof(sensorMax));
+    rpmToCms = (M_PI * (c.wheelDiameter / 10.0f)) / 60.0f;
 }
 
 // Global instances
 const char* NVS_NAMESPACE = "robot_config";
 RobotConfig config;
 SharedData sharedData;
+Versioned<ControlParams> controlParams;
+
+void publishConfig() {
+    ControlParams next;
+    next.build(config);
+    controlParams.publish(next);
+}
 
 // Other globals
 adc_oneshot_unit_handle_t adc_handle;
@@ -1,44 +1,63 @@
 #include "features.h"
 
-Features::Features() : config({false, false, false, false, false, false, false, false, false}),
-                      medianCount(0), movingSum(0), movingCount(0), kalmanX(0), kalmanP(1000),
-                      hysteresisLast(0), lowPassLast(0) {}
+void SlidingMedian::setLength(uint8_t n) {
+    if (n > FILTER_WINDOW_MAX) n = FILTER_WINDOW_MAX;
+    if (n != len) { len = n; primed = false; }
+}
+
+// La ventana arranca llena con la primera muestra; cambiar el largo la vuelve a llenar
+int16_t SlidingMedian::process(int16_t x) {
+    if (!primed) {
+        for (uint8_t i = 0; i < len; i++) ring[i] = sorted[i] = x;
+        head = 0;
+        primed = true;
+        return x;
+    }
+    int16_t old = ring[head];
+    ring[head] = x;
+    if (++head == len) head = 0;
+    medianReplace(sorted, len, old, x);
+    return sorted[len / 2];
+}
 
-void Features::setConfig(FeaturesConfig& f) { config = f; }
+void SlidingAverage::setLength(uint8_t n) {
+    if (n > FILTER_WINDOW_MAX) n = FILTER_WINDOW_MAX;
+    if (n < 1) n = 1;
+    if (n != len) { len = n; primed = false; }
+}
 
-void Features::sort(float arr[], int n) {
-    for (int i = 0; i < n-1; i++) {
-        for (int j = 0; j < n-i-1; j++) {
-            if (arr[j] > arr[j+1]) {
-                float temp = arr[j];
-                arr[j] = arr[j+1];
-                arr[j+1] = temp;
-            }
-        }
+// Suma corrida: O(1) por muestra. Redondeo al entero más cercano
+int16_t SlidingAverage::process(int16_t x) {
+    if (!primed) {
+        for (uint8_t i = 0; i < len; i++) ring[i] = x;
+        sum = (int32_t)x * len;
+        head = 0;
+        primed = true;
     }
+    sum += x - ring[head];
+    ring[head] = x;
+    if (++head == len) head = 0;
+    return (int16_t)((sum >= 0 ? sum + len / 2 : sum - len / 2) / len);
+}
+
+Features::Features() : config({false, false, false, false, false, false, false, false, false, 0, 0}),
+                      kalmanX(0), kalmanP(1000), hysteresisLast(0), lowPassLast(0) {}
+
+void Features::setConfig(FeaturesConfig& f) {
+    config = f;
+    median.setLength(f.getWindow(0));
+    average.setLength(f.getWindow(1));
 }
 
 float Features::applySignalFilters(float raw) {
     float result = raw;
 
     if (config.medianFilter) {
-        medianBuffer[medianCount++] = (int16_t)raw;
-        if (medianCount >= 3) {
-            float sorted[3] = {(float)medianBuffer[0], (float)medianBuffer[1], (float)medianBuffer[2]};
-            sort(sorted, 3);
-            result = sorted[1];
-            medianCount = 0;
-        }
+        result = median.process((int16_t)result);
     }
 
     if (config.movingAverage) {
-        movingSum -= movingBuffer[movingCount];
-        movingBuffer[movingCount] = result;
-        movingSum += result;
-        movingCount = (movingCount + 1) % 3;
-        if (movingCount == 0) {
-            result = movingSum / 3.0f;
-        }
+        result = average.process((int16_t)result);
     }
 
     if (config.kalmanFilter) {
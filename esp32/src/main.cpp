@@ -13,6 +13,7 @@
 #include "config.h"
 #include "robot.h"
 #include "tasks.h"
+#include "runlog.h"
 
 extern "C" void app_main() {
     esp_err_t ret = nvs_flash_init();
@@ -23,6 +24,7 @@ extern "C" void app_main() {
     ESP_ERROR_CHECK(ret);
 
     robot.loadConfig();
+    robot.loadProfiles();
 
     robot.init();
 
@@ -37,6 +39,7 @@ extern "C" void app_main() {
     sharedData.telemetryEnabled = config.telemetry;
     sharedData.operationMode = config.operationMode;
     sharedData.cascadeMode = config.cascadeMode;
+    memset(&sharedData.timing, 0, sizeof(sharedData.timing));
     sharedData.mutex = xSemaphoreCreateMutex();
 
     robot.linePid.setGains(config.lineKp, config.lineKi, config.lineKd);
@@ -47,10 +50,16 @@ extern "C" void app_main() {
 
     printf("Calibrating sensors...\n");
     robot.qtr.calibrate();
+    robot.qtr.getCalibration(config.sensorMin, config.sensorMax);
+    publishConfig();
     printf("Calibration complete. Mode: %d\n", config.operationMode);
 
-    xTaskCreate(sensorsTask, "Sensors", 4096, NULL, 2, NULL);
-    xTaskCreate(motorsTask, "Motors", 4096, NULL, 2, NULL);
-    xTaskCreate(telemetryTask, "Telemetry", 4096, NULL, 1, NULL);
-    xTaskCreate(commandTask, "Commands", 4096, NULL, 1, NULL);
+    // Tareas auxiliares en core 0 junto a WiFi/BT; core 1 queda para el control
+    xTaskCreatePinnedToCore(telemetryTask, "Telemetry", 4096, NULL, 1, NULL, SENSOR_TASK_CORE);
+    xTaskCreatePinnedToCore(commandTask, "Commands", 4096, NULL, 1, NULL, SENSOR_TASK_CORE);
+
+    runLog.init();
+    runLog.startTask();
+
+    startControlPipeline();
 }
\ No newline at end of file
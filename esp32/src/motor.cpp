@@ -1,8 +1,13 @@
 #include "motor.h"
+#include <esp_attr.h>
 #include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+
+// Cuenta y tiempo del último flanco se leen juntos: la ISR puede correr en el otro core
+static portMUX_TYPE encoderMux = portMUX_INITIALIZER_UNLOCKED;
 
 Motor::Motor(uint8_t p1, uint8_t p2, Location loc, uint8_t encA, uint8_t encB)
-    : pin1(p1), pin2(p2), speed(0), location(loc), forwardCount(0), backwardCount(0), lastCount(0),
+    : pin1(p1), pin2(p2), speed(0), location(loc), forwardCount(0), backwardCount(0), lastEdgeUs(0), lastCount(0),
       lastSpeedCheck(0), currentRPM(0), filteredRPM(0), targetRPM(0), encoderAPin(encA), encoderBPin(encB) {}
 
 void Motor::init() {
@@ -42,7 +47,7 @@ void Motor::init() {
     ledc_channel.flags.output_invert = 0;
     ledc_channel_config(&ledc_channel);
 
-    lastSpeedCheck = esp_timer_get_time();
+    lastSpeedCheck = lastEdgeUs = esp_timer_get_time();
 }
 
 void Motor::setSpeed(int s) {
@@ -63,14 +68,30 @@ void Motor::setSpeed(int s) {
 
 int Motor::getSpeed() { return speed; }
 
+// Método M/T: los pulsos desde la medición anterior se dividen por el tiempo entre el
+// flanco que la cerró y el último, no por el periodo del lazo. A 1 kHz un tick casi nunca
+// tiene un pulso entero y contar por tick daba 0 o 1667 RPM (36 ppr). Sin flancos nuevos
+// la RPM queda hasta que el tiempo sin pulsos implica una menor y de ahí baja como
+// 60e6/(ppr·t); pasado RPM_STOP_TIMEOUT_US es 0.
 float Motor::getRPM() {
-    uint32_t now = esp_timer_get_time();
-    uint32_t dt = now - lastSpeedCheck;
-    if (dt > 0) {
-        int32_t delta = forwardCount + backwardCount - lastCount;
-        currentRPM = (delta * 60.0f * 1000000.0f) / (config.pulsesPerRevolution * dt);
-        lastCount = forwardCount + backwardCount;
-        lastSpeedCheck = now;
+    portENTER_CRITICAL(&encoderMux);
+    int32_t count = forwardCount + backwardCount;
+    uint32_t edge = lastEdgeUs;
+    portEXIT_CRITICAL(&encoderMux);
+    int32_t delta = count - lastCount;
+    uint32_t span = edge - lastSpeedCheck;
+    if (delta > 0 && span > 0) {
+        currentRPM = (delta * 60.0f * 1000000.0f) / (config.pulsesPerRevolution * (float)span);
+        lastCount = count;
+        lastSpeedCheck = edge;
+    } else {
+        uint32_t idle = (uint32_t)esp_timer_get_time() - lastSpeedCheck;
+        if (idle > RPM_STOP_TIMEOUT_US) {
+            currentRPM = 0;
+        } else if (idle > 0) {
+            float bound = (60.0f * 1000000.0f) / (config.pulsesPerRevolution * (float)idle);
+            if (bound < currentRPM) currentRPM = bound;
+        }
     }
     return currentRPM;
 }
@@ -80,12 +101,18 @@ float Motor::getFilteredRPM() {
     return filteredRPM;
 }
 
+float Motor::getCurrentRPM() const { return currentRPM; }
+float Motor::getCurrentFilteredRPM() const { return filteredRPM; }
+
 void Motor::setTargetRPM(float t) { targetRPM = t; }
 float Motor::getTargetRPM() { return targetRPM; }
 long Motor::getEncForwardCount() { return forwardCount; }
 long Motor::getEncBackwardCount() { return backwardCount; }
 
-void Motor::updateEncoder() {
+void IRAM_ATTR Motor::updateEncoder() {
+    portENTER_CRITICAL_ISR(&encoderMux);
     if (speed >= 0) forwardCount += 1;
     else backwardCount += 1;
+    lastEdgeUs = esp_timer_get_time();
+    portEXIT_CRITICAL_ISR(&encoderMux);
 }
\ No newline at end of file
@@ -0,0 +1,93 @@
+#include "protocol.h"
+#include <string.h>
+
+uint16_t crc16Ccitt(const uint8_t* data, size_t len) {
+    uint16_t crc = 0xFFFF;
+    while (len--) {
+        crc ^= (uint16_t)(*data++) << 8;
+        for (int i = 0; i < 8; i++) {
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+        }
+    }
+    return crc;
+}
+
+uint32_t crc32(const uint8_t* data, size_t len) {
+    uint32_t crc = 0xFFFFFFFF;
+    while (len--) {
+        crc ^= *data++;
+        for (int i = 0; i < 8; i++) {
+            crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320 : crc >> 1;
+        }
+    }
+    return ~crc;
+}
+
+size_t cobsEncode(const uint8_t* in, size_t len, uint8_t* out) {
+    size_t codeIdx = 0;
+    size_t outIdx = 1;
+    uint8_t code = 1;
+    for (size_t i = 0; i < len; i++) {
+        if (in[i] == 0) {
+            out[codeIdx] = code;
+            codeIdx = outIdx++;
+            code = 1;
+        } else {
+            out[outIdx++] = in[i];
+            if (++code == 0xFF) {
+                out[codeIdx] = code;
+                codeIdx = outIdx++;
+                code = 1;
+            }
+        }
+    }
+    out[codeIdx] = code;
+    return outIdx;
+}
+
+size_t buildFrame(uint8_t type, uint16_t seq, const void* payload, size_t len, uint8_t* out) {
+    uint8_t raw[FRAME_MAX_RAW];
+    if (len > FRAME_MAX_PAYLOAD) return 0;
+    raw[0] = type;
+    raw[1] = seq & 0xFF;
+    raw[2] = seq >> 8;
+    memcpy(raw + 3, payload, len);
+    size_t rawLen = 3 + len;
+    uint16_t crc = crc16Ccitt(raw, rawLen);
+    raw[rawLen++] = crc & 0xFF;
+    raw[rawLen++] = crc >> 8;
+
+    out[0] = 0x00;
+    size_t n = cobsEncode(raw, rawLen, out + 1);
+    out[n + 1] = 0x00;
+    return n + 2;
+}
+
+int16_t toFixed16(float v, float scale) {
+    float s = v * scale;
+    if (s >= 32767.0f) return 32767;
+    if (s <= -32768.0f) return -32768;
+    return (int16_t)(s >= 0 ? s + 0.5f : s - 0.5f);
+}
+
+size_t putVarint(uint8_t* out, uint32_t v) {
+    size_t n = 0;
+    while (v >= 0x80) {
+        out[n++] = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    out[n++] = (uint8_t)v;
+    return n;
+}
+
+size_t getVarint(const uint8_t* in, size_t len, uint32_t* v) {
+    uint32_t result = 0;
+    for (size_t i = 0; i < len && i < 5; i++) {
+        result |= (uint32_t)(in[i] & 0x7F) << (7 * i);
+        if (!(in[i] & 0x80)) {
+            *v = result;
+            return i + 1;
+        }
+    }
+    return 0;
+}
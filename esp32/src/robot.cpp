@@ -1,5 +1,6 @@
 #include "robot.h"
 #include "tasks.h"
+#include "protocol.h"
 #include <nvs_flash.h>
 #include <esp_log.h>
 #include <driver/uart.h>
@@ -9,7 +10,8 @@ Robot::Robot() : leftMotor(MOTOR_LEFT_PIN1, MOTOR_LEFT_PIN2, LEFT, ENCODER_LEFT_
                  rightMotor(MOTOR_RIGHT_PIN1, MOTOR_RIGHT_PIN2, RIGHT, ENCODER_RIGHT_A, ENCODER_RIGHT_B),
                  linePid(DEFAULT_LINE_KP, DEFAULT_LINE_KI, DEFAULT_LINE_KD, LIMIT_MAX_PWM, -LIMIT_MAX_PWM),
                  leftPid(DEFAULT_LEFT_KP, DEFAULT_LEFT_KI, DEFAULT_LEFT_KD, LIMIT_MAX_PWM, -LIMIT_MAX_PWM),
-                 rightPid(DEFAULT_RIGHT_KP, DEFAULT_RIGHT_KI, DEFAULT_RIGHT_KD, LIMIT_MAX_PWM, -LIMIT_MAX_PWM) {}
+                 rightPid(DEFAULT_RIGHT_KP, DEFAULT_RIGHT_KI, DEFAULT_RIGHT_KD, LIMIT_MAX_PWM, -LIMIT_MAX_PWM),
+                 profileValid(), activeProfile(NO_PROFILE) {}
 
 void Robot::init() {
     leftMotor.init();
@@ -39,7 +41,7 @@ void Robot::init() {
 
     // Initialize UART
     uart_config_t uart_config = {
-        .baud_rate = 115200,
+        .baud_rate = SERIAL_DEFAULT_BAUD,
         .data_bits = UART_DATA_8_BITS,
         .parity = UART_PARITY_DISABLE,
         .stop_bits = UART_STOP_BITS_1,
@@ -72,13 +74,41 @@ void Robot::loadConfig() {
         return;
     }
 
-    size_t size = sizeof(RobotConfig);
-    err = nvs_get_blob(nvs_handle, "config", &config, &size);
+    static uint8_t blob[sizeof(ConfigHeader) + CONFIG_BLOB_MAX];
+    size_t size = sizeof(blob);
+    err = nvs_get_blob(nvs_handle, "config", blob, &size);
+    nvs_close(nvs_handle);
     if (err != ESP_OK) {
         ESP_LOGI("CONFIG", "NVS get failed, using defaults");
         config.restoreDefaults();
+        return;
     }
-    nvs_close(nvs_handle);
+
+    ConfigHeader header;
+    memcpy(&header, blob, sizeof(header));
+    if (size >= sizeof(header) && header.magic == CONFIG_MAGIC) {
+        const uint8_t* payload = blob + sizeof(header);
+        if (header.length != size - sizeof(header) || crc32(payload, header.length) != header.crc) {
+            ESP_LOGW("CONFIG", "Config CRC mismatch, using defaults");
+            config.restoreDefaults();
+            return;
+        }
+        if (!migrateConfig(header.version, payload, header.length, config)) {
+            // Escrita por un firmware más nuevo: defaults en RAM, el blob queda intacto
+            ESP_LOGW("CONFIG", "Unknown config schema v%u, using defaults", header.version);
+            return;
+        }
+        if (header.version == CONFIG_SCHEMA_VERSION && header.length == sizeof(RobotConfig)) return;
+    } else if (size == CONFIG_V1_SIZE) {
+        migrateConfig(1, blob, size, config);
+    } else {
+        ESP_LOGW("CONFIG", "Unrecognized config blob (%u bytes), using defaults", (unsigned)size);
+        config.restoreDefaults();
+        return;
+    }
+    // Migrada: se reescribe ya con el esquema actual para no repetirlo en cada arranque
+    ESP_LOGI("CONFIG", "Config migrated to schema v%u", CONFIG_SCHEMA_VERSION);
+    saveConfig();
 }
 
 void Robot::saveConfig() {
@@ -89,11 +119,77 @@ void Robot::saveConfig() {
         return;
     }
 
-    err = nvs_set_blob(nvs_handle, "config", &config, sizeof(RobotConfig));
+    uint8_t blob[sizeof(ConfigHeader) + sizeof(RobotConfig)];
+    ConfigHeader header = { CONFIG_MAGIC, CONFIG_SCHEMA_VERSION, sizeof(RobotConfig),
+                            crc32((const uint8_t*)&config, sizeof(RobotConfig)), 0 };
+    memcpy(blob, &header, sizeof(header));
+    memcpy(blob + sizeof(header), &config, sizeof(RobotConfig));
+    err = nvs_set_blob(nvs_handle, "config", blob, sizeof(blob));
     if (err != ESP_OK) {
         ESP_LOGE("CONFIG", "NVS set failed");
     } else {
         nvs_commit(nvs_handle);
     }
     nvs_close(nvs_handle);
-}
\ No newline at end of file
+}
+
+void Robot::loadProfiles() {
+    nvs_handle_t nvs_handle;
+    if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &nvs_handle) != ESP_OK) return;
+    for (uint8_t n = 0; n < PROFILE_SLOTS; n++) {
+        char key[10];
+        snprintf(key, sizeof(key), "profile%u", n);
+        uint8_t blob[sizeof(ConfigHeader) + sizeof(TuningProfile)];
+        size_t size = sizeof(blob);
+        profileValid[n] = false;
+        if (nvs_get_blob(nvs_handle, key, blob, &size) != ESP_OK || size < sizeof(ConfigHeader)) continue;
+        ConfigHeader header;
+        memcpy(&header, blob, sizeof(header));
+        const uint8_t* payload = blob + sizeof(header);
+        if (header.magic != CONFIG_MAGIC || header.version != PROFILE_SCHEMA_VERSION ||
+            header.length != size - sizeof(header) || crc32(payload, header.length) != header.crc) {
+            ESP_LOGW("CONFIG", "Profile %u invalid, ignored", n);
+            continue;
+        }
+        // Un perfil guardado antes de agregar campos deja esos valores como están
+        profiles[n].capture(config);
+        memcpy(&profiles[n], payload, header.length);
+        profileValid[n] = true;
+    }
+    nvs_close(nvs_handle);
+}
+
+bool Robot::saveProfile(uint8_t n, const char* name) {
+    TuningProfile p = {};
+    p.capture(config);
+    strncpy(p.name, name, PROFILE_NAME_LEN - 1);
+
+    nvs_handle_t nvs_handle;
+    if (nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs_handle) != ESP_OK) return false;
+    char key[10];
+    snprintf(key, sizeof(key), "profile%u", n);
+    uint8_t blob[sizeof(ConfigHeader) + sizeof(TuningProfile)];
+    ConfigHeader header = { CONFIG_MAGIC, PROFILE_SCHEMA_VERSION, sizeof(TuningProfile),
+                            crc32((const uint8_t*)&p, sizeof(p)), 0 };
+    memcpy(blob, &header, sizeof(header));
+    memcpy(blob + sizeof(header), &p, sizeof(p));
+    esp_err_t err = nvs_set_blob(nvs_handle, key, blob, sizeof(blob));
+    if (err == ESP_OK) err = nvs_commit(nvs_handle);
+    nvs_close(nvs_handle);
+    if (err != ESP_OK) return false;
+
+    profiles[n] = p;
+    profileValid[n] = true;
+    activeProfile = n;
+    return true;
+}
+
+// Sin NVS ni flash: una copia de RAM y publishConfig(). Las tareas adoptan la nueva
+// versión al inicio de su próximo tick y el PID cambia de ganancias sin salto.
+bool Robot::applyProfile(uint8_t n) {
+    if (!profileValid[n]) return false;
+    profiles[n].apply(config);
+    publishConfig();
+    activeProfile = n;
+    return true;
+}
@@ -0,0 +1,364 @@
+#include "runlog.h"
+#include "tasks.h"
+#include <string.h>
+#include <freertos/task.h>
+
+// Campos de RecorderSample que se codifican como delta, en orden
+static void sampleFields(const RecorderSample& s, int16_t* f) {
+    f[0] = (int16_t)s.tick;
+    f[1] = s.linePos;
+    f[2] = s.lineIntegral;
+    f[3] = s.lineDeriv;
+    f[4] = s.linePidOut;
+    f[5] = s.lTargetRpm;
+    f[6] = s.rTargetRpm;
+    f[7] = s.lRpm;
+    f[8] = s.rRpm;
+    f[9] = s.lPwm;
+    f[10] = s.rPwm;
+}
+static const int RUNLOG_FIELDS = 11;
+static const size_t RUNLOG_MAX_RECORD = 1 + RUNLOG_FIELDS * 3;
+
+static uint8_t readBuf[RUNLOG_SECTOR_SIZE];  // Lectura para `log read`, bajo mutex
+
+RunLog runLog;
+
+// --- Almacenamiento ---
+
+LogStorage::LogStorage() :
+#if CONFIG_IDF_TARGET_LINUX
+    file(NULL),
+#else
+    partition(NULL),
+#endif
+    length(0) {}
+
+#if CONFIG_IDF_TARGET_LINUX
+bool LogStorage::open() {
+    file = fopen(RUNLOG_HOST_FILE, "r+b");
+    if (!file) {
+        file = fopen(RUNLOG_HOST_FILE, "w+b");
+        if (!file) return false;
+        uint8_t blank[RUNLOG_SECTOR_SIZE];
+        memset(blank, 0xFF, sizeof(blank));
+        for (uint32_t i = 0; i < RUNLOG_HOST_SIZE / RUNLOG_SECTOR_SIZE; i++) fwrite(blank, 1, sizeof(blank), file);
+        fflush(file);
+    }
+    length = RUNLOG_HOST_SIZE;
+    return true;
+}
+
+bool LogStorage::read(uint32_t offset, void* buf, size_t len) {
+    return fseek(file, offset, SEEK_SET) == 0 && fread(buf, 1, len, file) == len;
+}
+
+// Igual que la flash NOR: solo se pueden bajar bits
+bool LogStorage::write(uint32_t offset, const void* buf, size_t len) {
+    uint8_t cur[256];
+    const uint8_t* src = (const uint8_t*)buf;
+    while (len) {
+        size_t n = len < sizeof(cur) ? len : sizeof(cur);
+        if (!read(offset, cur, n)) return false;
+        for (size_t i = 0; i < n; i++) cur[i] &= src[i];
+        if (fseek(file, offset, SEEK_SET) != 0 || fwrite(cur, 1, n, file) != n) return false;
+        offset += n; src += n; len -= n;
+    }
+    fflush(file);
+    return true;
+}
+
+bool LogStorage::eraseSector(uint32_t offset) {
+    uint8_t blank[RUNLOG_SECTOR_SIZE];
+    memset(blank, 0xFF, sizeof(blank));
+    if (fseek(file, offset, SEEK_SET) != 0) return false;
+    bool ok = fwrite(blank, 1, sizeof(blank), file) == sizeof(blank);
+    fflush(file);
+    return ok;
+}
+#else
+bool LogStorage::open() {
+    partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, (esp_partition_subtype_t)RUNLOG_PARTITION_SUBTYPE, RUNLOG_PARTITION_LABEL);
+    if (!partition) return false;
+    length = partition->size;
+    return true;
+}
+
+bool LogStorage::read(uint32_t offset, void* buf, size_t len) {
+    return esp_partition_read(partition, offset, buf, len) == ESP_OK;
+}
+
+bool LogStorage::write(uint32_t offset, const void* buf, size_t len) {
+    return esp_partition_write(partition, offset, buf, len) == ESP_OK;
+}
+
+bool LogStorage::eraseSector(uint32_t offset) {
+    return esp_partition_erase_range(partition, offset, RUNLOG_SECTOR_SIZE) == ESP_OK;
+}
+#endif
+
+// --- Registro ---
+
+RunLog::RunLog() : mutex(NULL), ready(false), sectorCount(0), headSector(0), erasedAhead(0), nextSeq(0),
+                   nextRunId(0), runId(0), periodUs(0), running(false), full(false), lostSamples(0),
+                   sectorOpen(false), sectorOffset(0),
+                   used(0), flushed(0) {
+    memset(&last, 0, sizeof(last));
+}
+
+bool RunLog::init() {
+    if (!storage.open()) {
+        printf("Run log: partition '%s' not found\n", RUNLOG_PARTITION_LABEL);
+        return false;
+    }
+    mutex = xSemaphoreCreateMutex();
+    sectorCount = storage.size() / RUNLOG_SECTOR_SIZE;
+    scan();
+    ready = true;
+    printf("Run log: %lu sectors, next run %u\n", (unsigned long)sectorCount, nextRunId);
+    return true;
+}
+
+void RunLog::startTask() {
+    if (!ready) return;
+    xTaskCreatePinnedToCore(writerTask, "RunLog", 4096, this, RUNLOG_TASK_PRIORITY, NULL, SENSOR_TASK_CORE);
+}
+
+// Busca el sector más nuevo para seguir el anillo detrás de él
+void RunLog::scan() {
+    bool found = false;
+    uint32_t newest = 0, maxSeq = 0;
+    uint16_t maxRun = 0;
+    for (uint32_t i = 0; i < sectorCount; i++) {
+        RunLogSectorHeader h;
+        if (!storage.read(i * RUNLOG_SECTOR_SIZE, &h, sizeof(h)) || h.magic != RUNLOG_MAGIC) continue;
+        if (!found || h.seq > maxSeq) {
+            maxSeq = h.seq;
+            newest = i;
+        }
+        if (!found || (int16_t)(h.runId - maxRun) > 0) maxRun = h.runId;
+        found = true;
+    }
+    headSector = found ? (newest + 1) % sectorCount : 0;
+    nextSeq = found ? maxSeq + 1 : 0;
+    nextRunId = found ? maxRun + 1 : 0;
+    // Los sectores que siguen pueden estar ya en blanco (`log erase`, partición nueva o
+    // borrados adelantados antes del reinicio): se cuentan para que la primera vuelta
+    // pueda usarlos sin esperar a preErase(). Uno queda siempre como límite del anillo.
+    erasedAhead = 0;
+    while (erasedAhead + 1 < sectorCount && sectorBlank((headSector + erasedAhead) % sectorCount)) erasedAhead++;
+}
+
+// Sector entero en 0xFF; usa staging, que en scan() todavía no tiene datos
+bool RunLog::sectorBlank(uint32_t sector) {
+    if (!storage.read(sector * RUNLOG_SECTOR_SIZE, staging, sizeof(staging))) return false;
+    for (size_t i = 0; i < sizeof(staging); i++) {
+        if (staging[i] != 0xFF) return false;
+    }
+    return true;
+}
+
+// Borrar un sector frena la caché de ambos cores decenas de ms: en vuelta solo se
+// usan los ya borrados y, si no quedan, se deja de grabar
+bool RunLog::openSector() {
+    if (erasedAhead == 0) {
+        full = true;
+        sectorOpen = false;
+        return false;
+    }
+    erasedAhead--;
+    sectorOffset = headSector * RUNLOG_SECTOR_SIZE;
+    headSector = (headSector + 1) % sectorCount;
+
+    RunLogSectorHeader h;
+    h.magic = RUNLOG_MAGIC;
+    h.seq = nextSeq++;
+    h.runId = runId;
+    h.periodUs = periodUs;
+    memset(staging, 0xFF, sizeof(staging));
+    memcpy(staging, &h, sizeof(h));
+    used = sizeof(h);
+    flushed = 0;
+    sectorOpen = true;
+    return true;
+}
+
+void RunLog::append(const RecorderSample& s) {
+    if (full) { lostSamples++; return; }
+    uint8_t rec[RUNLOG_MAX_RECORD];
+    size_t n = 0;
+    if (sectorOpen) {
+        int16_t cur[RUNLOG_FIELDS], prev[RUNLOG_FIELDS];
+        sampleFields(s, cur);
+        sampleFields(last, prev);
+        rec[n++] = RUNLOG_REC_DELTA;
+        for (int i = 0; i < RUNLOG_FIELDS; i++) {
+            n += putVarint(rec + n, zigzagEncode((int16_t)(cur[i] - prev[i])));
+        }
+    }
+    if (!sectorOpen || used + n > RUNLOG_SECTOR_SIZE) {
+        if (sectorOpen) flush();
+        if (!openSector()) { lostSamples++; return; }
+        n = 0;
+        rec[n++] = RUNLOG_REC_KEY;
+        memcpy(rec + n, &s, sizeof(s));
+        n += sizeof(s);
+    }
+    memcpy(staging + used, rec, n);
+    used += n;
+    last = s;
+}
+
+void RunLog::flush() {
+    if (!sectorOpen || flushed == used) return;
+    storage.write(sectorOffset + flushed, staging + flushed, used - flushed);
+    flushed = used;
+}
+
+// Un sector por pasada para no demorar a los comandos que esperan el mutex
+bool RunLog::preErase() {
+    if (erasedAhead >= RUNLOG_PREERASE_SECTORS || erasedAhead + 1 >= sectorCount) return false;
+    storage.eraseSector(((headSector + erasedAhead) % sectorCount) * RUNLOG_SECTOR_SIZE);
+    erasedAhead++;
+    return true;
+}
+
+void RunLog::writerTask(void* arg) {
+    RunLog* self = (RunLog*)arg;
+    RunLogItem item;
+    bool erasing = false;
+    while (true) {
+        // Entre vueltas se borra de corrido hasta tener lugar para la próxima
+        vTaskDelay(pdMS_TO_TICKS(erasing ? RUNLOG_ERASE_GAP_MS : RUNLOG_FLUSH_MS));
+        xSemaphoreTake(self->mutex, portMAX_DELAY);
+        while (self->queue.pop(item)) {
+            switch (item.type) {
+            case RUNLOG_ITEM_START:
+                self->flush();
+                self->runId = self->nextRunId++;
+                self->periodUs = item.periodUs;
+                self->running = true;
+                self->full = false;
+                self->lostSamples = 0;
+                self->sectorOpen = false;
+                break;
+            case RUNLOG_ITEM_STOP:
+                self->flush();
+                if (self->running && self->full) {
+                    printf("Run log: run %u truncated, %lu samples not saved (no erased sectors left)\n",
+                           self->runId, (unsigned long)self->lostSamples);
+                }
+                self->running = false;
+                self->sectorOpen = false;
+                break;
+            default:
+                if (self->running) self->append(item.sample);
+                break;
+            }
+        }
+        self->flush();
+        erasing = !self->running && self->preErase();
+        xSemaphoreGive(self->mutex);
+    }
+}
+
+void RunLog::list() {
+    if (!ready) { printf("Run log not available\n"); return; }
+    // Vueltas contiguas en orden de secuencia, empezando por el sector más viejo
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    uint32_t start = headSector;
+    bool any = false;
+    uint16_t current = 0;
+    uint32_t sectors = 0, firstSeq = 0;
+    for (uint32_t k = 0; k <= sectorCount; k++) {
+        RunLogSectorHeader h;
+        bool valid = false;
+        if (k < sectorCount) {
+            valid = storage.read(((start + k) % sectorCount) * RUNLOG_SECTOR_SIZE, &h, sizeof(h)) && h.magic == RUNLOG_MAGIC;
+        }
+        if (sectors && (!valid || h.runId != current)) {
+            printf("Run %u: %lu sectors, first seq %lu\n", current, (unsigned long)sectors, (unsigned long)firstSeq);
+            sectors = 0;
+        }
+        if (!valid) continue;
+        if (sectors == 0) {
+            current = h.runId;
+            firstSeq = h.seq;
+        }
+        sectors++;
+        any = true;
+    }
+    xSemaphoreGive(mutex);
+    if (!any) printf("Run log empty\n");
+}
+
+bool RunLog::read(uint16_t id) {
+    if (!ready) return false;
+    uint32_t sent = 0;
+    uint8_t payload[8 + RUNLOG_CHUNK];
+    for (uint32_t k = 0; k < sectorCount; k++) {
+        uint32_t offset = ((headSector + k) % sectorCount) * RUNLOG_SECTOR_SIZE;
+        xSemaphoreTake(mutex, portMAX_DELAY);
+        bool ok = storage.read(offset, readBuf, sizeof(readBuf));
+        xSemaphoreGive(mutex);
+        RunLogSectorHeader h;
+        memcpy(&h, readBuf, sizeof(h));
+        if (!ok || h.magic != RUNLOG_MAGIC || h.runId != id) continue;
+
+        size_t len = usedBytes(readBuf, sizeof(readBuf));
+        for (size_t pos = 0; pos < len; pos += RUNLOG_CHUNK) {
+            size_t n = len - pos < RUNLOG_CHUNK ? len - pos : RUNLOG_CHUNK;
+            memcpy(payload, &id, 2);
+            memcpy(payload + 2, &h.seq, 4);
+            uint16_t off16 = pos;
+            memcpy(payload + 6, &off16, 2);
+            memcpy(payload + 8, readBuf + pos, n);
+            sendBinaryFrame(FRAME_RUNLOG_CHUNK, payload, 8 + n);
+        }
+        sent++;
+    }
+    uint8_t end[4];
+    uint16_t sectors16 = sent;
+    memcpy(end, &id, 2);
+    memcpy(end + 2, &sectors16, 2);
+    sendBinaryFrame(FRAME_RUNLOG_END, end, sizeof(end));
+    return sent > 0;
+}
+
+void RunLog::eraseAll() {
+    if (!ready) return;
+    for (uint32_t i = 0; i < sectorCount; i++) {
+        xSemaphoreTake(mutex, portMAX_DELAY);
+        storage.eraseSector(i * RUNLOG_SECTOR_SIZE);
+        xSemaphoreGive(mutex);
+    }
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    sectorOpen = false;
+    headSector = 0;
+    erasedAhead = sectorCount - 1;
+    xSemaphoreGive(mutex);
+}
+
+size_t RunLog::usedBytes(const uint8_t* sector, size_t len) {
+    size_t pos = sizeof(RunLogSectorHeader);
+    while (pos < len) {
+        if (sector[pos] == RUNLOG_REC_KEY) {
+            if (pos + 1 + sizeof(RecorderSample) > len) break;
+            pos += 1 + sizeof(RecorderSample);
+        } else if (sector[pos] == RUNLOG_REC_DELTA) {
+            size_t p = pos + 1;
+            int i = 0;
+            for (; i < RUNLOG_FIELDS; i++) {
+                uint32_t v;
+                size_t n = getVarint(sector + p, len - p, &v);
+                if (!n) break;
+                p += n;
+            }
+            if (i < RUNLOG_FIELDS) break;
+            pos = p;
+        } else {
+            break;
+        }
+    }
+    return pos;
+}
@@ -1,12 +1,14 @@
 #include "sensor.h"
 #include <string.h>
 #include <esp_timer.h>
+#include <esp_rom_sys.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 #include <driver/gpio.h>
 #include <esp_adc/adc_oneshot.h>
 
 QTR::QTR() : linePosition(0) {
+    memset(sensorScale, 0, sizeof(sensorScale));
     memset(sensorValues, 0, sizeof(sensorValues));
     memset(rawSensorValues, 0, sizeof(rawSensorValues));
     memset(sensorMin, 0, sizeof(sensorMin));
@@ -45,6 +47,15 @@ void QTR::init() {
 void QTR::setCalibration(int16_t minVals[], int16_t maxVals[]) {
     memcpy(sensorMin, minVals, sizeof(sensorMin));
     memcpy(sensorMax, maxVals, sizeof(sensorMax));
+    for (int i = 0; i < NUM_SENSORS; i++) {
+        int32_t range = sensorMax[i] - sensorMin[i];
+        sensorScale[i] = range > 0 ? (1000 << 16) / range : 0;
+    }
+}
+
+void QTR::getCalibration(int16_t minVals[], int16_t maxVals[]) {
+    memcpy(minVals, sensorMin, sizeof(sensorMin));
+    memcpy(maxVals, sensorMax, sizeof(sensorMax));
 }
 
 void QTR::read() {
@@ -55,14 +66,14 @@ void QTR::read() {
         gpio_set_level((gpio_num_t)MUX_S2, (i & 0x04) >> 2);
         gpio_set_level((gpio_num_t)MUX_S3, (i & 0x08) >> 3);
 
-        // Small delay for settling
-        vTaskDelay(pdMS_TO_TICKS(1));
+        // Asentamiento del mux; vTaskDelay(1) costaba un tick entero por canal
+        esp_rom_delay_us(MUX_SETTLE_US);
 
         int raw;
         adc_oneshot_read(adc_handle, ADC_CHANNEL_6, &raw);
         rawSensorValues[i] = raw;
-        if (sensorMax[i] > sensorMin[i]) {
-            sensorValues[i] = (raw - sensorMin[i]) * 1000 / (sensorMax[i] - sensorMin[i]);
+        if (sensorScale[i] > 0) {
+            sensorValues[i] = ((int64_t)(raw - sensorMin[i]) * sensorScale[i]) >> 16;
         } else {
             sensorValues[i] = 0;
         }
@@ -102,6 +113,7 @@ void QTR::calibrate() {
         }
         vTaskDelay(pdMS_TO_TICKS(10));
     }
+    setCalibration(sensorMin, sensorMax);
 }
 
 int16_t* QTR::getSensorValues() { return sensorValues; }
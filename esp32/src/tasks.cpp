@@ -1,4 +1,9 @@
 #include "robot.h"
+#include "tasks.h"
+#include "spsc_queue.h"
+#include "protocol.h"
+#include "recorder.h"
+#include "runlog.h"
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 #include <esp_timer.h>
@@ -8,6 +13,8 @@
 #include <string.h>
 #include <stdio.h>
 #include <math.h>
+#include <stdlib.h>
+#include <atomic>
 
 // Utility functions
 template <typename T>
@@ -29,6 +36,68 @@ void IRAM_ATTR rightEncoderISR(void* arg) {
     if (rightMotorPtr) rightMotorPtr->updateEncoder();
 }
 
+// Pipeline sensores (core 0) -> control (core 1)
+static SpscQueue<SensorFrame, SENSOR_QUEUE_LEN> sensorQueue;
+static TaskHandle_t sensorTaskHandle = NULL;
+static TaskHandle_t controlTaskHandle = NULL;
+static esp_timer_handle_t controlTimer = NULL;
+static volatile uint32_t controlPeriodUs = 1000000UL / DEFAULT_CONTROL_RATE_HZ;
+
+// Grabador de vuelo: solo la tarea de control lo escribe. Los comandos piden
+// armar/disparar/congelar con recorderRequest y esperan a que se atienda.
+enum RecorderRequest : uint8_t { REC_REQ_NONE, REC_REQ_ARM, REC_REQ_TRIGGER, REC_REQ_FREEZE };
+static FlightRecorder<RecorderSample, RECORDER_SAMPLES> recorder;
+static std::atomic<uint8_t> recorderRequest(REC_REQ_NONE);
+static std::atomic<uint8_t> recorderTriggers(0);
+static std::atomic<float> recorderDeviation(DEFAULT_RECORDER_DEVIATION);
+static uint16_t dumpSeq = 0;
+
+// Cambio de baud: la tarea de comandos conmuta después de enviar la respuesta
+// y espera `baud ok` a la nueva velocidad
+enum BaudState : uint8_t { BAUD_IDLE, BAUD_SWITCH, BAUD_CONFIRM };
+static BaudState baudState = BAUD_IDLE;
+static uint32_t serialBaud = SERIAL_DEFAULT_BAUD;
+static uint32_t pendingBaud = SERIAL_DEFAULT_BAUD;
+static int64_t baudDeadlineUs = 0;
+
+// Registro persistente: se graba cada vuelta en modo línea; `log start/stop` lo fuerzan
+enum RunLogRequest : uint8_t { RUNLOG_REQ_NONE, RUNLOG_REQ_START, RUNLOG_REQ_STOP };
+static std::atomic<uint8_t> runLogRequest(RUNLOG_REQ_NONE);
+
+// Cada tick del timer despierta ambas etapas: la adquisición produce el frame
+// que el control consume en el tick siguiente.
+static void controlTimerCallback(void* arg) {
+    if (sensorTaskHandle) xTaskNotifyGive(sensorTaskHandle);
+    if (controlTaskHandle) xTaskNotifyGive(controlTaskHandle);
+}
+
+bool setControlRate(uint16_t hz) {
+    if (hz < LIMIT_MIN_CONTROL_RATE_HZ || hz > LIMIT_MAX_CONTROL_RATE_HZ) return false;
+    controlPeriodUs = 1000000UL / hz;
+    if (controlTimer) {
+        esp_timer_stop(controlTimer);  // Falla si aún no corría; no importa
+        esp_timer_start_periodic(controlTimer, controlPeriodUs);
+    }
+    return true;
+}
+
+void startControlPipeline() {
+    xTaskCreatePinnedToCore(sensorsTask, "Sensors", 4096, NULL, SENSOR_TASK_PRIORITY, &sensorTaskHandle, SENSOR_TASK_CORE);
+    xTaskCreatePinnedToCore(controlTask, "Control", 4096, NULL, CONTROL_TASK_PRIORITY, &controlTaskHandle, CONTROL_TASK_CORE);
+
+    esp_timer_create_args_t timerArgs = {};
+    timerArgs.callback = controlTimerCallback;
+    timerArgs.dispatch_method = ESP_TIMER_TASK;
+    timerArgs.name = "control";
+    timerArgs.skip_unhandled_events = true;
+    esp_timer_create(&timerArgs, &controlTimer);
+
+    if (!setControlRate(config.controlRateHz)) {
+        config.controlRateHz = DEFAULT_CONTROL_RATE_HZ;
+        setControlRate(config.controlRateHz);
+    }
+}
+
 // Functions
 
 void updateModeLed(unsigned long currentMillis, unsigned long blinkInterval) {
@@ -43,6 +112,7 @@ void updateModeLed(unsigned long currentMillis, unsigned long blinkInterval) {
 
 TelemetryData buildTelemetryData() {
     TelemetryData data;
+    data.profile = robot.activeProfile;
     if (xSemaphoreTake(sharedData.mutex, pdMS_TO_TICKS(10)) == pdTRUE) {
         int16_t* sensors = sharedData.sensorValues;
         memcpy(data.sensors, sensors, sizeof(data.sensors));
@@ -64,10 +134,11 @@ TelemetryData buildTelemetryData() {
         data.rIntegral = robot.rightPid.getIntegral();
         data.rDeriv = robot.rightPid.getDerivative();
         data.uptime = esp_timer_get_time() / 1000;
-        data.lRpm = robot.leftMotor.getRPM();
-        data.rRpm = robot.rightMotor.getRPM();
-        data.lFilteredRpm = robot.leftMotor.getFilteredRPM();
-        data.rFilteredRpm = robot.rightMotor.getFilteredRPM();
+        // Solo lectura: getRPM() reiniciaría la ventana que usa el lazo de velocidad
+        data.lRpm = robot.leftMotor.getCurrentRPM();
+        data.rRpm = robot.rightMotor.getCurrentRPM();
+        data.lFilteredRpm = robot.leftMotor.getCurrentFilteredRPM();
+        data.rFilteredRpm = robot.rightMotor.getCurrentFilteredRPM();
         data.lTargetRpm = sharedData.leftTargetRPM;
         data.rTargetRpm = sharedData.rightTargetRPM;
         data.lPwm = robot.leftMotor.getSpeed();
@@ -76,29 +147,90 @@ TelemetryData buildTelemetryData() {
         data.encRForward = robot.rightMotor.getEncForwardCount();
         data.encLBackward = robot.leftMotor.getEncBackwardCount();
         data.encRBackward = robot.rightMotor.getEncBackwardCount();
-        data.leftSpeedCms = (data.lRpm * M_PI * (config.wheelDiameter / 10.0)) / 60.0;
-        data.rightSpeedCms = (data.rRpm * M_PI * (config.wheelDiameter / 10.0)) / 60.0;
+        ControlParams params;
+        controlParams.read(params);
+        data.leftSpeedCms = data.lRpm * params.rpmToCms;
+        data.rightSpeedCms = data.rRpm * params.rpmToCms;
         data.battery = 8.4;
-        data.loopTime = 0; // TODO
+        data.loopTime = sharedData.timing.totalUs;
         data.curvature = 0; // TODO
         data.sensorState = (uint8_t)sharedData.sensorState;
+        data.sensorUs = sharedData.timing.sensorUs;
+        data.frameAgeUs = sharedData.timing.frameAgeUs;
+        data.lineUs = sharedData.timing.lineUs;
+        data.speedUs = sharedData.timing.speedUs;
+        data.pwmUs = sharedData.timing.pwmUs;
+        data.jitterUs = sharedData.timing.jitterUs;
+        data.droppedFrames = sensorQueue.droppedCount();
         xSemaphoreGive(sharedData.mutex);
     }
     return data;
 }
 
+// Calibra con motores detenidos y publica los nuevos límites para la tarea de sensores
+static void runCalibration(const char* msg) {
+    robot.leftMotor.setSpeed(0);
+    robot.rightMotor.setSpeed(0);
+    gpio_set_level((gpio_num_t)MODE_LED_PIN, 1);
+    printf("%s\n", msg);
+    robot.qtr.calibrate();
+    robot.qtr.getCalibration(config.sensorMin, config.sensorMax);
+    publishConfig();
+    gpio_set_level((gpio_num_t)MODE_LED_PIN, 0);
+    printf("Calibration complete.\n");
+}
+
+static bool requestRecorder(RecorderRequest req) {
+    recorderRequest.store(req);
+    for (int i = 0; i < 100 && recorderRequest.load() != REC_REQ_NONE; i++) {
+        vTaskDelay(pdMS_TO_TICKS(1));
+    }
+    return recorderRequest.load() == REC_REQ_NONE;
+}
+
+void sendBinaryFrame(uint8_t type, const void* payload, size_t len) {
+    uint8_t frame[FRAME_MAX_WIRE];
+    size_t n = buildFrame(type, dumpSeq++, payload, len, frame);
+    // Directo al driver: la consola de stdout convierte '\n' y rompería el binario
+    uart_write_bytes(UART_NUM, (const char*)frame, n);
+}
+
+// Vuelca el grabador congelado; corre en la tarea de comandos y no toca el control
+static void dumpRecorder() {
+    if (!requestRecorder(REC_REQ_FREEZE)) {
+        printf("Recorder busy\n");
+        return;
+    }
+    fflush(stdout);
+    RecorderHeader h;
+    h.reason = recorder.getReason();
+    h.samples = recorder.size();
+    h.triggerIndex = recorder.triggerIndex();
+    h.periodUs = controlPeriodUs;
+    h.posScale = 1000;
+    h.sampleSize = sizeof(RecorderSample);
+    sendBinaryFrame(FRAME_RECORDER_HEADER, &h, sizeof(h));
+
+    uint8_t payload[FRAME_MAX_PAYLOAD];
+    for (uint32_t i = 0; i < recorder.size(); i += RECORDER_SAMPLES_PER_FRAME) {
+        payload[0] = i & 0xFF;
+        payload[1] = (i >> 8) & 0xFF;
+        uint32_t n = 0;
+        while (n < RECORDER_SAMPLES_PER_FRAME && i + n < recorder.size()) {
+            memcpy(payload + 2 + n * sizeof(RecorderSample), &recorder.at(i + n), sizeof(RecorderSample));
+            n++;
+        }
+        sendBinaryFrame(FRAME_RECORDER_SAMPLES, payload, 2 + n * sizeof(RecorderSample));
+    }
+    uart_wait_tx_done(UART_NUM, pdMS_TO_TICKS(1000));
+}
+
 void processCommand(const char* cmd) {
     if (strlen(cmd) == 0) return;
 
     bool handled = false;
     if (strcmp(cmd, "calibrate") == 0) {
-        robot.leftMotor.setSpeed(0);
-        robot.rightMotor.setSpeed(0);
-        gpio_set_level((gpio_num_t)MODE_LED_PIN, 1);
-        printf("Calibrating...\n");
-        robot.qtr.calibrate();
-        gpio_set_level((gpio_num_t)MODE_LED_PIN, 0);
-        printf("Calibration complete.\n");
+        runCalibration("Calibrating...");
         handled = true;
     } else if (strcmp(cmd, "save") == 0) {
         robot.saveConfig();
@@ -107,13 +239,120 @@ void processCommand(const char* cmd) {
     } else if (strcmp(cmd, "reset") == 0) {
         config.restoreDefaults();
         robot.saveConfig();
-        robot.linePid.setGains(config.lineKp, config.lineKi, config.lineKd);
-        robot.leftPid.setGains(config.leftKp, config.leftKi, config.leftKd);
-        robot.rightPid.setGains(config.rightKp, config.rightKi, config.rightKd);
+        publishConfig();
+        setControlRate(config.controlRateHz);
         printf("Config reset.\n");
         handled = true;
+    } else if (strncmp(cmd, "set control_rate ", 17) == 0) {
+        int hz = atoi(cmd + 17);
+        if (hz > 0 && hz <= LIMIT_MAX_CONTROL_RATE_HZ && setControlRate((uint16_t)hz)) {
+            config.controlRateHz = hz;
+            printf("Control rate: %d Hz\n", hz);
+        } else {
+            printf("Control rate must be %d-%d Hz\n", LIMIT_MIN_CONTROL_RATE_HZ, LIMIT_MAX_CONTROL_RATE_HZ);
+        }
+        handled = true;
+    } else if (strncmp(cmd, "set feature ", 12) == 0) {
+        // set feature <idx> <0/1> [ventana]: la ventana solo aplica a mediana (0) y media (1)
+        int idx = -1, val = -1, window = 0;
+        int count = sscanf(cmd + 12, "%d %d %d", &idx, &val, &window);
+        if (count < 2 || idx < 0 || idx > 8 || (val != 0 && val != 1)) {
+            printf("Usage: set feature <idx 0-8> <0/1> [window]\n");
+        } else if (count == 3 && (window > 255 || window < 0 || !config.features.setWindow(idx, window))) {
+            printf("Window: median odd %d-%d, average %d-%d\n", FILTER_WINDOW_MIN, FILTER_WINDOW_MAX,
+                   FILTER_WINDOW_MIN, FILTER_WINDOW_MIN + 7 < FILTER_WINDOW_MAX ? FILTER_WINDOW_MIN + 7 : FILTER_WINDOW_MAX);
+        } else {
+            config.features.setFeature(idx, val == 1);
+            publishConfig();
+            printf("Feature %d: %d (median %u, average %u)\n", idx, val,
+                   config.features.getWindow(0), config.features.getWindow(1));
+        }
+        handled = true;
+    } else if (strcmp(cmd, "log arm") == 0 || strncmp(cmd, "log arm ", 8) == 0) {
+        uint8_t mask = REC_TRIG_COMMAND;
+        float deviation = recorderDeviation.load();
+        if (cmd[7] == ' ') {
+            int m = 0;
+            int count = sscanf(cmd + 8, "%d,%f", &m, &deviation);
+            if (count >= 1) mask |= (uint8_t)m;
+        }
+        recorderTriggers.store(mask);
+        recorderDeviation.store(deviation);
+        if (requestRecorder(REC_REQ_ARM)) printf("Recorder armed: triggers=0x%02X deviation=%.2f\n", mask, deviation);
+        handled = true;
+    } else if (strcmp(cmd, "log trigger") == 0) {
+        requestRecorder(REC_REQ_TRIGGER);
+        handled = true;
+    } else if (strcmp(cmd, "dump log") == 0) {
+        dumpRecorder();
+        handled = true;
+    } else if (strcmp(cmd, "log start") == 0 || strcmp(cmd, "log stop") == 0) {
+        runLogRequest.store(cmd[5] == 'a' ? RUNLOG_REQ_START : RUNLOG_REQ_STOP);
+        printf("Run log %s\n", cmd + 4);
+        handled = true;
+    } else if (strcmp(cmd, "log list") == 0) {
+        runLog.list();
+        handled = true;
+    } else if (strncmp(cmd, "log read ", 9) == 0) {
+        fflush(stdout);
+        if (!runLog.read((uint16_t)atoi(cmd + 9))) printf("Run not found\n");
+        uart_wait_tx_done(UART_NUM, pdMS_TO_TICKS(1000));
+        handled = true;
+    } else if (strcmp(cmd, "log erase") == 0) {
+        printf("Erasing run log...\n");
+        runLog.eraseAll();
+        printf("Run log erased\n");
+        handled = true;
+    } else if (strncmp(cmd, "set baud ", 9) == 0) {
+        uint32_t baud = strtoul(cmd + 9, NULL, 10);
+        if (baud < SERIAL_DEFAULT_BAUD || baud > SERIAL_MAX_BAUD) {
+            printf("Baud must be %d-%d\n", SERIAL_DEFAULT_BAUD, SERIAL_MAX_BAUD);
+        } else if (baudState != BAUD_IDLE) {
+            printf("Baud change in progress\n");
+        } else {
+            pendingBaud = baud;
+            baudState = BAUD_SWITCH;
+            printf("Switching to %lu baud, confirm with 'baud ok'\n", (unsigned long)baud);
+        }
+        handled = true;
+    } else if (strcmp(cmd, "baud ok") == 0) {
+        if (baudState == BAUD_CONFIRM) {
+            serialBaud = pendingBaud;
+            baudState = BAUD_IDLE;
+            printf("Baud: %lu\n", (unsigned long)serialBaud);
+        } else {
+            printf("Nothing to confirm\n");
+        }
+        handled = true;
+    } else if (strncmp(cmd, "profile save ", 13) == 0 || strncmp(cmd, "profile load ", 13) == 0) {
+        char* end;
+        long n = strtol(cmd + 13, &end, 10);
+        if (end == cmd + 13 || n < 0 || n >= PROFILE_SLOTS || (*end != '\0' && *end != ' ')) {
+            printf("Profile must be 0-%d\n", PROFILE_SLOTS - 1);
+        } else if (cmd[8] == 's') {
+            if (robot.saveProfile(n, *end ? end + 1 : end)) printf("Profile %ld saved\n", n);
+            else printf("Profile save failed\n");
+        } else {
+            if (robot.applyProfile(n)) printf("Profile %ld loaded\n", n);
+            else printf("Profile %ld is empty\n", n);
+        }
+        handled = true;
+    } else if (strcmp(cmd, "profile list") == 0) {
+        for (uint8_t n = 0; n < PROFILE_SLOTS; n++) {
+            const TuningProfile& p = robot.profiles[n];
+            if (!robot.profileValid[n]) {
+                printf(" P%u (empty)\n", n);
+                continue;
+            }
+            printf("%cP%u %s line=[%.3f,%.4f,%.3f] base=%d/%.0f max=%d/%.0f cascade=%d\n",
+                   n == robot.activeProfile ? '*' : ' ', n, p.name, p.lineKp, p.lineKi, p.lineKd,
+                   p.basePwm, p.baseRPM, p.maxPwm, p.maxRpm, p.cascadeMode);
+        }
+        handled = true;
     } else if (strcmp(cmd, "help") == 0) {
-        printf("Commands: calibrate, save, reset, help\n");
+        printf("Commands: calibrate, save, reset, set control_rate <hz>, set feature <idx> <0/1> [window], log arm [mask,deviation], log trigger, dump log, "
+               "log start, log stop, log list, log read <id>, log erase, set baud <rate>, baud ok, "
+               "profile save <n> [name], profile load <n>, profile list, help\n");
         handled = true;
     }
 
@@ -124,112 +363,255 @@ void processCommand(const char* cmd) {
 
 // Tasks
 void sensorsTask(void* pvParameters) {
-    unsigned long lastLineTime = esp_timer_get_time() / 1000;
+    SensorFrame frame = {};
+    ControlParams params;
+    uint32_t epoch = controlParams.read(params) - 1;
     while (true) {
-        unsigned long currentMillis = esp_timer_get_time() / 1000;
-        if (xSemaphoreTake(sharedData.mutex, pdMS_TO_TICKS(10)) == pdTRUE) {
-            if (currentMillis - lastLineTime >= config.loopLineMs) {
-                lastLineTime = currentMillis;
-                if (sharedData.operationMode == MODE_LINE_FOLLOWING) {
-                    robot.qtr.read();
-                    int16_t* rawSensors = robot.qtr.getRawSensorValues();
-                    sharedData.sensorState = NORMAL;
-
-                    float currentPosition = robot.features.applySignalFilters(robot.qtr.linePosition);
-
-                    sharedData.linePosition = currentPosition;
-                    memcpy(sharedData.sensorValues, robot.qtr.getSensorValues(), 16 * sizeof(int16_t));
-                    memcpy(sharedData.rawSensorValues, rawSensors, 16 * sizeof(int16_t));
-                }
-            }
-            xSemaphoreGive(sharedData.mutex);
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        int64_t start = esp_timer_get_time();
+
+        // Nueva versión de config: se adopta entre frames, nunca a mitad de uno
+        if (controlParams.currentEpoch() != epoch) {
+            epoch = controlParams.read(params);
+            robot.features.setConfig(params.features);
+            robot.qtr.setCalibration(params.sensorMin, params.sensorMax);
         }
-        vTaskDelay(pdMS_TO_TICKS(config.loopLineMs));
+
+        robot.qtr.read();
+        frame.linePosition = robot.features.applySignalFilters(robot.qtr.linePosition);
+        memcpy(frame.sensorValues, robot.qtr.getSensorValues(), sizeof(frame.sensorValues));
+        memcpy(frame.rawSensorValues, robot.qtr.getRawSensorValues(), sizeof(frame.rawSensorValues));
+        frame.sensorState = NORMAL;
+
+        frame.timestampUs = esp_timer_get_time();
+        frame.acquireUs = (uint32_t)(frame.timestampUs - start);
+        sensorQueue.push(frame);
     }
 }
 
-void motorsTask(void* pvParameters) {
+void controlTask(void* pvParameters) {
     // Subscribe to WDT
     esp_task_wdt_add(NULL);
-    unsigned long lastSpeedTime = esp_timer_get_time() / 1000;
+
+    SensorFrame frame = {};
+    bool haveFrame = false;
+    StageTiming timing = {};
+    int64_t lastTick = esp_timer_get_time();
+    int64_t lastFrameTime = 0;
+    uint32_t wdtTicks = 0;
+
+    // Copia local de las entradas de comandos; se refresca sin bloquear
+    OperationMode mode = sharedData.operationMode;
+    bool cascade = sharedData.cascadeMode;
+    float throttle = 0, steering = 0;
+    float leftTargetRPM = 0, rightTargetRPM = 0;
+    ControlParams params;
+    uint32_t epoch = controlParams.read(params) - 1;
+    uint16_t tick = 0;
+    SensorState lastState = NORMAL;
+    bool runLogActive = false;
+    bool runLogForced = false;
+
     while (true) {
-        unsigned long currentMillis = esp_timer_get_time() / 1000;
-        if (xSemaphoreTake(sharedData.mutex, pdMS_TO_TICKS(10)) == pdTRUE) {
-            if (currentMillis - lastSpeedTime >= config.loopSpeedMs) {
-                lastSpeedTime = currentMillis;
-                float dtSpeed = config.loopSpeedMs / 1000.0;
-
-                if (sharedData.operationMode == MODE_REMOTE_CONTROL) {
-                    sharedData.leftTargetRPM = sharedData.throttle - sharedData.steering;
-                    sharedData.rightTargetRPM = sharedData.throttle + sharedData.steering;
-                    sharedData.leftTargetRPM = constrain(sharedData.leftTargetRPM, -config.maxRpm, config.maxRpm);
-                    sharedData.rightTargetRPM = constrain(sharedData.rightTargetRPM, -config.maxRpm, config.maxRpm);
-                } else if (sharedData.operationMode == MODE_LINE_FOLLOWING && sharedData.cascadeMode) {
-                    float applyBaseRPM = config.baseRPM;
-
-                    float pidOutput;
-                    float error = 0 - sharedData.linePosition;
-                    robot.linePid.setGains(config.lineKp, config.lineKi, config.lineKd);
-                    pidOutput = robot.linePid.calculate(0, error, dtSpeed);
-
-                    float rpmAdjustment = pidOutput * 0.5;
-                    sharedData.leftTargetRPM = applyBaseRPM + rpmAdjustment;
-                    sharedData.rightTargetRPM = applyBaseRPM - rpmAdjustment;
-                }
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        int64_t tickStart = esp_timer_get_time();
+
+        // Adopta la config publicada al inicio del tick; las ganancias cambian sin salto
+        if (controlParams.currentEpoch() != epoch) {
+            epoch = controlParams.read(params);
+            robot.linePid.setGainsBumpless(params.lineKp, params.lineKi, params.lineKd);
+            robot.leftPid.setGainsBumpless(params.leftKp, params.leftKi, params.leftKd);
+            robot.rightPid.setGainsBumpless(params.rightKp, params.rightKi, params.rightKd);
+            // El anti-windup tiene que ver la misma saturación que después aplica el lazo
+            robot.leftPid.setOutputLimits(-params.maxPwm, params.maxPwm);
+            robot.rightPid.setOutputLimits(-params.maxPwm, params.maxPwm);
+        }
+        uint32_t periodUs = controlPeriodUs;
+        timing.jitterUs = (uint32_t)llabs((tickStart - lastTick) - (int64_t)periodUs);
+        lastTick = tickStart;
+        float dtSpeed = periodUs / 1000000.0f;
+
+        // Intercambio con comandos/telemetría; si el mutex está ocupado se usa la copia anterior
+        if (xSemaphoreTake(sharedData.mutex, 0) == pdTRUE) {
+            mode = sharedData.operationMode;
+            cascade = sharedData.cascadeMode;
+            throttle = sharedData.throttle;
+            steering = sharedData.steering;
+            if (mode == MODE_IDLE) {
+                leftTargetRPM = sharedData.leftTargetRPM;
+                rightTargetRPM = sharedData.rightTargetRPM;
+            } else {
+                sharedData.leftTargetRPM = leftTargetRPM;
+                sharedData.rightTargetRPM = rightTargetRPM;
+            }
+            if (haveFrame) {
+                sharedData.linePosition = frame.linePosition;
+                sharedData.sensorState = frame.sensorState;
+                memcpy(sharedData.sensorValues, frame.sensorValues, sizeof(frame.sensorValues));
+                memcpy(sharedData.rawSensorValues, frame.rawSensorValues, sizeof(frame.rawSensorValues));
+            }
+            sharedData.timing = timing;
+            xSemaphoreGive(sharedData.mutex);
+        }
 
-                if (sharedData.operationMode == MODE_REMOTE_CONTROL || (sharedData.operationMode == MODE_LINE_FOLLOWING && sharedData.cascadeMode)) {
-                    int leftSpeed = robot.leftPid.calculate(sharedData.leftTargetRPM, robot.leftMotor.getFilteredRPM(), dtSpeed);
-                    int rightSpeed = robot.rightPid.calculate(sharedData.rightTargetRPM, robot.rightMotor.getFilteredRPM(), dtSpeed);
+        // Etapa 1: PID de línea sobre el frame más reciente
+        int64_t lineStart = esp_timer_get_time();
+        bool newFrame = sensorQueue.popLatest(frame);
+        if (newFrame) {
+            haveFrame = true;
+            timing.sensorUs = frame.acquireUs;
+            timing.frameAgeUs = (uint32_t)(lineStart - frame.timestampUs);
+        }
 
-                    leftSpeed = constrain(leftSpeed, -(int)config.maxPwm, (int)config.maxPwm);
-                    rightSpeed = constrain(rightSpeed, -(int)config.maxPwm, (int)config.maxPwm);
+        if (mode == MODE_REMOTE_CONTROL) {
+            leftTargetRPM = constrain(throttle - steering, -params.maxRpm, params.maxRpm);
+            rightTargetRPM = constrain(throttle + steering, -params.maxRpm, params.maxRpm);
+        } else if (mode == MODE_LINE_FOLLOWING && cascade && newFrame) {
+            float dtLine = lastFrameTime ? (frame.timestampUs - lastFrameTime) / 1000000.0f : dtSpeed;
+            lastFrameTime = frame.timestampUs;
 
-                    robot.leftMotor.setSpeed(leftSpeed);
-                    robot.rightMotor.setSpeed(rightSpeed);
-                } else if (sharedData.operationMode == MODE_IDLE) {
-                    int leftSpeed = robot.leftPid.calculate(sharedData.leftTargetRPM, robot.leftMotor.getFilteredRPM(), dtSpeed);
-                    int rightSpeed = robot.rightPid.calculate(sharedData.rightTargetRPM, robot.rightMotor.getFilteredRPM(), dtSpeed);
+            float error = 0 - frame.linePosition;
+            float pidOutput = robot.linePid.calculate(0, error, dtLine);
 
-                    leftSpeed = constrain(leftSpeed, -(int)config.maxPwm, (int)config.maxPwm);
-                    rightSpeed = constrain(rightSpeed, -(int)config.maxPwm, (int)config.maxPwm);
+            float rpmAdjustment = pidOutput * 0.5;
+            leftTargetRPM = params.baseRPM + rpmAdjustment;
+            rightTargetRPM = params.baseRPM - rpmAdjustment;
+        }
 
-                    robot.leftMotor.setSpeed(leftSpeed);
-                    robot.rightMotor.setSpeed(rightSpeed);
-                }
+        // Etapa 2: PIDs de velocidad en cascada
+        int64_t speedStart = esp_timer_get_time();
+        timing.lineUs = (uint32_t)(speedStart - lineStart);
+        bool drive = mode == MODE_REMOTE_CONTROL || mode == MODE_IDLE || (mode == MODE_LINE_FOLLOWING && cascade);
+        int leftSpeed = 0, rightSpeed = 0;
+        if (drive) {
+            leftSpeed = robot.leftPid.calculate(leftTargetRPM, robot.leftMotor.getFilteredRPM(), dtSpeed);
+            rightSpeed = robot.rightPid.calculate(rightTargetRPM, robot.rightMotor.getFilteredRPM(), dtSpeed);
+            leftSpeed = constrain(leftSpeed, -(int)params.maxPwm, (int)params.maxPwm);
+            rightSpeed = constrain(rightSpeed, -(int)params.maxPwm, (int)params.maxPwm);
+        }
 
-                if (sharedData.operationMode == MODE_LINE_FOLLOWING) {
-                    updateModeLed(currentMillis, 100);
-                } else if (sharedData.operationMode == MODE_REMOTE_CONTROL) {
-                    updateModeLed(currentMillis, 500);
-                } else {
-                    gpio_set_level((gpio_num_t)MODE_LED_PIN, 0);
+        // Etapa 3: PWM
+        int64_t pwmStart = esp_timer_get_time();
+        timing.speedUs = (uint32_t)(pwmStart - speedStart);
+        if (drive) {
+            robot.leftMotor.setSpeed(leftSpeed);
+            robot.rightMotor.setSpeed(rightSpeed);
+        }
+        int64_t tickEnd = esp_timer_get_time();
+        timing.pwmUs = (uint32_t)(tickEnd - pwmStart);
+        timing.totalUs = (uint32_t)(tickEnd - tickStart);
+
+        // Grabador de vuelo: pedidos de los comandos, muestra y disparos
+        tick++;
+        switch (recorderRequest.exchange(REC_REQ_NONE)) {
+        case REC_REQ_ARM: recorder.arm(); lastState = frame.sensorState; break;
+        case REC_REQ_TRIGGER: recorder.trigger(REC_TRIG_COMMAND); break;
+        case REC_REQ_FREEZE: recorder.freeze(); break;
+        default: break;
+        }
+        switch (runLogRequest.exchange(RUNLOG_REQ_NONE)) {
+        case RUNLOG_REQ_START: runLogForced = true; break;
+        case RUNLOG_REQ_STOP: runLogForced = false; break;
+        default: break;
+        }
+        // Inicio/fin de vuelta por la misma cola que las muestras; si está llena se reintenta
+        bool runLogWanted = runLogForced || mode == MODE_LINE_FOLLOWING;
+        RunLogItem logItem;
+        if (runLogWanted != runLogActive) {
+            logItem.type = runLogWanted ? RUNLOG_ITEM_START : RUNLOG_ITEM_STOP;
+            logItem.periodUs = periodUs;
+            if (runLog.push(logItem)) runLogActive = runLogWanted;
+        }
+        bool recording = recorder.getState() == recorder.ARMED || recorder.getState() == recorder.TRIGGERED;
+        if (recording || runLogActive) {
+            RecorderSample& sample = logItem.sample;
+            sample.tick = tick;
+            sample.linePos = toFixed16(frame.linePosition, 1000);
+            sample.lineIntegral = toFixed16(robot.linePid.getIntegral(), 1);
+            sample.lineDeriv = toFixed16(robot.linePid.getDerivative(), 1);
+            sample.linePidOut = toFixed16(robot.linePid.getOutput(), 10);
+            sample.lTargetRpm = toFixed16(leftTargetRPM, 8);
+            sample.rTargetRpm = toFixed16(rightTargetRPM, 8);
+            sample.lRpm = toFixed16(robot.leftMotor.getCurrentFilteredRPM(), 8);
+            sample.rRpm = toFixed16(robot.rightMotor.getCurrentFilteredRPM(), 8);
+            sample.lPwm = leftSpeed / 2;
+            sample.rPwm = rightSpeed / 2;
+            if (runLogActive) {
+                logItem.type = RUNLOG_ITEM_SAMPLE;
+                runLog.push(logItem);
+            }
+        }
+        if (recording) {
+            recorder.record(logItem.sample);
+
+            uint8_t triggers = recorderTriggers.load();
+            if (recorder.getState() == recorder.ARMED) {
+                if ((triggers & REC_TRIG_LINE_LOST) && frame.sensorState == ALL_WHITE) {
+                    recorder.trigger(REC_TRIG_LINE_LOST);
+                } else if ((triggers & REC_TRIG_STATE) && frame.sensorState != lastState) {
+                    recorder.trigger(REC_TRIG_STATE);
+                } else if ((triggers & REC_TRIG_DEVIATION) && fabsf(frame.linePosition) > recorderDeviation.load()) {
+                    recorder.trigger(REC_TRIG_DEVIATION);
                 }
             }
+        }
+        lastState = frame.sensorState;
 
-            xSemaphoreGive(sharedData.mutex);
+        unsigned long currentMillis = tickEnd / 1000;
+        if (mode == MODE_LINE_FOLLOWING) {
+            updateModeLed(currentMillis, 100);
+        } else if (mode == MODE_REMOTE_CONTROL) {
+            updateModeLed(currentMillis, 500);
+        } else {
+            gpio_set_level((gpio_num_t)MODE_LED_PIN, 0);
+        }
+
+        // Reset watchdog (no hace falta en cada tick a 1 kHz)
+        if (++wdtTicks >= 100) {
+            wdtTicks = 0;
+            esp_task_wdt_reset();
         }
-        // Reset watchdog
-        esp_task_wdt_reset();
-        vTaskDelay(pdMS_TO_TICKS(config.loopSpeedMs));
     }
 }
 
 void telemetryTask(void* pvParameters) {
     unsigned long lastTelemetryTime = 0;
     while (true) {
-        if (xSemaphoreTake(sharedData.mutex, portMAX_DELAY) == pdTRUE) {
-            unsigned long currentMillis = esp_timer_get_time() / 1000;
-            if (sharedData.telemetryEnabled && (currentMillis - lastTelemetryTime > config.telemetryIntervalMs)) {
-                TelemetryData data = buildTelemetryData();
-                printf("T:%f,%f,%f,%f\n", data.linePos, data.lRpm, data.rRpm, data.uptime / 1000.0);
-                lastTelemetryTime = currentMillis;
-            }
-            xSemaphoreGive(sharedData.mutex);
+        unsigned long currentMillis = esp_timer_get_time() / 1000;
+        // buildTelemetryData() toma el mutex por su cuenta
+        if (sharedData.telemetryEnabled && (currentMillis - lastTelemetryTime > config.telemetryIntervalMs)) {
+            TelemetryData data = buildTelemetryData();
+            printf("T:%f,%f,%f,%f,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%u\n",
+                   data.linePos, data.lRpm, data.rRpm, data.uptime / 1000.0,
+                   (unsigned long)data.loopTime, (unsigned long)data.sensorUs, (unsigned long)data.frameAgeUs,
+                   (unsigned long)data.lineUs, (unsigned long)data.speedUs, (unsigned long)data.pwmUs,
+                   (unsigned long)data.jitterUs, (unsigned long)data.droppedFrames, (unsigned long)config.controlRateHz,
+                   data.profile);
+            lastTelemetryTime = currentMillis;
         }
         vTaskDelay(pdMS_TO_TICKS(10));
     }
 }
 
+static void setUartBaud(uint32_t baud) {
+    fflush(stdout);
+    uart_wait_tx_done(UART_NUM, pdMS_TO_TICKS(100));
+    uart_set_baudrate(UART_NUM, baud);
+    uart_flush_input(UART_NUM);
+}
+
+static void serviceBaud() {
+    if (baudState == BAUD_SWITCH) {
+        setUartBaud(pendingBaud);
+        baudDeadlineUs = esp_timer_get_time() + BAUD_CONFIRM_TIMEOUT_MS * 1000LL;
+        baudState = BAUD_CONFIRM;
+    } else if (baudState == BAUD_CONFIRM && esp_timer_get_time() >= baudDeadlineUs) {
+        setUartBaud(serialBaud);
+        baudState = BAUD_IDLE;
+        printf("No confirmation, baud: %lu\n", (unsigned long)serialBaud);
+    }
+}
+
 void commandTask(void* pvParameters) {
     uint8_t data[BUF_SIZE];
     static uint32_t lastButtonTime = 0;
@@ -250,18 +632,14 @@ void commandTask(void* pvParameters) {
             }
         }
 
+        serviceBaud();
+
         // Check calibration button
         uint32_t currentTime = esp_timer_get_time() / 1000;
         if (gpio_get_level((gpio_num_t)CALIBRATION_BUTTON_PIN) == 0 && (currentTime - lastButtonTime) > 500) {  // Debounce 500ms
             lastButtonTime = currentTime;
             // Trigger calibration
-            robot.leftMotor.setSpeed(0);
-            robot.rightMotor.setSpeed(0);
-            gpio_set_level((gpio_num_t)MODE_LED_PIN, 1);
-            printf("Calibrating sensors via button...\n");
-            robot.qtr.calibrate();
-            gpio_set_level((gpio_num_t)MODE_LED_PIN, 0);
-            printf("Calibration complete.\n");
+            runCalibration("Calibrating sensors via button...");
         }
 
         vTaskDelay(pdMS_TO_TICKS(10));
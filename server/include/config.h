@@ -10,13 +10,34 @@
 
 
 #include <Arduino.h>
+#include "filters.h"
+#include "fixedpoint.h"
 
 // =============================================================================
 // CONSTANTES GLOBALES
 // =============================================================================
 
-// EEPROM address for config
+// EEPROM: la configuración rota entre EEPROM_CONFIG_SLOTS copias, cada una con su
+// número de secuencia; vale la de secuencia más alta. Cada guardado va al slot
+// siguiente, así el desgaste se reparte entre todos.
 const int16_t EEPROM_CONFIG_ADDR = 0;
+const uint8_t EEPROM_CONFIG_SLOTS = 3;
+// Tamaño fijo de cada slot (cabecera + RobotConfig), con margen para campos nuevos
+const uint8_t EEPROM_CONFIG_SLOT_SIZE = 160;
+// Tras el último cambio se espera este tiempo en idle antes de escribir, para juntar ráfagas de `set`
+const unsigned long CONFIG_FLUSH_DELAY_MS = 1000;
+// Perfiles de ajuste (`profile save/load`): detrás de los slots de configuración
+const uint8_t PROFILE_SLOTS = 4;
+const uint8_t PROFILE_NAME_LEN = 10;                 // Con el '\0'
+const uint8_t PROFILE_SLOT_SIZE = 80;
+const int16_t EEPROM_PROFILE_ADDR = EEPROM_CONFIG_ADDR + EEPROM_CONFIG_SLOTS * EEPROM_CONFIG_SLOT_SIZE;
+const uint8_t NO_PROFILE = 0xFF;
+// Modelo de los motores (`identify motors`): detrás de los perfiles, con su cabecera
+const int16_t EEPROM_MOTOR_MODEL_ADDR = EEPROM_PROFILE_ADDR + PROFILE_SLOTS * PROFILE_SLOT_SIZE;
+const uint8_t MOTOR_MODEL_SLOT_SIZE = 96;
+// Checkpoint del optimizador en pista (`autotune`): dos slots alternados al final
+const int16_t EEPROM_TUNER_ADDR = EEPROM_MOTOR_MODEL_ADDR + MOTOR_MODEL_SLOT_SIZE;
+const uint8_t TUNER_SLOT_SIZE = 64;
 
 // Constants
 const int16_t DEFAULT_RC_DEADZONE = 10;
@@ -35,6 +56,27 @@ const float DEFAULT_ROBOT_WEIGHT = 135.0f;
 // QTR sensor position calculation constants
 const float QTR_POSITION_SCALE = 4000.0f / 3.5f;  // ≈1142.857
 const float QTR_CENTER_OFFSET = 3.5f;
+// Estado de los sensores sobre la lectura calibrada (0-1000): negro desde el 70 % del
+// rango y blanco hasta el 30 %. Un sensor sin calibrar no cuenta como ninguno.
+const int16_t QTR_BLACK_LEVEL = 700;
+const int16_t QTR_WHITE_LEVEL = 300;
+
+// Grabador de vuelo: muestras por tick en RAM. Cada una ocupa 14 bytes; en el
+// Nano es lo que queda de SRAM tras buffers de salida y pila (55 ms a 5 ms/tick).
+#ifndef RECORDER_SAMPLES
+#define RECORDER_SAMPLES 11
+#endif
+const int16_t DEFAULT_RECORDER_DEVIATION = 3000;
+
+// Puerto serie: arranca siempre a SERIAL_DEFAULT_BAUD. `set baud` cambia la velocidad
+// hasta el próximo reinicio y vuelve sola si el host no manda `baud ok` a tiempo.
+const uint32_t SERIAL_DEFAULT_BAUD = 115200;
+const unsigned long BAUD_CONFIRM_TIMEOUT_MS = 2000;
+
+// Línea de comandos: admite lotes `@<seq> cmd;cmd;...` con hasta COMMAND_BATCH_MAX comandos.
+// El buffer RX del HardwareSerial es de 64 bytes: el host no debe tener más de eso sin confirmar.
+const uint8_t SERIAL_LINE_MAX = 128;
+const uint8_t COMMAND_BATCH_MAX = 16;
 
 // Límites de seguridad para proteger motores
 const int16_t LIMIT_MAX_PWM = 255;    // PWM máximo seguro
@@ -67,6 +109,99 @@ const int SENSOR_PINS[NUM_SENSORS] = {A0, A1, A2, A3, A4, A5, A6, A7};
 // LEDs de indicación de modo
 #define MODE_LED_PIN      13  // LED integrado para indicar modo
 
+// Estimador de línea (`set estimator`): ganancias fijas de corrección del filtro α-β-γ
+// sobre desplazamiento lateral, rumbo y curvatura. β y γ están por mm de residuo: con
+// más avance por tick del lazo de línea conviene bajarlas.
+struct EstimatorConfig {
+  uint8_t enabled;
+  uint16_t alphaQ15;                    // Desplazamiento (adimensional, 0-1)
+  uint16_t betaQ16;                     // Rumbo [rad/mm]
+  uint16_t gammaQ24;                    // Curvatura [1/mm²]
+};
+
+// Separación entre sensores del QTR-8A, para pasar la posición (±4000) a mm
+const float QTR_SENSOR_PITCH_MM = 9.525f;
+// Contraste de la lectura (máximo - mínimo calibrado, 0-1000) desde el que se empieza a
+// creer la posición y con el que se la cree del todo; debajo el estimador solo predice
+const int16_t ESTIMATOR_CONTRAST_MIN = 150;
+const int16_t ESTIMATOR_CONTRAST_FULL = 600;
+
+// Modelo estático de cada motor (`identify motors`): RPM en régimen contra PWM por rueda
+// y sentido, como tabla lineal por tramos. El PWM de cada punto no se guarda: van
+// equiespaciados entre la banda muerta y topPwm. Sirve de feedforward al lazo de RPM.
+const uint8_t MOTOR_LUT_POINTS = 8;
+const uint16_t MOTOR_MODEL_SCHEMA_VERSION = 1;
+// Tiempos de `identify motors` (el lazo de RPM no corre mientras tanto)
+const uint8_t IDENTIFY_DEADBAND_STEP = 4;          // PWM por escalón buscando la banda muerta
+const unsigned long IDENTIFY_DEADBAND_MS = 150;    // Duración de cada escalón
+const uint8_t IDENTIFY_MOVE_PULSES = 3;            // Pulsos en un escalón para decir que gira
+const unsigned long IDENTIFY_SETTLE_MS = 400;      // Espera al régimen en cada punto
+const unsigned long IDENTIFY_MEASURE_MS = 400;     // Ventana de medición de la RPM
+const unsigned long IDENTIFY_REST_MS = 1000;       // Parada antes de invertir el sentido
+// Tiempos de `identify step`: el filtro de RPM de Motor (0.9/0.1 cada 100 ms) tiene
+// τ ≈ 1 s, así que cada nivel se sostiene ~5τ antes de tomarlo como régimen
+const unsigned long IDENTIFY_STEP_SETTLE_MS = 5000;  // Base con u0 antes de cada escalón
+const unsigned long IDENTIFY_STEP_HOLD_MS = 6000;    // Escalón de la pasada 0
+const unsigned long IDENTIFY_STEP_WINDOW_MS = 1000;  // Ventana final promediada como régimen
+// Autotuning por relé (`autotune line|wheels`)
+const uint8_t RELAY_SKIP_CYCLES = 2;                 // Ciclos de transitorio que no se miden
+const uint8_t RELAY_MEASURE_CYCLES = 4;              // Ciclos promediados para Ku y Pu
+const unsigned long RELAY_LINE_TIMEOUT_MS = 15000;   // Corta si el lazo de línea no oscila
+const unsigned long RELAY_WHEEL_TIMEOUT_MS = 60000;  // Un ciclo de RPM dura segundos (τ ≈ 1 s)
+const int16_t RELAY_LINE_HYSTERESIS = 100;           // ε sobre la posición (±4000)
+const int16_t RELAY_WHEEL_HYSTERESIS = 5;            // ε sobre la RPM filtrada
+const int16_t RELAY_LINE_LIMIT = 3000;               // |posición| que se toma como línea perdida
+// Optimizador en pista (`autotune`, `autotune track`). Cada término del puntaje va
+// relativo al de la vuelta de referencia, así los pesos no tienen unidades
+const float OPT_WEIGHT_TIME = 1.0f;                  // Tiempo de vuelta
+const float OPT_WEIGHT_IAE = 0.5f;                   // ∫|posición| dt
+const float OPT_WEIGHT_DEVIATION = 0.25f;            // |posición| máxima
+const float OPT_INITIAL_STEP = 0.3f;                 // Paso relativo de partida: ×1.3 y ÷1.3
+const float OPT_MAX_STEP = 1.0f;
+const float OPT_MIN_STEP = 0.04f;                    // Converge con todos los pasos por debajo
+const float OPT_MIN_IMPROVEMENT = 0.02f;             // Mejora del puntaje para aceptar (ruido entre vueltas)
+const uint16_t OPT_MAX_EVALS = 60;
+const uint16_t OPT_MIN_LAP_MM = 1000;                // Dos marcas más cerca que esto son la misma
+const unsigned long OPT_LINE_LOST_MS = 300;          // Todo blanco durante más que esto corta la sesión
+const uint16_t TUNER_SCHEMA_VERSION = 1;
+
+struct MotorCurve {
+  uint8_t deadband;                     // PWM mínimo con el que la rueda arranca y sigue girando
+  uint8_t topPwm;                       // PWM del último punto
+  int16_t rpm[MOTOR_LUT_POINTS];        // |RPM| en régimen, creciente
+
+  int16_t pwmAt(uint8_t i) const { return deadband + (int16_t)(topPwm - deadband) * i / (MOTOR_LUT_POINTS - 1); }
+  // PWM (positivo) para girar a `rpm`: compensa la banda muerta e interpola la tabla
+  int16_t pwmFor(int16_t rpm) const;
+  // PWM con signo para `rpm` con signo (la curva ya es la del sentido de giro)
+  int16_t feedforward(int16_t rpm) const { return rpm < 0 ? -pwmFor(-rpm) : pwmFor(rpm); }
+};
+
+enum MotorCurveIndex : uint8_t { CURVE_LEFT_FWD, CURVE_LEFT_REV, CURVE_RIGHT_FWD, CURVE_RIGHT_REV, MOTOR_CURVE_COUNT };
+
+// Curva de la rueda indicada en el sentido de `rpm`
+inline uint8_t motorCurveIndex(bool right, int16_t rpm) {
+  return (right ? CURVE_RIGHT_FWD : CURVE_LEFT_FWD) + (rpm < 0 ? 1 : 0);
+}
+
+struct MotorModel {
+  MotorCurve curve[MOTOR_CURVE_COUNT];
+
+  bool valid() const;
+};
+
+// Lo que el optimizador en pista necesita para seguir después de apagar el robot
+struct TunerCheckpoint {
+  float gain[3];                // Mejores kp, ki, kd de línea hasta ahora
+  float step[3];                // Paso relativo de cada ganancia
+  float ref[3];                 // Vuelta de referencia: tiempo [s], IAE, desvío máximo
+  float bestScore;
+  uint16_t evals;               // Evaluaciones hechas; su paridad elige el slot
+  uint16_t windowMm;            // 0: vueltas entre marcas, si no ventanas de distancia
+  uint8_t coord;                // Ganancia en prueba
+  int8_t dir;                   // +1 prueba ×(1 + paso), -1 ÷(1 + paso), 0 vuelta de referencia
+};
+
 // =============================================================================
 // VALORES POR DEFECTO
 // =============================================================================
@@ -95,6 +230,15 @@ enum OperationMode {
   MODE_REMOTE_CONTROL    // Control remoto
 };
 
+const uint8_t FEATURES_TEXT_SIZE = 22;  // "[0,1,...]" de serialize() con el terminador
+
+// Ventanas de mediana y media móvil (`set feature 0/1 1 <ventana>`). En el Nano cada
+// muestra de ventana son 6 bytes de RAM entre las dos.
+#ifndef FILTER_WINDOW_MAX
+#define FILTER_WINDOW_MAX 7
+#endif
+const uint8_t FILTER_WINDOW_MIN = 3;
+
 // Features configuration class
 class FeaturesConfig {
 public:
@@ -107,9 +251,13 @@ public:
   bool dynamicLinePid : 1;     // 6
   bool speedProfiling : 1;     // 7
   bool turnDirection : 1;     // 8
+  // Bits libres del mismo uint16: largo de ventana guardado como diferencia con 3,
+  // así una configuración guardada antes de estos campos (bits en 0) sigue en 3
+  uint8_t medianTaps : 3;     // Mediana: 3 + 2·medianTaps muestras
+  uint8_t averageTaps : 3;    // Media móvil: 3 + averageTaps muestras
 
-  // Serialize to string [0,1,0,...]
-  const char* serialize();
+  // Serialize to string [0,1,0,...] en out (FEATURES_TEXT_SIZE bytes, lo pone quien llama)
+  void serialize(char* out) const;
 
   // Deserialize from command like "0,1,0,1,1,1,0,1,1"
   bool deserialize(const char* cmd);
@@ -117,6 +265,21 @@ public:
   void setFeature(uint8_t idx, bool value);  // Cambiado de int a uint8_t
 
   bool getFeature(uint8_t idx);  // Cambiado de int a uint8_t
+
+  uint8_t getWindow(uint8_t idx) const;          // 0 si el feature no tiene ventana
+  bool setWindow(uint8_t idx, uint8_t length);   // false si el largo no es válido
+};
+
+static_assert(sizeof(FeaturesConfig) == 2, "FeaturesConfig: es parte del layout guardado");
+
+// Banco de biquads (`set biquad`): un filtro por señal. Posición y derivada corren al
+// ritmo del lazo de línea y RPM (ambas ruedas, mismos coeficientes) al del de velocidad.
+enum BiquadSignal : uint8_t { BQ_POSITION, BQ_DERIVATIVE, BQ_RPM, BIQUAD_SIGNAL_COUNT };
+
+struct BiquadConfig {
+  uint8_t type;                         // BiquadType
+  uint16_t fcDeciHz;                    // Corte o centro en décimas de Hz
+  uint16_t qCenti;                      // Factor Q ×100 (71 = Butterworth)
 };
 
 // =============================================================================
@@ -125,8 +288,10 @@ public:
 
 const bool DEFAULT_CASCADE = false;
 const bool DEFAULT_TELEMETRY_ENABLED = false;
-const FeaturesConfig DEFAULT_FEATURES = {false, false, false, false, false, false, false, false, false};
+const FeaturesConfig DEFAULT_FEATURES = {false, false, false, false, false, false, false, false, false, 0, 0};
 const OperationMode DEFAULT_OPERATION_MODE = MODE_IDLE;
+const BiquadConfig DEFAULT_BIQUAD = {BIQUAD_OFF, 200, 71};
+const EstimatorConfig DEFAULT_ESTIMATOR = {false, 9830, 1311, 3355};  // α 0.3, β 0.02, γ 0.0002
 const int16_t DEFAULT_BASE_SPEED = 150;
 const float DEFAULT_BASE_RPM = 400.0f;
 const int16_t DEFAULT_MAX_SPEED = 250;
@@ -160,7 +325,7 @@ public:
    int16_t rcMaxThrottle;                // Throttle máximo control remoto
    int16_t rcMaxSteering;                // Steering máximo control remoto
    bool cascadeMode;                     // Modo cascada activado/desactivado
-   bool telemetry;                // Habilitar/deshabilitar telemetry (0=deshabilitado, 1=habilitado)
+   uint8_t telemetry;             // Modo de telemetry (0=deshabilitado, 1=texto, 2=binario, 3=delta)
    // Features configuration
    FeaturesConfig features;
    OperationMode operationMode;          // Cambiado de OperationMode a uint8_t
@@ -172,11 +337,97 @@ public:
    uint16_t loopSpeedMs;
    unsigned long telemetryIntervalMs;
    float robotWeight;                    // Peso del robot en gramos
-   uint32_t checksum;                    // Checksum para verificación
+   BiquadConfig biquad[BIQUAD_SIGNAL_COUNT];  // Banco de biquads por señal
+   EstimatorConfig estimator;            // Estimador de línea con odometría
+   bool speedFeedforward;                // Lazo de RPM = modelo de motores + PID
+   // Campos nuevos siempre al final: una copia más corta del mismo esquema se completa con defaults
 
    void restoreDefaults();
 };
 
+// Esquema guardado de RobotConfig. Se sube cuando un campo cambia de tipo, se mueve o se
+// quita (agregar al final no cuenta) y se agrega el paso correspondiente en migrateConfig().
+//   1: sin cabecera, terminaba en `uint32_t checksum` = CONFIG_V1_CHECKSUM
+//   2: cabecera ConfigHeader con CRC-32; sin checksum
+const uint16_t CONFIG_SCHEMA_VERSION = 2;
+const uint32_t CONFIG_MAGIC = 0x47464352;            // "RCFG" en little-endian
+const uint32_t CONFIG_V1_CHECKSUM = 1234567892;
+const uint8_t CONFIG_V1_SIZE = 118;                   // RobotConfig v1 con su checksum
+const uint8_t CONFIG_V2_SIZE = CONFIG_V1_SIZE - sizeof(uint32_t);  // Hasta robotWeight
+
+// Cabecera de cada copia guardada. La secuencia va al final para escribirse última.
+struct ConfigHeader {
+   uint32_t magic;
+   uint16_t version;                     // CONFIG_SCHEMA_VERSION de quien la escribió
+   uint16_t length;                      // sizeof(RobotConfig) de quien la escribió
+   uint32_t crc;                         // CRC-32 de los `length` bytes que siguen
+   uint16_t seq;                         // Copia más nueva entre los slots
+};
+
+// Lleva `len` bytes guardados con el esquema `version` a `out`; lo que esa versión no
+// trae queda en su valor por defecto. false si la versión no se conoce o falta contenido.
+bool migrateConfig(uint16_t version, const uint8_t* raw, uint16_t len, RobotConfig& out);
+
+// Perfil de ajuste: la parte de RobotConfig que cambia entre pistas o baterías.
+// Se guarda con ConfigHeader (versión PROFILE_SCHEMA_VERSION); campos nuevos al final.
+const uint16_t PROFILE_SCHEMA_VERSION = 1;
+
+struct TuningProfile {
+   char name[PROFILE_NAME_LEN];
+   float lineKp, lineKi, lineKd;
+   float leftKp, leftKi, leftKd;
+   float rightKp, rightKi, rightKd;
+   int16_t basePwm;
+   int16_t maxPwm;
+   float baseRPM;
+   float maxRpm;
+   bool cascadeMode;
+   FeaturesConfig features;
+
+   void capture(const RobotConfig& c);
+   void apply(RobotConfig& c) const;
+};
+
+// =============================================================================
+// PARÁMETROS ACTIVOS DEL LAZO DE CONTROL
+// =============================================================================
+
+// Copia de trabajo que usa Robot::run(). Los comandos editan `config` y llaman a
+// publishConfig(); el lazo adopta la nueva versión al inicio del siguiente tick
+// y recalcula aquí, una sola vez, los valores derivados.
+class ControlParams {
+public:
+   int16_t basePwm;
+   int16_t maxPwm;
+   real_t baseRPM;
+   real_t maxRpm;
+   bool cascadeMode;
+   OperationMode operationMode;
+   FeaturesConfig features;
+   uint16_t loopLineMs;
+   uint16_t loopSpeedMs;
+   unsigned long telemetryIntervalMs;
+   // Derivados
+   real_t dtLine;                        // loopLineMs en segundos
+   real_t dtSpeed;                       // loopSpeedMs en segundos
+   real_t invDtLine;                     // Ticks del lazo de línea por segundo
+   real_t curvatureHigh, curvatureLow;   // Umbrales de speedProfiling por tick (500 y 100 por segundo)
+   float rpmToCms;                       // RPM -> cm/s según diámetro de rueda
+   BiquadCoeffs biquad[BIQUAD_SIGNAL_COUNT];  // Recalculados con cada cambio de loopLineMs/loopSpeedMs
+   EstimatorConfig estimator;
+   bool speedFeedforward;
+   int32_t mmPerPulseQ16;                // Avance de rueda por pulso de encoder [mm, Q16]
+   int32_t invWheelDistanceQ16;          // 1 / wheelDistance [1/mm, Q16]
+
+   void build(const RobotConfig& c);
+};
+
+// Época de la configuración publicada; cambia con cada publishConfig()
+extern volatile uint8_t configEpoch;
+
+// Publica los cambios hechos en `config` para que el lazo los adopte
+void publishConfig();
+
 // =============================================================================
 // ENUMERACIONES
 // =============================================================================
@@ -0,0 +1,287 @@
+/**
+ * ARCHIVO: filters.h
+ * DESCRIPCIÓN: Cadena de filtros de la posición de línea armada al compilar
+ * CONTIENE: Etapas en aritmética entera y el compositor Pipeline<...>
+ *
+ * Features::applySignalFilters() decide en cada muestra qué filtros aplicar según
+ * los bits de `set feature`, sirve para ajustar en pista. Una vez elegida la cadena,
+ * compilar con -DFIXED_FILTERS usa LineFilterChain: cada etapa es un tipo, el
+ * compilador encadena los process() en línea y las etapas que no están en la lista
+ * no generan código ni ocupan RAM. Todo trabaja sobre la posición en int16_t
+ * (±4000), sin escalas intermedias ni float.
+ *
+ * `bench` compara las dos variantes sobre la misma señal.
+ *
+ * SlidingMedian y SlidingAverage son las mismas ventanas con largo elegido en
+ * ejecución (`set feature 0/1 1 <ventana>`); las usa Features.
+ *
+ * Biquad: IIR de segundo orden en punto fijo para el banco de `set biquad`.
+ */
+
+#ifndef FILTERS_H
+#define FILTERS_H
+
+#include <stdint.h>
+
+// Reemplaza `old` por `x` en la ventana ordenada sorted[0..n): busca `old` y desplaza
+// hacia el lado donde va `x`. Un solo recorrido, sin ordenar de nuevo.
+inline void medianReplace(int16_t* sorted, uint8_t n, int16_t old, int16_t x) {
+  uint8_t i = 0;
+  while (sorted[i] != old) i++;
+  while (i > 0 && sorted[i - 1] > x) { sorted[i] = sorted[i - 1]; i--; }
+  while (i < n - 1 && sorted[i + 1] < x) { sorted[i] = sorted[i + 1]; i++; }
+  sorted[i] = x;
+}
+
+// Mediana deslizante de N muestras (N impar). Mantiene la ventana ordenada: sale la
+// muestra más vieja y entra la nueva, O(N) por muestra y una salida por muestra.
+template <uint8_t N>
+class Median {
+  static_assert(N % 2 == 1 && N <= 15, "Median: N impar y chico");
+  int16_t ring[N];
+  int16_t sorted[N];
+  uint8_t head;
+  bool primed;
+
+public:
+  Median() : head(0), primed(false) {}
+  void reset() { primed = false; }
+
+  int16_t process(int16_t x) {
+    if (!primed) {
+      // La ventana arranca llena con la primera muestra: sin transitorio hacia 0
+      for (uint8_t i = 0; i < N; i++) ring[i] = sorted[i] = x;
+      primed = true;
+      return x;
+    }
+    int16_t old = ring[head];
+    ring[head] = x;
+    if (++head == N) head = 0;
+    medianReplace(sorted, N, old, x);
+    return sorted[N / 2];
+  }
+};
+
+// Mediana con largo de ventana en ejecución (impar, hasta MAX). Cambiar el largo
+// vuelve a llenar la ventana con la próxima muestra.
+template <uint8_t MAX>
+class SlidingMedian {
+  int16_t ring[MAX];
+  int16_t sorted[MAX];
+  uint8_t len;
+  uint8_t head;
+  bool primed;
+
+public:
+  SlidingMedian() : len(MAX | 1), head(0), primed(false) {}
+  void reset() { primed = false; }
+  void setLength(uint8_t n) {
+    if (n > MAX) n = MAX;
+    if (n != len) { len = n; primed = false; }
+  }
+
+  int16_t process(int16_t x) {
+    if (!primed) {
+      for (uint8_t i = 0; i < len; i++) ring[i] = sorted[i] = x;
+      head = 0;
+      primed = true;
+      return x;
+    }
+    int16_t old = ring[head];
+    ring[head] = x;
+    if (++head == len) head = 0;
+    medianReplace(sorted, len, old, x);
+    return sorted[len / 2];
+  }
+};
+
+// Media móvil de N muestras con suma corrida. Con N potencia de 2 la división es un shift.
+template <uint8_t N>
+class MovingAvg {
+  int16_t ring[N];
+  int32_t sum;
+  uint8_t head;
+  bool primed;
+
+public:
+  MovingAvg() : sum(0), head(0), primed(false) {}
+  void reset() { primed = false; }
+
+  int16_t process(int16_t x) {
+    if (!primed) {
+      for (uint8_t i = 0; i < N; i++) ring[i] = x;
+      sum = (int32_t)x * N;
+      primed = true;
+    }
+    sum += x - ring[head];
+    ring[head] = x;
+    if (++head == N) head = 0;
+    return sum / N;
+  }
+};
+
+// Media móvil con largo de ventana en ejecución (hasta MAX). En lugar de dividir por
+// el largo multiplica por su recíproco en Q16 (en el AVR dividir 32 bits cuesta ~40 µs).
+// El recíproco se redondea hacia abajo: así |sum·recip| < 2^31 para cualquier largo y
+// rango de int16 (redondeado al más cercano, 32767·6·10923 ya desborda). El costo es un
+// sesgo hacia cero de menos de |media|·len/65536 (< 0.5 con posiciones de ±4000) más
+// el redondeo final.
+template <uint8_t MAX>
+class SlidingAverage {
+  int16_t ring[MAX];
+  int32_t sum;
+  uint16_t recip;                 // 65536 / len, truncado
+  uint8_t len;
+  uint8_t head;
+  bool primed;
+
+public:
+  SlidingAverage() : sum(0), recip(0), len(0), head(0), primed(false) { setLength(MAX); }
+  void reset() { primed = false; }
+  void setLength(uint8_t n) {
+    if (n > MAX) n = MAX;
+    if (n < 2) n = 2;
+    if (n != len) { len = n; recip = 65536UL / n; primed = false; }
+  }
+
+  int16_t process(int16_t x) {
+    if (!primed) {
+      for (uint8_t i = 0; i < len; i++) ring[i] = x;
+      sum = (int32_t)x * len;
+      head = 0;
+      primed = true;
+    }
+    sum += (int32_t)x - ring[head];  // En el AVR int es de 16 bits
+    ring[head] = x;
+    if (++head == len) head = 0;
+    // int32_t y no long: en la PC long es de 64 bits y los tests no verían el desborde
+    return (int16_t)((sum * recip + (int32_t)32768) >> 16);
+  }
+};
+
+// Pasabajos de primer orden y += α·(x - y), α en Q15 (6554 ≈ 0.2). El resto de la
+// multiplicación se arrastra a la próxima muestra, así no hay sesgo por truncado.
+template <uint16_t ALPHA_Q15>
+class LowPass {
+  static_assert(ALPHA_Q15 > 0 && ALPHA_Q15 <= 32768, "LowPass: 0 < α <= 1");
+  int16_t y;
+  int32_t rem;
+  bool primed;
+
+public:
+  LowPass() : y(0), rem(0), primed(false) {}
+  void reset() { primed = false; }
+
+  int16_t process(int16_t x) {
+    if (!primed) { y = x; rem = 0; primed = true; return x; }
+    int32_t t = (int32_t)(x - y) * ALPHA_Q15 + rem;
+    y += (int16_t)(t >> 15);
+    rem = t & 0x7FFF;
+    return y;
+  }
+};
+
+// Mantiene la salida mientras la entrada no se aleje más de TH
+template <int16_t TH>
+class Hysteresis {
+  int16_t last;
+
+public:
+  Hysteresis() : last(0) {}
+  void reset() { last = 0; }
+
+  int16_t process(int16_t x) {
+    if (x - last > TH || last - x > TH) last = x;
+    return last;
+  }
+};
+
+// Posiciones a menos de TH del centro se toman como centradas
+template <int16_t TH>
+class DeadZone {
+public:
+  void reset() {}
+  int16_t process(int16_t x) { return (x < TH && x > -TH) ? 0 : x; }
+};
+
+// Coeficientes de un biquad normalizados a a0 = 1, en Q14 (|a1| y |b1| llegan a 2):
+//   y[n] = b0·x[n] + b1·x[n-1] + b2·x[n-2] - a1·y[n-1] - a2·y[n-2]
+// dcGain es la ganancia en continua (Q14) con la que se inicializa la historia.
+struct BiquadCoeffs {
+  int16_t b0, b1, b2, a1, a2;
+  int16_t dcGain;
+  bool active;                    // false: el filtro deja pasar la señal sin tocarla
+};
+
+const uint8_t BIQUAD_SHIFT = 14;
+
+enum BiquadType : uint8_t { BIQUAD_OFF, BIQUAD_LOWPASS, BIQUAD_HIGHPASS, BIQUAD_NOTCH, BIQUAD_TYPE_COUNT };
+
+// Diseño RBJ (Audio EQ Cookbook) para corte/centro fc y factor Q a la frecuencia de
+// muestreo fs. Usa float y trigonometría: se llama al cambiar la configuración, no por
+// muestra. false (y active = false) si fc no queda por debajo de 0.45·fs o si algún
+// coeficiente no entra en Q14.
+bool designBiquad(BiquadType type, float fc, float q, float fs, BiquadCoeffs& c);
+
+// Estado de un biquad en forma directa I: la historia es de entradas y salidas, así
+// que cambiar los coeficientes en marcha no produce saltos de estado. Los bits que se
+// pierden al volver de Q14 se suman en la muestra siguiente (error feedback), lo que
+// evita ciclos límite y el error de continua con polos cerca de 1.
+class Biquad {
+  int16_t x1, x2, y1, y2;
+  int16_t rem;
+  bool primed;
+
+public:
+  Biquad() : x1(0), x2(0), y1(0), y2(0), rem(0), primed(false) {}
+  void reset() { primed = false; }
+
+  int16_t process(const BiquadCoeffs& c, int16_t x) {
+    if (!c.active) { primed = false; return x; }
+    if (!primed) {
+      // Arranque en régimen: sin escalón desde 0 al activar el filtro
+      x1 = x2 = x;
+      y1 = y2 = (int16_t)(((int32_t)x * c.dcGain) >> BIQUAD_SHIFT);
+      rem = 0;
+      primed = true;
+    }
+    int32_t acc = (int32_t)c.b0 * x + (int32_t)c.b1 * x1 + (int32_t)c.b2 * x2
+                - (int32_t)c.a1 * y1 - (int32_t)c.a2 * y2 + rem;
+    int32_t y = acc >> BIQUAD_SHIFT;
+    rem = acc & ((1 << BIQUAD_SHIFT) - 1);
+    if (y > 32767) y = 32767;
+    else if (y < -32768) y = -32768;
+    x2 = x1; x1 = x;
+    y2 = y1; y1 = (int16_t)y;
+    return (int16_t)y;
+  }
+};
+
+// Pipeline<A, B, C>::process(x) == C(B(A(x))). Hereda del resto de la cadena para
+// que Pipeline<> (vacía) no ocupe bytes.
+template <typename... Stages>
+class Pipeline;
+
+template <>
+class Pipeline<> {
+public:
+  void reset() {}
+  int16_t process(int16_t x) { return x; }
+};
+
+template <typename First, typename... Rest>
+class Pipeline<First, Rest...> : private Pipeline<Rest...> {
+  First stage;
+
+public:
+  void reset() { stage.reset(); Pipeline<Rest...>::reset(); }
+  inline int16_t process(int16_t x) __attribute__((always_inline)) {
+    return Pipeline<Rest...>::process(stage.process(x));
+  }
+};
+
+// Cadena fija del build con -DFIXED_FILTERS (también la que mide `bench`).
+// Mismas etapas que `set features 1,1,0,0,0,1,0,0,0`, con media de 4 y α = 0.2.
+typedef Pipeline<Median<3>, MovingAvg<4>, LowPass<6554>> LineFilterChain;
+
+#endif
@@ -0,0 +1,107 @@
+/**
+ * ARCHIVO: fixedpoint.h
+ * DESCRIPCIÓN: Número Q16.16 con signo para los lazos de control sin FPU
+ * CONTIENE: Clase Q16 y toFloat() para escribir plantillas que sirvan con float y Q16
+ *
+ * El ATmega328 no tiene FPU: cada suma o multiplicación de float es una rutina de
+ * ~100-150 ciclos. Q16 guarda el valor ×65536 en un int32_t: suma, resta y
+ * comparación son las de enteros, y la multiplicación arma el producto con cuatro
+ * multiplicaciones de 16×16 (las que el AVR hace con MUL) en lugar de la de 64 bits
+ * de libgcc. Rango ±32768 con resolución 1.5e-5; sumas y productos que se salen del
+ * rango se saturan en lugar de dar la vuelta.
+ *
+ * No hay división: los coeficientes se calculan en float al cambiar la configuración
+ * y se convierten una vez.
+ *
+ * real_t es Q16 en el AVR y float en el ESP32 o en una PC, así el lazo de control
+ * (PID, curvatura, RPM) se escribe una sola vez. Los valores del lazo entran en el
+ * rango: posición ±4000, RPM ±3000, PWM ±255; lo que se pasa (una derivada de la
+ * posición por segundo, por ejemplo) satura y se maneja por tick en lugar de por segundo.
+ */
+
+#ifndef FIXEDPOINT_H
+#define FIXEDPOINT_H
+
+#include <stdint.h>
+#include <math.h>
+
+class Q16 {
+  int32_t raw;
+
+  static int32_t saturate(int64_t v) {
+    if (v > INT32_MAX) return INT32_MAX;
+    if (v < INT32_MIN) return INT32_MIN;
+    return (int32_t)v;
+  }
+
+public:
+  static const int32_t ONE = 65536L;
+
+  Q16() : raw(0) {}
+  Q16(int v) : raw((int32_t)v << 16) {}
+  Q16(float v) : raw(v >= 32767.99f ? INT32_MAX : v <= -32768.0f ? INT32_MIN : lroundf(v * 65536.0f)) {}
+
+  static Q16 fromRaw(int32_t r) { Q16 q; q.raw = r; return q; }
+  int32_t getRaw() const { return raw; }
+  float toFloat() const { return raw * (1.0f / 65536.0f); }
+  int16_t toInt() const { return (int16_t)((raw + 0x8000L) >> 16); }
+  // Redondeo al entero más cercano saturado a int16: el bit de 0.5 se suma después del
+  // shift, así el valor máximo no se desborda
+  int16_t toIntSat() const {
+    int32_t r = (raw >> 16) + ((raw >> 15) & 1);
+    return r > INT16_MAX ? INT16_MAX : (int16_t)r;
+  }
+
+  // Suma y resta en 32 bits: el desborde lo detecta el flag V (sin pasar a int64) y
+  // satura hacia el signo del primer operando
+  Q16 operator-() const { return fromRaw(raw == INT32_MIN ? INT32_MAX : -raw); }
+  Q16 operator+(Q16 o) const {
+    int32_t r;
+    if (__builtin_add_overflow(raw, o.raw, &r)) r = raw < 0 ? INT32_MIN : INT32_MAX;
+    return fromRaw(r);
+  }
+  Q16 operator-(Q16 o) const {
+    int32_t r;
+    if (__builtin_sub_overflow(raw, o.raw, &r)) r = raw < 0 ? INT32_MIN : INT32_MAX;
+    return fromRaw(r);
+  }
+  Q16& operator+=(Q16 o) { return *this = *this + o; }
+  Q16& operator-=(Q16 o) { return *this = *this - o; }
+
+  // (ah·2^16 + al)·(bh·2^16 + bl) / 2^16, con al y bl sin signo
+  Q16 operator*(Q16 o) const {
+    int16_t ah = raw >> 16, bh = o.raw >> 16;
+    uint16_t al = raw & 0xFFFF, bl = o.raw & 0xFFFF;
+    int64_t r = ((int64_t)((int32_t)ah * bh) << 16)
+              + (int32_t)ah * bl + (int32_t)bh * al
+              + (((uint32_t)al * bl) >> 16);
+    return fromRaw(saturate(r));
+  }
+  Q16& operator*=(Q16 o) { return *this = *this * o; }
+
+  bool operator==(Q16 o) const { return raw == o.raw; }
+  bool operator!=(Q16 o) const { return raw != o.raw; }
+  bool operator<(Q16 o) const { return raw < o.raw; }
+  bool operator>(Q16 o) const { return raw > o.raw; }
+  bool operator<=(Q16 o) const { return raw <= o.raw; }
+  bool operator>=(Q16 o) const { return raw >= o.raw; }
+};
+
+inline float toFloat(float v) { return v; }
+inline float toFloat(Q16 v) { return v.toFloat(); }
+inline int16_t toInt(float v) { return (int16_t)lroundf(v); }
+inline int16_t toInt(Q16 v) { return v.toInt(); }
+inline int16_t toIntSat(float v) { return v >= 32767.0f ? INT16_MAX : v <= -32768.0f ? INT16_MIN : (int16_t)lroundf(v); }
+inline int16_t toIntSat(Q16 v) { return v.toIntSat(); }
+
+// Tipo de los lazos de control: Q16 donde no hay FPU, float en el resto. El mismo
+// código compila con los dos; las constantes se escriben como float o int.
+#ifdef __AVR__
+typedef Q16 real_t;
+inline real_t realFromRaw(int32_t q16) { return Q16::fromRaw(q16); }
+#else
+typedef float real_t;
+inline real_t realFromRaw(int32_t q16) { return q16 * (1.0f / 65536.0f); }
+#endif
+
+#endif
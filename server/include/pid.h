@@ -0,0 +1,175 @@
+/**
+ * ARCHIVO: pid.h
+ * DESCRIPCIÓN: PID de los tres lazos (línea, motor izquierdo, motor derecho)
+ * CONTIENE: Plantilla PIDController<T> para float y Q16 (fixedpoint.h)
+ *
+ *   u = kp·(b·r - y) + ki·∫e dt + kd·d/dt(c·r - y),   e = r - y
+ *
+ * - Pesos del setpoint b y c: con c = 0 (por defecto) la derivada es solo de la
+ *   medición, así un cambio de setpoint (`set rpm`, `rc`) no produce una patada en D.
+ * - La derivada pasa por un pasabajos de primer orden con Tf = Td / N.
+ * - Anti-windup por back-calculation: cuando la salida se satura (o la limita la
+ *   pendiente máxima) el integrador se corrige con (u - v) / Tt, en lugar de un tope
+ *   fijo. Tt por defecto es sqrt(Ti·Td), o Ti sin término D.
+ * - Límite opcional de pendiente de la salida (unidades por segundo).
+ * - setGainsBumpless() y track() reacomodan el integrador para que la salida siga
+ *   donde estaba al cambiar ganancias o al pasar de mando manual a automático.
+ * - Feedforward opcional (setFeedforward) sumado antes de la saturación: el lazo de RPM
+ *   le pasa el PWM del modelo de motores y el PID solo corrige el resto.
+ *
+ * Los coeficientes por muestra se recalculan en float solo cuando cambian dt o una
+ * opción; calculate() hace únicamente sumas y productos de T. Misma plantilla que
+ * esp32/include/pid.h, más el biquad opcional sobre la derivada (`set biquad deriv`),
+ * que se pasa en cada llamada para no guardar dos punteros por instancia.
+ */
+
+#ifndef PID_H
+#define PID_H
+
+#include <stdint.h>
+#include <math.h>
+#include "fixedpoint.h"
+#include "filters.h"
+
+template <typename T>
+class PIDController {
+private:
+  T kp, ki, kd;
+  T b, c;                   // Pesos del setpoint en P y en D
+  uint8_t n;                // Filtro de la derivada: Tf = Td / N (0 = sin filtro)
+  T rateLimit;              // Pendiente máxima de la salida [unidades/s], 0 = sin límite
+  float trackTime;          // Tt del anti-windup [s], 0 = automático
+  T maxOutput, minOutput;
+  // Coeficientes para el dt de la última llamada
+  T dt;
+  T dKeep, dGain;           // dTerm = dKeep·dTerm + dGain·Δ(c·r - y)
+  T trackGain;              // dt / (ki·Tt)
+  bool coeffsValid;
+  // Estado
+  T error, integral, dTerm, output;
+  T feedforward;            // Se suma a la salida antes de saturar
+  T lastDInput, lastPInput;  // c·r - y y b·r - y de la última llamada
+  bool primed;
+
+  void updateCoefficients(T sampleTime) {
+    dt = sampleTime;
+    float h = toFloat(sampleTime);
+    float p = toFloat(kp), i = toFloat(ki), d = toFloat(kd);
+    float tf = (p > 0 && n > 0) ? d / (p * n) : 0;
+    dKeep = T(tf / (tf + h));
+    dGain = T(d / (tf + h));
+    float tt = trackTime;
+    if (tt <= 0 && p > 0 && i > 0) tt = d > 0 ? sqrtf(d / i) : p / i;   // sqrt(Ti·Td) o Ti
+    if (tt <= 0) tt = h;
+    trackGain = T(i > 0 ? h / (i * tt) : 0.0f);
+    coeffsValid = true;
+  }
+
+  T finish(T setpoint, T measurement) {
+    primed = true;
+    error = setpoint - measurement;
+    lastPInput = b * setpoint - measurement;
+    T v = feedforward + kp * lastPInput + ki * integral + dTerm;
+    T u = v;
+    if (u > maxOutput) u = maxOutput;
+    if (u < minOutput) u = minOutput;
+    if (rateLimit > T(0)) {
+      T maxStep = rateLimit * dt;   // Un producto solo con el límite activo
+      if (u > output + maxStep) u = output + maxStep;
+      if (u < output - maxStep) u = output - maxStep;
+    }
+    if (ki != T(0)) integral += dt * error + trackGain * (u - v);
+    output = u;
+    return u;
+  }
+
+public:
+  PIDController(float p, float i, float d, float maxOut, float minOut)
+    : kp(p), ki(i), kd(d), b(1.0f), c(0.0f), n(10), rateLimit(0), trackTime(0),
+      maxOutput(maxOut), minOutput(minOut), dt(0), dKeep(0), dGain(0), trackGain(0),
+      coeffsValid(false), error(0), integral(0), dTerm(0), output(0), feedforward(0),
+      lastDInput(0), lastPInput(0), primed(false) {}
+
+  void setGains(float p, float i, float d) {
+    kp = T(p); ki = T(i); kd = T(d);
+    coeffsValid = false;
+  }
+
+  // Cambia ganancias sin salto en la salida: el integrador absorbe la diferencia
+  void setGainsBumpless(float p, float i, float d) {
+    if (T(p) == kp && T(i) == ki && T(d) == kd) return;
+    float oldKd = toFloat(kd);
+    setGains(p, i, d);
+    // El término D guardado es kd·derivada: se escala a la nueva kd
+    dTerm = oldKd != 0 ? T(toFloat(dTerm) * d / oldKd) : T(0);
+    if (primed && i != 0) {
+      float pTerm = p * toFloat(lastPInput);
+      integral = T((toFloat(output) - toFloat(feedforward) - pTerm - toFloat(dTerm)) / i);
+    }
+  }
+
+  void setOutputLimits(float minOut, float maxOut) { minOutput = T(minOut); maxOutput = T(maxOut); }
+  void setSetpointWeights(float pWeight, float dWeight) { b = T(pWeight); c = T(dWeight); }
+  void setDerivativeFilterN(uint8_t filterN) { n = filterN; coeffsValid = false; }
+  void setRateLimit(float unitsPerSecond) { rateLimit = T(unitsPerSecond); }
+  void setTrackingTime(float seconds) { trackTime = seconds; coeffsValid = false; }
+  // Término de adelanto del próximo calculate() (modelo de la planta); el anti-windup
+  // trabaja sobre la suma, así que el integrador solo junta lo que el modelo no explica
+  void setFeedforward(T ff) { feedforward = ff; }
+
+  // `filter`/`coeffs`: biquad opcional sobre Δ(c·r - y); estado y coeficientes son del dueño
+  T calculate(T setpoint, T measurement, T sampleTime, Biquad* filter = 0, const BiquadCoeffs* coeffs = 0) {
+    if (!coeffsValid || sampleTime != dt) updateCoefficients(sampleTime);
+    T dInput = c * setpoint - measurement;
+    T delta = primed ? dInput - lastDInput : T(0);
+    lastDInput = dInput;
+    if (filter && coeffs->active) {
+      // En Q16 es un shift: sin pasar por float en el tick
+      delta = T((int)filter->process(*coeffs, toIntSat(delta)));
+    }
+    dTerm = dKeep * dTerm + dGain * delta;
+    return finish(setpoint, measurement);
+  }
+
+  // Con la derivada de la medición ya estimada (LineEstimator): no diferencia ni filtra
+  T calculate(T setpoint, T measurement, T sampleTime, T measurementRate) {
+    if (!coeffsValid || sampleTime != dt) updateCoefficients(sampleTime);
+    lastDInput = c * setpoint - measurement;
+    dTerm = -(kd * measurementRate);
+    return finish(setpoint, measurement);
+  }
+
+  // Transferencia sin salto desde mando manual: la próxima salida parte de `u`
+  void track(float u) {
+    output = T(u);
+    dTerm = T(0);
+    if (primed && ki != T(0)) {
+      float pTerm = toFloat(kp) * toFloat(lastPInput);
+      integral = T((u - toFloat(feedforward) - pTerm) / toFloat(ki));
+    }
+  }
+
+  void reset() {
+    error = T(0);
+    integral = T(0);
+    dTerm = T(0);
+    output = T(0);
+    primed = false;
+  }
+
+  float getOutput() const { return toFloat(output); }
+  float getError() const { return toFloat(error); }
+  float getIntegral() const { return toFloat(integral); }
+  float getDerivative() const {
+    float d = toFloat(kd);
+    return d != 0 ? toFloat(dTerm) / d : 0;
+  }
+  float getProportional() const {
+    return toFloat(kp) * toFloat(lastPInput);
+  }
+};
+
+// Q16 en el Nano: el lazo no llama a rutinas de float (ver fixedpoint.h)
+typedef PIDController<real_t> PID;
+
+#endif
@@ -0,0 +1,200 @@
+/**
+ * ARCHIVO: protocol.h
+ * DESCRIPCIÓN: Telemetría binaria (COBS + CRC-16) paralela al formato de texto
+ * CONTIENE: Formato de trama, campos en punto fijo y funciones de codificación
+ *
+ * Trama en el cable:
+ *   0x00 | COBS( tipo:u8 | seq:u16 | payload | crc16:u16 ) | 0x00
+ * Todo en little-endian. CRC-16/CCITT-FALSE (poly 0x1021, init 0xFFFF) sobre
+ * tipo+seq+payload. El 0x00 inicial permite resincronizar tras líneas de texto
+ * (type:1/2/3), que nunca contienen 0x00 y conviven en el mismo puerto.
+ * Decodificador de referencia: tools/telemetry_decoder.py
+ */
+
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <Arduino.h>
+#include <stddef.h>
+#include <avr/pgmspace.h>
+
+// Modos de `set telemetry`
+const uint8_t TELEMETRY_OFF = 0;
+const uint8_t TELEMETRY_TEXT = 1;     // type:4|... (compatibilidad)
+const uint8_t TELEMETRY_BINARY = 2;   // Tramas COBS
+const uint8_t TELEMETRY_DELTA = 3;    // Tramas COBS: claves + deltas varint (enlaces lentos)
+
+// Tipos de trama binaria
+const uint8_t FRAME_TELEMETRY = 0x01;
+const uint8_t FRAME_RECORDER_HEADER = 0x02;   // RecorderHeader
+const uint8_t FRAME_RECORDER_SAMPLES = 0x03;  // índice:u16 | RecorderSample[...]
+// 0x04/0x05 los usa el registro de vueltas del ESP32
+const uint8_t FRAME_TELEMETRY_DELTA = 0x06;   // máscara:u8 | bits de cambio | varints zigzag (ver packTelemetryDelta)
+
+// TelemetryData en punto fijo. Escalas (valor_real = campo / escala):
+//   line*         x1      (posición/error de línea, ±4000)
+//   linePidOut    x10
+//   *Rpm, *Error  x8      (±4095 RPM)
+//   *Integral     x1
+//   *Deriv        x1
+//   *PidOut       x10     (PWM)
+//   *SpeedCms     x100
+//   curvature     x1
+//   battery       mV
+// Los campos se agrupan de forma contigua para poder suscribirse a cada grupo
+// (ver TELEMETRY_GROUPS); el orden de los grupos es el de TelemetryGroupId.
+struct __attribute__((packed)) TelemetryWire {
+  // TG_SYS
+  uint32_t uptime;          // ms
+  uint16_t loopTime;        // us, saturado
+  uint16_t battery;
+  int16_t curvature;
+  uint8_t sensorState;
+  uint16_t txDropped;       // Tramas descartadas por buffer de salida lleno
+  uint8_t profile;          // Perfil de ajuste activo (0xFF = ninguno)
+  // TG_LINE
+  int16_t linePos, lineError, lineIntegral, lineDeriv, linePidOut;
+  // TG_LEFT
+  int16_t lRpm, lTargetRpm, lError, lIntegral, lDeriv, lPidOut, lSpeed;
+  int32_t encL, encLBackward;
+  // TG_RIGHT
+  int16_t rRpm, rTargetRpm, rError, rIntegral, rDeriv, rPidOut, rSpeed;
+  int32_t encR, encRBackward;
+  // TG_SPEED
+  int16_t leftSpeedCms, rightSpeedCms;
+  // TG_QTR
+  uint16_t sensors[8];
+  // TG_RC
+  uint8_t rcSeq;            // seq de la última trama RC binaria aplicada al PWM
+  uint16_t rcLatencyUs;     // Recepción -> PWM de esa trama, saturado
+  uint16_t rcErrors;        // Tramas RC descartadas por CRC
+};
+
+static_assert(sizeof(TelemetryWire) == 93, "TelemetryWire: el layout es parte del protocolo");
+
+// Grupos de campos para suscripciones (`subscribe <grupo> <divisor>`)
+enum TelemetryGroupId : uint8_t { TG_SYS, TG_LINE, TG_LEFT, TG_RIGHT, TG_SPEED, TG_QTR, TG_RC, TELEMETRY_GROUP_COUNT };
+const uint8_t TELEMETRY_ALL_GROUPS = (1 << TELEMETRY_GROUP_COUNT) - 1;
+
+// Posición de cada grupo dentro de TelemetryWire, precalculada en flash
+struct TelemetryGroup {
+  uint8_t offset;
+  uint8_t size;
+};
+extern const TelemetryGroup TELEMETRY_GROUPS[TELEMETRY_GROUP_COUNT] PROGMEM;
+extern const char TELEMETRY_GROUP_NAMES[TELEMETRY_GROUP_COUNT][6] PROGMEM;
+
+// Payload de FRAME_TELEMETRY: máscara:u8 seguida de los grupos marcados, en orden
+const uint8_t TELEMETRY_PAYLOAD_MAX = 1 + sizeof(TelemetryWire);
+
+// Copia los grupos de `mask` a `out` (máscara incluida); devuelve el tamaño
+size_t packTelemetryGroups(const TelemetryWire& w, uint8_t mask, uint8_t* out);
+
+// Modo delta: una FRAME_TELEMETRY completa (clave) y luego FRAME_TELEMETRY_DELTA
+// con la diferencia de cada campo de los grupos de la máscara respecto al último
+// valor enviado de ese grupo. Tras la máscara va un mapa de bits (LSB primero, un
+// bit por campo de los grupos marcados) y solo los campos con bit en 1 llevan su
+// delta. La resta es modular al ancho del campo, así que la reconstrucción es
+// exacta. Cada TELEMETRY_KEYFRAME_INTERVAL tramas se manda una clave con todos los
+// grupos con referencia, para recuperarse de tramas perdidas (hueco en seq).
+const uint8_t TELEMETRY_FIELD_COUNT = 43;
+const uint8_t TELEMETRY_KEYFRAME_INTERVAL = 32;
+extern const uint8_t TELEMETRY_FIELD_SIZES[TELEMETRY_FIELD_COUNT] PROGMEM;
+
+// Copia los grupos de `mask` de `w` a `ref` (referencia tras una clave)
+void copyTelemetryGroups(const TelemetryWire& w, TelemetryWire& ref, uint8_t mask);
+
+// Codifica el delta de los grupos de `mask` contra `ref` y copia esos grupos a
+// `ref`. Devuelve el tamaño, o 0 (sin tocar `ref`) si no cabe en `cap`: en ese
+// caso conviene mandar una clave, que nunca es más grande.
+size_t packTelemetryDelta(const TelemetryWire& w, TelemetryWire& ref, uint8_t mask, uint8_t* out, size_t cap);
+
+// Enteros de longitud variable (7 bits por byte, LSB primero) con zigzag para signo
+inline uint32_t zigzagEncode(int32_t v) { return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31); }
+size_t putVarint(uint8_t* out, uint32_t v);
+
+// Índice del grupo por nombre (sys, line, left, right, speed, qtr, rc); -1 si no existe
+int8_t findTelemetryGroup(const char* name);
+
+// Trama de control remoto (host -> robot), alternativa binaria a `rc t,s`:
+//   0xA5 | seq:u8 | throttle:i16 | steering:i16 | crc16:u16
+// throttle/steering en RPM, little-endian. CRC-16/CCITT-FALSE sobre seq..steering.
+// Sin COBS ni ack. 0xA5 puede venir dentro de un texto UTF-8 ("å" = C3 A5), pero
+// siempre como byte de continuación, nunca al principio de una línea: SerialReader
+// solo lo toma como sync con la línea vacía y descarta la trama si el CRC no da.
+// El eco es rcSeq en la telemetría (grupo rc).
+const uint8_t RC_FRAME_SYNC = 0xA5;
+
+struct __attribute__((packed)) RcFrame {
+  uint8_t sync;
+  uint8_t seq;
+  int16_t throttle;
+  int16_t steering;
+  uint16_t crc;
+};
+
+static_assert(sizeof(RcFrame) == 8, "RcFrame: el layout es parte del protocolo");
+
+// Muestra por tick del grabador de vuelo (`dump log`). Escalas de la línea como
+// TelemetryWire; las RPM van en un byte (±4000 RPM / 32) para que entren más muestras
+// en la SRAM. El tick no viaja: la muestra i está a i * periodUs de la primera. El
+// ESP32 usa la versión de 20 bytes con tick y RPM x8; el decodificador distingue por
+// RecorderHeader::sampleSize.
+struct __attribute__((packed)) RecorderSample {
+  int16_t linePos;          // x1
+  int16_t lineIntegral;     // x1
+  int16_t lineDeriv;        // x1
+  int16_t linePidOut;       // x10
+  int8_t lTargetRpm, rTargetRpm;  // RPM / 32
+  int8_t lRpm, rRpm;        // RPM / 32
+  int8_t lPwm, rPwm;        // PWM / 2
+};
+
+static_assert(sizeof(RecorderSample) == 14, "RecorderSample: el layout es parte del protocolo");
+
+// Causas de disparo (también sirven como máscara en `log arm`)
+const uint8_t REC_TRIG_COMMAND = 0x01;
+const uint8_t REC_TRIG_LINE_LOST = 0x02;
+const uint8_t REC_TRIG_STATE = 0x04;      // Cambio de estado de sensores
+const uint8_t REC_TRIG_DEVIATION = 0x08;  // |posición| supera el umbral
+
+struct __attribute__((packed)) RecorderHeader {
+  uint8_t reason;           // REC_TRIG_* que disparó, 0 si se volcó sin disparo
+  uint16_t samples;         // Muestras que siguen
+  uint16_t triggerIndex;    // Posición de la muestra del disparo
+  uint16_t periodUs;        // Periodo entre muestras
+  uint16_t posScale;        // Escala de linePos (valor_real = linePos / posScale)
+  uint8_t sampleSize;       // sizeof(RecorderSample)
+};
+
+const uint8_t RECORDER_SAMPLES_PER_FRAME = 4;
+
+// tipo + seq + payload máximo + crc
+const uint8_t FRAME_HEADER_SIZE = 3;
+const uint8_t FRAME_MAX_RAW = FRAME_HEADER_SIZE + TELEMETRY_PAYLOAD_MAX + 2;
+static_assert(2 + RECORDER_SAMPLES_PER_FRAME * sizeof(RecorderSample) <= TELEMETRY_PAYLOAD_MAX, "Bloque de muestras demasiado grande");
+// COBS agrega 1 byte cada 254 como máximo, más los dos delimitadores
+const uint8_t FRAME_MAX_WIRE = FRAME_MAX_RAW + FRAME_MAX_RAW / 254 + 1 + 2;
+
+uint16_t crc16Ccitt(const uint8_t* data, size_t len);
+// Un byte más del mismo CRC, para quien arma la trama sobre la marcha (empezar con 0xFFFF)
+uint16_t crc16CcittStep(uint16_t crc, uint8_t b);
+
+// CRC-32 (IEEE 802.3, el de zlib) para la configuración guardada. Por partes:
+// empezar con 0xFFFFFFFF, encadenar crc32Update() e invertir el resultado.
+uint32_t crc32Update(uint32_t crc, const uint8_t* data, size_t len);
+inline uint32_t crc32(const uint8_t* data, size_t len) { return ~crc32Update(0xFFFFFFFF, data, len); }
+
+// Codifica `len` bytes en `out` (sin delimitadores). Devuelve los bytes escritos.
+size_t cobsEncode(const uint8_t* in, size_t len, uint8_t* out);
+
+// Peor tamaño en el cable de una trama con `len` bytes de payload
+inline size_t frameWireSize(size_t len) { size_t raw = FRAME_HEADER_SIZE + len + 2; return raw + raw / 254 + 1 + 2; }
+
+// Arma la trama completa (delimitadores incluidos) en `out`; devuelve su tamaño
+size_t buildFrame(uint8_t type, uint16_t seq, const void* payload, size_t len, uint8_t* out);
+
+// Convierte float a int16 con escala, saturando en vez de desbordar
+int16_t toFixed16(float v, float scale);
+
+#endif
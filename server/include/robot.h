@@ -9,8 +9,11 @@
 #include <Arduino.h>
 #include <string.h>
 #include "config.h"
+#include "protocol.h"
+#include "filters.h"
+#include "pid.h"
 
-enum SensorState { NORMAL, ALL_BLACK, ALL_WHITE };
+enum SensorState : uint8_t { NORMAL, ALL_BLACK, ALL_WHITE };
 
 enum Location {
   LEFT,
@@ -50,6 +53,13 @@ struct TelemetryData {
   // Sistema
   float battery;
   uint32_t loopTime;  // Cambiado de unsigned long a uint32_t
+  uint16_t txDropped;  // Tramas de salida descartadas por buffer lleno
+  uint8_t profile;     // Perfil activo (NO_PROFILE = ninguno)
+
+  // Control remoto binario
+  uint8_t rcSeq;
+  uint16_t rcLatencyUs;
+  uint16_t rcErrors;
 
 };
 
@@ -62,9 +72,8 @@ private:
   volatile int32_t backwardCount;  // Cambiado de long a int32_t
   int32_t lastCount;  // Cambiado de long a int32_t
   uint32_t lastSpeedCheck;  // Cambiado de unsigned long a uint32_t
-  float currentRPM;
-  float filteredRPM;
-  float targetRPM;
+  int16_t currentRPM;  // Entera: la ventana de medición no da más resolución
+  real_t filteredRPM;
   uint8_t encoderAPin, encoderBPin;  // Reducido de int a uint8_t para pines
 
 public:
@@ -76,85 +85,55 @@ public:
 
   int getSpeed();
 
-  float getRPM();
-
-  float getFilteredRPM();
+  // Recalcula la RPM cada 100 ms (en enteros); se llama en cada tick del lazo de velocidad
+  void updateRPM();
 
-  void setTargetRPM(float t);
+  float getRPM();
 
-  float getTargetRPM();
+  real_t getFilteredRPM();
 
   long getEncoderCount();
 
   long getBackwardCount();
 
-  void updateEncoder();
-};
-
-class PID {
-private:
-  float kp, ki, kd;
-  float error, lastError, integral, derivative;
-  float output;
-  bool antiWindupEnabled;
-  float maxOutput, minOutput;
-
-public:
-   PID(float p, float i, float d, float maxOut, float minOut);
-
-  void setGains(float p, float i, float d);
-
-  float calculate(float setpoint, float measurement, float dt);
-
-  void reset();
-
-  float getOutput();
-
-  float getError();
-
-  float getIntegral();
+  // Pulsos hacia adelante menos hacia atrás, leídos juntos con interrupciones apagadas
+  long getNetCount();
 
-  float getDerivative();
+  void updateEncoder();
 };
 
 class Features {
 private:
     FeaturesConfig config;
 
-    // Median filter
-    int16_t medianBuffer[3];
-    uint8_t medianCount;
-    // Moving average
-    int16_t movingBuffer[3];
-    int32_t movingSum;
-    uint8_t movingCount;
-    // Kalman
-    int16_t kalmanX, kalmanP;
-    // Hysteresis
-    int16_t hysteresisLast;
-    // Low pass
-    int16_t lowPassLast;
-
-    // Bubble sort for median
-    void sort(float arr[], int n);
+    // Median filter y moving average: una salida por muestra, largo según `set feature`
+    SlidingMedian<FILTER_WINDOW_MAX> median;
+    SlidingAverage<FILTER_WINDOW_MAX> average;
+    // Kalman (posición ×100)
+    int32_t kalmanX;
+    int16_t kalmanP;
+    Hysteresis<10> hysteresis;
+    DeadZone<5> deadZone;
+    LowPass<6554> lowPass;       // y = 0.8·y + 0.2·x
 
 public:
     Features();
 
     void setConfig(FeaturesConfig& f);
 
-    float applySignalFilters(float raw);
+    int16_t applySignalFilters(int16_t raw);
 };
 
 class QTR {
 private:
   int16_t sensorValues[8];  // Reducido de int a int16_t
-  int16_t rawSensorValues[8];  // Reducido de int a int16_t
   int16_t sensorMin[8];
-  int16_t sensorMax[8];
+  uint16_t sensorScale[8];  // 1000/(max-min) en Q10, precalculado en setCalibration()
 
 public:
-  float linePosition;
+  int16_t linePosition;     // ±4000, 0 = línea centrada
+  SensorState sensorState;  // Todos en negro / todos en blanco en la última read()
+  int16_t lineContrast;     // Lectura calibrada máxima - mínima (0-1000) de la última read()
 
   QTR();
 
@@ -167,47 +146,517 @@ public:
   void calibrate();
 
   int16_t* getSensorValues();
+};
+
+// Estimador de la posición de línea con modelo cinemático (`set estimator`). Estado:
+// desplazamiento lateral y de la línea respecto del centro del QTR (+ = a la derecha,
+// como linePosition), rumbo ψ de la línea respecto del robot y curvatura κ de la línea.
+// Por tick del lazo de línea predice con el avance ds y el giro dθ de los encoders
+//   y += ds·ψ    ψ += ds·κ - dθ
+// y corrige con el residuo de la posición del QTR pesado por el contraste de la lectura
+// (ganancias fijas α-β-γ, sin matrices ni divisiones). En un cruce o un hueco el
+// contraste cae a 0 y el estimador sigue solo con la odometría.
+// Todo en enteros: y en mm Q8, ψ en rad Q16, κ en 1/mm Q24.
+class LineEstimator {
+private:
+  int32_t offset;
+  int32_t heading;
+  int32_t curvature;
+  int32_t stepAvg;          // Avance medio por tick [mm, Q8], para la derivada
+  long lastLeft, lastRight; // Cuentas netas de encoder del tick anterior
+  bool primed;
+
+public:
+  LineEstimator();
+
+  // Vuelve a partir de la próxima lectura con contraste
+  void reset();
+
+  void update(const ControlParams& p, long leftCount, long rightCount, int16_t measured, int16_t contrast);
 
-  int16_t* getRawSensorValues();
+  // Posición estimada en las unidades de linePosition (±4000)
+  int16_t getPosition() const;
+
+  // Derivada de la posición estimada, v·ψ, en unidades por segundo
+  real_t getRate(real_t ticksPerSecond) const;
+
+  // Curvatura estimada en 1/m
+  float getCurvature() const;
 };
 
+// Identificación del modelo de motores en el banco (`identify motors`), con las ruedas
+// en el aire. Sube el PWM de a IDENTIFY_DEADBAND_STEP hasta que cada rueda gira (banda
+// muerta) y después recorre los puntos de la tabla: espera el régimen y mide la RPM
+// media con los encoders. Las dos ruedas a la vez, cada una con su PWM; primero hacia
+// adelante y después hacia atrás. Escribe directo en el modelo que se le pasa.
+class MotorIdentifier {
+public:
+  enum Phase : uint8_t { IDLE, DEADBAND, SETTLE, MEASURE, REST, DONE, FAILED };
+
+private:
+  Phase phase;
+  bool reverse;
+  uint8_t point;            // Punto de la tabla en curso
+  uint8_t topPwm;
+  uint8_t pwm[2];           // Módulo del PWM de cada rueda
+  bool moving[2];
+  uint8_t failedWheel;      // 0 izquierda, 1 derecha (con FAILED)
+  unsigned long phaseStart;
+  long startCount[2];
+
+  void enter(Phase p, unsigned long now, const long* counts);
+
+public:
+  MotorIdentifier();
+
+  void start(uint8_t maxPwm, unsigned long now, long leftCount, long rightCount);
+  void abort() { phase = IDLE; }
+  bool active() const { return phase != IDLE && phase != DONE && phase != FAILED; }
+  Phase getPhase() const { return phase; }
+  uint8_t getFailedWheel() const { return failedWheel; }
+  bool isReverse() const { return reverse; }
+
+  // Un paso por tick del lazo de velocidad: deja en pwmOut el PWM con signo de cada rueda
+  void service(MotorModel& model, unsigned long now, long leftCount, long rightCount,
+               int16_t pulsesPerRevolution, int16_t* pwmOut);
+};
+
+// Ensayo al escalón (`identify step`): ajusta un modelo de primer orden con retardo
+//   G(s) = K·e^(-L·s) / (T·s + 1)
+// a la RPM que ven los PID de velocidad (con el filtro de Motor), de PWM u0 a u1, sin
+// guardar la respuesta: método de las áreas con integrales corridas.
+//   Pasada 0: A0 = ∫(y∞ - y) dt sobre el escalón da K = Δy∞ / Δu y T + L = A0 / Δy∞
+//   Pasada 1: el mismo escalón otra vez; A1 = ∫y dt hasta T + L da T = e·A1 / Δy∞
+// y se mide desde el valor en régimen con u0 antes de cada escalón.
+class StepIdentifier {
+public:
+  enum Phase : uint8_t { IDLE, BASELINE, STEP, DONE, FAILED };
+  struct Result {
+    float gain;             // K [RPM/PWM]
+    float timeConstant;     // T [s]
+    float delay;            // L [s]
+  };
+
+private:
+  Phase phase;
+  uint8_t pass;
+  uint8_t u0, u1;
+  uint8_t failedWheel;
+  bool slow;                // FAILED porque T + L no entra en el escalón
+  unsigned long phaseStart;
+  unsigned long lastTick;
+  unsigned long windowMs;   // Largo real de la ventana acumulada
+  long area[2];             // ∫y dt desde el inicio de la fase (o hasta T + L) [RPM·ms]
+  long windowArea[2];       // ∫y dt en la ventana final de la fase [RPM·ms]
+  float y0[2];              // Régimen con u0 [RPM]
+  float dy[2];              // Δy∞ [RPM]
+  float tl[2];              // T + L [ms]
+  Result result[2];
+
+  void finishPass0(unsigned long now, unsigned long holdMs);
+
+public:
+  StepIdentifier();
+
+  void start(uint8_t pwmLow, uint8_t pwmHigh, unsigned long now);
+  void abort() { phase = IDLE; }
+  bool active() const { return phase == BASELINE || phase == STEP; }
+  Phase getPhase() const { return phase; }
+  uint8_t getFailedWheel() const { return failedWheel; }
+  bool wasTooSlow() const { return slow; }
+  const Result& getResult(uint8_t wheel) const { return result[wheel]; }
+
+  // Un paso por tick del lazo de velocidad con la RPM filtrada de cada rueda
+  void service(unsigned long now, int16_t leftRpm, int16_t rightRpm, int16_t* pwmOut);
+};
+
+// Autotuning por realimentación con relé (Åström–Hägglund, `autotune line|wheels`).
+// En lugar del PID, la salida conmuta entre bias + d y bias - d según el signo del
+// error, con histéresis ε. El lazo entra en un ciclo límite de período Pu y la medición
+// oscila con amplitud a; la función descriptiva del relé da la ganancia última
+//   Ku = 4·d / (π·sqrt(a² - ε²))
+// Los primeros ciclos son transitorio; Ku y Pu promedian los siguientes. Cada ciclo
+// corrige el bias para que los dos semiciclos duren lo mismo: alrededor de una RPM
+// distinta de cero el PWM de trabajo no se conoce de antemano. Hasta el primer ciclo el
+// bias además camina d por segundo hacia la salida del relé, por si bias ± d no alcanza
+// para cruzar el setpoint.
+class RelayTuner {
+public:
+  enum Phase : uint8_t { IDLE, RUNNING, DONE, FAILED };
+  enum Target : uint8_t { TARGET_LINE, TARGET_WHEELS };
+  // Reglas sobre Ku y Pu (ver relayGains en robot.cpp)
+  enum Rule : uint8_t { RULE_ZN, RULE_TL, RULE_PI, RULE_NO_OVERSHOOT, RULE_COUNT };
+
+private:
+  struct Channel {
+    float bias;
+    int8_t state;               // +1: salida bias + d, -1: bias - d
+    uint8_t cycles;             // Ciclos completos (de subida a subida)
+    int16_t yMax, yMin;         // Extremos de la medición en el ciclo en curso
+    unsigned long lastRise, lastFall;
+    unsigned long periodSum;    // [ms] de los ciclos medidos
+    float amplitudeSum;
+  };
+  Phase phase;
+  Target target;
+  Rule rule;
+  uint8_t channels;             // 1 con la línea, 2 con las ruedas
+  uint8_t failedChannel;
+  int16_t setpoint;
+  float d, eps;
+  float biasMin, biasMax;
+  unsigned long startTime, timeoutMs;
+  unsigned long lastTick;
+  Channel ch[2];
+
+public:
+  RelayTuner();
+
+  void start(Target t, Rule r, int16_t sp, const float* bias, float amplitude, float hysteresis,
+             float minBias, float maxBias, unsigned long now);
+  void abort() { phase = IDLE; }
+  bool active() const { return phase == RUNNING; }
+  Phase getPhase() const { return phase; }
+  Target getTarget() const { return target; }
+  Rule getRule() const { return rule; }
+  int16_t getSetpoint() const { return setpoint; }
+  uint8_t getFailedChannel() const { return failedChannel; }
+  // Resultado de un canal con DONE: Ku en unidades de la salida por unidad de la medición
+  float ultimateGain(uint8_t c) const;
+  float ultimatePeriod(uint8_t c) const;   // [s]
+
+  // Un paso por tick del lazo: y es la medición de cada canal, deja la salida en out
+  void service(unsigned long now, const int16_t* y, float* out);
+};
+
+// Optimizador de las ganancias de línea en pista (`autotune`). Cada evaluación es una
+// vuelta entre dos pasadas por la marca de largada (todo negro) o una ventana de
+// distancia de los encoders, con el puntaje
+//   J = wT·t/t0 + wI·IAE/IAE0 + wD·desvío/desvío0
+// relativo a la primera vuelta, que corre con las ganancias de partida. Búsqueda por
+// coordenadas sin derivadas en escala multiplicativa: prueba k·(1 + s) y si no mejora
+// k/(1 + s); con una mejora sigue en esa dirección con un paso 1.5 veces mayor, sin
+// ninguna achica el paso a la mitad y pasa a la ganancia siguiente. Una ganancia en 0
+// no se toca. Lo que hay que recordar entre vueltas está en TunerCheckpoint; el resto
+// es de la ventana en curso. Vive en la unión de herramientas de Robot.
+class LapTuner {
+public:
+  enum Event : uint8_t { NONE, SCORED, LOST };
+
+private:
+  TunerCheckpoint cp;
+  bool running;
+  bool started;             // Hay una ventana en curso (en vueltas, desde la primera marca)
+  bool onMark;
+  bool lost;
+  int16_t maxDev;
+  uint32_t absSum;          // Σ|posición| por tick de la ventana
+  long windowPulses;        // Largo de la ventana en pulsos (0 = vueltas entre marcas)
+  long minLapPulses;
+  long startCount;
+  unsigned long windowStart;
+  unsigned long lostSince;
+  float lastScore;
+
+  void setDistances(float pulsesPerMm);
+  void score(float seconds, float iae, float deviation);
+  void advance(bool better, float j);
+
+public:
+  LapTuner();
+
+  void start(const float* gains, uint16_t windowMm, float pulsesPerMm);
+  void resume(const TunerCheckpoint& c, float pulsesPerMm);
+  void stop() { running = false; }
+  bool active() const { return running; }
+  bool converged() const;
+  const TunerCheckpoint& checkpoint() const { return cp; }
+  float getLastScore() const { return lastScore; }
+  // Ganancias de la próxima evaluación
+  void candidate(float* k) const;
+  // La candidata en curso cuenta como peor que la mejor (línea perdida). En la vuelta
+  // de referencia no hay candidata: no hace nada
+  void reject() { if (cp.dir != 0) advance(false, 0); }
+
+  // Un paso por tick del lazo de línea. SCORED al cerrar una ventana, con la próxima
+  // candidata ya elegida; LOST si la línea falta más de OPT_LINE_LOST_MS
+  Event update(unsigned long now, int16_t position, SensorState state, long distance, float dt);
+};
+
+// Buffer circular de transmisión en SRAM. Cada trama (beginFrame/commitFrame) se
+// guarda completa o se descarta entera si no cabe; nunca se bloquea esperando al
+// puerto. drainTo() pasa a Serial solo lo que cabe en su buffer de hardware, que
+// el ISR UDRE de HardwareSerial vacía en segundo plano. N potencia de 2, <= 256.
+template <uint16_t N>
+class TxRing : public Print {
+private:
+  uint8_t buf[N];
+  uint8_t head;        // Cursor de escritura (incluye la trama abierta)
+  uint8_t commitHead;  // Fin de la última trama completa
+  uint8_t tail;        // Próximo byte a enviar
+  bool overflow;
+  uint16_t dropped;
+
+public:
+  TxRing() : head(0), commitHead(0), tail(0), overflow(false), dropped(0) {}
+
+  void beginFrame() { head = commitHead; overflow = false; }
+
+  bool commitFrame() {
+    if (overflow) { head = commitHead; dropped++; return false; }
+    commitHead = head;
+    return true;
+  }
+
+  virtual size_t write(uint8_t c) {
+    if (overflow) return 0;
+    uint8_t next = (head + 1) & (N - 1);
+    if (next == tail) { overflow = true; return 0; }
+    buf[head] = c;
+    head = next;
+    return 1;
+  }
+  using Print::write;
+
+  // Trama binaria completa (ver buildFrame) escrita sobre la marcha, sin armarla en la
+  // pila: el código COBS de cada bloque se reserva al abrirlo y se completa al cerrarlo.
+  // Dentro de beginFrame()/commitFrame(); si no entra, commitFrame() la descarta.
+  void writeFrame(uint8_t type, uint16_t seq, const uint8_t* payload, size_t len) {
+    const uint8_t header[FRAME_HEADER_SIZE] = { type, (uint8_t)(seq & 0xFF), (uint8_t)(seq >> 8) };
+    size_t rawLen = FRAME_HEADER_SIZE + len + 2;
+    uint16_t crc = 0xFFFF;
+    write((uint8_t)0x00);
+    uint8_t codePos = head, code = 1;
+    write((uint8_t)0x01);
+    for (size_t i = 0; i < rawLen; i++) {
+      uint8_t b;
+      if (i < FRAME_HEADER_SIZE) b = header[i];
+      else if (i < rawLen - 2) b = payload[i - FRAME_HEADER_SIZE];
+      else b = (i == rawLen - 2) ? (crc & 0xFF) : (crc >> 8);
+      if (i < rawLen - 2) crc = crc16CcittStep(crc, b);
+      if (b != 0) {
+        write(b);
+        if (++code < 0xFF) continue;
+      }
+      if (!overflow) buf[codePos] = code;
+      codePos = head;
+      code = 1;
+      write((uint8_t)0x01);
+    }
+    if (!overflow) buf[codePos] = code;
+    write((uint8_t)0x00);
+  }
+
+  bool empty() const { return tail == commitHead; }
+  uint16_t freeSpace() const { return N - 1 - ((uint8_t)(head - tail) & (N - 1)); }
+  uint16_t droppedFrames() const { return dropped; }
+
+  void drainTo(HardwareSerial& port) {
+    int room = port.availableForWrite();
+    while (room-- > 0 && tail != commitHead) {
+      port.write(buf[tail]);
+      tail = (tail + 1) & (N - 1);
+    }
+  }
+};
+
+// Grabador de vuelo en RAM. Graba una muestra por tick en un buffer circular;
+// al dispararse sigue grabando hasta completar la ventana posterior y se congela
+// con PRE muestras de historia previa al disparo.
+template <typename Sample, uint16_t N>
+class FlightRecorder {
+public:
+  enum State : uint8_t { IDLE, ARMED, TRIGGERED, FROZEN };
+  static const uint16_t PRE = N / 4;
+
+private:
+  Sample samples[N];
+  uint16_t head;
+  uint16_t count;
+  uint16_t postRemaining;
+  uint8_t reason;
+  State state;
+
+public:
+  FlightRecorder() : head(0), count(0), postRemaining(0), reason(0), state(IDLE) {}
+
+  void arm() { head = 0; count = 0; reason = 0; state = ARMED; }
+
+  void trigger(uint8_t why) {
+    if (state != ARMED) return;
+    reason = why;
+    postRemaining = N - PRE;
+    state = TRIGGERED;
+  }
+
+  // Detiene la grabación tal como está (volcado sin disparo)
+  void freeze() { if (state != FROZEN) { postRemaining = 0; state = FROZEN; } }
+
+  void record(const Sample& s) {
+    if (state != ARMED && state != TRIGGERED) return;
+    samples[head] = s;
+    head = (head + 1 == N) ? 0 : head + 1;
+    if (count < N) count++;
+    if (state == TRIGGERED && --postRemaining == 0) state = FROZEN;
+  }
+
+  State getState() const { return state; }
+  uint8_t getReason() const { return reason; }
+  uint16_t size() const { return count; }
+
+  // Posición de la muestra que disparó, contando desde la más antigua
+  uint16_t triggerIndex() const {
+    if (!reason) return count;
+    uint16_t post = (N - PRE) - postRemaining;
+    return count > post ? count - post - 1 : 0;
+  }
+
+  // i = 0 es la muestra más antigua
+  const Sample& at(uint16_t i) const {
+    uint16_t idx = (count < N ? 0 : head) + i;
+    return samples[idx >= N ? idx - N : idx];
+  }
+};
+
+const uint16_t TX_MSG_RING_SIZE = 128;  // Mensajes y tramas binarias (una trama de FRAME_MAX_WIRE entra)
+const uint16_t TX_LINE_RING_SIZE = 64;  // Un grupo de una línea de texto larga (≤ 63 caracteres)
+static_assert(FRAME_MAX_WIRE < TX_MSG_RING_SIZE, "Una trama binaria no entra en msgTx");
+
+// Líneas largas (type:3/4/5) que se emiten por grupos, uno por iteración del loop
+enum TextJob : uint8_t { JOB_NONE, JOB_TELEMETRY, JOB_CONFIG, JOB_DEBUG };
+// type:5 lleva todos los grupos de configuración y luego la telemetría
+const uint8_t DEBUG_CONFIG_GROUPS = 10;
+
 class Debugger {
+private:
+  uint16_t txSeq;  // Secuencia de tramas binarias
+  TxRing<TX_MSG_RING_SIZE> msgTx;
+  TxRing<TX_LINE_RING_SIZE> lineTx;
+  TextJob job;
+  TextJob nextJob;
+  uint8_t jobStep;
+  uint16_t droppedLines;
+  uint8_t groupDivisor[TELEMETRY_GROUP_COUNT];  // 0 = no suscrito
+  uint8_t groupCount[TELEMETRY_GROUP_COUNT];
+  uint8_t deltaValid;      // Grupos con referencia válida en deltaRef
+  uint8_t framesToKey;     // Tramas delta que faltan para la próxima clave
+  TelemetryWire* deltaRef; // Último valor enviado de cada grupo (RAM de Robot); NULL = sin delta
+
+  bool printConfigGroup(uint8_t group);
+  bool printTelemetryGroup(uint8_t group, const TelemetryData& data);
+  bool printJobGroup(const TelemetryData* data);
+
 public:
   Debugger();
 
+  // Envía lo pendiente sin bloquear; llamar en cada iteración del loop. La línea de
+  // telemetry no guarda copia: sus grupos se arman con `data`, y sin datos esperan.
+  void service(const TelemetryData* data = NULL);
+
+  // El próximo grupo a emitir es de telemetría: pasar datos a service()
+  bool needsTelemetry() const;
+
+  // Queda algo por enviar (para vaciar bloqueando antes de calibrar)
+  bool pending() const;
+
+  // Tramas/líneas descartadas por falta de espacio
+  uint16_t droppedFrames();
+
   // Mensaje de sistema (comandos, estados, etc.)
   void systemMessage(const char* msg);
 
+  void systemMessage(const __FlashStringHelper* msg);
+
   void systemMessage(const String& msg);
 
-  // Datos de debug telemetry (telemetría reducida)
-  void sendTelemetryData(TelemetryData& data, bool endLine = true);
+  // Como systemMessage(), pero si no cabe ahora devuelve false sin descartarlo, para que
+  // quien manda varias líneas seguidas las reparta entre iteraciones
+  bool trySystemMessage(const char* msg);
+
+  // Línea de telemetry (type:4). Se descarta si hay otra línea en curso.
+  void sendTelemetryData();
+
+  // Misma telemetría en trama binaria COBS (ver protocol.h), solo los grupos de `mask`.
+  // En modo delta manda FRAME_TELEMETRY_DELTA salvo cuando toca una clave.
+  void sendTelemetryBinary(const TelemetryWire& w, uint8_t mask = TELEMETRY_ALL_GROUPS);
+
+  // Trama binaria genérica. Si no cabe ahora devuelve false sin descartar nada,
+  // para que quien emite por partes (volcado del grabador) reintente después.
+  bool sendFrame(uint8_t type, const void* payload, size_t len);
 
-  void sendDebugData(TelemetryData& data, RobotConfig& config);
+  // Activa el modo delta con `ref` como memoria de referencia, o lo apaga con NULL;
+  // siempre empieza con una clave
+  void setDeltaMode(TelemetryWire* ref);
+  bool deltaMode() const { return deltaRef != NULL; }
+
+  // Suscripciones: el grupo sale cada `divisor` ticks del lazo de velocidad (0 = nunca)
+  bool subscribe(uint8_t group, uint8_t divisor);
+  void clearSubscriptions();
+  bool hasSubscriptions();
+  // Avanza un tick y devuelve la máscara de grupos que toca enviar
+  uint8_t dueGroups();
+
+  // Línea de debug (type:5): configuración seguida de telemetry
+  void sendDebugData();
 
   // Datos de configuración
-  void sendConfigData(RobotConfig& config, bool endLine = true);
+  void sendConfigData();
 
   // Confirmación de comando procesado
   void ackMessage(const char* cmd);
 
+  // Confirmación de un lote secuenciado: bit i de okMask = comando i aceptado
+  void batchAck(uint32_t seq, uint8_t count, uint16_t okMask);
+
 };
 
 class SerialReader {
 private:
-    char serBuf[64];
+    char serBuf[SERIAL_LINE_MAX];
     bool lineReady;
     uint8_t idx;
+    // Trama RC binaria: se arma aparte del texto, sin pasar por la línea. La válida
+    // queda en rcBuf hasta getRc(), igual que la línea en serBuf.
+    uint8_t rcBuf[sizeof(RcFrame)];
+    uint8_t rcIdx;
+    bool rcReady;
+    uint32_t rcRxUs;
+    uint16_t rcErrors;
 
 public:
     SerialReader();
 
     void fillBuffer();
 
-    bool getLine(const char **buf);
+    // La línea se entrega modificable para partirla en el sitio sin copiarla
+    bool getLine(char **buf);
+
+    // Última trama RC válida desde la anterior llamada y el micros() de su recepción
+    bool getRc(RcFrame& frame, uint32_t& rxUs);
+    uint16_t rcErrorCount() const { return rcErrors; }
 };
 
 class EEPROMManager {
+private:
+  uint8_t slot;          // Slot con la copia vigente
+  uint16_t seq;          // Secuencia de esa copia
+  bool writing;          // Hay una copia en curso hacia (slot + 1)
+  bool flushRequested;   // `save`: escribir sin esperar a idle
+  uint8_t pos;           // Próximo byte de la copia: datos y después cabecera
+  uint32_t crc;          // CRC-32 parcial de los datos ya copiados
+
+  // Cada slot: ConfigHeader y detrás RobotConfig. La cabecera se escribe al final y
+  // la secuencia es su último campo: una copia cortada a medias no pasa el CRC.
+  static int slotAddr(uint8_t s) { return EEPROM_CONFIG_ADDR + s * EEPROM_CONFIG_SLOT_SIZE; }
+  void beginCopy();
+  // Compara bytes de la copia hasta escribir uno distinto o terminar
+  void copyStep();
+  bool loadLegacy(uint8_t* raw);
+  // Copia pendiente del checkpoint del optimizador. Nunca corre a la vez que la de
+  // config, así que usa su misma posición y CRC
+  const TunerCheckpoint* checkpointSrc;
+  void checkpointStep();
+
 public:
   EEPROMManager();
 
@@ -215,17 +664,110 @@ public:
 
   void load();
 
+  // Copia completa y bloqueante; solo para el arranque
   void save();
+
+  // Escribe en cuanto pueda, aunque el robot no esté en idle
+  void requestFlush() { flushRequested = true; }
+
+  // Avanza la copia pendiente como mucho un byte por llamada, sin esperar a la EEPROM
+  void service(bool idle);
+
+  bool busy() const { return writing; }
+
+  // Perfiles: lectura directa de EEPROM (~µs); la escritura bloquea, solo en idle
+  static int profileAddr(uint8_t n) { return EEPROM_PROFILE_ADDR + n * PROFILE_SLOT_SIZE; }
+  bool loadProfile(uint8_t n, TuningProfile& p);
+  void saveProfile(uint8_t n, const TuningProfile& p);
+
+  // Modelo de motores: mismo formato que un perfil, en su propio slot. loadMotorCurve()
+  // lee una sola curva sin verificar el CRC (ya verificado con loadMotorModel())
+  bool loadMotorModel(MotorModel& m);
+  void saveMotorModel(const MotorModel& m);
+  static void loadMotorCurve(uint8_t index, MotorCurve& c);
+
+  // Checkpoint del optimizador en pista: vale el slot con más evaluaciones. La copia es
+  // de a un byte por service(), también fuera de idle; `c` no tiene que cambiar mientras
+  // tanto (si cambia, se vuelve a pedir y la copia empieza de nuevo)
+  static int checkpointAddr(uint8_t n) { return EEPROM_TUNER_ADDR + n * TUNER_SLOT_SIZE; }
+  bool loadCheckpoint(TunerCheckpoint& c);
+  void requestCheckpoint(const TunerCheckpoint* c);
+  bool checkpointPending() const { return checkpointSrc != 0; }
+  // Invalida los dos slots (sesión nueva)
+  void clearCheckpoint();
+
+private:
+  // Registro con ConfigHeader en `addr`; al leer, `size` es el largo actual del struct
+  // y lo que una versión más corta no trae queda como está
+  static bool readRecord(int addr, uint16_t version, uint8_t* dst, uint8_t size);
+  static void writeRecord(int addr, uint16_t version, const uint8_t* src, uint8_t size);
 };
 
-// Función global para guardar configuración
-void saveConfig();
+// Marca la configuración para guardarse; EEPROMManager::service() la escribe después
+void markConfigDirty();
 
 class Robot;
 
+// Tabla de comandos: clave de una o dos palabras y handler. El opcode (posición en
+// la lista) es parte del protocolo: `#<opcode> <params>` salta el texto de la clave,
+// así que los comandos nuevos se agregan siempre al final.
+#define COMMAND_LIST(X) \
+  X(CALIBRATE,     "calibrate",     handleCalibrate) \
+  X(SAVE,          "save",          handleSave) \
+  X(GET_DEBUG,     "get debug",     handleGetDebug) \
+  X(GET_TELEMETRY, "get telemetry", handleGetTelemetry) \
+  X(GET_CONFIG,    "get config",    handleGetConfig) \
+  X(RESET,         "reset",         handleReset) \
+  X(HELP,          "help",          handleHelp) \
+  X(SET_TELEMETRY, "set telemetry", handleSetTelemetry) \
+  X(SET_MODE,      "set mode",      handleSetMode) \
+  X(SET_CASCADE,   "set cascade",   handleSetCascade) \
+  X(SET_FEATURE,   "set feature",   handleSetFeature) \
+  X(SET_FEATURES,  "set features",  handleSetFeatures) \
+  X(SET_LINE,      "set line",      handleSetLine) \
+  X(SET_LEFT,      "set left",      handleSetLeft) \
+  X(SET_RIGHT,     "set right",     handleSetRight) \
+  X(SET_BASE,      "set base",      handleSetBase) \
+  X(SET_MAX,       "set max",       handleSetMax) \
+  X(SET_WEIGHT,    "set weight",    handleSetWeight) \
+  X(SET_SAMP_RATE, "set samp_rate", handleSetSampRate) \
+  X(RC,            "rc",            handleRc) \
+  X(SET_PWM,       "set pwm",       handleSetPwm) \
+  X(SET_RPM,       "set rpm",       handleSetRpm) \
+  X(AUTOTUNE,      "autotune",      handleAutoTune) \
+  X(SUBSCRIBE,     "subscribe",     handleSubscribe) \
+  X(LOG_ARM,       "log arm",       handleLogArm) \
+  X(LOG_TRIGGER,   "log trigger",   handleLogTrigger) \
+  X(DUMP_LOG,      "dump log",      handleDumpLog) \
+  X(SET_BAUD,      "set baud",      handleSetBaud) \
+  X(BAUD_OK,       "baud ok",       handleBaudOk) \
+  X(PROFILE_SAVE,  "profile save",  handleProfileSave) \
+  X(PROFILE_LOAD,  "profile load",  handleProfileLoad) \
+  X(PROFILE_LIST,  "profile list",  handleProfileList) \
+  X(BENCH,         "bench",         handleBench) \
+  X(SET_BIQUAD,    "set biquad",    handleSetBiquad) \
+  X(SET_ESTIMATOR, "set estimator", handleSetEstimator) \
+  X(IDENTIFY_MOTORS, "identify motors", handleIdentifyMotors) \
+  X(SET_FEEDFORWARD, "set feedforward", handleSetFeedforward) \
+  X(GET_MOTORS,    "get motors",    handleGetMotors) \
+  X(IDENTIFY_STEP, "identify step", handleIdentifyStep) \
+  X(GET_MEM,       "get mem",       handleGetMem)
+
+enum CommandOpcode : uint8_t {
+#define COMMAND_OPCODE(id, name, handler) CMD_##id,
+  COMMAND_LIST(COMMAND_OPCODE)
+#undef COMMAND_OPCODE
+  COMMAND_COUNT
+};
+
+// FNV-1a de 32 bits. constexpr: las claves de la tabla se hashean al compilar
+const uint32_t FNV1A_OFFSET = 2166136261UL;
+constexpr uint32_t fnv1aStep(uint32_t h, uint8_t c) { return (h ^ c) * 16777619UL; }
+constexpr uint32_t fnv1a(const char* s, uint32_t h = FNV1A_OFFSET) { return *s ? fnv1a(s + 1, fnv1aStep(h, *s)) : h; }
+
 struct SerialCommand {
-    const char* command;
-    void (*handler)(Robot* self, const char* params);
+    const char* command;  // En PROGMEM
+    bool (*handler)(Robot* self, const char* params);  // false si rechazó los parámetros
 };
 
 class Robot {
@@ -241,6 +783,21 @@ private:
     Debugger debugger;
     SerialReader serialReader;
     Features features;
+#ifdef FIXED_FILTERS
+    LineFilterChain lineFilter;   // Reemplaza a features.applySignalFilters() en el lazo
+#endif
+    // Banco de biquads (`set biquad`): estado por señal, coeficientes en params.biquad
+    Biquad positionBiquad;
+    Biquad derivativeBiquad;
+    Biquad leftRpmBiquad, rightRpmBiquad;
+    LineEstimator estimator;
+    // Modelo de motores para el feedforward del lazo de RPM: vive en su registro de
+    // EEPROM y el lazo lee ahí la curva que usa; en RAM solo mientras se identifica
+    bool motorModelValid;
+    // Informes de varias líneas (`get motors`, `identify step`, `autotune`): una por iteración
+    enum ReportKind : uint8_t { REPORT_NONE, REPORT_MOTORS, REPORT_STEP, REPORT_RELAY };
+    ReportKind reportKind;
+    uint8_t reportLine;
 
     // Static pointers for ISRs
     static Motor* leftMotorPtr;
@@ -250,85 +807,176 @@ private:
     static void leftEncoderISR();
     static void rightEncoderISR();
 
+    // Configuración activa y época adoptada
+    ControlParams params;
+    uint8_t appliedEpoch;
+
     // Variables de estado
-    float lastPidOutput;
     unsigned long lastTelemetryTime;
     unsigned long lastLineTime;
     unsigned long lastSpeedTime;
     int16_t lastLinePosition;
     unsigned long loopTime;
-    unsigned long loopStartTime;
-    float leftTargetRPM;
-    float rightTargetRPM;
-    float throttle;
-    float steering;
+    real_t leftTargetRPM;
+    real_t rightTargetRPM;
+    real_t throttle;
+    real_t steering;
+    // Latencia RC: de la recepción de la trama binaria al PWM que la aplica
+    bool rcPending;
+    uint8_t rcRxSeq;
+    uint8_t rcSeq;
+    uint32_t rcRxUs;
+    uint16_t rcLatencyUs;
+    // Último perfil cargado o guardado (NO_PROFILE si ninguno desde el arranque)
+    uint8_t activeProfile;
     // LED indication
     unsigned long lastLedTime;
     bool ledState;
     // Variables para mejoras dinámicas
-    float previousLinePosition;
-    float currentCurvature;
-    float filteredCurvature; // Filtro para suavizar curvatura
+    int16_t previousLinePosition;
+    real_t filteredCurvature; // Filtro para suavizar curvatura
     SensorState currentSensorState;
-    int lastTurnDirection; // 1 para derecha, -1 para izquierda
-    // Unified target RPM for all modes
-    
-    // Auto-tuning variables
-    bool autoTuningActive;
-    unsigned long autoTuneStartTime;
-    unsigned long autoTuneTestStartTime;
-    int currentTestIndex;
-    int totalTests;
-    float bestIAE;
-    float bestKp, bestKi, bestKd;
-    float originalKp, originalKi, originalKd;
-    float testKp[6], testKi[6], testKd[6];
-    float accumulatedIAE;
-    int samplesCount;
-    float lastPosition;
-    float maxDeviation;
+
+    // `identify motors`: el identificador y el modelo que va armando
+    struct Identification {
+        MotorIdentifier identifier;
+        MotorModel model;
+    };
+
+    // `autotune line|wheels`: el relé y, en la línea, su última salida (el PID arranca ahí)
+    struct RelayTune {
+        RelayTuner tuner;
+        real_t lineOutput;
+    };
+
+    // El grabador, la referencia de la telemetría delta, el auto-tuning y los ensayos
+    // de identificación nunca se usan a la vez: comparten la misma RAM y `tool` dice
+    // cuál es el dueño. El que toma la memoria (claimTool) pisa al anterior, así que un
+    // registro congelado se pierde.
+    enum Tool : uint8_t { TOOL_NONE, TOOL_RECORDER, TOOL_DELTA, TOOL_AUTOTUNE, TOOL_IDENTIFY, TOOL_STEP, TOOL_RELAY };
+    Tool tool;
+    union {
+        FlightRecorder<RecorderSample, RECORDER_SAMPLES> recorder;
+        TelemetryWire deltaRef;   // Referencia de `set telemetry 3`
+        LapTuner lapTuner;        // `autotune`, `autotune track`
+        Identification identify;
+        StepIdentifier stepTest;  // Sigue siendo dueño hasta terminar el informe
+        RelayTune relay;          // Ídem
+    };
+    // Grabador de vuelo
+    uint8_t recorderTriggers;
+    int16_t recorderDeviation;
+    SensorState recorderLastState;
+    bool dumping;
+    uint16_t dumpIndex;
+    bool calibrationPending;   // `calibrate` recibido; se ejecuta en el próximo run()
+
+    // Cambio de baud: se conmuta tras enviar el ack y se espera `baud ok` a la nueva velocidad
+    enum BaudState : uint8_t { BAUD_IDLE, BAUD_SWITCH, BAUD_CONFIRM };
+    BaudState baudState;
+    uint32_t serialBaud;
+    uint32_t pendingBaud;
+    unsigned long baudDeadline;
 
     // Funciones auxiliares
-    SensorState checkSensorState(int16_t* rawSensors);
+    void applyConfig();
+    real_t filterRpm(Biquad& filter, real_t rpm);
+    void recordSample();
+    bool recording() const { return tool == TOOL_RECORDER; }
+    bool deltaTelemetry() const { return tool == TOOL_DELTA && debugger.deltaMode(); }
+    bool autoTuning() const { return tool == TOOL_AUTOTUNE && lapTuner.active(); }
+    bool identifying() const { return tool == TOOL_IDENTIFY && identify.identifier.active(); }
+    bool stepTesting() const { return tool == TOOL_STEP && stepTest.active(); }
+    bool relayTuning() const { return tool == TOOL_RELAY && relay.tuner.active(); }
+    bool claimTool(Tool t);
+    __attribute__((noinline)) void serviceDump();
+    void serviceBaud();
+    void serviceDebugger();
+    void flushDebugger();
+    void serviceCalibration();
     void updateModeLed(unsigned long currentMillis, unsigned long blinkInterval);
-    // Command handling
-    SerialCommand commands[24];
-    static void handleCalibrate(Robot* self, const char* params);
-    static void handleAutoTune(Robot* self, const char* params);
-    static void handleSave(Robot* self, const char* params);
-    static void handleGetDebug(Robot* self, const char* params);
-    static void handleGetTelemetry(Robot* self, const char* params);
-    static void handleGetConfig(Robot* self, const char* params);
-    static void handleReset(Robot* self, const char* params);
-    static void handleHelp(Robot* self, const char* params);
-    static void handleSetTelemetry(Robot* self, const char* params);
-    static void handleSetMode(Robot* self, const char* params);
-    static void handleSetCascade(Robot* self, const char* params);
-    static void handleSetFeature(Robot* self, const char* params);
-    static void handleSetFeatures(Robot* self, const char* params);
-    static void handleSetLine(Robot* self, const char* params);
-    static void handleSetLeft(Robot* self, const char* params);
-    static void handleSetRight(Robot* self, const char* params);
-    static void handleSetBase(Robot* self, const char* params);
-    static void handleSetMax(Robot* self, const char* params);
-    static void handleSetWeight(Robot* self, const char* params);
-    static void handleSetSampRate(Robot* self, const char* params);
-    static void handleRc(Robot* self, const char* params);
-    static void handleSetPwm(Robot* self, const char* params);
-    static void handleSetRpm(Robot* self, const char* params);
+    // Command handling: tabla en PROGMEM indexada por CommandOpcode
+    static const SerialCommand COMMANDS[COMMAND_COUNT];
+    static int8_t findCommand(uint32_t hash);
+    static bool handleCalibrate(Robot* self, const char* params);
+    static bool handleAutoTune(Robot* self, const char* params);
+    static bool startRelayTune(Robot* self, const char* params);
+    static bool startLapTuner(Robot* self, const char* params);
+    static bool handleSave(Robot* self, const char* params);
+    static bool handleGetDebug(Robot* self, const char* params);
+    static bool handleGetTelemetry(Robot* self, const char* params);
+    static bool handleGetConfig(Robot* self, const char* params);
+    static bool handleReset(Robot* self, const char* params);
+    static bool handleHelp(Robot* self, const char* params);
+    static bool handleSetTelemetry(Robot* self, const char* params);
+    static bool handleSubscribe(Robot* self, const char* params);
+    static bool handleLogArm(Robot* self, const char* params);
+    static bool handleLogTrigger(Robot* self, const char* params);
+    static bool handleDumpLog(Robot* self, const char* params);
+    static bool handleSetBaud(Robot* self, const char* params);
+    static bool handleBaudOk(Robot* self, const char* params);
+    static bool handleProfileSave(Robot* self, const char* params);
+    static bool handleProfileLoad(Robot* self, const char* params);
+    static bool handleProfileList(Robot* self, const char* params);
+    static int8_t parseProfileIndex(const char* params, const char** rest);
+    static bool handleBench(Robot* self, const char* params);
+    static bool handleSetBiquad(Robot* self, const char* params);
+    static bool handleSetEstimator(Robot* self, const char* params);
+    static bool handleIdentifyMotors(Robot* self, const char* params);
+    static bool handleSetFeedforward(Robot* self, const char* params);
+    static bool handleGetMotors(Robot* self, const char* params);
+    static bool handleIdentifyStep(Robot* self, const char* params);
+    static bool handleGetMem(Robot* self, const char* params);
+    void serviceIdentification(unsigned long now);
+    int16_t motorFeedforward(bool right, real_t targetRpm);
+    void serviceStepTest(unsigned long now);
+    bool serviceRelayLine(int16_t position, unsigned long now, real_t& out);
+    void serviceRelayWheels(unsigned long now);
+    void finishRelay(RelayTuner::Phase phase);
+    void stopRelay();
+    // Una línea por iteración, para no desbordar el buffer de mensajes
+    void startReport(ReportKind kind) { reportKind = kind; reportLine = 0; }
+    void serviceReport();
+    bool formatReportLine(char* msg, uint8_t size);
+    static bool handleSetMode(Robot* self, const char* params);
+    static bool handleSetCascade(Robot* self, const char* params);
+    static bool handleSetFeature(Robot* self, const char* params);
+    static bool handleSetFeatures(Robot* self, const char* params);
+    static bool handleSetLine(Robot* self, const char* params);
+    static bool handleSetLeft(Robot* self, const char* params);
+    static bool handleSetRight(Robot* self, const char* params);
+    static bool handleSetBase(Robot* self, const char* params);
+    static bool handleSetMax(Robot* self, const char* params);
+    static bool handleSetWeight(Robot* self, const char* params);
+    static bool handleSetSampRate(Robot* self, const char* params);
+    static bool handleRc(Robot* self, const char* params);
+    static bool handleSetPwm(Robot* self, const char* params);
+    static bool handleSetRpm(Robot* self, const char* params);
     static int parseFloatArray(const char* params, float* values, int maxCount);
-    
-    // Auto-tuning methods
-    void performAutoTune(float currentPosition, float dtLine);
-    void generateTestParameters();
+
+    // Optimizador en pista: una llamada por tick del lazo de línea
+    void serviceLapTuner(int16_t position, unsigned long now, float dt);
+    void applyLapCandidate();
+    void finishLapTuner(const __FlashStringHelper* msg);
 
 public:
     Robot();
 
     void init();
     void run();
-    void processCommand(const char* cmd);
+    // Ejecuta un comando; false si es desconocido o el handler rechazó los parámetros
+    bool processCommand(const char* cmd, bool ack = true);
+    // Línea completa: [@<seq> ]cmd[;cmd...], partida en el sitio
+    void processLine(char* line);
     TelemetryData buildTelemetryData();
+    void buildTelemetryWire(TelemetryWire& w);
+    __attribute__((noinline)) void sendTelemetryBinary(uint8_t mask = TELEMETRY_ALL_GROUPS);
 };
 
+#ifdef __AVR_ATmega328P__
+// Nano: con config, HardwareSerial, el core y la pila del peor camino (~370 bytes) no
+// sobra casi nada de los 2 KB. Un tuner nuevo va en la unión de Robot.
+static_assert(sizeof(Robot) <= 1250, "Robot no entra en la SRAM del Nano");
+#endif
+
 #endif
\ No newline at end of file
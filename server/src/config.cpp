@@ -1,10 +1,8 @@
 #include "config.h"
 
 // FeaturesConfig implementations
-const char* FeaturesConfig::serialize() {
-    static char buf[22];
-    sprintf(buf, "[%d,%d,%d,%d,%d,%d,%d,%d,%d]", medianFilter, movingAverage, kalmanFilter, hysteresis, deadZone, lowPass, dynamicLinePid, speedProfiling, turnDirection);
-    return buf;
+void FeaturesConfig::serialize(char* out) const {
+    snprintf_P(out, FEATURES_TEXT_SIZE, PSTR("[%d,%d,%d,%d,%d,%d,%d,%d,%d]"), medianFilter, movingAverage, kalmanFilter, hysteresis, deadZone, lowPass, dynamicLinePid, speedProfiling, turnDirection);
 }
 
 bool FeaturesConfig::deserialize(const char* cmd) {
@@ -56,6 +54,30 @@ bool FeaturesConfig::getFeature(uint8_t idx) {
     }
 }
 
+uint8_t FeaturesConfig::getWindow(uint8_t idx) const {
+    switch(idx) {
+      case 0: return FILTER_WINDOW_MIN + 2 * medianTaps;
+      case 1: return FILTER_WINDOW_MIN + averageTaps;
+      default: return 0;
+    }
+}
+
+bool FeaturesConfig::setWindow(uint8_t idx, uint8_t length) {
+    if (length < FILTER_WINDOW_MIN || length > FILTER_WINDOW_MAX) return false;
+    switch(idx) {
+      case 0:
+        if (length % 2 == 0) return false;
+        medianTaps = (length - FILTER_WINDOW_MIN) / 2;
+        return true;
+      case 1:
+        if (length - FILTER_WINDOW_MIN > 7) return false;
+        averageTaps = length - FILTER_WINDOW_MIN;
+        return true;
+      default:
+        return false;
+    }
+}
+
 // RobotConfig implementations
 void RobotConfig::restoreDefaults() {
      lineKp = DEFAULT_LINE_KP;
@@ -85,12 +107,117 @@ void RobotConfig::restoreDefaults() {
      loopSpeedMs = DEFAULT_LOOP_SPEED_MS;
      telemetryIntervalMs = DEFAULT_TELEMTRY_INTERVAL_MS;
      robotWeight = DEFAULT_ROBOT_WEIGHT;
-     checksum = 1234567892;
+     for (uint8_t i = 0; i < BIQUAD_SIGNAL_COUNT; i++) biquad[i] = DEFAULT_BIQUAD;
+     estimator = DEFAULT_ESTIMATOR;
+     speedFeedforward = false;
      for (int i = 0; i < 8; i++) {
          sensorMin[i] = 0;
          sensorMax[i] = 1023;
      }
 }
 
+bool migrateConfig(uint16_t version, const uint8_t* raw, uint16_t len, RobotConfig& out) {
+    out.restoreDefaults();
+    switch (version) {
+    case 1:
+        // v1 -> v2: se quitó el checksum final; el resto del layout no cambió
+        if (len < CONFIG_V1_SIZE) return false;
+        memcpy(&out, raw, CONFIG_V2_SIZE);
+        return true;
+    case CONFIG_SCHEMA_VERSION:
+        // Mismo esquema escrito por un firmware con más o menos campos al final
+        memcpy(&out, raw, len < sizeof(RobotConfig) ? len : sizeof(RobotConfig));
+        return true;
+    default:
+        return false;
+    }
+}
+
+// TuningProfile implementations
+void TuningProfile::capture(const RobotConfig& c) {
+     lineKp = c.lineKp; lineKi = c.lineKi; lineKd = c.lineKd;
+     leftKp = c.leftKp; leftKi = c.leftKi; leftKd = c.leftKd;
+     rightKp = c.rightKp; rightKi = c.rightKi; rightKd = c.rightKd;
+     basePwm = c.basePwm;
+     maxPwm = c.maxPwm;
+     baseRPM = c.baseRPM;
+     maxRpm = c.maxRpm;
+     cascadeMode = c.cascadeMode;
+     features = c.features;
+}
+
+void TuningProfile::apply(RobotConfig& c) const {
+     c.lineKp = lineKp; c.lineKi = lineKi; c.lineKd = lineKd;
+     c.leftKp = leftKp; c.leftKi = leftKi; c.leftKd = leftKd;
+     c.rightKp = rightKp; c.rightKi = rightKi; c.rightKd = rightKd;
+     c.basePwm = basePwm;
+     c.maxPwm = maxPwm;
+     c.baseRPM = baseRPM;
+     c.maxRpm = maxRpm;
+     c.cascadeMode = cascadeMode;
+     c.features = features;
+}
+
+// MotorModel implementations
+int16_t MotorCurve::pwmFor(int16_t r) const {
+     if (r <= 0) return 0;
+     // Debajo del primer punto la rueda no sostiene el giro: se compensa la banda muerta
+     // y el PID hace el resto
+     if (r <= rpm[0]) return deadband;
+     uint8_t i = 1;
+     while (i < MOTOR_LUT_POINTS - 1 && r > rpm[i]) i++;
+     // Tramo [i-1, i]; pasado el último punto sigue la pendiente del último tramo
+     int16_t p0 = pwmAt(i - 1), p1 = pwmAt(i);
+     int16_t span = rpm[i] - rpm[i - 1];
+     if (span <= 0) return p1;
+     int32_t pwm = p0 + (int32_t)(r - rpm[i - 1]) * (p1 - p0) / span;
+     return pwm > LIMIT_MAX_PWM ? LIMIT_MAX_PWM : (int16_t)pwm;
+}
+
+bool MotorModel::valid() const {
+     for (uint8_t i = 0; i < MOTOR_CURVE_COUNT; i++) {
+         if (curve[i].topPwm <= curve[i].deadband || curve[i].rpm[MOTOR_LUT_POINTS - 1] <= 0) return false;
+     }
+     return true;
+}
+
+// ControlParams implementations
+void ControlParams::build(const RobotConfig& c) {
+     basePwm = c.basePwm;
+     maxPwm = c.maxPwm;
+     baseRPM = c.baseRPM;
+     maxRpm = c.maxRpm;
+     cascadeMode = c.cascadeMode;
+     operationMode = c.operationMode;
+     features = c.features;
+     loopLineMs = c.loopLineMs;
+     loopSpeedMs = c.loopSpeedMs;
+     telemetryIntervalMs = c.telemetryIntervalMs;
+
+     dtLine = loopLineMs / 1000.0f;
+     dtSpeed = loopSpeedMs / 1000.0f;
+     invDtLine = 1000.0f / loopLineMs;
+     curvatureHigh = 500.0f * loopLineMs / 1000.0f;
+     curvatureLow = 100.0f * loopLineMs / 1000.0f;
+     rpmToCms = (PI * (c.wheelDiameter / 10.0f)) / 60.0f;
+     // Los coeficientes dependen de la frecuencia de muestreo de cada lazo
+     for (uint8_t i = 0; i < BIQUAD_SIGNAL_COUNT; i++) {
+         const BiquadConfig& b = c.biquad[i];
+         float fs = 1000.0f / (i == BQ_RPM ? loopSpeedMs : loopLineMs);
+         designBiquad((BiquadType)b.type, b.fcDeciHz / 10.0f, b.qCenti / 100.0f, fs, biquad[i]);
+     }
+     estimator = c.estimator;
+     speedFeedforward = c.speedFeedforward;
+     mmPerPulseQ16 = c.pulsesPerRevolution > 0
+         ? lroundf(PI * c.wheelDiameter / c.pulsesPerRevolution * 65536.0f) : 0;
+     invWheelDistanceQ16 = c.wheelDistance > 0 ? lroundf(65536.0f / c.wheelDistance) : 0;
+}
+
+volatile uint8_t configEpoch = 0;
+
+void publishConfig() {
+     configEpoch++;
+}
+
 // Global config instance
 RobotConfig config;
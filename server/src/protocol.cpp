@@ -0,0 +1,179 @@
+#include "protocol.h"
+#include <util/crc16.h>
+
+#define GROUP(first, next) { offsetof(TelemetryWire, first), offsetof(TelemetryWire, next) - offsetof(TelemetryWire, first) }
+
+const TelemetryGroup TELEMETRY_GROUPS[TELEMETRY_GROUP_COUNT] PROGMEM = {
+    GROUP(uptime, linePos),
+    GROUP(linePos, lRpm),
+    GROUP(lRpm, rRpm),
+    GROUP(rRpm, leftSpeedCms),
+    GROUP(leftSpeedCms, sensors),
+    GROUP(sensors, rcSeq),
+    { offsetof(TelemetryWire, rcSeq), sizeof(TelemetryWire) - offsetof(TelemetryWire, rcSeq) },
+};
+
+const char TELEMETRY_GROUP_NAMES[TELEMETRY_GROUP_COUNT][6] PROGMEM = {
+    "sys", "line", "left", "right", "speed", "qtr", "rc"
+};
+
+size_t packTelemetryGroups(const TelemetryWire& w, uint8_t mask, uint8_t* out) {
+    const uint8_t* src = (const uint8_t*)&w;
+    size_t len = 0;
+    out[len++] = mask;
+    for (uint8_t g = 0; g < TELEMETRY_GROUP_COUNT; g++) {
+        if (!(mask & (1 << g))) continue;
+        uint8_t offset = pgm_read_byte(&TELEMETRY_GROUPS[g].offset);
+        uint8_t size = pgm_read_byte(&TELEMETRY_GROUPS[g].size);
+        memcpy(out + len, src + offset, size);
+        len += size;
+    }
+    return len;
+}
+
+const uint8_t TELEMETRY_FIELD_SIZES[TELEMETRY_FIELD_COUNT] PROGMEM = {
+    4, 2, 2, 2, 1, 2, 1,           // TG_SYS
+    2, 2, 2, 2, 2,                 // TG_LINE
+    2, 2, 2, 2, 2, 2, 2, 4, 4,     // TG_LEFT
+    2, 2, 2, 2, 2, 2, 2, 4, 4,     // TG_RIGHT
+    2, 2,                          // TG_SPEED
+    2, 2, 2, 2, 2, 2, 2, 2,        // TG_QTR
+    1, 2, 2,                       // TG_RC
+};
+
+size_t packTelemetryDelta(const TelemetryWire& w, TelemetryWire& ref, uint8_t mask, uint8_t* out, size_t cap) {
+    const uint8_t* cur = (const uint8_t*)&w;
+    const uint8_t* prev = (const uint8_t*)&ref;
+    // Campos de los grupos marcados, para reservar el mapa de bits de cambios
+    uint8_t fields = 0;
+    uint8_t offset = 0;
+    uint8_t group = 0;
+    uint8_t groupEnd = pgm_read_byte(&TELEMETRY_GROUPS[0].size);
+    for (uint8_t f = 0; f < TELEMETRY_FIELD_COUNT; f++) {
+        if (offset >= groupEnd) groupEnd += pgm_read_byte(&TELEMETRY_GROUPS[++group].size);
+        if (mask & (1 << group)) fields++;
+        offset += pgm_read_byte(&TELEMETRY_FIELD_SIZES[f]);
+    }
+    uint8_t* bitmap = out + 1;
+    size_t len = 1 + (fields + 7) / 8;
+    if (len > cap) return 0;
+    out[0] = mask;
+    memset(bitmap, 0, len - 1);
+
+    uint8_t bit = 0;
+    offset = 0;
+    group = 0;
+    groupEnd = pgm_read_byte(&TELEMETRY_GROUPS[0].size);
+    for (uint8_t f = 0; f < TELEMETRY_FIELD_COUNT; f++) {
+        uint8_t size = pgm_read_byte(&TELEMETRY_FIELD_SIZES[f]);
+        if (offset >= groupEnd) groupEnd += pgm_read_byte(&TELEMETRY_GROUPS[++group].size);
+        if (mask & (1 << group)) {
+            uint32_t a = 0, b = 0;
+            memcpy(&a, cur + offset, size);
+            memcpy(&b, prev + offset, size);
+            uint32_t d = a - b;
+            int32_t delta = size == 1 ? (int32_t)(int8_t)d : size == 2 ? (int32_t)(int16_t)d : (int32_t)d;
+            if (delta) {
+                // Peor caso 5 bytes por campo; se corta antes de pasarse
+                if (len + 5 > cap) return 0;
+                bitmap[bit >> 3] |= 1 << (bit & 7);
+                len += putVarint(out + len, zigzagEncode(delta));
+            }
+            bit++;
+        }
+        offset += size;
+    }
+    copyTelemetryGroups(w, ref, mask);
+    return len;
+}
+
+void copyTelemetryGroups(const TelemetryWire& w, TelemetryWire& ref, uint8_t mask) {
+    for (uint8_t g = 0; g < TELEMETRY_GROUP_COUNT; g++) {
+        if (!(mask & (1 << g))) continue;
+        uint8_t offset = pgm_read_byte(&TELEMETRY_GROUPS[g].offset);
+        memcpy((uint8_t*)&ref + offset, (const uint8_t*)&w + offset, pgm_read_byte(&TELEMETRY_GROUPS[g].size));
+    }
+}
+
+size_t putVarint(uint8_t* out, uint32_t v) {
+    size_t n = 0;
+    while (v >= 0x80) {
+        out[n++] = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    out[n++] = (uint8_t)v;
+    return n;
+}
+
+int8_t findTelemetryGroup(const char* name) {
+    for (uint8_t g = 0; g < TELEMETRY_GROUP_COUNT; g++) {
+        if (strcasecmp_P(name, TELEMETRY_GROUP_NAMES[g]) == 0) return g;
+    }
+    return -1;
+}
+
+uint16_t crc16Ccitt(const uint8_t* data, size_t len) {
+    uint16_t crc = 0xFFFF;
+    while (len--) crc = _crc_xmodem_update(crc, *data++);
+    return crc;
+}
+
+uint16_t crc16CcittStep(uint16_t crc, uint8_t b) {
+    return _crc_xmodem_update(crc, b);
+}
+
+uint32_t crc32Update(uint32_t crc, const uint8_t* data, size_t len) {
+    // Bit a bit: sin tabla en flash, solo se usa al guardar/cargar la configuración
+    while (len--) {
+        crc ^= *data++;
+        for (uint8_t i = 0; i < 8; i++) crc = (crc >> 1) ^ (0xEDB88320UL & -(crc & 1));
+    }
+    return crc;
+}
+
+size_t cobsEncode(const uint8_t* in, size_t len, uint8_t* out) {
+    size_t codeIdx = 0;
+    size_t outIdx = 1;
+    uint8_t code = 1;
+    for (size_t i = 0; i < len; i++) {
+        if (in[i] == 0) {
+            out[codeIdx] = code;
+            codeIdx = outIdx++;
+            code = 1;
+        } else {
+            out[outIdx++] = in[i];
+            if (++code == 0xFF) {
+                out[codeIdx] = code;
+                codeIdx = outIdx++;
+                code = 1;
+            }
+        }
+    }
+    out[codeIdx] = code;
+    return outIdx;
+}
+
+size_t buildFrame(uint8_t type, uint16_t seq, const void* payload, size_t len, uint8_t* out) {
+    uint8_t raw[FRAME_MAX_RAW];
+    if (len > FRAME_MAX_RAW - FRAME_HEADER_SIZE - 2) return 0;
+    raw[0] = type;
+    raw[1] = seq & 0xFF;
+    raw[2] = seq >> 8;
+    memcpy(raw + FRAME_HEADER_SIZE, payload, len);
+    size_t rawLen = FRAME_HEADER_SIZE + len;
+    uint16_t crc = crc16Ccitt(raw, rawLen);
+    raw[rawLen++] = crc & 0xFF;
+    raw[rawLen++] = crc >> 8;
+
+    out[0] = 0x00;
+    size_t n = cobsEncode(raw, rawLen, out + 1);
+    out[n + 1] = 0x00;
+    return n + 2;
+}
+
+int16_t toFixed16(float v, float scale) {
+    float s = v * scale;
+    if (s >= 32767.0f) return 32767;
+    if (s <= -32768.0f) return -32768;
+    return (int16_t)(s >= 0 ? s + 0.5f : s - 0.5f);
+}
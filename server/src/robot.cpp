@@ -10,7 +10,7 @@ Motor* Robot::leftMotorPtr;
 Motor* Robot::rightMotorPtr;
 
 // Motor implementations
-Motor::Motor(uint8_t p1, uint8_t p2, Location loc, uint8_t encA, uint8_t encB) : pin1(p1), pin2(p2), speed(0), location(loc), forwardCount(0), backwardCount(0), lastCount(0), lastSpeedCheck(0), currentRPM(0), filteredRPM(0), targetRPM(0), encoderAPin(encA), encoderBPin(encB) {
+Motor::Motor(uint8_t p1, uint8_t p2, Location loc, uint8_t encA, uint8_t encB) : pin1(p1), pin2(p2), speed(0), location(loc), forwardCount(0), backwardCount(0), lastCount(0), lastSpeedCheck(0), currentRPM(0), filteredRPM(0), encoderAPin(encA), encoderBPin(encB) {
 }
 
 void Motor::init() {
@@ -45,29 +45,30 @@ int Motor::getSpeed() {
     return speed;
 }
 
-float Motor::getRPM() {
+void Motor::updateRPM() {
+    // 0.9 y 0.1 en Q16: constantes sin estático con guarda en SRAM ni conversión de float
+    const real_t KEEP = realFromRaw(58982);
+    const real_t GAIN = realFromRaw(6554);
     unsigned long now = millis();
-    if (now - lastSpeedCheck < 100) return currentRPM;
-    long currentCount = forwardCount - backwardCount;
+    if (now - lastSpeedCheck < 100) return;
+    long currentCount = getNetCount();
     long delta = currentCount - lastCount;
-    float dt = (now - lastSpeedCheck) / 1000.0;
-    currentRPM = (delta / (float)config.pulsesPerRevolution) * 60.0 / dt;
-    filteredRPM = 0.9 * filteredRPM + 0.1 * currentRPM;
+    // RPM = delta / PPR · 60000 / ms, redondeado y en enteros
+    long den = (long)config.pulsesPerRevolution * (long)(now - lastSpeedCheck);
+    long num = delta * 60000L;
+    int rpm = den > 0 ? (int)((num + (num >= 0 ? den / 2 : -den / 2)) / den) : 0;
+    currentRPM = rpm;
+    filteredRPM = KEEP * filteredRPM + GAIN * real_t(rpm);
     lastCount = currentCount;
     lastSpeedCheck = now;
-    return currentRPM;
-}
-
-float Motor::getFilteredRPM() {
-    return filteredRPM;
 }
 
-void Motor::setTargetRPM(float t) {
-    targetRPM = t;
+float Motor::getRPM() {
+    return currentRPM;
 }
 
-float Motor::getTargetRPM() {
-    return targetRPM;
+real_t Motor::getFilteredRPM() {
+    return filteredRPM;
 }
 
 long Motor::getEncoderCount() {
@@ -78,6 +79,13 @@ long Motor::getBackwardCount() {
     return backwardCount;
 }
 
+long Motor::getNetCount() {
+    noInterrupts();
+    long net = forwardCount - backwardCount;
+    interrupts();
+    return net;
+}
+
 void Motor::updateEncoder() {
     if (location == LEFT) {
       if (digitalRead(encoderBPin)) {
@@ -114,66 +122,61 @@ Robot::Robot() :
     debugger(),
     serialReader(),
     features(),
-    lastPidOutput(0),
+    motorModelValid(false),
+    reportKind(REPORT_NONE),
+    reportLine(0),
+    appliedEpoch(0),
     lastTelemetryTime(0),
     lastLineTime(0),
     lastSpeedTime(0),
     lastLinePosition(0),
     loopTime(0),
-    loopStartTime(0),
     leftTargetRPM(0),
     rightTargetRPM(0),
     throttle(0),
     steering(0),
+    rcPending(false),
+    rcRxSeq(0),
+    rcSeq(0),
+    rcRxUs(0),
+    rcLatencyUs(0),
+    activeProfile(NO_PROFILE),
     lastLedTime(0),
     ledState(false),
     previousLinePosition(0),
-    currentCurvature(0),
     filteredCurvature(0),
     currentSensorState(NORMAL),
-    lastTurnDirection(1),
-    autoTuningActive(false),
-    autoTuneStartTime(0),
-    autoTuneTestStartTime(0),
-    currentTestIndex(0),
-    totalTests(0),
-    bestIAE(999999.0f),
-    bestKp(0), bestKi(0), bestKd(0),
-    originalKp(0), originalKi(0), originalKd(0),
-    accumulatedIAE(0),
-    samplesCount(0),
-    lastPosition(0),
-    maxDeviation(0)
+    tool(TOOL_NONE),
+    recorderTriggers(0),
+    recorderDeviation(DEFAULT_RECORDER_DEVIATION),
+    recorderLastState(NORMAL),
+    dumping(false),
+    dumpIndex(0),
+    calibrationPending(false),
+    baudState(BAUD_IDLE),
+    serialBaud(SERIAL_DEFAULT_BAUD),
+    pendingBaud(SERIAL_DEFAULT_BAUD),
+    baudDeadline(0)
 {
-    // Initialize commands
-    commands[0] = {"calibrate", &Robot::handleCalibrate};
-    commands[1] = {"save", &Robot::handleSave};
-    commands[2] = {"get debug", &Robot::handleGetDebug};
-    commands[3] = {"get telemetry", &Robot::handleGetTelemetry};
-    commands[4] = {"get config", &Robot::handleGetConfig};
-    commands[5] = {"reset", &Robot::handleReset};
-    commands[6] = {"help", &Robot::handleHelp};
-    commands[7] = {"set telemetry ", &Robot::handleSetTelemetry};
-    commands[8] = {"set mode ", &Robot::handleSetMode};
-    commands[9] = {"set cascade ", &Robot::handleSetCascade};
-    commands[10] = {"set feature ", &Robot::handleSetFeature};
-    commands[11] = {"set features ", &Robot::handleSetFeatures};
-    commands[12] = {"set line ", &Robot::handleSetLine};
-    commands[13] = {"set left ", &Robot::handleSetLeft};
-    commands[14] = {"set right ", &Robot::handleSetRight};
-    commands[15] = {"set base ", &Robot::handleSetBase};
-    commands[16] = {"set max ", &Robot::handleSetMax};
-    commands[17] = {"set weight ", &Robot::handleSetWeight};
-    commands[18] = {"set samp_rate ", &Robot::handleSetSampRate};
-    commands[19] = {"rc ", &Robot::handleRc};
-    commands[20] = {"set pwm ", &Robot::handleSetPwm};
-    commands[21] = {"set rpm ", &Robot::handleSetRpm};
-    commands[22] = {"autotune", &Robot::handleAutoTune};
-    commands[23] = {NULL, NULL};
 }
 
+#ifdef __AVR__
+// init() pinta la SRAM libre entre el final de .bss y la pila. La pila baja pisando la
+// pintura, así que los bytes intactos son el mínimo libre que hubo desde el arranque,
+// con el peor camino de loop() y de las ISR incluido (get mem).
+extern uint8_t __heap_start;
+static const uint8_t STACK_PAINT = 0xC5;
+
+static void paintStack() {
+    for (uint8_t* p = &__heap_start; p < (uint8_t*)SP; p++) *p = STACK_PAINT;
+}
+#endif
+
 void Robot::init() {
-    Serial.begin(115200);
+#ifdef __AVR__
+    paintStack();
+#endif
+    Serial.begin(SERIAL_DEFAULT_BAUD);
     while (!Serial);
 
     leftMotor.init();
@@ -187,16 +190,18 @@ void Robot::init() {
     digitalWrite(MODE_LED_PIN, LOW);
 
     eeprom.load();
-    linePid.setGains(config.lineKp, config.lineKi, config.lineKd);
-    leftPid.setGains(config.leftKp, config.leftKi, config.leftKd);
-    rightPid.setGains(config.rightKp, config.rightKi, config.rightKd);
-    features.setConfig(config.features);
-
-    qtr.setCalibration(config.sensorMin, config.sensorMax);
+    {
+        MotorModel model;
+        motorModelValid = eeprom.loadMotorModel(model);
+    }
+    applyConfig();
+    if (config.telemetry == TELEMETRY_DELTA && claimTool(TOOL_DELTA)) debugger.setDeltaMode(&deltaRef);
 
     qtr.calibrate();
 
-    debugger.systemMessage("Robot iniciado. Modo: " + String(config.operationMode));
+    char msg[32];
+    snprintf_P(msg, sizeof(msg), PSTR("Robot iniciado. Modo: %d"), (int)config.operationMode);
+    debugger.systemMessage(msg);
     lastLineTime = millis();
     lastSpeedTime = millis();
 }
@@ -204,279 +209,291 @@ void Robot::init() {
 void Robot::run() {
     unsigned long currentMillis = millis();
 
-    if (currentMillis - lastLineTime >= config.loopLineMs) {
+    // Límite de tick: adoptar la configuración publicada por los comandos
+    if (appliedEpoch != configEpoch) {
+        applyConfig();
+    }
+
+    if (currentMillis - lastLineTime >= params.loopLineMs) {
         lastLineTime = currentMillis;
-        float dtLine = config.loopLineMs / 1000.0;
+        real_t dtLine = params.dtLine;
 
-        if (config.operationMode == MODE_LINE_FOLLOWING) {
+        if (params.operationMode == MODE_LINE_FOLLOWING) {
             qtr.read();
-            int16_t* rawSensors = qtr.getRawSensorValues();
-            SensorState state = checkSensorState(rawSensors);
+            SensorState state = qtr.sensorState;
             currentSensorState = state;
 
-            float currentPosition = features.applySignalFilters(qtr.linePosition);
-            
-            // Auto-tuning logic
-            if (autoTuningActive) {
-                performAutoTune(currentPosition, dtLine);
+            // Posición en enteros (±4000) desde el QTR hasta el PID
+            int16_t currentPosition;
+            if (params.estimator.enabled) {
+                // El estimador toma la lectura cruda: reemplaza a los filtros y al biquad
+                estimator.update(params, leftMotor.getNetCount(), rightMotor.getNetCount(),
+                                 qtr.linePosition, qtr.lineContrast);
+                currentPosition = estimator.getPosition();
+            } else {
+#ifdef FIXED_FILTERS
+                currentPosition = lineFilter.process(qtr.linePosition);
+#else
+                currentPosition = features.applySignalFilters(qtr.linePosition);
+#endif
+                if (params.biquad[BQ_POSITION].active) {
+                    currentPosition = positionBiquad.process(params.biquad[BQ_POSITION], currentPosition);
+                }
+            }
+
+            if (autoTuning()) {
+                serviceLapTuner(currentPosition, currentMillis, toFloat(dtLine));
             }
             
-            float curvature = abs(currentPosition - previousLinePosition) / dtLine;
+            // Curvatura por tick: los umbrales (500 y 100 por segundo) vienen escalados en params
+            real_t curvature = real_t(abs(currentPosition - previousLinePosition));
             previousLinePosition = currentPosition;
-            currentCurvature = curvature;
-            filteredCurvature = 0.8 * filteredCurvature + 0.2 * curvature;
-
-            if (currentPosition > 10) lastTurnDirection = 1;
-            else if (currentPosition < -10) lastTurnDirection = -1;
-
-            float applyBaseRPM = config.baseRPM;
-            int applyBaseSpeed = config.basePwm;
-            if(config.features.speedProfiling) {
-                if(filteredCurvature > 500.0f) {
-                    applyBaseRPM = max(60.0f, applyBaseRPM - 30.0f);
+            filteredCurvature = real_t(0.8f) * filteredCurvature + real_t(0.2f) * curvature;
+
+            real_t applyBaseRPM = params.baseRPM;
+            int applyBaseSpeed = params.basePwm;
+            if(params.features.speedProfiling) {
+                if(filteredCurvature > params.curvatureHigh) {
+                    applyBaseRPM = applyBaseRPM - real_t(30);
+                    if (applyBaseRPM < real_t(60)) applyBaseRPM = real_t(60);
                     applyBaseSpeed = max(100, applyBaseSpeed - 50);
-                } else if(filteredCurvature < 100.0f) {
-                    applyBaseRPM = min(config.baseRPM + 20.0f, applyBaseRPM + 10.0f);
-                    applyBaseSpeed = min(config.maxPwm, applyBaseSpeed + 20);
+                } else if(filteredCurvature < params.curvatureLow) {
+                    applyBaseRPM = applyBaseRPM + real_t(10);
+                    applyBaseSpeed = min(params.maxPwm, applyBaseSpeed + 20);
                 }
             }
 
-            float pidOutput;
+            real_t pidOutput;
             lastLinePosition = currentPosition;
-            float error = 0 - lastLinePosition;
-            linePid.setGains(config.lineKp, config.lineKi, config.lineKd);
-            pidOutput = linePid.calculate(0, error, dtLine);
-            lastPidOutput = pidOutput;
+            real_t error = real_t(-currentPosition);
+            if (relayTuning() && serviceRelayLine(currentPosition, currentMillis, pidOutput)) {
+                // Autotune: el relé manda en lugar del PID de línea
+            } else if (params.estimator.enabled) {
+                pidOutput = linePid.calculate(real_t(0), error, dtLine, -estimator.getRate(params.invDtLine));
+            } else {
+                pidOutput = linePid.calculate(real_t(0), error, dtLine, &derivativeBiquad, &params.biquad[BQ_DERIVATIVE]);
+            }
 
-            if (config.cascadeMode) {
-                float rpmAdjustment = pidOutput * 0.5;
+            if (params.cascadeMode) {
+                real_t rpmAdjustment = pidOutput * real_t(0.5f);
                 leftTargetRPM = applyBaseRPM + rpmAdjustment;
                 rightTargetRPM = applyBaseRPM - rpmAdjustment;
             } else {
-                int leftSpeed = applyBaseSpeed + pidOutput;
-                int rightSpeed = applyBaseSpeed - pidOutput;
-                leftSpeed = constrain(leftSpeed, -config.maxPwm, config.maxPwm);
-                rightSpeed = constrain(rightSpeed, -config.maxPwm, config.maxPwm);
+                int correction = toInt(pidOutput);
+                int leftSpeed = applyBaseSpeed + correction;
+                int rightSpeed = applyBaseSpeed - correction;
+                leftSpeed = constrain(leftSpeed, -params.maxPwm, params.maxPwm);
+                rightSpeed = constrain(rightSpeed, -params.maxPwm, params.maxPwm);
                 leftMotor.setSpeed(leftSpeed);
                 rightMotor.setSpeed(rightSpeed);
             }
         }
     }
 
-    if (currentMillis - lastSpeedTime >= config.loopSpeedMs) {
+    if (currentMillis - lastSpeedTime >= params.loopSpeedMs) {
         lastSpeedTime = currentMillis;
-        loopStartTime = micros();
-        float dtSpeed = config.loopSpeedMs / 1000.0;
+        unsigned long loopStartTime = micros();
+        real_t dtSpeed = params.dtSpeed;
+        leftMotor.updateRPM();
+        rightMotor.updateRPM();
 
-        if (config.operationMode == MODE_REMOTE_CONTROL) {
+        if (params.operationMode == MODE_REMOTE_CONTROL) {
             leftTargetRPM = throttle - steering;
             rightTargetRPM = throttle + steering;
-            leftTargetRPM = constrain(leftTargetRPM, -config.maxRpm, config.maxRpm);
-            rightTargetRPM = constrain(rightTargetRPM, -config.maxRpm, config.maxRpm);
-        } else if (config.operationMode == MODE_LINE_FOLLOWING && config.cascadeMode) {
+            leftTargetRPM = constrain(leftTargetRPM, -params.maxRpm, params.maxRpm);
+            rightTargetRPM = constrain(rightTargetRPM, -params.maxRpm, params.maxRpm);
+        } else if (params.operationMode == MODE_LINE_FOLLOWING && params.cascadeMode) {
             // targetRPMs already set
         }
 
-        if (config.operationMode == MODE_REMOTE_CONTROL || (config.operationMode == MODE_LINE_FOLLOWING && config.cascadeMode)) {
-            int leftSpeed = leftPid.calculate(leftTargetRPM, leftMotor.getFilteredRPM(), dtSpeed);
-            int rightSpeed = rightPid.calculate(rightTargetRPM, rightMotor.getFilteredRPM(), dtSpeed);
+        // Feedforward del modelo de motores: el PID de RPM solo corrige lo que falta.
+        // Va después de actualizar los objetivos de RC para usar los de este tick
+        int16_t leftFf = 0, rightFf = 0;
+        if (params.speedFeedforward && motorModelValid) {
+            leftFf = motorFeedforward(false, leftTargetRPM);
+            rightFf = motorFeedforward(true, rightTargetRPM);
+        }
+        leftPid.setFeedforward(real_t((int)leftFf));
+        rightPid.setFeedforward(real_t((int)rightFf));
 
-            leftSpeed = constrain(leftSpeed, -config.maxPwm, config.maxPwm);
-            rightSpeed = constrain(rightSpeed, -config.maxPwm, config.maxPwm);
+        if (params.operationMode == MODE_REMOTE_CONTROL || (params.operationMode == MODE_LINE_FOLLOWING && params.cascadeMode)) {
+            int leftSpeed = toInt(leftPid.calculate(leftTargetRPM, filterRpm(leftRpmBiquad, leftMotor.getFilteredRPM()), dtSpeed));
+            int rightSpeed = toInt(rightPid.calculate(rightTargetRPM, filterRpm(rightRpmBiquad, rightMotor.getFilteredRPM()), dtSpeed));
 
-            int currentMax = max(abs(leftSpeed), abs(rightSpeed));
-            if(currentMax > config.maxPwm) {
-                config.maxPwm = currentMax;
-                saveConfig();
-            }
+            leftSpeed = constrain(leftSpeed, -params.maxPwm, params.maxPwm);
+            rightSpeed = constrain(rightSpeed, -params.maxPwm, params.maxPwm);
 
             leftMotor.setSpeed(leftSpeed);
             rightMotor.setSpeed(rightSpeed);
-        } else if (config.operationMode == MODE_IDLE) {
-            int leftSpeed = leftPid.calculate(leftTargetRPM, leftMotor.getFilteredRPM(), dtSpeed);
-            int rightSpeed = rightPid.calculate(rightTargetRPM, rightMotor.getFilteredRPM(), dtSpeed);
-
-            leftSpeed = constrain(leftSpeed, -config.maxPwm, config.maxPwm);
-            rightSpeed = constrain(rightSpeed, -config.maxPwm, config.maxPwm);
+            if (rcPending && params.operationMode == MODE_REMOTE_CONTROL) {
+                uint32_t latency = micros() - rcRxUs;
+                rcLatencyUs = latency > 0xFFFF ? 0xFFFF : latency;
+                rcSeq = rcRxSeq;
+                rcPending = false;
+            }
+        } else if (identifying()) {
+            serviceIdentification(currentMillis);
+        } else if (stepTesting()) {
+            serviceStepTest(currentMillis);
+        } else if (relayTuning() && params.operationMode == MODE_IDLE) {
+            serviceRelayWheels(currentMillis);
+        } else if (params.operationMode == MODE_IDLE) {
+            int leftSpeed = toInt(leftPid.calculate(leftTargetRPM, filterRpm(leftRpmBiquad, leftMotor.getFilteredRPM()), dtSpeed));
+            int rightSpeed = toInt(rightPid.calculate(rightTargetRPM, filterRpm(rightRpmBiquad, rightMotor.getFilteredRPM()), dtSpeed));
+
+            leftSpeed = constrain(leftSpeed, -params.maxPwm, params.maxPwm);
+            rightSpeed = constrain(rightSpeed, -params.maxPwm, params.maxPwm);
 
             leftMotor.setSpeed(leftSpeed);
             rightMotor.setSpeed(rightSpeed);
         }
 
         loopTime = micros() - loopStartTime;
+        recordSample();
+
+        // Suscripciones binarias: cada grupo sale cada N ticks del lazo de velocidad
+        if (config.telemetry >= TELEMETRY_BINARY && debugger.hasSubscriptions()) {
+            uint8_t mask = debugger.dueGroups();
+            if (mask) sendTelemetryBinary(mask);
+        }
     }
 
-    if (config.telemetry && (millis() - lastTelemetryTime > config.telemetryIntervalMs)) {
-        TelemetryData data = buildTelemetryData();
-        debugger.sendTelemetryData(data);
+    bool subscribed = config.telemetry >= TELEMETRY_BINARY && debugger.hasSubscriptions();
+    if (config.telemetry != TELEMETRY_OFF && !subscribed && (millis() - lastTelemetryTime > params.telemetryIntervalMs)) {
+        if (config.telemetry >= TELEMETRY_BINARY) {
+            sendTelemetryBinary();
+        } else {
+            debugger.sendTelemetryData();
+        }
         lastTelemetryTime = millis();
     }
-
-    if (config.operationMode == MODE_LINE_FOLLOWING) {
-        if (autoTuningActive) {
+    if (calibrationPending) serviceCalibration();
+    if (dumping) serviceDump();
+    if (reportKind != REPORT_NONE) serviceReport();
+    if (baudState != BAUD_IDLE) serviceBaud();
+    serviceDebugger();
+    eeprom.service(params.operationMode == MODE_IDLE);
+
+    if (params.operationMode == MODE_LINE_FOLLOWING) {
+        if (autoTuning() || relayTuning()) {
             updateModeLed(currentMillis, 200); // Faster blink during auto-tuning
         } else {
             updateModeLed(currentMillis, 100);
         }
-    } else if (config.operationMode == MODE_REMOTE_CONTROL) {
+    } else if (params.operationMode == MODE_REMOTE_CONTROL) {
         updateModeLed(currentMillis, 500);
     } else {
         digitalWrite(MODE_LED_PIN, LOW);
     }
 
     serialReader.fillBuffer();
-    const char *cmd;
-    if (serialReader.getLine(&cmd)) {
-        if (strlen(cmd) == 0) return;
-        processCommand(cmd);
+    RcFrame rc;
+    if (serialReader.getRc(rc, rcRxUs)) {
+        throttle = rc.throttle;
+        steering = rc.steering;
+        rcRxSeq = rc.seq;
+        rcPending = true;
     }
-}
-
-// PID implementations
-PID::PID(float p, float i, float d, float maxOut, float minOut) : kp(p), ki(i), kd(d), error(0), lastError(0), integral(0), derivative(0), output(0), antiWindupEnabled(true), maxOutput(maxOut), minOutput(minOut) {}
-
-void PID::setGains(float p, float i, float d) {
-    kp = p;
-    ki = i;
-    kd = d;
-}
-
-float PID::calculate(float setpoint, float measurement, float dt) {
-    error = setpoint - measurement;
-    derivative = (error - lastError) / dt;
-
-    // Calcular términos
-    float pTerm = kp * error;
-    float iTerm = ki * integral;
-    float dTerm = kd * derivative;
-
-    // Anti-windup: integración condicional
-    if (antiWindupEnabled) {
-      float unsaturatedOutput = pTerm + iTerm + dTerm;
-      // Solo integrar si no está saturado en la dirección del error
-      if ((unsaturatedOutput < maxOutput || error <= 0) && (unsaturatedOutput > minOutput || error >= 0)) {
-        integral += error * dt;
-        integral = constrain(integral, -1000, 1000);
-      }
-    } else {
-      integral += error * dt;
-      integral = constrain(integral, -1000, 1000);
+    char *line;
+    if (serialReader.getLine(&line)) {
+        if (strlen(line) == 0) return;
+        processLine(line);
     }
-
-    iTerm = ki * integral;
-    output = pTerm + iTerm + dTerm;
-    output = constrain(output, minOutput, maxOutput);
-    lastError = error;
-    return output;
 }
 
-void PID::reset() {
-    error = 0;
-    lastError = 0;
-    integral = 0;
-    derivative = 0;
-    output = 0;
-}
-
-float PID::getOutput() {
-    return output;
-}
-
-float PID::getError() {
-    return error;
-}
-
-float PID::getIntegral() {
-    return integral;
-}
-
-float PID::getDerivative() {
-    return derivative;
+// Biquad: diseño RBJ y paso a Q14
+static bool toQ14(float v, int16_t& out) {
+    float scaled = v * (1 << BIQUAD_SHIFT);
+    if (scaled >= 32767.5f || scaled < -32768.5f) return false;
+    out = (int16_t)lroundf(scaled);
+    return true;
 }
 
-// Features implementations
-void Features::sort(float arr[], int n) {
-    for (int i = 0; i < n-1; i++) {
-        for (int j = 0; j < n-i-1; j++) {
-            if (arr[j] > arr[j+1]) {
-                float temp = arr[j];
-                arr[j] = arr[j+1];
-                arr[j+1] = temp;
-            }
-        }
+bool designBiquad(BiquadType type, float fc, float q, float fs, BiquadCoeffs& c) {
+    c.active = false;
+    if (type == BIQUAD_OFF) return true;
+    if (type >= BIQUAD_TYPE_COUNT || fc <= 0 || q <= 0 || fc >= 0.45f * fs) return false;
+    float w0 = 2.0f * PI * fc / fs;
+    float cosw = cos(w0);
+    float alpha = sin(w0) / (2.0f * q);
+    float b0, b1, b2;
+    switch (type) {
+    case BIQUAD_LOWPASS:  b0 = (1 - cosw) / 2; b1 = 1 - cosw;    b2 = b0; break;
+    case BIQUAD_HIGHPASS: b0 = (1 + cosw) / 2; b1 = -(1 + cosw); b2 = b0; break;
+    default:              b0 = 1;              b1 = -2 * cosw;   b2 = 1;  break;  // Notch
     }
+    float a0 = 1 + alpha;
+    if (!toQ14(b0 / a0, c.b0) || !toQ14(b1 / a0, c.b1) || !toQ14(b2 / a0, c.b2) ||
+        !toQ14(-2 * cosw / a0, c.a1) || !toQ14((1 - alpha) / a0, c.a2)) return false;
+    // Redondear cada coeficiente por separado corre la ganancia en continua (con fc/fs
+    // chico los b son de pocas cuentas); b1 absorbe la diferencia para que sea exacta
+    c.dcGain = type == BIQUAD_HIGHPASS ? 0 : (1 << BIQUAD_SHIFT);
+    int32_t sumA = (1L << BIQUAD_SHIFT) + c.a1 + c.a2;
+    int32_t mid = (int32_t)c.dcGain * sumA / (1L << BIQUAD_SHIFT) - c.b0 - c.b2;
+    if (mid < -32768 || mid > 32767) return false;
+    c.b1 = mid;
+    c.active = true;
+    return true;
 }
 
-Features::Features() : medianCount(0), movingSum(0), movingCount(0), kalmanX(0), kalmanP(100), hysteresisLast(0), lowPassLast(0) {
-    memset(medianBuffer, 0, sizeof(medianBuffer));
-    memset(movingBuffer, 0, sizeof(movingBuffer));
+// Features implementations
+Features::Features() : kalmanX(0), kalmanP(100) {
+    median.setLength(FILTER_WINDOW_MIN);
+    average.setLength(FILTER_WINDOW_MIN);
 }
 
 void Features::setConfig(FeaturesConfig& f) {
     config = f;
+    median.setLength(f.getWindow(0));
+    average.setLength(f.getWindow(1));
 }
 
-float Features::applySignalFilters(float raw) {
-    float current = raw;
+int16_t Features::applySignalFilters(int16_t raw) {
+    int16_t current = raw;
 
-    // 0: Median filter (3 samples)
+    // 0: Median filter (ventana impar, 3 por defecto)
     if (config.medianFilter) {
-        medianBuffer[medianCount] = raw * 100;
-        medianCount = (medianCount + 1) % 3;
-        if (medianCount == 0) { // buffer full
-            float arr[3] = {medianBuffer[0] / 100.0, medianBuffer[1] / 100.0, medianBuffer[2] / 100.0};
-            sort(arr, 3);
-            current = arr[1]; // median
-        }
+        current = median.process(current);
     }
 
-    // 1: Moving average (3 samples)
+    // 1: Moving average (3 muestras por defecto)
     if (config.movingAverage) {
-        movingSum -= movingBuffer[movingCount];
-        movingBuffer[movingCount] = current * 100;
-        movingSum += movingBuffer[movingCount];
-        movingCount = (movingCount + 1) % 3;
-        current = movingSum / 3.0 / 100.0;
+        current = average.process(current);
     }
 
     // 2: Kalman filter
     if (config.kalmanFilter) {
         kalmanP += 1; // 0.01 * 100
-        int32_t measurement = current * 100;
-        int32_t k = kalmanP * 100 / (kalmanP + 10); // k = P / (P + 0.1) scaled
+        int32_t measurement = (int32_t)current * 100;
+        int32_t k = (int32_t)kalmanP * 100 / (kalmanP + 10); // k = P / (P + 0.1) scaled
         kalmanX += k * (measurement - kalmanX) / 100;
-        kalmanP = kalmanP * (10000 - k) / 10000; // P *= (1 - k/100)
-        current = kalmanX / 100.0;
+        kalmanP = (int32_t)kalmanP * (10000 - k) / 10000; // P *= (1 - k/100)
+        current = kalmanX / 100;
     }
 
     // 3: Hysteresis (threshold 10)
     if (config.hysteresis) {
-        if (abs(current - hysteresisLast / 100.0) > 10) {
-            hysteresisLast = current * 100;
-        } else {
-            current = hysteresisLast / 100.0;
-        }
+        current = hysteresis.process(current);
     }
 
     // 4: Dead zone (threshold 5)
     if (config.deadZone) {
-        if (abs(current) < 5) current = 0;
+        current = deadZone.process(current);
     }
 
     // 5: Low pass (alpha 0.8)
     if (config.lowPass) {
-        current = 0.8 * (lowPassLast / 100.0) + 0.2 * current;
-        lowPassLast = current * 100;
+        current = lowPass.process(current);
     }
 
     return current;
 }
 
 // QTR implementations
-QTR::QTR() : linePosition(0.0) {
+QTR::QTR() : linePosition(0), sensorState(NORMAL), lineContrast(0) {
     for (int i = 0; i < 8; i++) {
       sensorMin[i] = 0;
-      sensorMax[i] = 1023;
+      sensorScale[i] = (1000L << 10) / 1023;
     }
 }
 
@@ -490,7 +507,10 @@ void QTR::init() {
 void QTR::setCalibration(int16_t minVals[], int16_t maxVals[]) {
     for (int i = 0; i < NUM_SENSORS; i++) {
       sensorMin[i] = minVals[i];
-      sensorMax[i] = maxVals[i];
+      int16_t range = maxVals[i] - minVals[i];
+      // Recíproco precalculado: read() normaliza con una multiplicación en vez de map()
+      // En Q10 cabe en 16 bits con rangos de 16 cuentas o más; uno menor satura
+      sensorScale[i] = range > 0 ? (uint16_t)min((1000L << 10) / range, 65535L) : 0;
     }
 }
 
@@ -498,36 +518,47 @@ void QTR::read() {
     int sum = 0;
     int weightedSum = 0;
     int totalVal = 0;
+    bool allBlack = true;
+    bool allWhite = true;
+    int minVal = 1000;
+    int maxVal = 0;
     digitalWrite(SENSOR_POWER_PIN, HIGH);
     delayMicroseconds(100);
     for (int i = 0; i < NUM_SENSORS; i++) {
       int val = analogRead(SENSOR_PINS[i]);
-      rawSensorValues[i] = val;
-      int range = sensorMax[i] - sensorMin[i];
-      if (range > 0) {
-        val = map(val, sensorMin[i], sensorMax[i], 0, 1000);
+      if (sensorScale[i] > 0) {
+        val = ((int32_t)(val - sensorMin[i]) * sensorScale[i]) >> 10;
+        val = constrain(val, 0, 1000);
+        if (val < QTR_BLACK_LEVEL) allBlack = false;
+        if (val > QTR_WHITE_LEVEL) allWhite = false;
       } else {
         val = 0; // Default if not calibrated
+        allBlack = allWhite = false;
       }
-      val = constrain(val, 0, 1000);
       sensorValues[i] = val;
       totalVal += val;
+      if (val < minVal) minVal = val;
+      if (val > maxVal) maxVal = val;
       int weight = 1000 - val;
       weightedSum += i * weight;
       sum += weight;
     }
     digitalWrite(SENSOR_POWER_PIN, LOW);
+    sensorState = allBlack ? ALL_BLACK : allWhite ? ALL_WHITE : NORMAL;
+    lineContrast = maxVal - minVal;
 
     // Calculate line position
     if (sum > 0) {
-      linePosition = ((float)weightedSum / sum - QTR_CENTER_OFFSET) * QTR_POSITION_SCALE;
+      // (weightedSum / sum - 3.5) · 8000 / 7, en enteros
+      linePosition = (int16_t)(((int32_t)weightedSum * 8000L / sum - 28000L) / 7);
     }
 }
 
 void QTR::calibrate() {
+    // Se calibra directamente sobre config; los recíprocos se recalculan al adoptarla
     for (int i = 0; i < NUM_SENSORS; i++) {
-      sensorMin[i] = 1023;
-      sensorMax[i] = 0;
+      config.sensorMin[i] = 1023;
+      config.sensorMax[i] = 0;
     }
     unsigned long start = millis();
     digitalWrite(SENSOR_POWER_PIN, HIGH);
@@ -535,152 +566,905 @@ void QTR::calibrate() {
     while (millis() - start < 5000) {  // 5 segundos
       for (int i = 0; i < NUM_SENSORS; i++) {
         int val = analogRead(SENSOR_PINS[i]);
-        if (val < sensorMin[i]) sensorMin[i] = val;
-        if (val > sensorMax[i]) sensorMax[i] = val;
+        if (val < config.sensorMin[i]) config.sensorMin[i] = val;
+        if (val > config.sensorMax[i]) config.sensorMax[i] = val;
       }
       delay(10);
     }
     digitalWrite(SENSOR_POWER_PIN, LOW);
-    // Save to config
-    for (int i = 0; i < NUM_SENSORS; i++) {
-      config.sensorMin[i] = sensorMin[i];
-      config.sensorMax[i] = sensorMax[i];
-    }
-    saveConfig();
+    setCalibration(config.sensorMin, config.sensorMax);
+    publishConfig();
+    markConfigDirty();
 }
 
 int16_t* QTR::getSensorValues() {
     return sensorValues;
 }
 
-int16_t* QTR::getRawSensorValues() {
-    return rawSensorValues;
+// LineEstimator implementations
+
+// Posición del QTR (±4000) <-> mm en Q8, factores en Q16
+static const int32_t UNITS_TO_MM_Q8 = (int32_t)(256.0 * 65536.0 * QTR_SENSOR_PITCH_MM / QTR_POSITION_SCALE + 0.5);
+static const int32_t MM_Q8_TO_UNITS = (int32_t)(65536.0 * QTR_POSITION_SCALE / QTR_SENSOR_PITCH_MM / 256.0 + 0.5);
+// Límites del estado: el desplazamiento no sale del ancho del QTR, ψ ±1 rad y κ hasta
+// un radio de 50 mm
+static const int32_t ESTIMATOR_OFFSET_MAX = (4000L * UNITS_TO_MM_Q8) >> 16;
+static const int32_t ESTIMATOR_HEADING_MAX = 65536L;
+static const int32_t ESTIMATOR_CURVATURE_MAX = 335544L;
+
+LineEstimator::LineEstimator() : offset(0), heading(0), curvature(0), stepAvg(0),
+                                 lastLeft(0), lastRight(0), primed(false) {}
+
+void LineEstimator::reset() {
+    primed = false;
+}
+
+void LineEstimator::update(const ControlParams& p, long leftCount, long rightCount, int16_t measured, int16_t contrast) {
+    int32_t dl = leftCount - lastLeft;
+    int32_t dr = rightCount - lastRight;
+    lastLeft = leftCount;
+    lastRight = rightCount;
+
+    int32_t z = ((int32_t)measured * UNITS_TO_MM_Q8) >> 16;
+    uint8_t confidence;
+    if (contrast <= ESTIMATOR_CONTRAST_MIN) confidence = 0;
+    else if (contrast >= ESTIMATOR_CONTRAST_FULL) confidence = 255;
+    else confidence = (uint8_t)((int32_t)(contrast - ESTIMATOR_CONTRAST_MIN) * 255
+                                / (ESTIMATOR_CONTRAST_FULL - ESTIMATOR_CONTRAST_MIN));
+
+    if (!primed) {
+        // Sin una lectura creíble no hay de dónde partir
+        if (confidence == 0) return;
+        offset = z;
+        heading = 0;
+        curvature = 0;
+        stepAvg = 0;
+        primed = true;
+        return;
+    }
+
+    // Predicción con la odometría del tick
+    int32_t sl = (dl * p.mmPerPulseQ16) >> 8;
+    int32_t sr = (dr * p.mmPerPulseQ16) >> 8;
+    int32_t ds = (sl + sr) >> 1;
+    int32_t turn = ((sl - sr) * p.invWheelDistanceQ16) >> 8;   // + = giro a la derecha
+    // Con pocos pulsos por vuelta ds salta entre 0 y 1-2 pulsos: y y ψ avanzan con su
+    // media, si no la corrección de ψ se acumula en los ticks sin pulso. El giro sí es
+    // el de los pulsos del tick, así su suma es exacta.
+    stepAvg += (ds - stepAvg) >> 3;
+    offset += (stepAvg * heading) >> 16;
+    heading += ((stepAvg * (curvature >> 8)) >> 8) - turn;
+
+    // Corrección con la medición, pesada por su confianza
+    if (confidence) {
+        int32_t r = ((z - offset) * confidence) >> 8;
+        offset += (r * (int32_t)p.estimator.alphaQ15) >> 15;
+        heading += (r * (int32_t)p.estimator.betaQ16) >> 8;
+        curvature += (r * (int32_t)p.estimator.gammaQ24) >> 8;
+    }
+
+    offset = constrain(offset, -ESTIMATOR_OFFSET_MAX, ESTIMATOR_OFFSET_MAX);
+    heading = constrain(heading, -ESTIMATOR_HEADING_MAX, ESTIMATOR_HEADING_MAX);
+    curvature = constrain(curvature, -ESTIMATOR_CURVATURE_MAX, ESTIMATOR_CURVATURE_MAX);
+}
+
+int16_t LineEstimator::getPosition() const {
+    return (int16_t)((offset * MM_Q8_TO_UNITS) >> 16);
+}
+
+real_t LineEstimator::getRate(real_t ticksPerSecond) const {
+    int32_t step = (stepAvg * heading) >> 8;                   // mm Q16 por tick
+    // mm Q12 · (unidades/mm Q8) = unidades Q16 por tick
+    return realFromRaw(((step >> 4) * MM_Q8_TO_UNITS) >> 4) * ticksPerSecond;
+}
+
+float LineEstimator::getCurvature() const {
+    return curvature * (1000.0f / 16777216.0f);
+}
+
+// MotorIdentifier implementations
+MotorIdentifier::MotorIdentifier() : phase(IDLE), reverse(false), point(0), topPwm(0), failedWheel(0), phaseStart(0) {
+    pwm[0] = pwm[1] = 0;
+    moving[0] = moving[1] = false;
+    startCount[0] = startCount[1] = 0;
+}
+
+void MotorIdentifier::start(uint8_t maxPwm, unsigned long now, long leftCount, long rightCount) {
+    const long counts[2] = {leftCount, rightCount};
+    topPwm = maxPwm;
+    reverse = false;
+    pwm[0] = pwm[1] = 0;
+    moving[0] = moving[1] = false;
+    enter(DEADBAND, now, counts);
+}
+
+void MotorIdentifier::enter(Phase p, unsigned long now, const long* counts) {
+    phase = p;
+    phaseStart = now;
+    startCount[0] = counts[0];
+    startCount[1] = counts[1];
+}
+
+void MotorIdentifier::service(MotorModel& model, unsigned long now, long leftCount, long rightCount,
+                              int16_t pulsesPerRevolution, int16_t* pwmOut) {
+    const long counts[2] = {leftCount, rightCount};
+    const int8_t sign = reverse ? -1 : 1;
+    MotorCurve* curves[2] = {&model.curve[reverse ? CURVE_LEFT_REV : CURVE_LEFT_FWD],
+                             &model.curve[reverse ? CURVE_RIGHT_REV : CURVE_RIGHT_FWD]};
+    unsigned long elapsed = now - phaseStart;
+
+    switch (phase) {
+    case DEADBAND:
+        if (elapsed < IDENTIFY_DEADBAND_MS) break;
+        for (uint8_t w = 0; w < 2; w++) {
+            if (moving[w]) continue;
+            if ((counts[w] - startCount[w]) * sign >= IDENTIFY_MOVE_PULSES) {
+                moving[w] = true;
+                curves[w]->deadband = pwm[w];
+                curves[w]->topPwm = topPwm;
+            } else if (pwm[w] + IDENTIFY_DEADBAND_STEP > topPwm) {
+                // No giró ni con el máximo: motor, driver o encoder (o encoder invertido)
+                failedWheel = w;
+                phase = FAILED;
+            } else {
+                pwm[w] += IDENTIFY_DEADBAND_STEP;
+            }
+        }
+        if (phase == FAILED) break;
+        if (moving[0] && moving[1]) {
+            point = 0;
+            pwm[0] = curves[0]->pwmAt(0);
+            pwm[1] = curves[1]->pwmAt(0);
+            enter(SETTLE, now, counts);
+        } else {
+            enter(DEADBAND, now, counts);
+        }
+        break;
+
+    case SETTLE:
+        if (elapsed >= IDENTIFY_SETTLE_MS) enter(MEASURE, now, counts);
+        break;
+
+    case MEASURE:
+        if (elapsed < IDENTIFY_MEASURE_MS) break;
+        for (uint8_t w = 0; w < 2; w++) {
+            // RPM = pulsos / PPR · 60000 / ms, en módulo
+            long pulses = (counts[w] - startCount[w]) * sign;
+            long rpm = pulses * 60000L / ((long)pulsesPerRevolution * (long)elapsed);
+            // La tabla tiene que ser creciente para invertirla; un punto que no sube
+            // (ruido, o el motor ya saturado) queda apenas por encima del anterior
+            if (point > 0 && rpm <= curves[w]->rpm[point - 1]) rpm = curves[w]->rpm[point - 1] + 1;
+            if (rpm < 0) rpm = 0;
+            curves[w]->rpm[point] = rpm > INT16_MAX ? INT16_MAX : (int16_t)rpm;
+        }
+        if (++point < MOTOR_LUT_POINTS) {
+            pwm[0] = curves[0]->pwmAt(point);
+            pwm[1] = curves[1]->pwmAt(point);
+            enter(SETTLE, now, counts);
+        } else if (!reverse) {
+            pwm[0] = pwm[1] = 0;
+            enter(REST, now, counts);
+        } else {
+            pwm[0] = pwm[1] = 0;
+            phase = model.valid() ? DONE : FAILED;
+        }
+        break;
+
+    case REST:
+        if (elapsed < IDENTIFY_REST_MS) break;
+        reverse = true;
+        moving[0] = moving[1] = false;
+        enter(DEADBAND, now, counts);
+        break;
+
+    default:
+        pwm[0] = pwm[1] = 0;
+        break;
+    }
+
+    pwmOut[0] = (phase == DONE || phase == FAILED) ? 0 : sign * pwm[0];
+    pwmOut[1] = (phase == DONE || phase == FAILED) ? 0 : sign * pwm[1];
+}
+
+// StepIdentifier implementations
+StepIdentifier::StepIdentifier() : phase(IDLE), pass(0), u0(0), u1(0), failedWheel(0), slow(false),
+                                   phaseStart(0), lastTick(0), windowMs(0) {
+    for (uint8_t w = 0; w < 2; w++) {
+        area[w] = windowArea[w] = 0;
+        y0[w] = dy[w] = tl[w] = 0;
+        result[w].gain = result[w].timeConstant = result[w].delay = 0;
+    }
+}
+
+void StepIdentifier::start(uint8_t pwmLow, uint8_t pwmHigh, unsigned long now) {
+    u0 = pwmLow;
+    u1 = pwmHigh;
+    pass = 0;
+    slow = false;
+    phase = BASELINE;
+    phaseStart = lastTick = now;
+    windowMs = 0;
+    for (uint8_t w = 0; w < 2; w++) area[w] = windowArea[w] = 0;
+}
+
+void StepIdentifier::finishPass0(unsigned long now, unsigned long holdMs) {
+    for (uint8_t w = 0; w < 2; w++) {
+        float yEnd = (float)windowArea[w] / windowMs;
+        dy[w] = yEnd - y0[w];
+        // Un escalón que casi no cambia la RPM no deja ajustar nada (o el encoder cuenta al revés)
+        if (dy[w] < 10) { failedWheel = w; phase = FAILED; return; }
+        // A0 = ∫(y∞ - y) dt, medido desde la base
+        tl[w] = (yEnd * holdMs - area[w]) / dy[w];
+        if (tl[w] < 1) tl[w] = 1;
+        if (tl[w] > holdMs / 2) { failedWheel = w; slow = true; phase = FAILED; return; }
+    }
+    pass = 1;
+    phase = BASELINE;
+    phaseStart = now;
+    windowMs = 0;
+    for (uint8_t w = 0; w < 2; w++) area[w] = windowArea[w] = 0;
+}
+
+void StepIdentifier::service(unsigned long now, int16_t leftRpm, int16_t rightRpm, int16_t* pwmOut) {
+    const int16_t y[2] = {leftRpm, rightRpm};
+    unsigned long dt = now - lastTick;
+    unsigned long elapsed = now - phaseStart;
+    lastTick = now;
+
+    switch (phase) {
+    case BASELINE:
+        if (elapsed > IDENTIFY_STEP_SETTLE_MS - IDENTIFY_STEP_WINDOW_MS) {
+            for (uint8_t w = 0; w < 2; w++) windowArea[w] += (long)y[w] * (long)dt;
+            windowMs += dt;
+        }
+        if (elapsed >= IDENTIFY_STEP_SETTLE_MS) {
+            for (uint8_t w = 0; w < 2; w++) {
+                y0[w] = (float)windowArea[w] / windowMs;
+                area[w] = windowArea[w] = 0;
+            }
+            windowMs = 0;
+            phase = STEP;
+            phaseStart = now;
+        }
+        break;
+
+    case STEP:
+        if (pass == 0) {
+            for (uint8_t w = 0; w < 2; w++) area[w] += (long)y[w] * (long)dt;
+            if (elapsed > IDENTIFY_STEP_HOLD_MS - IDENTIFY_STEP_WINDOW_MS) {
+                for (uint8_t w = 0; w < 2; w++) windowArea[w] += (long)y[w] * (long)dt;
+                windowMs += dt;
+            }
+            if (elapsed >= IDENTIFY_STEP_HOLD_MS) finishPass0(now, elapsed);
+        } else {
+            // Área hasta T + L de cada rueda; el último tick entra solo en parte
+            bool pending = false;
+            for (uint8_t w = 0; w < 2; w++) {
+                float from = (float)(elapsed - dt);
+                if (from >= tl[w]) continue;
+                float to = min((float)elapsed, tl[w]);
+                area[w] += (long)(y[w] * (to - from));
+                if (elapsed < tl[w]) pending = true;
+            }
+            if (pending) break;
+            for (uint8_t w = 0; w < 2; w++) {
+                // A1 = ∫(y - y0) dt hasta T + L = K·Δu·T/e
+                float t = 2.71828f * (area[w] - y0[w] * tl[w]) / dy[w];
+                t = constrain(t, 1.0f, tl[w]);
+                result[w].gain = dy[w] / (u1 - u0);
+                result[w].timeConstant = t / 1000.0f;
+                result[w].delay = (tl[w] - t) / 1000.0f;
+            }
+            phase = DONE;
+        }
+        break;
+
+    default:
+        break;
+    }
+
+    int16_t u = phase == BASELINE ? u0 : phase == STEP ? u1 : 0;
+    pwmOut[0] = pwmOut[1] = u;
+}
+
+RelayTuner::RelayTuner() : phase(IDLE), target(TARGET_LINE), rule(RULE_ZN), channels(1), failedChannel(0),
+                           setpoint(0), d(0), eps(0), biasMin(0), biasMax(0), startTime(0), timeoutMs(0), lastTick(0) {
+    for (uint8_t c = 0; c < 2; c++) {
+        ch[c].bias = ch[c].amplitudeSum = 0;
+        ch[c].state = 1;
+        ch[c].cycles = 0;
+        ch[c].yMax = ch[c].yMin = 0;
+        ch[c].lastRise = ch[c].lastFall = ch[c].periodSum = 0;
+    }
+}
+
+void RelayTuner::start(Target t, Rule r, int16_t sp, const float* bias, float amplitude, float hysteresis,
+                       float minBias, float maxBias, unsigned long now) {
+    target = t;
+    rule = r;
+    channels = t == TARGET_WHEELS ? 2 : 1;
+    setpoint = sp;
+    d = amplitude;
+    eps = hysteresis;
+    biasMin = minBias;
+    biasMax = maxBias;
+    timeoutMs = t == TARGET_WHEELS ? RELAY_WHEEL_TIMEOUT_MS : RELAY_LINE_TIMEOUT_MS;
+    startTime = lastTick = now;
+    failedChannel = 0;
+    for (uint8_t c = 0; c < channels; c++) {
+        ch[c].bias = bias[c];
+        ch[c].state = 1;
+        ch[c].cycles = 0;
+        ch[c].yMax = ch[c].yMin = 0;
+        ch[c].periodSum = 0;
+        ch[c].amplitudeSum = 0;
+    }
+    phase = RUNNING;
+}
+
+float RelayTuner::ultimateGain(uint8_t c) const {
+    float a = ch[c].amplitudeSum / RELAY_MEASURE_CYCLES;
+    float r = a * a - eps * eps;
+    return r > 0 ? 4 * d / (3.14159f * sqrtf(r)) : 0;
+}
+
+float RelayTuner::ultimatePeriod(uint8_t c) const {
+    return ch[c].periodSum / (RELAY_MEASURE_CYCLES * 1000.0f);
+}
+
+void RelayTuner::service(unsigned long now, const int16_t* y, float* out) {
+    unsigned long dt = now - lastTick;
+    lastTick = now;
+    bool complete = true;
+    for (uint8_t c = 0; c < channels; c++) {
+        Channel& k = ch[c];
+        if (y[c] > k.yMax) k.yMax = y[c];
+        if (y[c] < k.yMin) k.yMin = y[c];
+        int16_t e = setpoint - y[c];
+        if (k.state > 0 && e < -eps) {
+            k.state = -1;
+            k.lastFall = now;
+        } else if (k.state < 0 && e > eps) {
+            // Cada paso a +d cierra un ciclo desde el anterior (el primero solo lo abre)
+            k.state = 1;
+            if (k.cycles > 0) {
+                unsigned long period = now - k.lastRise;
+                if (k.cycles > RELAY_SKIP_CYCLES && k.cycles <= RELAY_SKIP_CYCLES + RELAY_MEASURE_CYCLES) {
+                    k.periodSum += period;
+                    k.amplitudeSum += (k.yMax - k.yMin) / 2.0f;
+                }
+                // Relé con bias: si el semiciclo con +d dura más, a la salida le falta bias
+                float high = k.lastFall - k.lastRise;
+                float low = now - k.lastFall;
+                k.bias = constrain(k.bias + d * (high - low) / (2 * period), biasMin, biasMax);
+            }
+            if (k.cycles < 255) k.cycles++;
+            k.lastRise = now;
+            k.yMax = k.yMin = y[c];
+        }
+        if (k.cycles < 2) k.bias = constrain(k.bias + k.state * d * dt / 1000.0f, biasMin, biasMax);
+        if (k.cycles <= RELAY_SKIP_CYCLES + RELAY_MEASURE_CYCLES) complete = false;
+        out[c] = k.bias + k.state * d;
+    }
+
+    if (complete) {
+        // Una amplitud que no supera la histéresis es ruido, no un ciclo límite
+        phase = DONE;
+        for (uint8_t c = 0; c < channels; c++) {
+            if (ultimateGain(c) <= 0) { failedChannel = c; phase = FAILED; }
+        }
+    } else if (now - startTime > timeoutMs) {
+        for (uint8_t c = channels; c-- > 0;) {
+            if (ch[c].cycles <= RELAY_SKIP_CYCLES + RELAY_MEASURE_CYCLES) failedChannel = c;
+        }
+        phase = FAILED;
+    }
+}
+
+LapTuner::LapTuner() : running(false), started(false), onMark(false), lost(false), maxDev(0), absSum(0),
+                       windowPulses(0), minLapPulses(0), startCount(0), windowStart(0), lostSince(0), lastScore(0) {
+    memset(&cp, 0, sizeof(cp));
+}
+
+void LapTuner::setDistances(float pulsesPerMm) {
+    windowPulses = lroundf(cp.windowMm * pulsesPerMm);
+    minLapPulses = lroundf(OPT_MIN_LAP_MM * pulsesPerMm);
+    running = true;
+    started = onMark = lost = false;
+}
+
+void LapTuner::start(const float* gains, uint16_t windowMm, float pulsesPerMm) {
+    memset(&cp, 0, sizeof(cp));
+    for (uint8_t c = 0; c < 3; c++) {
+        cp.gain[c] = gains[c];
+        cp.step[c] = OPT_INITIAL_STEP;
+    }
+    cp.windowMm = windowMm;
+    cp.dir = 0;
+    setDistances(pulsesPerMm);
+}
+
+void LapTuner::resume(const TunerCheckpoint& c, float pulsesPerMm) {
+    cp = c;
+    setDistances(pulsesPerMm);
+}
+
+bool LapTuner::converged() const {
+    if (cp.evals >= OPT_MAX_EVALS) return true;
+    for (uint8_t c = 0; c < 3; c++) {
+        if (cp.gain[c] != 0 && cp.step[c] >= OPT_MIN_STEP) return false;
+    }
+    return true;
+}
+
+void LapTuner::candidate(float* k) const {
+    for (uint8_t c = 0; c < 3; c++) k[c] = cp.gain[c];
+    if (cp.dir > 0) k[cp.coord] *= 1 + cp.step[cp.coord];
+    else if (cp.dir < 0) k[cp.coord] /= 1 + cp.step[cp.coord];
+}
+
+void LapTuner::score(float seconds, float iae, float deviation) {
+    if (cp.dir == 0) {
+        cp.ref[0] = max(seconds, 0.001f);
+        cp.ref[1] = max(iae, 1.0f);
+        cp.ref[2] = max(deviation, 1.0f);
+    }
+    float j = OPT_WEIGHT_TIME * seconds / cp.ref[0] + OPT_WEIGHT_IAE * iae / cp.ref[1]
+            + OPT_WEIGHT_DEVIATION * deviation / cp.ref[2];
+    lastScore = j;
+    if (cp.dir == 0) {
+        // Vuelta de referencia: desde acá se prueba kp hacia arriba
+        cp.bestScore = j;
+        cp.evals++;
+        cp.coord = 0;
+        cp.dir = 1;
+        return;
+    }
+    advance(j < cp.bestScore * (1 - OPT_MIN_IMPROVEMENT), j);
+}
+
+void LapTuner::advance(bool better, float j) {
+    cp.evals++;
+    uint8_t c = cp.coord;
+    if (better) {
+        float k[3];
+        candidate(k);
+        cp.gain[c] = k[c];
+        cp.bestScore = j;
+        cp.step[c] = min(cp.step[c] * 1.5f, OPT_MAX_STEP);
+        return;
+    }
+    if (cp.dir > 0) { cp.dir = -1; return; }
+    cp.step[c] *= 0.5f;
+    cp.dir = 1;
+    // Siguiente ganancia distinta de 0 (kp nunca es 0)
+    do c = (c + 1) % 3; while (cp.gain[c] == 0);
+    cp.coord = c;
+}
+
+LapTuner::Event LapTuner::update(unsigned long now, int16_t position, SensorState state, long distance, float dt) {
+    if (state == ALL_WHITE) {
+        if (!lost) { lost = true; lostSince = now; }
+        if (now - lostSince > OPT_LINE_LOST_MS) return LOST;
+    } else {
+        lost = false;
+    }
+    // Límite de la ventana: la distancia recorrida, o el flanco de entrada a la marca
+    bool mark = state == ALL_BLACK;
+    bool boundary;
+    if (windowPulses) boundary = !started || distance - startCount >= windowPulses;
+    else boundary = mark && !onMark && (!started || distance - startCount >= minLapPulses);
+    onMark = mark;
+    if (!boundary) {
+        if (started) {
+            int16_t e = abs(position);
+            absSum += e;
+            if (e > maxDev) maxDev = e;
+        }
+        return NONE;
+    }
+    bool scored = started;
+    if (scored) score((now - windowStart) / 1000.0f, absSum * dt, maxDev);
+    started = true;
+    windowStart = now;
+    startCount = distance;
+    absSum = 0;
+    maxDev = 0;
+    return scored ? SCORED : NONE;
 }
 
 // Debugger implementations
-Debugger::Debugger() {}
+Debugger::Debugger() : txSeq(0), job(JOB_NONE), nextJob(JOB_NONE), jobStep(0), droppedLines(0),
+                       deltaValid(0), framesToKey(0), deltaRef(NULL) {
+    clearSubscriptions();
+}
+
+void Debugger::service(const TelemetryData* data) {
+    // Mientras una línea por grupos está a medias no pasa ningún mensaje,
+    // así nunca queda un ack o una trama binaria en medio del texto.
+    if (jobStep == 0 && lineTx.empty()) {
+        msgTx.drainTo(Serial);
+        if (!msgTx.empty()) return;
+    }
+    if (job != JOB_NONE && lineTx.empty() && (data || !needsTelemetry())) {
+        lineTx.beginFrame();
+        bool last = printJobGroup(data);
+        if (!lineTx.commitFrame()) droppedLines++;
+        if (last) {
+            job = nextJob;
+            nextJob = JOB_NONE;
+            jobStep = 0;
+        } else {
+            jobStep++;
+        }
+    }
+    lineTx.drainTo(Serial);
+}
+
+bool Debugger::needsTelemetry() const {
+    return job == JOB_TELEMETRY || (job == JOB_DEBUG && jobStep >= DEBUG_CONFIG_GROUPS);
+}
+
+bool Debugger::pending() const {
+    return job != JOB_NONE || !lineTx.empty() || !msgTx.empty();
+}
+
+uint16_t Debugger::droppedFrames() {
+    return msgTx.droppedFrames() + lineTx.droppedFrames() + droppedLines;
+}
 
 void Debugger::systemMessage(const char* msg) {
-    Serial.print(F("type:1|"));
-    Serial.println(msg);
+    msgTx.beginFrame();
+    msgTx.print(F("type:1|"));
+    msgTx.println(msg);
+    msgTx.commitFrame();
+}
+
+bool Debugger::trySystemMessage(const char* msg) {
+    // "type:1|" + mensaje + "\r\n"
+    if (msgTx.freeSpace() < 9 + strlen(msg)) return false;
+    systemMessage(msg);
+    return true;
+}
+
+void Debugger::systemMessage(const __FlashStringHelper* msg) {
+    msgTx.beginFrame();
+    msgTx.print(F("type:1|"));
+    msgTx.println(msg);
+    msgTx.commitFrame();
 }
 
 void Debugger::systemMessage(const String& msg) {
-    Serial.print(F("type:1|"));
-    Serial.println(msg);
-}
-
-void Debugger::sendTelemetryData(TelemetryData& data, bool endLine) {
-    if (endLine) Serial.print(F("type:4|"));
-    Serial.print(F("LINE:["));
-    Serial.print(data.linePos, 2); Serial.print(F(","));
-    Serial.print(data.lineError, 2); Serial.print(F(","));
-    Serial.print(data.lineIntegral, 2); Serial.print(F(","));
-    Serial.print(data.lineDeriv, 2); Serial.print(F(","));
-    Serial.print(data.linePidOut, 2); Serial.print(F("]"));
-    Serial.print(F("|LEFT:["));
-    Serial.print(data.lRpm, 2); Serial.print(F(","));
-    Serial.print(data.lTargetRpm, 2); Serial.print(F(","));
-    Serial.print(data.lSpeed); Serial.print(F(","));
-    Serial.print(data.encL); Serial.print(F(","));
-    Serial.print(data.encLBackward); Serial.print(F(","));
-    Serial.print(data.lError, 2); Serial.print(F(","));
-    Serial.print(data.lIntegral, 2); Serial.print(F(","));
-    Serial.print(data.lDeriv, 2); Serial.print(F("]"));
-    Serial.print(F("|RIGHT:["));
-    Serial.print(data.rRpm, 2); Serial.print(F(","));
-    Serial.print(data.rTargetRpm, 2); Serial.print(F(","));
-    Serial.print(data.rSpeed); Serial.print(F(","));
-    Serial.print(data.encR); Serial.print(F(","));
-    Serial.print(data.encRBackward); Serial.print(F(","));
-    Serial.print(data.rError, 2); Serial.print(F(","));
-    Serial.print(data.rIntegral, 2); Serial.print(F(","));
-    Serial.print(data.rDeriv, 2); Serial.print(F("]"));
-    Serial.print(F("|PID:["));
-    Serial.print(data.linePidOut, 2); Serial.print(F(","));
-    Serial.print(data.lPidOut, 2); Serial.print(F(","));
-    Serial.print(data.rPidOut, 2); Serial.print(F("]"));
-    Serial.print(F("|SPEED_CMS:["));
-    Serial.print(data.leftSpeedCms, 2); Serial.print(F(","));
-    Serial.print(data.rightSpeedCms, 2); Serial.print(F("]"));
-    Serial.print(F("|QTR:["));
-    Serial.print(data.sensors[0]); Serial.print(F(","));
-    Serial.print(data.sensors[1]); Serial.print(F(","));
-    Serial.print(data.sensors[2]); Serial.print(F(","));
-    Serial.print(data.sensors[3]); Serial.print(F(","));
-    Serial.print(data.sensors[4]); Serial.print(F(","));
-    Serial.print(data.sensors[5]); Serial.print(F(","));
-    Serial.print(data.sensors[6]); Serial.print(F(","));
-    Serial.print(data.sensors[7]); Serial.print(F("]"));
-    Serial.print(F("|BATT:"));
-    Serial.print(data.battery, 2);
-    Serial.print(F("|LOOP_US:"));
-    Serial.print(data.loopTime);
-    Serial.print(F("|UPTIME:"));
-    Serial.print(data.uptime);
-    Serial.print(F("|CURV:"));
-    Serial.print(data.curvature, 2);
-    Serial.print(F("|STATE:"));
-    Serial.print(data.sensorState);
-    if (endLine) Serial.println();
-}
-
-void Debugger::sendDebugData(TelemetryData& data, RobotConfig& config) {
-    sendConfigData(config, false);
-    sendTelemetryData(data);
-}
-
-void Debugger::sendConfigData(RobotConfig& config, bool endLine) {
-    if (endLine) Serial.print(F("type:3|"));
-    Serial.print(F("LINE_K_PID:["));
-    Serial.print(config.lineKp, 3); Serial.print(F(","));
-    Serial.print(config.lineKi, 3); Serial.print(F(","));
-    Serial.print(config.lineKd, 3); Serial.print(F("]"));
-    Serial.print(F("|LEFT_K_PID:["));
-    Serial.print(config.leftKp, 3); Serial.print(F(","));
-    Serial.print(config.leftKi, 3); Serial.print(F(","));
-    Serial.print(config.leftKd, 3); Serial.print(F("]"));
-    Serial.print(F("|RIGHT_K_PID:["));
-    Serial.print(config.rightKp, 3); Serial.print(F(","));
-    Serial.print(config.rightKi, 3); Serial.print(F(","));
-    Serial.print(config.rightKd, 3); Serial.print(F("]"));
-    Serial.print(F("|BASE:["));
-    Serial.print(config.basePwm); Serial.print(F(","));
-    Serial.print(config.baseRPM, 2); Serial.print(F("]"));
-    Serial.print(F("|MAX:["));
-    Serial.print(config.maxPwm); Serial.print(F(","));
-    Serial.print(config.maxRpm, 2); Serial.print(F("]"));
-    Serial.print(F("|WHEELS:["));
-    Serial.print(config.wheelDiameter, 1); Serial.print(F(","));
-    Serial.print(config.wheelDistance, 1); Serial.print(F("]"));
-    Serial.print(F("|MODE:"));
-    Serial.print((int)config.operationMode);
-    Serial.print(F("|CASCADE:"));
-    Serial.print(config.cascadeMode ? F("1") : F("0"));
-    Serial.print(F("|TELEMETRY:"));
-    Serial.print(config.telemetry ? F("1") : F("0"));
-    Serial.print(F("|FEAT_CONFIG:"));
-    Serial.print(config.features.serialize());
-    Serial.print(F("|WEIGHT:"));
-    Serial.print(config.robotWeight, 1);
-    Serial.print(F("|SAMP_RATE:["));
-    Serial.print(config.loopLineMs); Serial.print(F(","));
-    Serial.print(config.loopSpeedMs); Serial.print(F(","));
-    Serial.print(config.telemetryIntervalMs); Serial.print(F("]"));
-    if (endLine) Serial.println();
+    msgTx.beginFrame();
+    msgTx.print(F("type:1|"));
+    msgTx.println(msg);
+    msgTx.commitFrame();
+}
+
+void Debugger::sendTelemetryData() {
+    if (job != JOB_NONE) { droppedLines++; return; }
+    job = JOB_TELEMETRY;
+}
+
+void Debugger::sendDebugData() {
+    if (job != JOB_NONE) { droppedLines++; return; }
+    job = JOB_DEBUG;
+}
+
+void Debugger::sendConfigData() {
+    // La config se lee al emitir, no necesita copia: se encola tras la línea en curso
+    if (job == JOB_NONE) job = JOB_CONFIG;
+    else if (job != JOB_CONFIG) nextJob = JOB_CONFIG;
+}
+
+// Un grupo por llamada; cada uno cabe en lineTx. Devuelve true al terminar la línea.
+bool Debugger::printJobGroup(const TelemetryData* data) {
+    bool last = false;
+    switch (job) {
+    case JOB_TELEMETRY:
+        if (jobStep == 0) lineTx.print(F("type:4|"));
+        last = printTelemetryGroup(jobStep, *data);
+        break;
+    case JOB_CONFIG:
+        if (jobStep == 0) lineTx.print(F("type:3|"));
+        last = printConfigGroup(jobStep);
+        break;
+    case JOB_DEBUG:
+        if (jobStep == 0) lineTx.print(F("type:5|"));
+        if (jobStep < DEBUG_CONFIG_GROUPS) {
+            printConfigGroup(jobStep);
+        } else {
+            if (jobStep == DEBUG_CONFIG_GROUPS) lineTx.print(F("|"));
+            last = printTelemetryGroup(jobStep - DEBUG_CONFIG_GROUPS, *data);
+        }
+        break;
+    default:
+        return true;
+    }
+    if (last) lineTx.println();
+    return last;
+}
+
+bool Debugger::printTelemetryGroup(uint8_t group, const TelemetryData& data) {
+    switch (group) {
+    case 0:
+        lineTx.print(F("LINE:["));
+        lineTx.print(data.linePos, 2); lineTx.print(F(","));
+        lineTx.print(data.lineError, 2); lineTx.print(F(","));
+        lineTx.print(data.lineIntegral, 2); lineTx.print(F(","));
+        return false;
+    case 1:
+        lineTx.print(data.lineDeriv, 2); lineTx.print(F(","));
+        lineTx.print(data.linePidOut, 2); lineTx.print(F("]"));
+        return false;
+    case 2:
+        lineTx.print(F("|LEFT:["));
+        lineTx.print(data.lRpm, 2); lineTx.print(F(","));
+        lineTx.print(data.lTargetRpm, 2); lineTx.print(F(","));
+        lineTx.print(data.lSpeed); lineTx.print(F(","));
+        return false;
+    case 3:
+        lineTx.print(data.encL); lineTx.print(F(","));
+        lineTx.print(data.encLBackward); lineTx.print(F(","));
+        lineTx.print(data.lError, 2); lineTx.print(F(","));
+        lineTx.print(data.lIntegral, 2); lineTx.print(F(","));
+        lineTx.print(data.lDeriv, 2); lineTx.print(F("]"));
+        return false;
+    case 4:
+        lineTx.print(F("|RIGHT:["));
+        lineTx.print(data.rRpm, 2); lineTx.print(F(","));
+        lineTx.print(data.rTargetRpm, 2); lineTx.print(F(","));
+        lineTx.print(data.rSpeed); lineTx.print(F(","));
+        return false;
+    case 5:
+        lineTx.print(data.encR); lineTx.print(F(","));
+        lineTx.print(data.encRBackward); lineTx.print(F(","));
+        lineTx.print(data.rError, 2); lineTx.print(F(","));
+        lineTx.print(data.rIntegral, 2); lineTx.print(F(","));
+        lineTx.print(data.rDeriv, 2); lineTx.print(F("]"));
+        return false;
+    case 6:
+        lineTx.print(F("|PID:["));
+        lineTx.print(data.linePidOut, 2); lineTx.print(F(","));
+        lineTx.print(data.lPidOut, 2); lineTx.print(F(","));
+        lineTx.print(data.rPidOut, 2); lineTx.print(F("]"));
+        return false;
+    case 7:
+        lineTx.print(F("|SPEED_CMS:["));
+        lineTx.print(data.leftSpeedCms, 2); lineTx.print(F(","));
+        lineTx.print(data.rightSpeedCms, 2); lineTx.print(F("]"));
+        return false;
+    case 8:
+        lineTx.print(F("|QTR:["));
+        for (uint8_t i = 0; i < 8; i++) {
+            if (i) lineTx.print(F(","));
+            lineTx.print(data.sensors[i]);
+        }
+        lineTx.print(F("]"));
+        return false;
+    case 9:
+        lineTx.print(F("|BATT:"));
+        lineTx.print(data.battery, 2);
+        lineTx.print(F("|LOOP_US:"));
+        lineTx.print(data.loopTime);
+        lineTx.print(F("|UPTIME:"));
+        lineTx.print(data.uptime);
+        return false;
+    case 10:
+        lineTx.print(F("|CURV:"));
+        lineTx.print(data.curvature, 2);
+        lineTx.print(F("|STATE:"));
+        lineTx.print(data.sensorState);
+        lineTx.print(F("|TX_DROP:"));
+        lineTx.print(data.txDropped);
+        lineTx.print(F("|PROFILE:"));
+        lineTx.print(data.profile);
+        return false;
+    default:
+        lineTx.print(F("|RC:["));
+        lineTx.print(data.rcSeq); lineTx.print(F(","));
+        lineTx.print(data.rcLatencyUs); lineTx.print(F(","));
+        lineTx.print(data.rcErrors); lineTx.print(F("]"));
+        return true;
+    }
+}
+
+bool Debugger::printConfigGroup(uint8_t group) {
+    switch (group) {
+    case 0:
+        lineTx.print(F("LINE_K_PID:["));
+        lineTx.print(config.lineKp, 3); lineTx.print(F(","));
+        lineTx.print(config.lineKi, 3); lineTx.print(F(","));
+        lineTx.print(config.lineKd, 3); lineTx.print(F("]"));
+        return false;
+    case 1:
+        lineTx.print(F("|LEFT_K_PID:["));
+        lineTx.print(config.leftKp, 3); lineTx.print(F(","));
+        lineTx.print(config.leftKi, 3); lineTx.print(F(","));
+        lineTx.print(config.leftKd, 3); lineTx.print(F("]"));
+        return false;
+    case 2:
+        lineTx.print(F("|RIGHT_K_PID:["));
+        lineTx.print(config.rightKp, 3); lineTx.print(F(","));
+        lineTx.print(config.rightKi, 3); lineTx.print(F(","));
+        lineTx.print(config.rightKd, 3); lineTx.print(F("]"));
+        return false;
+    case 3:
+        lineTx.print(F("|BASE:["));
+        lineTx.print(config.basePwm); lineTx.print(F(","));
+        lineTx.print(config.baseRPM, 2); lineTx.print(F("]"));
+        lineTx.print(F("|MAX:["));
+        lineTx.print(config.maxPwm); lineTx.print(F(","));
+        lineTx.print(config.maxRpm, 2); lineTx.print(F("]"));
+        return false;
+    case 4:
+        lineTx.print(F("|WHEELS:["));
+        lineTx.print(config.wheelDiameter, 1); lineTx.print(F(","));
+        lineTx.print(config.wheelDistance, 1); lineTx.print(F("]"));
+        lineTx.print(F("|MODE:"));
+        lineTx.print((int)config.operationMode);
+        lineTx.print(F("|CASCADE:"));
+        lineTx.print(config.cascadeMode ? F("1") : F("0"));
+        lineTx.print(F("|FF:"));
+        lineTx.print(config.speedFeedforward ? F("1") : F("0"));
+        return false;
+    case 5: {
+        char feat[FEATURES_TEXT_SIZE];
+        config.features.serialize(feat);
+        lineTx.print(F("|TELEMETRY:"));
+        lineTx.print(config.telemetry);
+        lineTx.print(F("|FEAT_CONFIG:"));
+        lineTx.print(feat);
+        return false;
+    }
+    case 6:
+        lineTx.print(F("|WINDOWS:["));
+        lineTx.print(config.features.getWindow(0)); lineTx.print(F(","));
+        lineTx.print(config.features.getWindow(1)); lineTx.print(F("]"));
+        return false;
+    case 7:
+        lineTx.print(F("|BIQUAD:["));
+        for (uint8_t i = 0; i < BIQUAD_SIGNAL_COUNT; i++) {
+            if (i) lineTx.print(F(","));
+            lineTx.print(config.biquad[i].type); lineTx.print(F(","));
+            lineTx.print(config.biquad[i].fcDeciHz / 10.0f, 1); lineTx.print(F(","));
+            lineTx.print(config.biquad[i].qCenti / 100.0f, 2);
+        }
+        lineTx.print(F("]"));
+        return false;
+    case 8:
+        lineTx.print(F("|ESTIMATOR:["));
+        lineTx.print(config.estimator.enabled); lineTx.print(F(","));
+        lineTx.print(config.estimator.alphaQ15 / 32768.0f, 3); lineTx.print(F(","));
+        lineTx.print(config.estimator.betaQ16 / 65536.0f, 4); lineTx.print(F(","));
+        lineTx.print(config.estimator.gammaQ24 / 16777216.0f, 6); lineTx.print(F("]"));
+        return false;
+    default:
+        lineTx.print(F("|WEIGHT:"));
+        lineTx.print(config.robotWeight, 1);
+        lineTx.print(F("|SAMP_RATE:["));
+        lineTx.print(config.loopLineMs); lineTx.print(F(","));
+        lineTx.print(config.loopSpeedMs); lineTx.print(F(","));
+        lineTx.print(config.telemetryIntervalMs); lineTx.print(F("]"));
+        return true;
+    }
 }
 
 void Debugger::ackMessage(const char* cmd) {
-    Serial.print(F("type:2|ack:"));
-    Serial.println(cmd);
+    msgTx.beginFrame();
+    msgTx.print(F("type:2|ack: "));
+    msgTx.println(cmd);
+    msgTx.commitFrame();
+}
+
+void Debugger::batchAck(uint32_t seq, uint8_t count, uint16_t okMask) {
+    msgTx.beginFrame();
+    msgTx.print(F("type:2|acks:"));
+    msgTx.print(seq);
+    msgTx.print(',');
+    msgTx.print(count);
+    msgTx.print(',');
+    msgTx.println(okMask, HEX);
+    msgTx.commitFrame();
+}
+
+bool Debugger::sendFrame(uint8_t type, const void* payload, size_t len) {
+    if (len > TELEMETRY_PAYLOAD_MAX || msgTx.freeSpace() < frameWireSize(len)) return false;
+    msgTx.beginFrame();
+    msgTx.writeFrame(type, txSeq, (const uint8_t*)payload, len);
+    msgTx.commitFrame();
+    txSeq++;
+    return true;
+}
+
+bool Debugger::subscribe(uint8_t group, uint8_t divisor) {
+    if (group >= TELEMETRY_GROUP_COUNT) return false;
+    groupDivisor[group] = divisor;
+    groupCount[group] = 0;
+    return true;
+}
+
+void Debugger::clearSubscriptions() {
+    memset(groupDivisor, 0, sizeof(groupDivisor));
+    memset(groupCount, 0, sizeof(groupCount));
+}
+
+bool Debugger::hasSubscriptions() {
+    for (uint8_t g = 0; g < TELEMETRY_GROUP_COUNT; g++) {
+        if (groupDivisor[g]) return true;
+    }
+    return false;
+}
+
+uint8_t Debugger::dueGroups() {
+    uint8_t mask = 0;
+    for (uint8_t g = 0; g < TELEMETRY_GROUP_COUNT; g++) {
+        if (!groupDivisor[g]) continue;
+        if (++groupCount[g] >= groupDivisor[g]) {
+            groupCount[g] = 0;
+            mask |= 1 << g;
+        }
+    }
+    return mask;
+}
+
+void Debugger::sendTelemetryBinary(const TelemetryWire& w, uint8_t mask) {
+    uint8_t payload[TELEMETRY_PAYLOAD_MAX];
+    uint8_t type = FRAME_TELEMETRY;
+    size_t payloadLen = 0;
+    // Delta solo si todos los grupos tienen referencia y no toca clave
+    if (deltaRef && (mask & ~deltaValid) == 0 && framesToKey > 0) {
+        payloadLen = packTelemetryDelta(w, *deltaRef, mask, payload, sizeof(payload));
+        if (payloadLen) {
+            type = FRAME_TELEMETRY_DELTA;
+            framesToKey--;
+        }
+    }
+    if (type == FRAME_TELEMETRY) {
+        // La clave renueva todas las referencias, también las de grupos que no tocaban
+        if (deltaRef) mask |= deltaValid;
+        payloadLen = packTelemetryGroups(w, mask, payload);
+        if (deltaRef) {
+            copyTelemetryGroups(w, *deltaRef, mask);
+            deltaValid = mask;
+            framesToKey = TELEMETRY_KEYFRAME_INTERVAL;
+        }
+    }
+    msgTx.beginFrame();
+    msgTx.writeFrame(type, txSeq++, payload, payloadLen);
+    // Si se descartó, el receptor ve el hueco en seq y espera una clave
+    if (!msgTx.commitFrame()) deltaValid = 0;
+}
+
+void Debugger::setDeltaMode(TelemetryWire* ref) {
+    deltaRef = ref;
+    deltaValid = 0;
+    framesToKey = 0;
 }
 
 // SerialReader implementations
-SerialReader::SerialReader() : lineReady(false), idx(0) {}
+SerialReader::SerialReader() : lineReady(false), idx(0), rcIdx(0), rcReady(false), rcRxUs(0), rcErrors(0) {}
 
 void SerialReader::fillBuffer() {
     while (Serial.available()) {
         char c = Serial.read();
+        // Trama RC: desde el byte de sync se toman los 8 bytes sin interpretarlos como texto.
+        // Solo entre líneas: a mitad de una, 0xA5 es parte de un carácter UTF-8
+        if (rcIdx > 0 || (idx == 0 && (uint8_t)c == RC_FRAME_SYNC)) {
+            rcBuf[rcIdx++] = c;
+            if (rcIdx == sizeof(RcFrame)) {
+                rcIdx = 0;
+                uint16_t crc = rcBuf[6] | (rcBuf[7] << 8);
+                if (crc16Ccitt(rcBuf + 1, 5) == crc) {
+                    rcReady = true;
+                    rcRxUs = micros();
+                    return;
+                } else {
+                    rcErrors++;
+                }
+            }
+            continue;
+        }
         if (c == '\n' || c == '\r') {
             serBuf[idx] = '\0';
             lineReady = true;
@@ -691,19 +1475,37 @@ void SerialReader::fillBuffer() {
     }
 }
 
-bool SerialReader::getLine(const char **buf) {
+bool SerialReader::getRc(RcFrame& frame, uint32_t& rxUs) {
+    if (!rcReady) return false;
+    memcpy(&frame, rcBuf, sizeof(frame));
+    rxUs = rcRxUs;
+    rcReady = false;
+    return true;
+}
+
+bool SerialReader::getLine(char **buf) {
     if (!lineReady) return false;
     *buf = serBuf;
-
-    // Convertir a minúsculas in-place
-    for (char *p = serBuf; *p; ++p) *p = tolower(*p);
-
     lineReady = false;
     return true;
 }
 
 // EEPROMManager implementations
-EEPROMManager::EEPROMManager() {
+static_assert(sizeof(ConfigHeader) + sizeof(RobotConfig) <= EEPROM_CONFIG_SLOT_SIZE, "RobotConfig no entra en el slot");
+static_assert(CONFIG_V1_SIZE <= EEPROM_CONFIG_SLOT_SIZE - sizeof(ConfigHeader), "El buffer de carga no admite v1");
+static_assert(EEPROM_CONFIG_ADDR + EEPROM_CONFIG_SLOTS * EEPROM_CONFIG_SLOT_SIZE <= 1024, "Los slots no entran en la EEPROM del Nano");
+
+// Cambios sin guardar: los marca cualquier código, los consume service()
+static bool configDirty = false;
+static unsigned long configDirtyMs = 0;
+
+void markConfigDirty() {
+    configDirty = true;
+    configDirtyMs = millis();
+}
+
+EEPROMManager::EEPROMManager() : slot(EEPROM_CONFIG_SLOTS - 1), seq(0), writing(false), flushRequested(false), pos(0), crc(0),
+                                 checkpointSrc(0) {
     load();
 }
 
@@ -712,43 +1514,666 @@ RobotConfig& EEPROMManager::getConfig() {
 }
 
 void EEPROMManager::load() {
-    EEPROM.get(EEPROM_CONFIG_ADDR, config);
-    if (config.checksum != 1234567892) {
-      Serial.println(F("Checksum EEPROM inválido"));
-      config.restoreDefaults();
-      save();
+    uint8_t raw[EEPROM_CONFIG_SLOT_SIZE - sizeof(ConfigHeader)];
+    ConfigHeader h;
+    bool found = false;
+    for (uint8_t s = 0; s < EEPROM_CONFIG_SLOTS; s++) {
+        EEPROM.get(slotAddr(s), h);
+        if (h.magic != CONFIG_MAGIC || h.length > sizeof(raw)) continue;
+        uint32_t c = 0xFFFFFFFF;
+        for (uint8_t i = 0; i < h.length; i++) {
+            uint8_t b = EEPROM.read(slotAddr(s) + sizeof(ConfigHeader) + i);
+            c = crc32Update(c, &b, 1);
+        }
+        if (~c != h.crc) continue;
+        // Comparación circular: la secuencia puede dar la vuelta
+        if (!found || (int16_t)(h.seq - seq) > 0) {
+            slot = s;
+            seq = h.seq;
+            found = true;
+        }
+    }
+
+    if (found) {
+        EEPROM.get(slotAddr(slot), h);
+        for (uint8_t i = 0; i < h.length; i++) raw[i] = EEPROM.read(slotAddr(slot) + sizeof(ConfigHeader) + i);
+        if (!migrateConfig(h.version, raw, h.length, config)) {
+            // Escrita por un firmware más nuevo: defaults en RAM, la copia queda intacta
+            Serial.println(F("Esquema de configuración desconocido"));
+            return;
+        }
+        if (h.version == CONFIG_SCHEMA_VERSION && h.length == sizeof(RobotConfig)) return;
+    } else if (loadLegacy(raw)) {
+        migrateConfig(1, raw, CONFIG_V1_SIZE, config);
+        slot = EEPROM_CONFIG_SLOTS - 1;
+    } else {
+        Serial.println(F("Configuración EEPROM inválida"));
+        config.restoreDefaults();
+    }
+    // Migrada o nueva: se reescribe ya con el esquema actual
+    save();
+}
+
+// Esquema 1, sin cabecera: en slots {seq:u16, config} o una sola copia al principio
+bool EEPROMManager::loadLegacy(uint8_t* raw) {
+    const uint8_t stride = sizeof(uint16_t) + CONFIG_V1_SIZE;
+    int best = -1;
+    uint16_t bestSeq = 0;
+    for (uint8_t s = 0; s < EEPROM_CONFIG_SLOTS; s++) {
+        int addr = EEPROM_CONFIG_ADDR + s * stride;
+        uint16_t slotSeq;
+        uint32_t checksum;
+        EEPROM.get(addr, slotSeq);
+        EEPROM.get(addr + stride - sizeof(checksum), checksum);
+        if (checksum != CONFIG_V1_CHECKSUM) continue;
+        if (best < 0 || (int16_t)(slotSeq - bestSeq) > 0) {
+            best = addr + sizeof(uint16_t);
+            bestSeq = slotSeq;
+        }
+    }
+    if (best < 0) {
+        uint32_t checksum;
+        EEPROM.get(EEPROM_CONFIG_ADDR + CONFIG_V1_SIZE - sizeof(checksum), checksum);
+        if (checksum != CONFIG_V1_CHECKSUM) return false;
+        best = EEPROM_CONFIG_ADDR;
     }
+    for (uint8_t i = 0; i < CONFIG_V1_SIZE; i++) raw[i] = EEPROM.read(best + i);
+    return true;
 }
 
 void EEPROMManager::save() {
-    EEPROM.put(EEPROM_CONFIG_ADDR, config);
+    beginCopy();
+    // EEPROM.write espera sola a que termine el byte anterior
+    while (writing) copyStep();
+    configDirty = false;
+}
+
+void EEPROMManager::beginCopy() {
+    writing = true;
+    pos = 0;
+    crc = 0xFFFFFFFF;
+}
+
+void EEPROMManager::copyStep() {
+    uint8_t next = (slot + 1) % EEPROM_CONFIG_SLOTS;
+    while (pos < sizeof(RobotConfig) + sizeof(ConfigHeader)) {
+        int addr;
+        uint8_t b;
+        if (pos < sizeof(RobotConfig)) {
+            addr = slotAddr(next) + sizeof(ConfigHeader) + pos;
+            b = ((const uint8_t*)&config)[pos];
+            crc = crc32Update(crc, &b, 1);
+        } else {
+            ConfigHeader h = { CONFIG_MAGIC, CONFIG_SCHEMA_VERSION, sizeof(RobotConfig), ~crc, (uint16_t)(seq + 1) };
+            uint8_t i = pos - sizeof(RobotConfig);
+            addr = slotAddr(next) + i;
+            b = ((const uint8_t*)&h)[i];
+        }
+        pos++;
+        if (EEPROM.read(addr) != b) {
+            EEPROM.write(addr, b);
+            return;
+        }
+    }
+    slot = next;
+    seq++;
+    writing = false;
+    // Un checkpoint pedido durante la copia arranca de cero
+    pos = 0;
+    crc = 0xFFFFFFFF;
+}
+
+static_assert(sizeof(ConfigHeader) + sizeof(TuningProfile) <= PROFILE_SLOT_SIZE, "TuningProfile no entra en el slot");
+static_assert(EEPROM_PROFILE_ADDR + PROFILE_SLOTS * PROFILE_SLOT_SIZE <= 1024, "Los perfiles no entran en la EEPROM del Nano");
+
+static_assert(sizeof(ConfigHeader) + sizeof(MotorModel) <= MOTOR_MODEL_SLOT_SIZE, "MotorModel no entra en el slot");
+static_assert(EEPROM_MOTOR_MODEL_ADDR + MOTOR_MODEL_SLOT_SIZE <= 1024, "El modelo de motores no entra en la EEPROM del Nano");
+
+bool EEPROMManager::readRecord(int addr, uint16_t version, uint8_t* dst, uint8_t size) {
+    ConfigHeader h;
+    EEPROM.get(addr, h);
+    if (h.magic != CONFIG_MAGIC || h.version != version || h.length > size) return false;
+    uint32_t c = 0xFFFFFFFF;
+    for (uint8_t i = 0; i < h.length; i++) {
+        uint8_t b = EEPROM.read(addr + sizeof(ConfigHeader) + i);
+        c = crc32Update(c, &b, 1);
+    }
+    if (~c != h.crc) return false;
+    for (uint8_t i = 0; i < h.length; i++) dst[i] = EEPROM.read(addr + sizeof(ConfigHeader) + i);
+    return true;
 }
 
-// Función global para guardar configuración
-void saveConfig() {
-   EEPROM.put(EEPROM_CONFIG_ADDR, config);
+void EEPROMManager::writeRecord(int addr, uint16_t version, const uint8_t* src, uint8_t size) {
+    ConfigHeader h = { CONFIG_MAGIC, version, size, crc32(src, size), 0 };
+    // Primero el contenido y al final la cabecera: cortado a medias no pasa el CRC
+    for (uint8_t i = 0; i < size; i++) EEPROM.update(addr + sizeof(ConfigHeader) + i, src[i]);
+    EEPROM.put(addr, h);
 }
 
-SensorState Robot::checkSensorState(int16_t* rawSensors) {
-    bool allBlack = true;
-    bool allWhite = true;
-    for(int i = 0; i < NUM_SENSORS; i++) {
-        int range = config.sensorMax[i] - config.sensorMin[i];
-        if(range > 0) {
-            if(rawSensors[i] < config.sensorMax[i] - 0.3f * range) {
-                allBlack = false;
-            }
-            if(rawSensors[i] > config.sensorMin[i] + 0.3f * range) {
-                allWhite = false;
-            }
+bool EEPROMManager::loadProfile(uint8_t n, TuningProfile& p) {
+    // Un perfil guardado antes de agregar campos deja esos valores como están
+    p.capture(config);
+    return readRecord(profileAddr(n), PROFILE_SCHEMA_VERSION, (uint8_t*)&p, sizeof(p));
+}
+
+void EEPROMManager::saveProfile(uint8_t n, const TuningProfile& p) {
+    writeRecord(profileAddr(n), PROFILE_SCHEMA_VERSION, (const uint8_t*)&p, sizeof(p));
+}
+
+bool EEPROMManager::loadMotorModel(MotorModel& m) {
+    memset(&m, 0, sizeof(m));
+    return readRecord(EEPROM_MOTOR_MODEL_ADDR, MOTOR_MODEL_SCHEMA_VERSION, (uint8_t*)&m, sizeof(m)) && m.valid();
+}
+
+void EEPROMManager::saveMotorModel(const MotorModel& m) {
+    writeRecord(EEPROM_MOTOR_MODEL_ADDR, MOTOR_MODEL_SCHEMA_VERSION, (const uint8_t*)&m, sizeof(m));
+}
+
+void EEPROMManager::loadMotorCurve(uint8_t index, MotorCurve& c) {
+    EEPROM.get(EEPROM_MOTOR_MODEL_ADDR + sizeof(ConfigHeader) + index * sizeof(MotorCurve), c);
+}
+
+static_assert(sizeof(ConfigHeader) + sizeof(TunerCheckpoint) <= TUNER_SLOT_SIZE, "TunerCheckpoint no entra en el slot");
+static_assert(EEPROM_TUNER_ADDR + 2 * TUNER_SLOT_SIZE <= 1024, "El checkpoint del optimizador no entra en la EEPROM del Nano");
+
+bool EEPROMManager::loadCheckpoint(TunerCheckpoint& c) {
+    TunerCheckpoint other;
+    memset(&c, 0, sizeof(c));
+    memset(&other, 0, sizeof(other));
+    bool a = readRecord(checkpointAddr(0), TUNER_SCHEMA_VERSION, (uint8_t*)&c, sizeof(c));
+    bool b = readRecord(checkpointAddr(1), TUNER_SCHEMA_VERSION, (uint8_t*)&other, sizeof(other));
+    if (b && (!a || other.evals > c.evals)) c = other;
+    return a || b;
+}
+
+void EEPROMManager::requestCheckpoint(const TunerCheckpoint* c) {
+    checkpointSrc = c;
+    // Con una copia de config en curso, empieza cuando ella termina
+    if (writing) return;
+    pos = 0;
+    crc = 0xFFFFFFFF;
+}
+
+void EEPROMManager::clearCheckpoint() {
+    checkpointSrc = 0;
+    // Basta con romper la marca de cada cabecera
+    for (uint8_t n = 0; n < 2; n++) EEPROM.update(checkpointAddr(n), 0);
+}
+
+// Como copyStep(), sobre el slot que no tiene la última copia: uno cortado a medias deja
+// la anterior
+void EEPROMManager::checkpointStep() {
+    int base = checkpointAddr(checkpointSrc->evals & 1);
+    while (pos < sizeof(TunerCheckpoint) + sizeof(ConfigHeader)) {
+        int addr;
+        uint8_t b;
+        if (pos < sizeof(TunerCheckpoint)) {
+            addr = base + sizeof(ConfigHeader) + pos;
+            b = ((const uint8_t*)checkpointSrc)[pos];
+            crc = crc32Update(crc, &b, 1);
+        } else {
+            ConfigHeader h = { CONFIG_MAGIC, TUNER_SCHEMA_VERSION, sizeof(TunerCheckpoint), ~crc, 0 };
+            uint8_t i = pos - sizeof(TunerCheckpoint);
+            addr = base + i;
+            b = ((const uint8_t*)&h)[i];
+        }
+        pos++;
+        if (EEPROM.read(addr) != b) {
+            EEPROM.write(addr, b);
+            return;
+        }
+    }
+    checkpointSrc = 0;
+}
+
+void EEPROMManager::service(bool idle) {
+    if (!writing && checkpointSrc) {
+        // El checkpoint se escribe primero; la configuración espera a que termine
+        if (eeprom_is_ready()) checkpointStep();
+        return;
+    }
+    if (!writing) {
+        if (!configDirty) { flushRequested = false; return; }
+        if (!flushRequested && !(idle && millis() - configDirtyMs >= CONFIG_FLUSH_DELAY_MS)) return;
+        flushRequested = false;
+        configDirty = false;
+        beginCopy();
+    } else if (configDirty) {
+        // Cambió durante la copia: se rehace sobre el mismo slot, los bytes iguales no se reescriben
+        configDirty = false;
+        beginCopy();
+    }
+    // Cada byte tarda ~3.3 ms en grabarse; mientras tanto se sigue con el lazo
+    if (!eeprom_is_ready()) return;
+    copyStep();
+}
+
+void Robot::applyConfig() {
+    // Época primero: si un handler publica durante la adopción se vuelve a aplicar
+    appliedEpoch = configEpoch;
+    params.build(config);
+    linePid.setGainsBumpless(config.lineKp, config.lineKi, config.lineKd);
+    leftPid.setGainsBumpless(config.leftKp, config.leftKi, config.leftKd);
+    rightPid.setGainsBumpless(config.rightKp, config.rightKi, config.rightKd);
+    // El anti-windup tiene que ver la misma saturación que después aplica el lazo
+    leftPid.setOutputLimits(-params.maxPwm, params.maxPwm);
+    rightPid.setOutputLimits(-params.maxPwm, params.maxPwm);
+    features.setConfig(params.features);
+    qtr.setCalibration(config.sensorMin, config.sensorMax);
+    // Fuera del modo línea las ruedas se mueven sin que el estimador mire la línea
+    if (!params.estimator.enabled || params.operationMode != MODE_LINE_FOLLOWING) {
+        estimator.reset();
+    }
+    // La identificación es solo en idle: salir de idle la corta y vuelve el modelo guardado
+    if (identifying() && params.operationMode != MODE_IDLE) {
+        tool = TOOL_NONE;
+        debugger.systemMessage(F("identify: cancelada"));
+    }
+    if (stepTesting() && params.operationMode != MODE_IDLE) {
+        tool = TOOL_NONE;
+        debugger.systemMessage(F("identify: cancelada"));
+    }
+    // El relé de línea necesita el modo línea y el de ruedas el banco en idle
+    if (relayTuning() && params.operationMode != (relay.tuner.getTarget() == RelayTuner::TARGET_LINE ? MODE_LINE_FOLLOWING : MODE_IDLE)) {
+        stopRelay();
+        debugger.systemMessage(F("autotune: cancelado"));
+    }
+    if (autoTuning() && params.operationMode != MODE_LINE_FOLLOWING) {
+        finishLapTuner(F("autotune: detenido con las mejores ganancias (autotune para seguir)"));
+    }
+}
+
+void Robot::serviceStepTest(unsigned long now) {
+    int16_t pwm[2];
+    stepTest.service(now, toInt(leftMotor.getFilteredRPM()), toInt(rightMotor.getFilteredRPM()), pwm);
+    leftMotor.setSpeed(pwm[0]);
+    rightMotor.setSpeed(pwm[1]);
+    if (stepTest.getPhase() == StepIdentifier::DONE) {
+        // Sigue siendo dueño de la memoria compartida hasta que el informe termina
+        stepTest.abort();
+        startReport(REPORT_STEP);
+    } else if (stepTest.getPhase() == StepIdentifier::FAILED) {
+        tool = TOOL_NONE;
+        if (stepTest.wasTooSlow()) debugger.systemMessage(F("identify: falló, la respuesta no se asienta en el escalón"));
+        else if (stepTest.getFailedWheel()) debugger.systemMessage(F("identify: falló, la rueda derecha no responde al escalón"));
+        else debugger.systemMessage(F("identify: falló, la rueda izquierda no responde al escalón"));
+    }
+}
+
+// Un tick del optimizador en pista con la posición que ve el PID de línea
+void Robot::serviceLapTuner(int16_t position, unsigned long now, float dt) {
+    long distance = (leftMotor.getNetCount() + rightMotor.getNetCount()) / 2;
+    LapTuner::Event event = lapTuner.update(now, position, currentSensorState, distance, dt);
+    if (event == LapTuner::NONE) return;
+    if (event == LapTuner::LOST) {
+        // La candidata cuenta como peor; `autotune` sigue desde la próxima
+        lapTuner.reject();
+        // Sin vuelta de referencia no hay nada que retomar
+        if (lapTuner.checkpoint().ref[0] > 0) eeprom.requestCheckpoint(&lapTuner.checkpoint());
+        finishLapTuner(F("autotune: se perdió la línea; vuelven las mejores ganancias (autotune para seguir)"));
+        return;
+    }
+    const TunerCheckpoint& cp = lapTuner.checkpoint();
+    eeprom.requestCheckpoint(&cp);
+    char msg[80], j[10], best[10], a[12], b[12], c[12];
+    dtostrf(lapTuner.getLastScore(), 0, 3, j);
+    dtostrf(cp.bestScore, 0, 3, best);
+    if (lapTuner.converged()) {
+        snprintf_P(msg, sizeof(msg), PSTR("autotune %u: J %s, mejor %s"), cp.evals, j, best);
+        debugger.systemMessage(msg);
+        finishLapTuner(F("autotune: convergió, mejores ganancias aplicadas"));
+        return;
+    }
+    applyLapCandidate();
+    dtostrf(config.lineKp, 0, 4, a);
+    dtostrf(config.lineKi, 0, 5, b);
+    dtostrf(config.lineKd, 0, 4, c);
+    snprintf_P(msg, sizeof(msg), PSTR("autotune %u: J %s, mejor %s; prueba %s,%s,%s"), cp.evals, j, best, a, b, c);
+    debugger.systemMessage(msg);
+}
+
+// Las ganancias de la próxima evaluación entran sin salto (setGainsBumpless en applyConfig)
+void Robot::applyLapCandidate() {
+    float k[3];
+    lapTuner.candidate(k);
+    config.lineKp = k[0];
+    config.lineKi = k[1];
+    config.lineKd = k[2];
+    publishConfig();
+}
+
+// Deja las mejores ganancias, que se guardan al volver a idle; el checkpoint queda
+void Robot::finishLapTuner(const __FlashStringHelper* msg) {
+    lapTuner.stop();
+    const TunerCheckpoint& cp = lapTuner.checkpoint();
+    config.lineKp = cp.gain[0];
+    config.lineKi = cp.gain[1];
+    config.lineKd = cp.gain[2];
+    publishConfig();
+    markConfigDirty();
+    debugger.systemMessage(msg);
+}
+
+// Lazo de línea con el relé: false si el ensayo terminó en este tick y vuelve el PID,
+// que arranca desde la última salida del relé
+bool Robot::serviceRelayLine(int16_t position, unsigned long now, real_t& out) {
+    if (currentSensorState == ALL_WHITE || abs(position) > RELAY_LINE_LIMIT) {
+        tool = TOOL_NONE;
+        linePid.track(toFloat(relay.lineOutput));
+        debugger.systemMessage(F("autotune: cancelado, se perdió la línea; ganancias sin cambios"));
+        return false;
+    }
+    // Misma convención que el PID: medición -posición, setpoint 0
+    int16_t y = -position;
+    float u;
+    relay.tuner.service(now, &y, &u);
+    if (relayTuning()) {
+        out = relay.lineOutput = real_t(u);
+        return true;
+    }
+    linePid.track(toFloat(relay.lineOutput));
+    finishRelay(relay.tuner.getPhase());
+    return false;
+}
+
+void Robot::serviceRelayWheels(unsigned long now) {
+    int16_t y[2] = {toInt(filterRpm(leftRpmBiquad, leftMotor.getFilteredRPM())),
+                    toInt(filterRpm(rightRpmBiquad, rightMotor.getFilteredRPM()))};
+    float u[2];
+    relay.tuner.service(now, y, u);
+    leftMotor.setSpeed(constrain(lroundf(u[0]), 0L, (long)params.maxPwm));
+    rightMotor.setSpeed(constrain(lroundf(u[1]), 0L, (long)params.maxPwm));
+    if (relayTuning()) return;
+    if (relay.tuner.getPhase() == RelayTuner::DONE) {
+        // Los PID siguen en la misma RPM desde el PWM del relé; las ganancias nuevas
+        // entran con setGainsBumpless al aplicar la configuración
+        leftPid.track(leftMotor.getSpeed());
+        rightPid.track(rightMotor.getSpeed());
+    } else {
+        stopRelay();
+    }
+    finishRelay(relay.tuner.getPhase());
+}
+
+// Corta el ensayo en curso: el lazo de línea vuelve al PID, las ruedas se paran
+void Robot::stopRelay() {
+    tool = TOOL_NONE;
+    if (relay.tuner.getTarget() == RelayTuner::TARGET_LINE) {
+        linePid.track(toFloat(relay.lineOutput));
+        return;
+    }
+    leftTargetRPM = rightTargetRPM = 0;
+    leftMotor.setSpeed(0);
+    rightMotor.setSpeed(0);
+    leftPid.track(0);
+    rightPid.track(0);
+}
+
+// Ganancias desde el punto último del ensayo con relé, en la forma de `set line`
+// (kp, ki = kp/Ti, kd = kp·Td)
+//   zn   Ziegler–Nichols PID:   kp = 0.6·Ku,   Ti = Pu/2,    Td = Pu/8
+//   tl   Tyreus–Luyben PID:     kp = Ku/2.2,   Ti = 2.2·Pu,  Td = Pu/6.3
+//   pi   Ziegler–Nichols PI:    kp = 0.45·Ku,  Ti = Pu/1.2
+//   nos  sin sobrepico, PID:    kp = 0.2·Ku,   Ti = Pu/2,    Td = Pu/3
+static const char RELAY_RULE_NAMES[RelayTuner::RULE_COUNT][4] PROGMEM = {"zn", "tl", "pi", "nos"};
+
+static void relayGains(RelayTuner::Rule rule, float ku, float pu, float* k) {
+    float ti, td;
+    switch (rule) {
+    case RelayTuner::RULE_TL: k[0] = ku / 2.2f; ti = 2.2f * pu; td = pu / 6.3f; break;
+    case RelayTuner::RULE_PI: k[0] = 0.45f * ku; ti = pu / 1.2f; td = 0; break;
+    case RelayTuner::RULE_NO_OVERSHOOT: k[0] = 0.2f * ku; ti = pu / 2; td = pu / 3; break;
+    default: k[0] = 0.6f * ku; ti = pu / 2; td = pu / 8; break;
+    }
+    k[1] = k[0] / ti;
+    k[2] = k[0] * td;
+}
+
+// Con DONE aplica las ganancias de la regla (bumpless, en applyConfig) y las deja para
+// guardar al volver a idle; el relé retiene la memoria compartida hasta terminar el informe
+void Robot::finishRelay(RelayTuner::Phase phase) {
+    relay.tuner.abort();
+    if (phase != RelayTuner::DONE) {
+        tool = TOOL_NONE;
+        debugger.systemMessage(relay.tuner.getTarget() == RelayTuner::TARGET_LINE
+            ? F("autotune: falló, sin ciclo límite medible (probar otro d); ganancias sin cambios")
+            : relay.tuner.getFailedChannel() ? F("autotune: falló, la rueda derecha no oscila; ganancias sin cambios")
+                                            : F("autotune: falló, la rueda izquierda no oscila; ganancias sin cambios"));
+        return;
+    }
+    float k[3];
+    if (relay.tuner.getTarget() == RelayTuner::TARGET_LINE) {
+        relayGains(relay.tuner.getRule(), relay.tuner.ultimateGain(0), relay.tuner.ultimatePeriod(0), k);
+        config.lineKp = k[0];
+        config.lineKi = k[1];
+        config.lineKd = k[2];
+    } else {
+        relayGains(relay.tuner.getRule(), relay.tuner.ultimateGain(0), relay.tuner.ultimatePeriod(0), k);
+        config.leftKp = k[0];
+        config.leftKi = k[1];
+        config.leftKd = k[2];
+        relayGains(relay.tuner.getRule(), relay.tuner.ultimateGain(1), relay.tuner.ultimatePeriod(1), k);
+        config.rightKp = k[0];
+        config.rightKi = k[1];
+        config.rightKd = k[2];
+    }
+    publishConfig();
+    markConfigDirty();
+    startReport(REPORT_RELAY);
+}
+
+void Robot::serviceIdentification(unsigned long now) {
+    MotorIdentifier& identifier = identify.identifier;
+    int16_t pwm[2];
+    identifier.service(identify.model, now, leftMotor.getNetCount(), rightMotor.getNetCount(),
+                       config.pulsesPerRevolution, pwm);
+    leftMotor.setSpeed(pwm[0]);
+    rightMotor.setSpeed(pwm[1]);
+    if (identifier.getPhase() == MotorIdentifier::DONE) {
+        // Escribir ~90 bytes bloquea unos 300 ms: los motores ya están parados
+        eeprom.saveMotorModel(identify.model);
+        tool = TOOL_NONE;
+        motorModelValid = true;
+        debugger.systemMessage(F("identify: listo, modelo guardado (set feedforward 1 para usarlo)"));
+        startReport(REPORT_MOTORS);
+    } else if (identifier.getPhase() == MotorIdentifier::FAILED) {
+        // El modelo guardado no se tocó: el feedforward sigue con él
+        tool = TOOL_NONE;
+        debugger.systemMessage(identifier.getFailedWheel() ? F("identify: falló, la rueda derecha no gira o no cuenta pulsos")
+                                                           : F("identify: falló, la rueda izquierda no gira o no cuenta pulsos"));
+    }
+}
+
+// PWM del modelo para la RPM objetivo: solo la curva de esa rueda y ese sentido, leída
+// de la EEPROM (18 bytes, unos µs; puede esperar a un byte de config en escritura, que
+// solo se copia en idle)
+__attribute__((noinline)) int16_t Robot::motorFeedforward(bool right, real_t targetRpm) {
+    int16_t rpm = toInt(targetRpm);
+    MotorCurve c;
+    eeprom.loadMotorCurve(motorCurveIndex(right, rpm), c);
+    return c.feedforward(rpm);
+}
+
+static const char MOTOR_CURVE_NAMES[MOTOR_CURVE_COUNT][5] PROGMEM = {"izq+", "izq-", "der+", "der-"};
+
+void Robot::serviceReport() {
+    char msg[80];
+    if (!formatReportLine(msg, sizeof(msg))) {
+        reportKind = REPORT_NONE;
+        if ((tool == TOOL_STEP && !stepTest.active()) || (tool == TOOL_RELAY && !relay.tuner.active())) tool = TOOL_NONE;
+        return;
+    }
+    if (debugger.trySystemMessage(msg)) reportLine++;
+}
+
+// Ganancias sugeridas para un modelo de primer orden con retardo, en la forma de
+// `set left` (kp, ki = kp/Ti, kd = kp·Td). El retardo suma medio período del lazo.
+//   SIMC (Skogestad), PI con τc = θ:  kp = T / (K·2θ),  Ti = min(T, 8θ)
+//   IMC (Rivera), PID con λ = max(θ, T/4):
+//     kp = (2T + θ) / (K·(2λ + θ)),  Ti = T + θ/2,  Td = T·θ / (2T + θ)
+static void fopdtGains(const StepIdentifier::Result& r, float dt, bool imc, float* k) {
+    float theta = r.delay + dt / 2;
+    float t = r.timeConstant;
+    if (!imc) {
+        float ti = min(t, 8 * theta);
+        k[0] = t / (r.gain * 2 * theta);
+        k[1] = k[0] / ti;
+        k[2] = 0;
+    } else {
+        float lambda = max(theta, t / 4);
+        k[0] = (2 * t + theta) / (r.gain * (2 * lambda + theta));
+        k[1] = k[0] / (t + theta / 2);
+        k[2] = k[0] * t * theta / (2 * t + theta);
+    }
+}
+
+bool Robot::formatReportLine(char* msg, uint8_t size) {
+    if (reportKind == REPORT_MOTORS) {
+        if (reportLine >= MOTOR_CURVE_COUNT) return false;
+        MotorCurve c;
+        eeprom.loadMotorCurve(reportLine, c);
+        int n = snprintf_P(msg, size, PSTR("motor %S pwm %u-%u rpm"), MOTOR_CURVE_NAMES[reportLine], c.deadband, c.topPwm);
+        for (uint8_t k = 0; k < MOTOR_LUT_POINTS && n < size; k++) {
+            n += snprintf_P(msg + n, size - n, PSTR("%c%d"), k ? ',' : ' ', c.rpm[k]);
+        }
+        return true;
+    }
+    if (reportKind == REPORT_RELAY) {
+        // Por lazo: Ku y Pu medidos y las ganancias aplicadas
+        uint8_t loops = relay.tuner.getTarget() == RelayTuner::TARGET_WHEELS ? 2 : 1;
+        if (reportLine >= 2 * loops) return false;
+        uint8_t c = reportLine / 2;
+        PGM_P loop = loops == 1 ? PSTR("line") : c ? PSTR("right") : PSTR("left");
+        float ku = relay.tuner.ultimateGain(c), pu = relay.tuner.ultimatePeriod(c);
+        char a[12], b[12], d[12];
+        if (reportLine % 2 == 0) {
+            dtostrf(ku, 0, 5, a);
+            dtostrf(pu, 0, 3, b);
+            snprintf_P(msg, size, PSTR("relay %S: Ku %s, Pu %s s"), loop, a, b);
         } else {
-            allBlack = false;
-            allWhite = false;
+            float k[3];
+            relayGains(relay.tuner.getRule(), ku, pu, k);
+            dtostrf(k[0], 0, 5, a);
+            dtostrf(k[1], 0, 5, b);
+            dtostrf(k[2], 0, 5, d);
+            snprintf_P(msg, size, PSTR("%S: set %S %s,%s,%s"), RELAY_RULE_NAMES[relay.tuner.getRule()], loop, a, b, d);
+        }
+        return true;
+    }
+    // REPORT_STEP: por rueda, el modelo y las ganancias SIMC e IMC
+    if (reportLine >= 6) return false;
+    uint8_t wheel = reportLine / 3;
+    PGM_P side = wheel ? PSTR("right") : PSTR("left");
+    const StepIdentifier::Result& r = stepTest.getResult(wheel);
+    char a[12], b[12], c[12];
+    if (reportLine % 3 == 0) {
+        dtostrf(r.gain, 0, 3, a);
+        dtostrf(r.timeConstant, 0, 3, b);
+        dtostrf(r.delay, 0, 3, c);
+        snprintf_P(msg, size, PSTR("step %S: K %s rpm/pwm, T %s s, L %s s"), side, a, b, c);
+    } else {
+        float k[3];
+        bool imc = reportLine % 3 == 2;
+        fopdtGains(r, toFloat(params.dtSpeed), imc, k);
+        dtostrf(k[0], 0, 4, a);
+        dtostrf(k[1], 0, 4, b);
+        dtostrf(k[2], 0, 5, c);
+        snprintf_P(msg, size, PSTR("%S: set %S %s,%s,%s"), imc ? PSTR("imc") : PSTR("simc"), side, a, b, c);
+    }
+    return true;
+}
+
+// RPM medida para los PID de velocidad, por el biquad de RPM si está activo (en ×8
+// para no perder resolución en int16)
+real_t Robot::filterRpm(Biquad& filter, real_t rpm) {
+    const BiquadCoeffs& c = params.biquad[BQ_RPM];
+    if (!c.active) return rpm;
+    // RPM ×8 en int16_t, como toFixed16(rpm, 8)
+    int16_t x = toInt(rpm * real_t(8));
+    return real_t((int)filter.process(c, x)) * real_t(0.125f);
+}
+// RPM en un byte para el grabador (RecorderSample)
+static int8_t recorderRpm(real_t rpm) {
+    return (int8_t)constrain(toFixed16(toFloat(rpm), 1) / 32, -128, 127);
+}
+
+void Robot::recordSample() {
+    if (!recording()) return;
+    FlightRecorder<RecorderSample, RECORDER_SAMPLES>::State state = recorder.getState();
+    if (state != recorder.ARMED && state != recorder.TRIGGERED) return;
+
+    RecorderSample s;
+    s.linePos = lastLinePosition;
+    s.lineIntegral = toFixed16(linePid.getIntegral(), 1);
+    s.lineDeriv = toFixed16(linePid.getDerivative(), 1);
+    s.linePidOut = toFixed16(linePid.getOutput(), 10);
+    s.lTargetRpm = recorderRpm(leftTargetRPM);
+    s.rTargetRpm = recorderRpm(rightTargetRPM);
+    s.lRpm = recorderRpm(leftMotor.getFilteredRPM());
+    s.rRpm = recorderRpm(rightMotor.getFilteredRPM());
+    s.lPwm = leftMotor.getSpeed() / 2;
+    s.rPwm = rightMotor.getSpeed() / 2;
+    recorder.record(s);
+
+    if (state == recorder.ARMED) {
+        if ((recorderTriggers & REC_TRIG_LINE_LOST) && currentSensorState == ALL_WHITE) {
+            recorder.trigger(REC_TRIG_LINE_LOST);
+        } else if ((recorderTriggers & REC_TRIG_STATE) && currentSensorState != recorderLastState) {
+            recorder.trigger(REC_TRIG_STATE);
+        } else if ((recorderTriggers & REC_TRIG_DEVIATION) && abs(lastLinePosition) > recorderDeviation) {
+            recorder.trigger(REC_TRIG_DEVIATION);
         }
     }
-    if(allBlack) return ALL_BLACK;
-    if(allWhite) return ALL_WHITE;
-    return NORMAL;
+    recorderLastState = currentSensorState;
+}
+
+// Un bloque por iteración y solo si cabe entero en el buffer de salida
+void Robot::serviceDump() {
+    if (dumpIndex == 0xFFFF) {
+        RecorderHeader h;
+        h.reason = recorder.getReason();
+        h.samples = recorder.size();
+        h.triggerIndex = recorder.triggerIndex();
+        h.periodUs = params.loopSpeedMs * 1000;
+        h.posScale = 1;
+        h.sampleSize = sizeof(RecorderSample);
+        if (debugger.sendFrame(FRAME_RECORDER_HEADER, &h, sizeof(h))) dumpIndex = 0;
+        return;
+    }
+    if (dumpIndex >= recorder.size()) {
+        dumping = false;
+        return;
+    }
+    uint8_t payload[2 + RECORDER_SAMPLES_PER_FRAME * sizeof(RecorderSample)];
+    payload[0] = dumpIndex & 0xFF;
+    payload[1] = dumpIndex >> 8;
+    uint8_t n = 0;
+    while (n < RECORDER_SAMPLES_PER_FRAME && dumpIndex + n < recorder.size()) {
+        memcpy(payload + 2 + n * sizeof(RecorderSample), &recorder.at(dumpIndex + n), sizeof(RecorderSample));
+        n++;
+    }
+    if (debugger.sendFrame(FRAME_RECORDER_SAMPLES, payload, 2 + n * sizeof(RecorderSample))) dumpIndex += n;
+}
+
+// El ack de `set baud` sale completo a la velocidad vieja antes de conmutar. Si el
+// host no confirma con `baud ok` a la nueva, se vuelve a la anterior.
+// Conmuta recién cuando salió todo lo pendiente (el ack va a la velocidad vieja),
+// sin bloquear el lazo mientras tanto
+void Robot::serviceBaud() {
+    if (debugger.pending()) return;
+    if (baudState == BAUD_SWITCH) {
+        Serial.end();
+        Serial.begin(pendingBaud);
+        baudDeadline = millis() + BAUD_CONFIRM_TIMEOUT_MS;
+        baudState = BAUD_CONFIRM;
+    } else if (baudState == BAUD_CONFIRM && (long)(millis() - baudDeadline) >= 0) {
+        Serial.end();
+        Serial.begin(serialBaud);
+        baudState = BAUD_IDLE;
+        char msg[40];
+        snprintf_P(msg, sizeof(msg), PSTR("Sin confirmación, baud: %lu"), (unsigned long)serialBaud);
+        debugger.systemMessage(msg);
+    }
 }
 
 void Robot::updateModeLed(unsigned long currentMillis, unsigned long blinkInterval) {
@@ -759,15 +2184,33 @@ void Robot::updateModeLed(unsigned long currentMillis, unsigned long blinkInterv
     }
 }
 
+// La línea de texto de telemetry no guarda copia en SRAM: cada grupo sale con los
+// datos del momento, armados en la pila solo cuando toca uno
+void Robot::serviceDebugger() {
+    if (debugger.needsTelemetry()) {
+        TelemetryData data = buildTelemetryData();
+        debugger.service(&data);
+    } else {
+        debugger.service();
+    }
+}
+
+// Vacía todo bloqueando; solo antes de operaciones que ya bloquean (calibración)
+void Robot::flushDebugger() {
+    while (debugger.pending()) serviceDebugger();
+    Serial.flush();
+}
+
 TelemetryData Robot::buildTelemetryData() {
     TelemetryData data;
-    qtr.read();
+    // En modo línea el lazo ya leyó los sensores en este ciclo
+    if (params.operationMode != MODE_LINE_FOLLOWING) qtr.read();
     int16_t* sensors = qtr.getSensorValues();
     memcpy(data.sensors, sensors, sizeof(data.sensors));
 
     data.linePos = qtr.linePosition;
     data.lineError = linePid.getError();
-    data.linePidOut = lastPidOutput;
+    data.linePidOut = linePid.getOutput();
     data.lineIntegral = linePid.getIntegral();
     data.lineDeriv = linePid.getDerivative();
     data.lPidOut = leftPid.getOutput();
@@ -781,129 +2224,577 @@ TelemetryData Robot::buildTelemetryData() {
     data.uptime = millis();
     data.lRpm = leftMotor.getRPM();
     data.rRpm = rightMotor.getRPM();
-    data.lTargetRpm = leftTargetRPM;
-    data.rTargetRpm = rightTargetRPM;
+    data.lTargetRpm = toFloat(leftTargetRPM);
+    data.rTargetRpm = toFloat(rightTargetRPM);
     data.lSpeed = leftMotor.getSpeed();
     data.rSpeed = rightMotor.getSpeed();
     data.encL = leftMotor.getEncoderCount();
     data.encR = rightMotor.getEncoderCount();
     data.encLBackward = leftMotor.getBackwardCount();
     data.encRBackward = rightMotor.getBackwardCount();
-    data.leftSpeedCms = (data.lRpm * PI * (config.wheelDiameter / 10.0)) / 60.0;
-    data.rightSpeedCms = (data.rRpm * PI * (config.wheelDiameter / 10.0)) / 60.0;
+    data.leftSpeedCms = data.lRpm * params.rpmToCms;
+    data.rightSpeedCms = data.rRpm * params.rpmToCms;
     data.battery = 8.4;
     data.loopTime = loopTime;
-    data.curvature = filteredCurvature;
+    data.txDropped = debugger.droppedFrames();
+    data.profile = activeProfile;
+    data.rcSeq = rcSeq;
+    data.rcLatencyUs = rcLatencyUs;
+    data.rcErrors = serialReader.rcErrorCount();
+    data.curvature = toFloat(filteredCurvature) * toFloat(params.invDtLine);   // por segundo
     data.sensorState = (uint8_t)currentSensorState;
     return data;
 }
 
-void Robot::processCommand(const char* cmd) {
-    if (strlen(cmd) == 0) return;
+// Los mismos valores que buildTelemetryData(), directo en punto fijo: en el camino
+// binario no hace falta la copia en float (137 bytes de pila)
+void Robot::buildTelemetryWire(TelemetryWire& w) {
+    if (params.operationMode != MODE_LINE_FOLLOWING) qtr.read();
+    const int16_t* sensors = qtr.getSensorValues();
+    for (uint8_t i = 0; i < 8; i++) w.sensors[i] = sensors[i] < 0 ? 0 : sensors[i];
+
+    float lRpm = leftMotor.getRPM(), rRpm = rightMotor.getRPM();
+    w.uptime = millis();
+    w.loopTime = loopTime > 0xFFFF ? 0xFFFF : loopTime;
+    w.linePos = toFixed16(qtr.linePosition, 1);
+    w.lineError = toFixed16(linePid.getError(), 1);
+    w.lineIntegral = toFixed16(linePid.getIntegral(), 1);
+    w.lineDeriv = toFixed16(linePid.getDerivative(), 1);
+    w.linePidOut = toFixed16(linePid.getOutput(), 10);
+    w.lRpm = toFixed16(lRpm, 8);
+    w.lTargetRpm = toFixed16(toFloat(leftTargetRPM), 8);
+    w.lError = toFixed16(leftPid.getError(), 8);
+    w.lIntegral = toFixed16(leftPid.getIntegral(), 1);
+    w.lDeriv = toFixed16(leftPid.getDerivative(), 1);
+    w.lPidOut = toFixed16(leftPid.getOutput(), 10);
+    w.lSpeed = leftMotor.getSpeed();
+    w.encL = leftMotor.getEncoderCount();
+    w.encLBackward = leftMotor.getBackwardCount();
+    w.rRpm = toFixed16(rRpm, 8);
+    w.rTargetRpm = toFixed16(toFloat(rightTargetRPM), 8);
+    w.rError = toFixed16(rightPid.getError(), 8);
+    w.rIntegral = toFixed16(rightPid.getIntegral(), 1);
+    w.rDeriv = toFixed16(rightPid.getDerivative(), 1);
+    w.rPidOut = toFixed16(rightPid.getOutput(), 10);
+    w.rSpeed = rightMotor.getSpeed();
+    w.encR = rightMotor.getEncoderCount();
+    w.encRBackward = rightMotor.getBackwardCount();
+    w.leftSpeedCms = toFixed16(lRpm * params.rpmToCms, 100);
+    w.rightSpeedCms = toFixed16(rRpm * params.rpmToCms, 100);
+    w.battery = 8400;
+    w.curvature = toFixed16(toFloat(filteredCurvature) * toFloat(params.invDtLine), 1);
+    w.sensorState = (uint8_t)currentSensorState;
+    w.txDropped = debugger.droppedFrames();
+    w.profile = activeProfile;
+    w.rcSeq = rcSeq;
+    w.rcLatencyUs = rcLatencyUs;
+    w.rcErrors = serialReader.rcErrorCount();
+}
+
+void Robot::sendTelemetryBinary(uint8_t mask) {
+    TelemetryWire w;
+    buildTelemetryWire(w);
+    debugger.sendTelemetryBinary(w, mask);
+}
+
+#define COMMAND_NAME(id, name, handler) static const char CMD_NAME_##id[] PROGMEM = name;
+COMMAND_LIST(COMMAND_NAME)
+#undef COMMAND_NAME
+
+const SerialCommand Robot::COMMANDS[COMMAND_COUNT] PROGMEM = {
+#define COMMAND_ENTRY(id, name, handler) { CMD_NAME_##id, &Robot::handler },
+    COMMAND_LIST(COMMAND_ENTRY)
+#undef COMMAND_ENTRY
+};
+
+// Hash de la clave -> opcode. Los case se calculan al compilar y dos claves con el
+// mismo hash darían un case duplicado, así que el hash es perfecto sobre la tabla.
+int8_t Robot::findCommand(uint32_t hash) {
+    switch (hash) {
+#define COMMAND_CASE(id, name, handler) case fnv1a(name): return CMD_##id;
+    COMMAND_LIST(COMMAND_CASE)
+#undef COMMAND_CASE
+    default: return -1;
+    }
+}
 
-    bool handled = false;
-    for (int i = 0; commands[i].command != NULL; i++) {
-        size_t len = strlen(commands[i].command);
-        if (strncmp(cmd, commands[i].command, len) == 0) {
-            const char* params = cmd + len;
-            commands[i].handler(this, params);
-            handled = true;
-            break;
+bool Robot::processCommand(const char* cmd, bool ack) {
+    if (strlen(cmd) == 0) return false;
+
+    int8_t op = -1;
+    const char* p = cmd;
+    if (*p == '#') {
+        // Opcode numérico: índice directo, sin hash ni comparación de texto
+        char* end;
+        long n = strtol(p + 1, &end, 10);
+        if (end != p + 1 && n >= 0 && n < COMMAND_COUNT && (*end == '\0' || *end == ' ')) op = n;
+        p = end;
+    } else {
+        // La clave es la primera palabra o, si no existe, las dos primeras.
+        // Se hashea en minúsculas; los parámetros pasan tal cual.
+        uint32_t h = FNV1A_OFFSET;
+        for (uint8_t words = 0; words < 2 && op < 0; words++) {
+            if (words) {
+                if (!*p) break;
+                h = fnv1aStep(h, *p++);
+            }
+            while (*p && *p != ' ') h = fnv1aStep(h, tolower(*p++));
+            op = findCommand(h);
+            // Descarta una entrada que solo coincide en el hash
+            if (op >= 0) {
+                PGM_P name = (PGM_P)pgm_read_ptr(&COMMANDS[op].command);
+                size_t len = p - cmd;
+                if (strlen_P(name) != len || strncasecmp_P(cmd, name, len) != 0) op = -1;
+            }
         }
     }
 
-    if (handled) {
-        char ackMsg[50];
-        sprintf(ackMsg, " %s", cmd);
-        debugger.ackMessage(ackMsg);
-    } else {
+    if (op < 0) {
         debugger.systemMessage(F("Comando desconocido. Envía 'help'"));
+        return false;
+    }
+    bool (*handler)(Robot*, const char*) = (bool (*)(Robot*, const char*))pgm_read_ptr(&COMMANDS[op].handler);
+    bool ok = handler(this, *p ? p + 1 : p);
+
+    if (ack) debugger.ackMessage(cmd);
+    return ok;
+}
+
+// Una línea puede llevar varios comandos separados por ';'. Sin prefijo cada comando
+// se confirma con su eco, como siempre; con `@<seq>` se responde un único
+// `acks:<seq>,<n>,<máscara>` y el host puede encadenar líneas sin esperar cada eco.
+void Robot::processLine(char* line) {
+    bool sequenced = false;
+    uint32_t seq = 0;
+    if (*line == '@') {
+        char* end;
+        seq = strtoul(line + 1, &end, 10);
+        if (end == line + 1 || (*end != ' ' && *end != '\0')) {
+            debugger.systemMessage(F("Formato: @<seq> cmd;cmd;..."));
+            return;
+        }
+        sequenced = true;
+        line = end;
+    }
+
+    uint8_t count = 0;
+    uint16_t okMask = 0;
+    char* p = line;
+    while (*p && count < COMMAND_BATCH_MAX) {
+        while (*p == ' ') p++;
+        char* cmd = p;
+        // Corta el comando en el sitio: el ';' pasa a ser su terminador
+        char* sep = strchr(p, ';');
+        if (sep) {
+            *sep = '\0';
+            p = sep + 1;
+        } else {
+            p += strlen(p);
+        }
+        char* last = cmd + strlen(cmd);
+        while (last > cmd && last[-1] == ' ') *--last = '\0';
+        if (!*cmd) continue;
+
+        if (processCommand(cmd, !sequenced)) okMask |= 1u << count;
+        count++;
     }
+    // Lo que no entra en el lote no se ejecuta; el host lo ve en <n> y lo reenvía
+    if (*p) debugger.systemMessage(F("Lote truncado"));
+    if (sequenced) debugger.batchAck(seq, count, okMask);
 }
 
+// Recorre los valores separados por ',' sin copiar la cadena; para en el primero que no es número
 int Robot:: parseFloatArray(const char* params, float* values, int maxCount) {
-    char temp[64];
-    strcpy(temp, params);
-    char* token = strtok(temp, ",");
+    const char* p = params;
     int count = 0;
-    while (token && count < maxCount) {
-        values[count++] = atof(token);
-        token = strtok(NULL, ",");
+    while (count < maxCount) {
+        char* end;
+        float v = strtod(p, &end);
+        if (end == p) break;
+        values[count++] = v;
+        if (*end != ',') break;
+        p = end + 1;
     }
     return count;
 }
 
 // Handler implementations
-void Robot::handleCalibrate(Robot* self, const char* params) {
+// La calibración bloquea 5 s: se hace desde run(), fuera del procesamiento del
+// comando, así el vaciado del debugger no se apila sobre el parser
+bool Robot::handleCalibrate(Robot* self, const char* params) {
     self->leftMotor.setSpeed(0);
     self->rightMotor.setSpeed(0);
+    self->calibrationPending = true;
+    return true;
+}
+
+void Robot::serviceCalibration() {
+    calibrationPending = false;
     digitalWrite(MODE_LED_PIN, HIGH);
-    self->debugger.systemMessage(F("Calibrando..."));
-    self->qtr.calibrate();
+    debugger.systemMessage(F("Calibrando..."));
+    flushDebugger();
+    qtr.calibrate();
     digitalWrite(MODE_LED_PIN, LOW);
-    self->debugger.systemMessage(F("Calibración completada."));
+    debugger.systemMessage(F("Calibración completada."));
 }
 
-void Robot::handleSave(Robot* self, const char* params) {
-    saveConfig();
+bool Robot::handleSave(Robot* self, const char* params) {
+    markConfigDirty();
+    self->eeprom.requestFlush();
+    return true;
 }
 
-void Robot::handleGetDebug(Robot* self, const char* params) {
-    TelemetryData data = self->buildTelemetryData();
-    self->debugger.sendDebugData(data, config);
+bool Robot::handleGetDebug(Robot* self, const char* params) {
+    self->debugger.sendDebugData();
+    return true;
 }
 
-void Robot::handleGetTelemetry(Robot* self, const char* params) {
-    TelemetryData data = self->buildTelemetryData();
-    self->debugger.sendTelemetryData(data);
+bool Robot::handleGetTelemetry(Robot* self, const char* params) {
+    self->debugger.sendTelemetryData();
+    return true;
 }
 
-void Robot::handleGetConfig(Robot* self, const char* params) {
-    self->debugger.sendConfigData(config);
+bool Robot::handleGetConfig(Robot* self, const char* params) {
+    self->debugger.sendConfigData();
+    return true;
 }
 
-void Robot::handleReset(Robot* self, const char* params) {
-    // Cancel auto-tuning if active
-    if (self->autoTuningActive) {
-        self->autoTuningActive = false;
-        // Restore original PID values
-        config.lineKp = self->originalKp;
-        config.lineKi = self->originalKi;
-        config.lineKd = self->originalKd;
-        self->linePid.setGains(self->originalKp, self->originalKi, self->originalKd);
+bool Robot::handleReset(Robot* self, const char* params) {
+    if (self->relayTuning()) {
+        self->stopRelay();
+        self->debugger.systemMessage(F("autotune: cancelado"));
+    }
+    if (self->autoTuning()) {
+        self->tool = TOOL_NONE;
         self->debugger.systemMessage(F("Auto-tuning cancelado."));
-        digitalWrite(MODE_LED_PIN, LOW);
     }
-    
+
     config.restoreDefaults();
-    saveConfig();
-    self->linePid.setGains(config.lineKp, config.lineKi, config.lineKd);
-    self->leftPid.setGains(config.leftKp, config.leftKi, config.leftKd);
-    self->rightPid.setGains(config.rightKp, config.rightKi, config.rightKd);
+    markConfigDirty();
+    self->eeprom.requestFlush();
+    publishConfig();
+    return true;
 }
 
-void Robot::handleHelp(Robot* self, const char* params) {
+bool Robot::handleHelp(Robot* self, const char* params) {
     // self->debugger.systemMessage(F("Comandos: calibrate, save, get debug, get telemetry, get config, reset, help, autotune"));
-    // self->debugger.systemMessage(F("set telemetry 0/1  |  set mode 0/1/2  |  set cascade 0/1"));
+    // self->debugger.systemMessage(F("set telemetry 0/1/2  |  set mode 0/1/2  |  set cascade 0/1"));
     // self->debugger.systemMessage(F("set feature <idx 0-8> 0/1  |  set features 0,1,0,...  |  set line kp,ki,kd  |  set left kp,ki,kd  |  set right kp,ki,kd"));
     // self->debugger.systemMessage(F("set base <pwm>,<rpm>  |  set max <pwm>,<rpm>  |  set weight <g>  |  set samp_rate <line_ms>,<speed_ms>,<telemetry_ms>"));
     // self->debugger.systemMessage(F("set pwm <derecha>,<izquierda>  (solo en modo idle)"));
     // self->debugger.systemMessage(F("set rpm <izquierda>,<derecha>  (solo en modo idle)"));
+    return true;
+}
+
+bool Robot::handleSetBaud(Robot* self, const char* params) {
+    char* end;
+    uint32_t baud = strtoul(params, &end, 10);
+    if (end == params || *end != '\0') { self->debugger.systemMessage(F("Falta argumento")); return false; }
+    // Con U2X a 16 MHz estas velocidades no tienen error de reloj (115200 queda en +2.1%)
+    if (baud != 115200 && baud != 250000 && baud != 500000 && baud != 1000000) {
+        self->debugger.systemMessage(F("Baud: 115200, 250000, 500000 o 1000000"));
+        return false;
+    }
+    if (self->baudState != BAUD_IDLE) { self->debugger.systemMessage(F("Cambio de baud en curso")); return false; }
+    self->pendingBaud = baud;
+    self->baudState = BAUD_SWITCH;
+    return true;
+}
+
+bool Robot::handleBaudOk(Robot* self, const char* params) {
+    if (self->baudState != BAUD_CONFIRM) { self->debugger.systemMessage(F("Nada que confirmar")); return false; }
+    self->serialBaud = self->pendingBaud;
+    self->baudState = BAUD_IDLE;
+    char msg[20];
+    snprintf_P(msg, sizeof(msg), PSTR("Baud: %lu"), (unsigned long)self->serialBaud);
+    self->debugger.systemMessage(msg);
+    return true;
+}
+
+// Índice de perfil al principio de `params`; en `rest` queda lo que sigue. -1 si no es válido
+int8_t Robot::parseProfileIndex(const char* params, const char** rest) {
+    char* end;
+    long n = strtol(params, &end, 10);
+    if (end == params || n < 0 || n >= PROFILE_SLOTS || (*end != '\0' && *end != ' ')) return -1;
+    *rest = *end ? end + 1 : end;
+    return n;
+}
+
+// profile save <n> [nombre]: ganancias, velocidades y features actuales al slot n
+bool Robot::handleProfileSave(Robot* self, const char* params) {
+    const char* name;
+    int8_t n = parseProfileIndex(params, &name);
+    if (n < 0) { self->debugger.systemMessage(F("Formato: profile save <0-3> [nombre]")); return false; }
+    // Escribir ~70 bytes de EEPROM bloquea cientos de ms: nunca con el robot andando. En
+    // idle las ruedas también giran con `set rpm` o con identify/autotune de ruedas
+    if (config.operationMode != MODE_IDLE) { self->debugger.systemMessage(F("Comando solo disponible en modo idle")); return false; }
+    if (self->leftTargetRPM != 0 || self->rightTargetRPM != 0 || self->identifying() || self->stepTesting() || self->relayTuning()) {
+        self->debugger.systemMessage(F("profile save: con las ruedas paradas (set rpm 0,0)"));
+        return false;
+    }
+    TuningProfile p;
+    memset(&p, 0, sizeof(p));
+    p.capture(config);
+    strncpy(p.name, name, PROFILE_NAME_LEN - 1);
+    self->eeprom.saveProfile(n, p);
+    self->activeProfile = n;
+    return true;
+}
+
+// profile load <n>: el lazo adopta el perfil al inicio del próximo tick, sin salto en la salida
+bool Robot::handleProfileLoad(Robot* self, const char* params) {
+    const char* rest;
+    int8_t n = parseProfileIndex(params, &rest);
+    if (n < 0) { self->debugger.systemMessage(F("Formato: profile load <0-3>")); return false; }
+    TuningProfile p;
+    if (!self->eeprom.loadProfile(n, p)) { self->debugger.systemMessage(F("Perfil vacío")); return false; }
+    p.apply(config);
+    publishConfig();
+    self->activeProfile = n;
+    return true;
 }
 
-void Robot::handleSetTelemetry(Robot* self, const char* params) {
+bool Robot::handleProfileList(Robot* self, const char* params) {
+    for (uint8_t n = 0; n < PROFILE_SLOTS; n++) {
+        TuningProfile p;
+        char msg[48];
+        if (self->eeprom.loadProfile(n, p)) {
+            snprintf_P(msg, sizeof(msg), PSTR("%cP%u %s base %d/%d max %d/%d"), n == self->activeProfile ? '*' : ' ', n,
+                     p.name, p.basePwm, (int)p.baseRPM, p.maxPwm, (int)p.maxRpm);
+        } else {
+            snprintf_P(msg, sizeof(msg), PSTR(" P%u (vacío)"), n);
+        }
+        self->debugger.systemMessage(msg);
+    }
+    return true;
+}
+
+// Señal de prueba para `bench`: rampa de ida y vuelta por todo el rango con ruido de
+// un LCG, así la mediana y la histéresis recorren todas sus ramas
+static int16_t benchSample(uint16_t i, uint32_t& lcg) {
+    lcg = lcg * 1664525UL + 1013904223UL;
+    int16_t ramp = (int16_t)((i & 0x3FF) < 0x200 ? (i & 0x1FF) : 0x1FF - (i & 0x1FF)) * 16 - 4096;
+    return ramp + (int16_t)((lcg >> 24) & 0x7F) - 64;
+}
+
+// Cada variante de `bench` en su propia función fuera de línea: sus instancias solo
+// ocupan pila mientras corre esa variante, no las cuatro juntas con el mensaje
+static __attribute__((noinline)) uint32_t benchSignal(uint16_t n) {
+    volatile int32_t sink = 0;
+    uint32_t lcg = 1;
+    uint32_t start = micros();
+    for (uint16_t i = 0; i < n; i++) sink += benchSample(i, lcg);
+    return micros() - start;
+}
+
+static __attribute__((noinline)) uint32_t benchFeatures(uint16_t n) {
+    // Instancias propias: no tocan el estado de los filtros del lazo
+    Features runtime;
+    runtime.setConfig(config.features);
+    volatile int32_t sink = 0;
+    uint32_t lcg = 1;
+    uint32_t start = micros();
+    for (uint16_t i = 0; i < n; i++) sink += runtime.applySignalFilters(benchSample(i, lcg));
+    return micros() - start;
+}
+
+static __attribute__((noinline)) uint32_t benchFilterChain(uint16_t n) {
+    LineFilterChain fixed;
+    volatile int32_t sink = 0;
+    uint32_t lcg = 1;
+    uint32_t start = micros();
+    for (uint16_t i = 0; i < n; i++) sink += fixed.process(benchSample(i, lcg));
+    return micros() - start;
+}
+
+static __attribute__((noinline)) uint32_t benchEstimator(uint16_t n, const ControlParams& p) {
+    LineEstimator model;
+    volatile int32_t sink = 0;
+    uint32_t lcg = 1;
+    uint32_t start = micros();
+    for (uint16_t i = 0; i < n; i++) {
+        int16_t x = benchSample(i, lcg);
+        // Avance de ~1 pulso por tick con la rueda derecha algo más rápida
+        model.update(p, i, i + (i >> 3), x, 500);
+        sink += model.getPosition() + toInt(model.getRate(p.invDtLine));
+    }
+    return micros() - start;
+}
+
+// PID de velocidad con las ganancias del motor izquierdo, en float y en Q16
+static __attribute__((noinline)) uint32_t benchPidFloat(uint16_t n, float dt) {
+    PIDController<float> pid(config.leftKp, config.leftKi, config.leftKd, LIMIT_MAX_PWM, -LIMIT_MAX_PWM);
+    volatile int32_t sink = 0;
+    uint32_t lcg = 1;
+    uint32_t start = micros();
+    for (uint16_t i = 0; i < n; i++) sink += (int16_t)pid.calculate(200, benchSample(i, lcg) >> 3, dt);
+    return micros() - start;
+}
+
+static __attribute__((noinline)) uint32_t benchPidFixed(uint16_t n, float dt) {
+    PIDController<Q16> pid(config.leftKp, config.leftKi, config.leftKd, LIMIT_MAX_PWM, -LIMIT_MAX_PWM);
+    Q16 dtFixed(dt);
+    volatile int32_t sink = 0;
+    uint32_t lcg = 1;
+    uint32_t start = micros();
+    for (uint16_t i = 0; i < n; i++) sink += pid.calculate(200, benchSample(i, lcg) >> 3, dtFixed).toInt();
+    return micros() - start;
+}
+
+// Los dos mensajes de `bench` se arman después de medir: el buffer no ocupa pila
+// mientras corren las variantes
+static __attribute__((noinline)) void benchReport(Debugger& debugger, long n, const uint32_t* us) {
+    // Se descuenta el costo de generar la señal; décimas de µs sin printf de float,
+    // en 16 bits (hasta 6553.5 µs por muestra)
+    uint16_t t[5];
+    for (uint8_t v = 0; v < 5; v++) {
+        uint32_t tenths = (us[v + 1] > us[0] ? us[v + 1] - us[0] : 0) * 10 / n;
+        t[v] = tenths > 0xFFFF ? 0xFFFF : tenths;
+    }
+    char msg[72];
+    snprintf_P(msg, sizeof(msg), PSTR("bench %ld: runtime %u.%u us, fija %u.%u us, estimador %u.%u us"),
+             n, t[0] / 10, t[0] % 10, t[1] / 10, t[1] % 10, t[2] / 10, t[2] % 10);
+    debugger.systemMessage(msg);
+    snprintf_P(msg, sizeof(msg), PSTR("bench %ld: pid float %u.%u us, q16 %u.%u us"),
+             n, t[3] / 10, t[3] % 10, t[4] / 10, t[4] % 10);
+    debugger.systemMessage(msg);
+}
+
+// bench [n]: µs por muestra de la señal de prueba sola, de Features con los bits de
+// `set features` actuales, de LineFilterChain y de LineEstimator (actualización más
+// derivada, con la configuración activa); en un segundo mensaje, del PID en float y en
+// Q16. Bloquea ~n·200 µs, solo en idle
+bool Robot::handleBench(Robot* self, const char* params) {
+    char* end;
+    long n = *params ? strtol(params, &end, 10) : 1000;
+    if ((*params && (end == params || *end != '\0')) || n < 1 || n > 10000) {
+        self->debugger.systemMessage(F("Formato: bench [1-10000]"));
+        return false;
+    }
+    if (config.operationMode != MODE_IDLE) { self->debugger.systemMessage(F("Comando solo disponible en modo idle")); return false; }
+
+    uint32_t us[6];
+    us[0] = benchSignal(n);
+    us[1] = benchFeatures(n);
+    us[2] = benchFilterChain(n);
+    us[3] = benchEstimator(n, self->params);
+    us[4] = benchPidFloat(n, toFloat(self->params.dtSpeed));
+    us[5] = benchPidFixed(n, toFloat(self->params.dtSpeed));
+    benchReport(self->debugger, n, us);
+    return true;
+}
+
+// get mem: SRAM que la pila nunca llegó a usar desde el arranque y libre en este momento
+bool Robot::handleGetMem(Robot* self, const char* params) {
+#ifdef __AVR__
+    uint8_t* p = &__heap_start;
+    while (p < (uint8_t*)SP && *p == STACK_PAINT) p++;
+    char msg[48];
+    snprintf_P(msg, sizeof(msg), PSTR("mem: libre %u bytes, mínimo %u bytes"),
+               (unsigned)((uint8_t*)SP - &__heap_start), (unsigned)(p - &__heap_start));
+    self->debugger.systemMessage(msg);
+#else
+    self->debugger.systemMessage(F("mem: solo en AVR"));
+#endif
+    return true;
+}
+
+bool Robot::handleSetTelemetry(Robot* self, const char* params) {
     char* end;
     int val = strtol(params, &end, 10);
-    if (end == params || *end != '\0') { self->debugger.systemMessage(F("Falta argumento")); return; }
-    config.telemetry = (val == 1);
-    saveConfig();
+    if (end == params || *end != '\0') { self->debugger.systemMessage(F("Falta argumento")); return false; }
+    if (val < TELEMETRY_OFF || val > TELEMETRY_DELTA) { self->debugger.systemMessage(F("Modo 0=off, 1=texto, 2=binario, 3=delta")); return false; }
+    // La referencia delta usa la RAM del grabador
+    if (val == TELEMETRY_DELTA && !self->deltaTelemetry() && !self->claimTool(TOOL_DELTA)) return false;
+    config.telemetry = (uint8_t)val;
+    self->debugger.setDeltaMode(val == TELEMETRY_DELTA ? &self->deltaRef : NULL);
+    markConfigDirty();
+    return true;
+}
+
+bool Robot::handleSubscribe(Robot* self, const char* params) {
+    if (strcasecmp_P(params, PSTR("none")) == 0) {
+        self->debugger.clearSubscriptions();
+        return true;
+    }
+    const char* space = strchr(params, ' ');
+    if (!space || space - params > 5) { self->debugger.systemMessage(F("Formato: subscribe <grupo|all|none> <divisor>")); return false; }
+    char name[6];
+    memcpy(name, params, space - params);
+    name[space - params] = '\0';
+    char* end;
+    long divisor = strtol(space + 1, &end, 10);
+    if (end == space + 1 || *end != '\0' || divisor < 0 || divisor > 255) { self->debugger.systemMessage(F("Divisor 0-255 (0=nunca)")); return false; }
+    if (strcasecmp_P(name, PSTR("all")) == 0) {
+        for (uint8_t g = 0; g < TELEMETRY_GROUP_COUNT; g++) self->debugger.subscribe(g, divisor);
+        return true;
+    }
+    int8_t group = findTelemetryGroup(name);
+    if (group < 0) { self->debugger.systemMessage(F("Grupos: sys, line, left, right, speed, qtr, rc")); return false; }
+    self->debugger.subscribe(group, divisor);
+    return true;
+}
+
+// La memoria compartida cambia de dueño solo con todo quieto: sin telemetría delta,
+// sin volcado del grabador, sin auto-tuning y sin identificación (el escalón y el relé la
+// retienen hasta terminar su informe, el optimizador hasta copiar su checkpoint)
+bool Robot::claimTool(Tool t) {
+    if (deltaTelemetry() || dumping || autoTuning() || identifying() || tool == TOOL_STEP || tool == TOOL_RELAY
+        || eeprom.checkpointPending()) {
+        debugger.systemMessage(F("Ocupado: telemetría delta, volcado, autotune o identify"));
+        return false;
+    }
+    tool = t;
+    return true;
+}
+
+// log arm [máscara,umbral]: arma el grabador; máscara de REC_TRIG_* (por defecto solo comando)
+bool Robot::handleLogArm(Robot* self, const char* params) {
+    uint8_t mask = REC_TRIG_COMMAND;
+    int16_t deviation = self->recorderDeviation;
+    if (*params != '\0') {
+        float values[2];
+        int count = parseFloatArray(params, values, 2);
+        if (count < 1) { self->debugger.systemMessage(F("Formato: log arm <mascara>,<umbral>")); return false; }
+        mask = (uint8_t)values[0] | REC_TRIG_COMMAND;
+        if (count == 2) deviation = (int16_t)values[1];
+    }
+    self->dumping = false;
+    if (!self->claimTool(TOOL_RECORDER)) return false;
+    self->recorderTriggers = mask;
+    self->recorderDeviation = deviation;
+    self->recorderLastState = self->currentSensorState;
+    self->recorder.arm();
+    // La ventana real depende del periodo del lazo de velocidad
+    char msg[48];
+    uint16_t period = self->params.loopSpeedMs;
+    snprintf_P(msg, sizeof(msg), PSTR("Grabador: %u muestras, %u ms (%u ms antes)"),
+               (unsigned)RECORDER_SAMPLES, (unsigned)(RECORDER_SAMPLES * period),
+               (unsigned)(self->recorder.PRE * period));
+    self->debugger.systemMessage(msg);
+    return true;
+}
+
+bool Robot::handleLogTrigger(Robot* self, const char* params) {
+    if (!self->recording() || self->recorder.getState() != self->recorder.ARMED) { self->debugger.systemMessage(F("Grabador no armado")); return false; }
+    self->recorder.trigger(REC_TRIG_COMMAND);
+    return true;
+}
+
+bool Robot::handleDumpLog(Robot* self, const char* params) {
+    if (!self->recording()) { self->debugger.systemMessage(F("Grabador no armado")); return false; }
+    self->recorder.freeze();
+    self->dumping = true;
+    self->dumpIndex = 0xFFFF;  // Primero la cabecera
+    return true;
 }
 
-void Robot::handleSetMode(Robot* self, const char* params) {
+bool Robot::handleSetMode(Robot* self, const char* params) {
     char* end;
     int m = strtol(params, &end, 10);
-    if (end == params || *end != '\0') { self->debugger.systemMessage(F("Falta argumento")); return; }
+    if (end == params || *end != '\0') { self->debugger.systemMessage(F("Falta argumento")); return false; }
     config.operationMode = (OperationMode)m;
+    publishConfig();
     if (config.operationMode == MODE_REMOTE_CONTROL) {
         self->throttle = 0; self->steering = 0;
         self->leftMotor.setSpeed(0); self->rightMotor.setSpeed(0);
@@ -912,318 +2803,467 @@ void Robot::handleSetMode(Robot* self, const char* params) {
         self->rightTargetRPM = 0;
         self->leftMotor.setSpeed(0); self->rightMotor.setSpeed(0);
     }
+    return true;
 }
 
-void Robot::handleSetCascade(Robot* self, const char* params) {
+bool Robot::handleSetCascade(Robot* self, const char* params) {
     char* end;
     int val = strtol(params, &end, 10);
-    if (end == params || *end != '\0') { self->debugger.systemMessage(F("Falta argumento")); return; }
+    if (end == params || *end != '\0') { self->debugger.systemMessage(F("Falta argumento")); return false; }
     config.cascadeMode = (val == 1);
+    publishConfig();
+    return true;
 }
 
-void Robot::handleSetFeature(Robot* self, const char* params) {
+bool Robot::handleSetFeature(Robot* self, const char* params) {
     const char* p = params;
     char* end1;
     int idx = strtol(p, &end1, 10);
-    if (end1 == p || *end1 != ' ') { self->debugger.systemMessage(F("Formato: set feature <idx> <0/1>")); return; }
+    if (end1 == p || *end1 != ' ') { self->debugger.systemMessage(F("Formato: set feature <idx> <0/1> [ventana]")); return false; }
     char* end2;
     int val = strtol(end1 + 1, &end2, 10);
-    if (end2 == end1 + 1 || *end2 != '\0' || idx < 0 || idx > 8) { self->debugger.systemMessage(F("Formato: set feature <idx> <0/1>")); return; }
+    if (end2 == end1 + 1 || (*end2 != '\0' && *end2 != ' ') || idx < 0 || idx > 8) { self->debugger.systemMessage(F("Formato: set feature <idx> <0/1> [ventana]")); return false; }
+    // Ventana opcional, solo para mediana (0) y media móvil (1)
+    if (*end2 == ' ') {
+        char* end3;
+        long window = strtol(end2 + 1, &end3, 10);
+        if (end3 == end2 + 1 || *end3 != '\0' || window > 255 || !config.features.setWindow(idx, window)) {
+            char msg[40];
+            snprintf_P(msg, sizeof(msg), PSTR("Ventana: mediana impar 3-%d, media 3-%d"), FILTER_WINDOW_MAX, FILTER_WINDOW_MAX);
+            self->debugger.systemMessage(msg);
+            return false;
+        }
+    }
     config.features.setFeature(idx, val == 1);
-    self->features.setConfig(config.features);
+    publishConfig();
+    return true;
 }
 
-void Robot::handleSetFeatures(Robot* self, const char* params) {
+bool Robot::handleSetFeatures(Robot* self, const char* params) {
     if (config.features.deserialize(params)) {
-        self->features.setConfig(config.features);
+        publishConfig();
     } else {
         self->debugger.systemMessage(F("Formato: set features 0,1,0,1,... (9 valores)"));
+        return false;
     }
+    return true;
 }
 
-void Robot::handleSetLine(Robot* self, const char* params) {
+bool Robot::handleSetLine(Robot* self, const char* params) {
     float values[3];
     int count = self->parseFloatArray(params, values, 3);
-    if (count != 3) { self->debugger.systemMessage(F("Formato: set line kp,ki,kd")); return; }
+    if (count != 3) { self->debugger.systemMessage(F("Formato: set line kp,ki,kd")); return false; }
     config.lineKp = values[0]; config.lineKi = values[1]; config.lineKd = values[2];
-    self->linePid.setGains(values[0], values[1], values[2]);
+    publishConfig();
+    return true;
 }
 
-void Robot::handleSetLeft(Robot* self, const char* params) {
+bool Robot::handleSetLeft(Robot* self, const char* params) {
     float values[3];
     int count = self->parseFloatArray(params, values, 3);
-    if (count != 3) { self->debugger.systemMessage(F("Formato: set left kp,ki,kd")); return; }
+    if (count != 3) { self->debugger.systemMessage(F("Formato: set left kp,ki,kd")); return false; }
     config.leftKp = values[0]; config.leftKi = values[1]; config.leftKd = values[2];
-    self->leftPid.setGains(values[0], values[1], values[2]);
+    publishConfig();
+    return true;
 }
 
-void Robot::handleSetRight(Robot* self, const char* params) {
+bool Robot::handleSetRight(Robot* self, const char* params) {
     float values[3];
     int count = self->parseFloatArray(params, values, 3);
-    if (count != 3) { self->debugger.systemMessage(F("Formato: set right kp,ki,kd")); return; }
+    if (count != 3) { self->debugger.systemMessage(F("Formato: set right kp,ki,kd")); return false; }
     config.rightKp = values[0]; config.rightKi = values[1]; config.rightKd = values[2];
-    self->rightPid.setGains(values[0], values[1], values[2]);
+    publishConfig();
+    return true;
 }
 
-void Robot::handleSetBase(Robot* self, const char* params) {
+bool Robot::handleSetBase(Robot* self, const char* params) {
     char* comma = strchr(params, ',');
-    if (!comma) { self->debugger.systemMessage(F("Formato: set base <pwm>,<rpm>")); return; }
+    if (!comma) { self->debugger.systemMessage(F("Formato: set base <pwm>,<rpm>")); return false; }
     int pwm = atoi(params);
     float rpm = atof(comma + 1);
     config.basePwm = constrain(pwm, -LIMIT_MAX_PWM, LIMIT_MAX_PWM);
     config.baseRPM = constrain(rpm, -LIMIT_MAX_RPM, LIMIT_MAX_RPM);
+    publishConfig();
+    return true;
 }
 
-void Robot::handleSetMax(Robot* self, const char* params) {
+bool Robot::handleSetMax(Robot* self, const char* params) {
     char* comma = strchr(params, ',');
-    if (!comma) { self->debugger.systemMessage(F("Formato: set max <pwm>,<rpm>")); return; }
+    if (!comma) { self->debugger.systemMessage(F("Formato: set max <pwm>,<rpm>")); return false; }
     int pwm = atoi(params);
     float rpm = atof(comma + 1);
     config.maxPwm = constrain(pwm, 0, LIMIT_MAX_PWM);
     config.maxRpm = constrain(rpm, 0, LIMIT_MAX_RPM);
+    publishConfig();
+    return true;
 }
 
-void Robot::handleSetWeight(Robot* self, const char* params) {
+bool Robot::handleSetWeight(Robot* self, const char* params) {
     float weight = atof(params);
     if (weight <= 0) { 
         // self->debugger.systemMessage(F("Peso debe ser mayor a 0")); 
-        return; 
+        return false; 
     }
     config.robotWeight = weight;
-    saveConfig();
+    markConfigDirty();
+    return true;
 }
 
-void Robot::handleSetSampRate(Robot* self, const char* params) {
+bool Robot::handleSetSampRate(Robot* self, const char* params) {
     char* comma1 = strchr(params, ',');
     if (!comma1) { 
         // self->debugger.systemMessage(F("Formato: set samp_rate <line_ms>,<speed_ms>,<telemetry_ms>"));
-         return; 
+         return false; 
     }
     char* comma2 = strchr(comma1 + 1, ',');
     if (!comma2) { 
         // self->debugger.systemMessage(F("Formato: set samp_rate <line_ms>,<speed_ms>,<telemetry_ms>")); 
-        return; 
+        return false; 
     }
     int lineMs = atoi(params);
     int speedMs = atoi(comma1 + 1);
     int telemetryMs = atoi(comma2 + 1);
     if (lineMs <= 0 || speedMs <= 0 || telemetryMs <= 0) {
         //  self->debugger.systemMessage(F("Valores deben ser mayores a 0")); 
-         return; 
+         return false; 
     }
     config.loopLineMs = lineMs;
     config.loopSpeedMs = speedMs;
     config.telemetryIntervalMs = telemetryMs;
-    saveConfig();
+    publishConfig();
+    markConfigDirty();
+    // Los biquads se rediseñan solos para la nueva frecuencia; avisar si alguno ya no entra
+    for (uint8_t i = 0; i < BIQUAD_SIGNAL_COUNT; i++) {
+        const BiquadConfig& b = config.biquad[i];
+        BiquadCoeffs c;
+        float fs = 1000.0f / (i == BQ_RPM ? speedMs : lineMs);
+        if (!designBiquad((BiquadType)b.type, b.fcDeciHz / 10.0f, b.qCenti / 100.0f, fs, c)) {
+            self->debugger.systemMessage(F("Biquad fuera de rango para esta frecuencia: queda sin filtrar"));
+        }
+    }
+    return true;
+}
+
+// Índice de la palabra [word, word+len) en una lista PROGMEM "a\0b\0..." de count
+// nombres, sin distinguir mayúsculas y sin copiarla a RAM; -1 si no está
+static int8_t matchName_P(const char* word, size_t len, PGM_P names, uint8_t count) {
+    for (uint8_t i = 0; i < count; i++, names += strlen_P(names) + 1) {
+        if (strlen_P(names) == len && strncasecmp_P(word, names, len) == 0) return i;
+    }
+    return -1;
+}
+
+// set biquad <pos|deriv|rpm> <off|lp|hp|notch> [fc_hz[,q]]
+bool Robot::handleSetBiquad(Robot* self, const char* params) {
+    static const char signalNames[] PROGMEM = "pos\0deriv\0rpm\0";
+    static const char typeNames[] PROGMEM = "off\0lp\0hp\0notch\0";
+    float fc = 0, q = 0;
+    const char* sig = params;
+    size_t sigLen = strcspn(sig, " ");
+    const char* type = sig + sigLen;
+    while (*type == ' ') type++;
+    size_t typeLen = strcspn(type, " ");
+    int8_t s = matchName_P(sig, sigLen, signalNames, BIQUAD_SIGNAL_COUNT);
+    int8_t t = matchName_P(type, typeLen, typeNames, BIQUAD_TYPE_COUNT);
+    if (s < 0 || t < 0) { self->debugger.systemMessage(F("Formato: set biquad <pos|deriv|rpm> <off|lp|hp|notch> [fc_hz[,q]]")); return false; }
+
+    BiquadConfig b = config.biquad[s];
+    b.type = t;
+    // fc y Q opcionales; sin ellos se conservan los anteriores. sscanf sin %f en AVR
+    const char* rest = type + typeLen;
+    while (*rest == ' ') rest++;
+    if (*rest) {
+        char* end;
+        fc = strtod(rest, &end);
+        if (end == rest || fc <= 0 || fc > 6000) { self->debugger.systemMessage(F("fc en Hz, mayor a 0")); return false; }
+        b.fcDeciHz = (uint16_t)(fc * 10 + 0.5f);
+        if (*end == ',') {
+            const char* qStart = end + 1;
+            q = strtod(qStart, &end);
+            if (end == qStart || q < 0.1f || q > 50) { self->debugger.systemMessage(F("Q entre 0.1 y 50")); return false; }
+            b.qCenti = (uint16_t)(q * 100 + 0.5f);
+        }
+        if (*end != '\0') { self->debugger.systemMessage(F("Formato: set biquad <pos|deriv|rpm> <off|lp|hp|notch> [fc_hz[,q]]")); return false; }
+    }
+    // Se diseña ya con la frecuencia actual del lazo para rechazar un fc imposible
+    BiquadCoeffs c;
+    float fs = 1000.0f / (s == BQ_RPM ? config.loopSpeedMs : config.loopLineMs);
+    if (!designBiquad((BiquadType)b.type, b.fcDeciHz / 10.0f, b.qCenti / 100.0f, fs, c)) {
+        self->debugger.systemMessage(F("fc debe ser menor a 0.45 veces la frecuencia del lazo"));
+        return false;
+    }
+    config.biquad[s] = b;
+    publishConfig();
+    markConfigDirty();
+    return true;
+}
+
+// set estimator <0|1> [alpha,beta,gamma]: β en rad/mm y γ en 1/mm² de residuo
+bool Robot::handleSetEstimator(Robot* self, const char* params) {
+    char* end;
+    long on = strtol(params, &end, 10);
+    if (end == params || (on != 0 && on != 1) || (*end != '\0' && *end != ' ')) {
+        self->debugger.systemMessage(F("Formato: set estimator <0|1> [alpha,beta,gamma]"));
+        return false;
+    }
+    EstimatorConfig e = config.estimator;
+    e.enabled = on;
+    if (*end == ' ') {
+        // Máximos: lo que entra en uint16 con la escala de cada ganancia
+        static const float limits[3] = {1.0f, 65535.0f / 65536.0f, 65535.0f / 16777216.0f};
+        static const float scales[3] = {32768.0f, 65536.0f, 16777216.0f};
+        uint16_t gains[3];
+        const char* p = end + 1;
+        for (uint8_t i = 0; i < 3; i++) {
+            float g = strtod(p, &end);
+            if (end == p || g <= 0 || g > limits[i] || *end != (i < 2 ? ',' : '\0')) {
+                self->debugger.systemMessage(F("Ganancias: 0 < alpha <= 1, 0 < beta < 1, 0 < gamma < 0.0039"));
+                return false;
+            }
+            gains[i] = (uint16_t)(g * scales[i] + 0.5f);
+            p = end + 1;
+        }
+        e.alphaQ15 = gains[0];
+        e.betaQ16 = gains[1];
+        e.gammaQ24 = gains[2];
+    }
+    config.estimator = e;
+    publishConfig();
+    markConfigDirty();
+    return true;
+}
+
+// identify motors [stop]: con las ruedas en el aire, arma la tabla PWM -> RPM de cada rueda
+bool Robot::handleIdentifyMotors(Robot* self, const char* params) {
+    if (strcasecmp_P(params, PSTR("stop")) == 0) {
+        if (!self->identifying()) return true;
+        self->tool = TOOL_NONE;
+        self->leftMotor.setSpeed(0);
+        self->rightMotor.setSpeed(0);
+        self->debugger.systemMessage(F("identify: cancelada"));
+        return true;
+    }
+    if (*params) { self->debugger.systemMessage(F("Formato: identify motors [stop]")); return false; }
+    if (config.operationMode != MODE_IDLE) { self->debugger.systemMessage(F("Comando solo disponible en modo idle")); return false; }
+    if (self->identifying() || self->stepTesting() || self->relayTuning()) { self->debugger.systemMessage(F("identify: ya en curso")); return false; }
+    if (!self->claimTool(TOOL_IDENTIFY)) return false;
+    memset(&self->identify.model, 0, sizeof(MotorModel));
+    uint8_t top = constrain(config.maxPwm, IDENTIFY_DEADBAND_STEP, LIMIT_MAX_PWM);
+    self->identify.identifier.start(top, millis(), self->leftMotor.getNetCount(), self->rightMotor.getNetCount());
+    self->debugger.systemMessage(F("identify: ruedas en el aire, ~20 s; identify motors stop para cortar"));
+    return true;
+}
+
+// identify step [u0,u1] | stop: escalón de PWM en las dos ruedas, modelo y ganancias sugeridas
+bool Robot::handleIdentifyStep(Robot* self, const char* params) {
+    if (strcasecmp_P(params, PSTR("stop")) == 0) {
+        if (!self->stepTesting()) return true;
+        self->tool = TOOL_NONE;
+        self->leftMotor.setSpeed(0);
+        self->rightMotor.setSpeed(0);
+        self->debugger.systemMessage(F("identify: cancelada"));
+        return true;
+    }
+    if (config.operationMode != MODE_IDLE) { self->debugger.systemMessage(F("Comando solo disponible en modo idle")); return false; }
+    if (self->identifying() || self->stepTesting() || self->relayTuning()) { self->debugger.systemMessage(F("identify: ya en curso")); return false; }
+    // Por defecto de 2/5 a 3/5 del máximo: lejos de la banda muerta y de la saturación
+    long u0 = config.maxPwm * 2 / 5, u1 = config.maxPwm * 3 / 5;
+    if (*params) {
+        char* end;
+        u0 = strtol(params, &end, 10);
+        if (*end != ',') { self->debugger.systemMessage(F("Formato: identify step [u0,u1] | stop")); return false; }
+        u1 = strtol(end + 1, &end, 10);
+        if (*end != '\0') { self->debugger.systemMessage(F("Formato: identify step [u0,u1] | stop")); return false; }
+    }
+    if (u0 < 0 || u1 <= u0 || u1 > LIMIT_MAX_PWM) { self->debugger.systemMessage(F("PWM: 0 <= u0 < u1 <= 255")); return false; }
+    if (!self->claimTool(TOOL_STEP)) return false;
+    self->stepTest.start(u0, u1, millis());
+    self->debugger.systemMessage(F("identify: ruedas en el aire, ~20 s; identify step stop para cortar"));
+    return true;
 }
 
-void Robot::handleRc(Robot* self, const char* params) {
+bool Robot::handleSetFeedforward(Robot* self, const char* params) {
+    char* end;
+    long on = strtol(params, &end, 10);
+    if (end == params || *end != '\0' || (on != 0 && on != 1)) { self->debugger.systemMessage(F("Formato: set feedforward <0|1>")); return false; }
+    if (on && !self->motorModelValid) { self->debugger.systemMessage(F("Sin modelo de motores: correr identify motors")); return false; }
+    config.speedFeedforward = on;
+    publishConfig();
+    markConfigDirty();
+    return true;
+}
+
+bool Robot::handleGetMotors(Robot* self, const char* params) {
+    if (!self->motorModelValid) { self->debugger.systemMessage(F("Sin modelo de motores")); return false; }
+    self->startReport(REPORT_MOTORS);
+    return true;
+}
+
+bool Robot::handleRc(Robot* self, const char* params) {
     char* comma = strchr(params, ',');
     if (!comma) { 
         // self->debugger.systemMessage(F("Formato: rc throttle,steering"));
-        return;
+        return false;
     }
     float t = atof(params);
     float s = atof(comma + 1);
     self->throttle = t;
     self->steering = s;
+    return true;
 }
 
-void Robot::handleSetPwm(Robot* self, const char* params) {
+bool Robot::handleSetPwm(Robot* self, const char* params) {
     if (config.operationMode != MODE_IDLE) {
         // self->debugger.systemMessage(F("Comando solo disponible en modo idle"));
-        return;
+        return false;
     }
     char* comma = strchr(params, ',');
     if (!comma) {
         // self->debugger.systemMessage(F("Formato: set pwm <derecha>,<izquierda>"));
-        return;
+        return false;
     }
     // Set target RPM to 0 for PWM mode (stop motors)
     self->leftTargetRPM = 0;
     self->rightTargetRPM = 0;
+    return true;
 }
 
-void Robot::handleSetRpm(Robot* self, const char* params) {
+bool Robot::handleSetRpm(Robot* self, const char* params) {
     if (config.operationMode != MODE_IDLE) {
         // self->debugger.systemMessage(F("Comando solo disponible en modo idle"));
-        return;
+        return false;
     }
     char* comma = strchr(params, ',');
     if (!comma) {
         // self->debugger.systemMessage(F("Formato: set rpm <izquierda>,<derecha>"));
-        return;
+        return false;
     }
     float leftRPM = atof(params);
     float rightRPM = atof(comma + 1);
     self->leftTargetRPM = leftRPM;
     self->rightTargetRPM = rightRPM;
-    self->leftPid.reset();
-    self->rightPid.reset();
+    // El PWM actual pasa a ser la salida de partida del lazo de RPM
+    self->leftPid.track(self->leftMotor.getSpeed());
+    self->rightPid.track(self->rightMotor.getSpeed());
+    return true;
 }
 
-void Robot::handleAutoTune(Robot* self, const char* params) {
-    if (self->autoTuningActive) {
-        self->debugger.systemMessage(F("Auto-tuning ya está en proceso."));
-        return;
+// autotune [track [mm] | line|wheels [regla] [d|rpm] | stop]. Sin parámetros sigue la
+// sesión del optimizador en pista guardada en EEPROM, o empieza una
+bool Robot::handleAutoTune(Robot* self, const char* params) {
+    if (strcasecmp_P(params, PSTR("stop")) == 0) {
+        if (self->relayTuning()) {
+            self->stopRelay();
+            self->debugger.systemMessage(F("autotune: cancelado"));
+        } else if (self->autoTuning()) {
+            self->finishLapTuner(F("autotune: detenido con las mejores ganancias (autotune para seguir)"));
+        }
+        return true;
     }
-    
-    if (config.operationMode != MODE_LINE_FOLLOWING || config.operationMode != MODE_IDLE) {
-        self->debugger.systemMessage(F("Auto-tuning solo funciona en modo línea o idle"));
-        return;
+    if (self->autoTuning() || self->relayTuning()) {
+        self->debugger.systemMessage(F("Auto-tuning ya está en proceso."));
+        return false;
     }
-    
-    self->debugger.systemMessage(F("Auto-tuning PID iniciado. Robot debe seguir línea. Proceso: ~3min."));
-    
-    // Save original values
-    self->originalKp = config.lineKp;
-    self->originalKi = config.lineKi;
-    self->originalKd = config.lineKd;
-    
-    // Generate test parameters (Ziegler-Nichols inspired)
-    self->generateTestParameters();
-    
-    // Reset auto-tuning variables
-    self->autoTuningActive = true;
-    self->autoTuneStartTime = millis();
-    self->autoTuneTestStartTime = millis();
-    self->currentTestIndex = 0;
-    self->bestIAE = 999999.0f;
-    self->bestKp = self->originalKp;
-    self->bestKi = self->originalKi;
-    self->bestKd = self->originalKd;
-    self->accumulatedIAE = 0;
-    self->samplesCount = 0;
-    self->lastPosition = 0;
-    self->maxDeviation = 0;
-    
-    // Apply first test parameters
-    config.lineKp = self->testKp[0];
-    config.lineKi = self->testKi[0];
-    config.lineKd = self->testKd[0];
-    self->linePid.setGains(config.lineKp, config.lineKi, config.lineKd);
-    
-    char msg[64];
-    snprintf(msg, sizeof(msg), "Probando combinación 1/%d - Kp:%.3f, Ki:%.3f, Kd:%.3f", 
-             self->totalTests, (double)config.lineKp, (double)config.lineKi, (double)config.lineKd);
-    self->debugger.systemMessage(msg);
+    if (!*params || strncasecmp_P(params, PSTR("track"), 5) == 0) return startLapTuner(self, params);
+    return startRelayTune(self, params);
 }
 
-void Robot::generateTestParameters() {
-    // Generate a systematic set of PID parameters to test
-    // Based on the original values, test variations around them
-    
-    float baseKp = config.lineKp;
-    float baseKi = config.lineKi;
-    float baseKd = config.lineKd;
-    
-    int count = 0;
-    
-    // Generate 6 key combinations for memory optimization
-    testKp[count] = baseKp * 0.8f;   testKi[count] = baseKi * 1.0f;  testKd[count] = baseKd * 0.8f; count++;
-    testKp[count] = baseKp * 1.0f;   testKi[count] = baseKi * 1.0f;  testKd[count] = baseKd * 1.0f; count++;
-    testKp[count] = baseKp * 1.2f;   testKi[count] = baseKi * 1.0f;  testKd[count] = baseKd * 1.0f; count++;
-    testKp[count] = baseKp * 1.0f;   testKi[count] = baseKi * 1.5f;  testKd[count] = baseKd * 1.0f; count++;
-    testKp[count] = baseKp * 1.0f;   testKi[count] = baseKi * 1.0f;  testKd[count] = baseKd * 1.5f; count++;
-    testKp[count] = baseKp * 1.2f;   testKi[count] = baseKi * 0.8f;  testKd[count] = baseKd * 1.2f; count++;
-    
-    totalTests = count;
-}
-
-void Robot::performAutoTune(float currentPosition, float dtLine) {
-    if (!autoTuningActive) return;
-    
-    unsigned long currentTime = millis();
-    unsigned long testDuration = 3000; // 3 seconds per test (optimized for memory)
-    
-    // Calculate IAE (Integral Absolute Error)
-    float error = abs(currentPosition - 0); // Error from center line
-    accumulatedIAE += error * dtLine;
-    samplesCount++;
-    
-    // Track maximum deviation
-    float deviation = abs(currentPosition);
-    if (deviation > maxDeviation) {
-        maxDeviation = deviation;
-    }
-    
-    // Check if test duration exceeded, too much deviation, or line lost
-    if (currentTime - autoTuneTestStartTime > testDuration || maxDeviation > 1000) {
-        // If we lost the line completely, abort auto-tuning
-        if (maxDeviation > 1500) {
-            autoTuningActive = false;
-            // Restore original values
-            config.lineKp = originalKp;
-            config.lineKi = originalKi;
-            config.lineKd = originalKd;
-            linePid.setGains(originalKp, originalKi, originalKd);
-            debugger.systemMessage(F("AUTO-TUNING ABORTADO: Robot perdió la línea. Valores originales restaurados."));
-            digitalWrite(MODE_LED_PIN, LOW);
-            return;
-        }
-        float averageIAE = accumulatedIAE / samplesCount;
-        
-        char msg[64];
-        snprintf(msg, sizeof(msg), "Test %d/%d - IAE: %.2f (Max dev: %.0f)", 
-                 currentTestIndex + 1, totalTests, (double)averageIAE, (double)maxDeviation);
-        debugger.systemMessage(msg);
-        
-        // Check if this is the best configuration so far
-        if (averageIAE < bestIAE) {
-            bestIAE = averageIAE;
-            bestKp = config.lineKp;
-            bestKi = config.lineKi;
-            bestKd = config.lineKd;
-            debugger.systemMessage(F("  *** NUEVO MEJOR RESULTADO ***"));
+bool Robot::startLapTuner(Robot* self, const char* params) {
+    if (config.operationMode != MODE_LINE_FOLLOWING) {
+        self->debugger.systemMessage(F("Auto-tuning solo funciona en modo línea"));
+        return false;
+    }
+    float pulsesPerMm = config.pulsesPerRevolution / (3.14159f * config.wheelDiameter);
+    if (!*params) {
+        TunerCheckpoint c;
+        // Un checkpoint sin referencia (t0 = 0) no sirve para puntuar: sesión nueva
+        if (self->eeprom.loadCheckpoint(c) && c.ref[0] > 0) {
+            if (!self->claimTool(TOOL_AUTOTUNE)) return false;
+            self->lapTuner.resume(c, pulsesPerMm);
+            if (self->lapTuner.converged()) {
+                self->tool = TOOL_NONE;
+                self->debugger.systemMessage(F("autotune: la sesión guardada ya terminó; autotune track para empezar otra"));
+                return false;
+            }
+            self->applyLapCandidate();
+            char msg[48];
+            snprintf_P(msg, sizeof(msg), PSTR("autotune: sigue la sesión, evaluación %u"), c.evals + 1);
+            self->debugger.systemMessage(msg);
+            return true;
         }
-        
-        // Move to next test or finish
-        currentTestIndex++;
-        
-        if (currentTestIndex >= totalTests) {
-            // Auto-tuning complete
-            autoTuningActive = false;
-            
-            // Apply best parameters found
-            config.lineKp = bestKp;
-            config.lineKi = bestKi;
-            config.lineKd = bestKd;
-            linePid.setGains(bestKp, bestKi, bestKd);
-            
-            debugger.systemMessage(F("=== AUTO-TUNING COMPLETADO ==="));
-            
-            char msg[64];
-            snprintf(msg, sizeof(msg), "Mejores parámetros encontrados: Kp=%.3f, Ki=%.3f, Kd=%.3f", 
-                     (double)bestKp, (double)bestKi, (double)bestKd);
-            debugger.systemMessage(msg);
-            
-            snprintf(msg, sizeof(msg), "IAE final: %.2f", (double)bestIAE);
-            debugger.systemMessage(msg);
-            
-            debugger.systemMessage(F("Parámetros guardados automáticamente."));
-            saveConfig(); // Automatically save the new parameters
-            
-            digitalWrite(MODE_LED_PIN, LOW);
-        } else {
-            // Start next test
-            autoTuneTestStartTime = currentTime;
-            accumulatedIAE = 0;
-            samplesCount = 0;
-            maxDeviation = 0;
-            lastPosition = 0;
-            
-            // Apply new test parameters
-            config.lineKp = testKp[currentTestIndex];
-            config.lineKi = testKi[currentTestIndex];
-            config.lineKd = testKd[currentTestIndex];
-            linePid.setGains(config.lineKp, config.lineKi, config.lineKd);
-            
-            char msg[64];
-            snprintf(msg, sizeof(msg), "Probando combinación %d/%d - Kp:%.3f, Ki:%.3f, Kd:%.3f", 
-                     currentTestIndex + 1, totalTests, (double)config.lineKp, (double)config.lineKi, (double)config.lineKd);
-            debugger.systemMessage(msg);
+    }
+    long windowMm = 0;
+    if (*params) {
+        const char* p = params + 5;
+        char* end;
+        windowMm = strtol(p, &end, 10);
+        if ((*p && *p != ' ') || *end != '\0' || (windowMm != 0 && (windowMm < 200 || windowMm > 30000))) {
+            self->debugger.systemMessage(F("Formato: autotune track [mm] (ventana de 200 a 30000 mm)"));
+            return false;
         }
     }
-    
-    lastPosition = currentPosition;
+    if (config.lineKp <= 0) { self->debugger.systemMessage(F("autotune: hace falta kp de línea > 0")); return false; }
+    if (!self->claimTool(TOOL_AUTOTUNE)) return false;
+    // Sesión nueva: el checkpoint anterior deja de valer
+    self->eeprom.clearCheckpoint();
+    float k[3] = {config.lineKp, config.lineKi, config.lineKd};
+    self->lapTuner.start(k, windowMm, pulsesPerMm);
+    self->debugger.systemMessage(windowMm ? F("autotune: vuelta de referencia ya; autotune stop para cortar")
+                                          : F("autotune: vuelta de referencia desde la próxima marca; autotune stop para cortar"));
+    return true;
+}
+
+bool Robot::startRelayTune(Robot* self, const char* params) {
+    char buf[24];
+    strncpy(buf, params, sizeof(buf) - 1);
+    buf[sizeof(buf) - 1] = '\0';
+    char* loop = strtok(buf, " ");
+    char* ruleName = strtok(NULL, " ");
+    char* value = strtok(NULL, " ");
+    bool wheels = loop && strcasecmp_P(loop, PSTR("wheels")) == 0;
+    if (!loop || (!wheels && strcasecmp_P(loop, PSTR("line")) != 0) || strtok(NULL, " ")) {
+        self->debugger.systemMessage(F("Formato: autotune [line|wheels [zn|tl|pi|nos] [d|rpm]] | stop"));
+        return false;
+    }
+    // Por defecto Tyreus–Luyben en la línea (menos oscilante que ZN) y PI en las ruedas
+    RelayTuner::Rule rule = wheels ? RelayTuner::RULE_PI : RelayTuner::RULE_TL;
+    if (ruleName) {
+        uint8_t r = 0;
+        while (r < RelayTuner::RULE_COUNT && strcasecmp_P(ruleName, RELAY_RULE_NAMES[r]) != 0) r++;
+        if (r == RelayTuner::RULE_COUNT) { self->debugger.systemMessage(F("Reglas: zn, tl, pi, nos")); return false; }
+        rule = (RelayTuner::Rule)r;
+    }
+    float v = value ? atof(value) : 0;
+    if (value && v <= 0) { self->debugger.systemMessage(F("autotune: d y rpm tienen que ser > 0")); return false; }
+
+    if (!wheels) {
+        if (config.operationMode != MODE_LINE_FOLLOWING) { self->debugger.systemMessage(F("autotune line: solo en modo línea")); return false; }
+        // Por defecto ±20 % de la base en cada rueda (en cascada cada rueda recibe la mitad)
+        float d = value ? v : config.cascadeMode ? 0.4f * config.baseRPM : 0.2f * config.basePwm;
+        float bias = 0;
+        if (!self->claimTool(TOOL_RELAY)) return false;
+        self->relay.lineOutput = 0;
+        self->relay.tuner.start(RelayTuner::TARGET_LINE, rule, 0, &bias, d, RELAY_LINE_HYSTERESIS, 0, 0, millis());
+        self->debugger.systemMessage(F("autotune: relé en la línea, hasta 15 s; autotune stop para cortar"));
+        return true;
+    }
+
+    if (config.operationMode != MODE_IDLE) { self->debugger.systemMessage(F("Comando solo disponible en modo idle")); return false; }
+    if (self->identifying() || self->stepTesting()) { self->debugger.systemMessage(F("identify: ya en curso")); return false; }
+    int16_t rpm = value ? (int16_t)v : (int16_t)config.baseRPM;
+    if (rpm <= 0 || rpm > config.maxRpm) { self->debugger.systemMessage(F("autotune: 0 < rpm <= max")); return false; }
+    // ±1/8 del PWM máximo alrededor del PWM de trabajo, del modelo de motores si lo hay
+    float d = config.maxPwm / 8.0f;
+    float bias[2];
+    for (uint8_t w = 0; w < 2; w++) {
+        bias[w] = self->motorModelValid ? self->motorFeedforward(w, real_t(rpm)) : config.maxPwm / 2;
+        bias[w] = constrain(bias[w], d, config.maxPwm - d);
+    }
+    if (!self->claimTool(TOOL_RELAY)) return false;
+    // Con la RPM como objetivo el feedforward coincide y al terminar los PID siguen ahí
+    self->leftTargetRPM = self->rightTargetRPM = rpm;
+    self->relay.tuner.start(RelayTuner::TARGET_WHEELS, rule, rpm, bias, d, RELAY_WHEEL_HYSTERESIS,
+                            d, config.maxPwm - d, millis());
+    self->debugger.systemMessage(F("autotune: ruedas en el aire, hasta 60 s; autotune stop para cortar"));
+    return true;
 }
\ No newline at end of file
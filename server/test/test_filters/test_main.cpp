@@ -0,0 +1,152 @@
+/**
+ * Ventanas de largo variable de filters.h (SlidingMedian, SlidingAverage) contra la
+ * cuenta directa sobre las últimas `len` muestras. Corre en la PC:
+ *   pio test -e native -f test_filters
+ */
+
+#include <unity.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+#include "filters.h"
+
+static const uint8_t WINDOW_MAX = 7;
+static const uint16_t SAMPLES = 2000;
+
+static uint32_t lcg;
+
+// Misma secuencia en cada corrida: un fallo se reproduce
+static int16_t nextSample(int16_t range) {
+  lcg = lcg * 1664525UL + 1013904223UL;
+  return (int16_t)((int32_t)(lcg >> 16) % (2 * (int32_t)range + 1) - range);
+}
+
+static int compareInt16(const void* a, const void* b) {
+  return *(const int16_t*)a - *(const int16_t*)b;
+}
+
+// Ventana de referencia: arranca llena con la primera muestra, como los filtros
+struct History {
+  int16_t x[WINDOW_MAX];
+  uint8_t len;
+  uint16_t count;
+
+  void push(int16_t v) {
+    if (count == 0) for (uint8_t i = 0; i < len; i++) x[i] = v;
+    else x[count % len] = v;
+    count++;
+  }
+  int16_t median() const {
+    int16_t s[WINDOW_MAX];
+    for (uint8_t i = 0; i < len; i++) s[i] = x[i];
+    qsort(s, len, sizeof(s[0]), compareInt16);
+    return s[len / 2];
+  }
+  float mean() const {
+    int32_t sum = 0;
+    for (uint8_t i = 0; i < len; i++) sum += x[i];
+    return (float)sum / len;
+  }
+};
+
+static void checkMedian(uint8_t len, int16_t range) {
+  SlidingMedian<WINDOW_MAX> f;
+  f.setLength(len);
+  History h = {{0}, len, 0};
+  for (uint16_t i = 0; i < SAMPLES; i++) {
+    int16_t x = nextSample(range);
+    h.push(x);
+    TEST_ASSERT_EQUAL_INT16(h.median(), f.process(x));
+  }
+}
+
+static void checkAverage(uint8_t len, int16_t range) {
+  SlidingAverage<WINDOW_MAX> f;
+  f.setLength(len);
+  History h = {{0}, len, 0};
+  for (uint16_t i = 0; i < SAMPLES; i++) {
+    int16_t x = nextSample(range);
+    h.push(x);
+    // Recíproco en Q16 truncado: sesgo < |media|·len/65536 más el redondeo
+    float mean = h.mean();
+    TEST_ASSERT_FLOAT_WITHIN(0.5f + fabsf(mean) * len / 65536.0f + 1e-3f, mean, f.process(x));
+  }
+}
+
+void setUp() { lcg = 12345; }
+void tearDown() {}
+
+// Posiciones de línea: ±4000
+void test_median_windows() {
+  for (uint8_t len = 3; len <= 7; len += 2) checkMedian(len, 4000);
+}
+
+void test_average_windows() {
+  for (uint8_t len = 3; len <= 7; len += 2) checkAverage(len, 4000);
+}
+
+// Largos pares: 65536 / len no es exacto y con recíproco redondeado arriba el 6 desbordaba
+void test_average_even_windows() {
+  for (uint8_t len = 2; len <= 6; len += 2) checkAverage(len, 4000);
+}
+
+// Todo el rango de int16: sum·recip y la diferencia de entrada/salida cerca de 2^31 y 2^16
+void test_average_full_range() {
+  for (uint8_t len = 2; len <= WINDOW_MAX; len++) checkAverage(len, 32767);
+}
+
+// Ventana llena de extremos: la media tiene que quedar en el extremo, sin dar la vuelta
+void test_average_saturated() {
+  for (uint8_t len = 2; len <= WINDOW_MAX; len++) {
+    SlidingAverage<WINDOW_MAX> f;
+    f.setLength(len);
+    for (uint8_t i = 0; i < 2 * len; i++) TEST_ASSERT_INT_WITHIN(len / 2 + 1, 32767, f.process(32767));
+    for (uint8_t i = 0; i < 2 * len; i++) f.process(-32768);
+    TEST_ASSERT_INT_WITHIN(len / 2 + 1, -32768, f.process(-32768));
+  }
+}
+
+// Muchos repetidos: medianReplace tiene que encontrar el valor que sale entre iguales
+void test_median_duplicates() {
+  for (uint8_t len = 3; len <= 7; len += 2) checkMedian(len, 2);
+}
+
+void test_median_full_range() {
+  for (uint8_t len = 3; len <= 7; len += 2) checkMedian(len, 32767);
+}
+
+// Cambiar el largo vuelve a llenar la ventana con la muestra siguiente
+void test_length_change_refills() {
+  SlidingMedian<WINDOW_MAX> median;
+  SlidingAverage<WINDOW_MAX> average;
+  median.setLength(7);
+  average.setLength(7);
+  for (uint8_t i = 0; i < 20; i++) {
+    int16_t x = nextSample(4000);
+    median.process(x);
+    average.process(x);
+  }
+  median.setLength(3);
+  average.setLength(5);
+  History hm = {{0}, 3, 0}, ha = {{0}, 5, 0};
+  for (uint8_t i = 0; i < 20; i++) {
+    int16_t x = nextSample(4000);
+    hm.push(x);
+    ha.push(x);
+    TEST_ASSERT_EQUAL_INT16(hm.median(), median.process(x));
+    TEST_ASSERT_FLOAT_WITHIN(1.0f, ha.mean(), average.process(x));
+  }
+}
+
+int main(int, char**) {
+  UNITY_BEGIN();
+  RUN_TEST(test_median_windows);
+  RUN_TEST(test_average_windows);
+  RUN_TEST(test_average_even_windows);
+  RUN_TEST(test_average_full_range);
+  RUN_TEST(test_average_saturated);
+  RUN_TEST(test_median_duplicates);
+  RUN_TEST(test_median_full_range);
+  RUN_TEST(test_length_change_refills);
+  return UNITY_END();
+}
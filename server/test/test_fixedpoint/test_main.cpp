@@ -0,0 +1,125 @@
+/**
+ * Q16 (fixedpoint.h) contra la cuenta exacta en 64 bits y contra float: suma y resta
+ * con saturación, producto, redondeo a int16, y el PID con el biquad de la derivada
+ * (que pasa la derivada a int16 con toIntSat) en Q16 y en float. Corre en la PC:
+ *   pio test -e native -f test_fixedpoint
+ */
+
+#include <unity.h>
+#include <stdint.h>
+#include <math.h>
+#include "fixedpoint.h"
+#include "pid.h"
+
+static const uint16_t CASES = 20000;
+static const int32_t EDGES[] = {INT32_MIN, INT32_MIN + 1, -65536, -32768, -1, 0, 1, 32767, 32768, 65536,
+                                INT32_MAX - 1, INT32_MAX};
+static const uint8_t EDGE_COUNT = sizeof(EDGES) / sizeof(EDGES[0]);
+
+static uint32_t lcg;
+
+static uint32_t nextRandom() {
+  lcg = lcg * 1664525UL + 1013904223UL;
+  uint32_t hi = lcg >> 16;
+  lcg = lcg * 1664525UL + 1013904223UL;
+  return (hi << 16) | (lcg >> 16);
+}
+
+// Mitad de los casos en todo el rango, mitad en el de los lazos (±4000)
+static int32_t randomRaw(uint16_t i) {
+  if (i % 2) return (int32_t)nextRandom();
+  return (int32_t)(nextRandom() % (8000UL << 16)) - (4000L << 16);
+}
+
+static int32_t saturate(int64_t v) {
+  return v > INT32_MAX ? INT32_MAX : v < INT32_MIN ? INT32_MIN : (int32_t)v;
+}
+
+// Sin pasar por float, que a ±4000 tiene menos resolución que Q16
+static double value(Q16 q) { return q.getRaw() / 65536.0; }
+
+void setUp() { lcg = 2024; }
+void tearDown() {}
+
+void test_add_sub_saturate() {
+  for (uint8_t i = 0; i < EDGE_COUNT; i++) {
+    for (uint8_t j = 0; j < EDGE_COUNT; j++) {
+      Q16 a = Q16::fromRaw(EDGES[i]), b = Q16::fromRaw(EDGES[j]);
+      TEST_ASSERT_EQUAL_INT32(saturate((int64_t)EDGES[i] + EDGES[j]), (a + b).getRaw());
+      TEST_ASSERT_EQUAL_INT32(saturate((int64_t)EDGES[i] - EDGES[j]), (a - b).getRaw());
+    }
+  }
+  for (uint16_t i = 0; i < CASES; i++) {
+    int32_t x = randomRaw(i), y = randomRaw(i);
+    Q16 a = Q16::fromRaw(x), b = Q16::fromRaw(y);
+    TEST_ASSERT_EQUAL_INT32(saturate((int64_t)x + y), (a + b).getRaw());
+    TEST_ASSERT_EQUAL_INT32(saturate((int64_t)x - y), (a - b).getRaw());
+  }
+}
+
+// El producto es floor(a·b / 2^16), saturado
+void test_multiply() {
+  for (uint16_t i = 0; i < CASES; i++) {
+    int32_t x = randomRaw(i), y = randomRaw(i);
+    int64_t exact = ((int64_t)x * y) >> 16;
+    TEST_ASSERT_EQUAL_INT32(saturate(exact), (Q16::fromRaw(x) * Q16::fromRaw(y)).getRaw());
+  }
+}
+
+// Al entero más cercano (0.5 hacia arriba), saturado a int16
+void test_to_int_sat() {
+  for (uint8_t i = 0; i < EDGE_COUNT; i++) {
+    int64_t r = ((int64_t)EDGES[i] + 32768) >> 16;
+    TEST_ASSERT_EQUAL_INT16(r > INT16_MAX ? INT16_MAX : r, toIntSat(Q16::fromRaw(EDGES[i])));
+  }
+  for (uint16_t i = 0; i < CASES; i++) {
+    int32_t x = randomRaw(i);
+    int64_t r = ((int64_t)x + 32768) >> 16;
+    TEST_ASSERT_EQUAL_INT16(r > INT16_MAX ? INT16_MAX : r, toIntSat(Q16::fromRaw(x)));
+  }
+  TEST_ASSERT_EQUAL_INT16(INT16_MAX, toIntSat(40000.0f));
+  TEST_ASSERT_EQUAL_INT16(INT16_MIN, toIntSat(-40000.0f));
+}
+
+// En el rango de los lazos las operaciones dan lo mismo que en float, a la resolución
+// de Q16 (el producto además redondea hacia abajo)
+void test_matches_float() {
+  for (uint16_t i = 0; i < CASES; i++) {
+    float x = (int32_t)(nextRandom() % 8000001UL - 4000000L) / 1000.0f;
+    float y = (int32_t)(nextRandom() % 8001UL - 4000L) / 1000.0f;
+    Q16 a(x), b(y);
+    TEST_ASSERT_FLOAT_WITHIN(2.0 / 65536, (double)x + y, value(a + b));
+    TEST_ASSERT_FLOAT_WITHIN(2.0 / 65536, (double)x - y, value(a - b));
+    TEST_ASSERT_FLOAT_WITHIN((fabs(x) + fabs(y) + 2.0) / 65536, (double)x * y, value(a * b));
+    TEST_ASSERT_INT_WITHIN(1, toInt(x), toIntSat(a));
+  }
+}
+
+// PID de línea con el biquad de la derivada activo (pasa todo): la derivada se pasa a
+// int16 con toIntSat en los dos tipos y las salidas tienen que seguirse
+void test_pid_derivative_filter() {
+  BiquadCoeffs pass = {1 << BIQUAD_SHIFT, 0, 0, 0, 0, 1 << BIQUAD_SHIFT, true};
+  Biquad filterF, filterQ;
+  PIDController<float> pf(0.05f, 0.001f, 0.5f, 255, -255);
+  PIDController<Q16> pq(0.05f, 0.001f, 0.5f, 255, -255);
+  float maxDiff = 0;
+  for (uint16_t i = 0; i < 2000; i++) {
+    // Posición de línea que oscila ±3000 con ruido
+    float position = 3000.0f * sinf(i * 0.02f) + (int32_t)(nextRandom() % 201) - 100;
+    position = roundf(position);
+    float of = pf.calculate(0.0f, position, 0.005f, &filterF, &pass);
+    float oq = toFloat(pq.calculate(Q16(0), Q16(position), Q16(0.005f), &filterQ, &pass));
+    maxDiff = fmaxf(maxDiff, fabsf(of - oq));
+  }
+  TEST_ASSERT_FLOAT_WITHIN(0.5f, 0, maxDiff);
+}
+
+int main(int, char**) {
+  UNITY_BEGIN();
+  RUN_TEST(test_add_sub_saturate);
+  RUN_TEST(test_multiply);
+  RUN_TEST(test_to_int_sat);
+  RUN_TEST(test_matches_float);
+  RUN_TEST(test_pid_derivative_filter);
+  return UNITY_END();
+}
@@ -0,0 +1,105 @@
+/**
+ * PIDController<Q16> (el del Nano) contra PIDController<float> cerrando el lazo de
+ * RPM sobre la misma planta de primer orden: escalón de setpoint, saturación con
+ * recuperación (anti-windup) y cambio de ganancias sin salto. Corre en la PC:
+ *   pio test -e native -f test_pid
+ */
+
+#include <unity.h>
+#include <math.h>
+#include "pid.h"
+
+// Rueda: τ·dy/dt = K·u - y, en RPM por unidad de PWM
+static const float PLANT_GAIN = 10.0f;
+static const float PLANT_TAU = 0.1f;
+static const float DT = 0.005f;          // Lazo de velocidad a 5 ms
+static const float KP = 0.5f, KI = 4.0f, KD = 0.002f;
+static const float PWM_MAX = 255.0f;
+
+// Un lazo cerrado: el PID y su propia planta, integrada exacta en float
+template <typename T>
+struct Loop {
+  PIDController<T> pid;
+  float rpm;
+  float pwm;
+
+  Loop() : pid(KP, KI, KD, PWM_MAX, -PWM_MAX), rpm(0), pwm(0) {}
+
+  void step(float setpoint) {
+    pwm = toFloat(pid.calculate(T(setpoint), T(rpm), T(DT)));
+    float a = expf(-DT / PLANT_TAU);
+    rpm = a * rpm + (1 - a) * PLANT_GAIN * pwm;
+  }
+};
+
+struct Pair {
+  Loop<float> f;
+  Loop<Q16> q;
+  float maxPwmDiff, maxRpmDiff;
+
+  Pair() : maxPwmDiff(0), maxRpmDiff(0) {}
+
+  void run(float setpoint, int ticks) {
+    for (int i = 0; i < ticks; i++) {
+      f.step(setpoint);
+      q.step(setpoint);
+      maxPwmDiff = fmaxf(maxPwmDiff, fabsf(f.pwm - q.pwm));
+      maxRpmDiff = fmaxf(maxRpmDiff, fabsf(f.rpm - q.rpm));
+    }
+  }
+};
+
+void setUp() {}
+void tearDown() {}
+
+void test_setpoint_step() {
+  Pair p;
+  p.run(1500, 400);
+  // Los dos llegan al setpoint y recorren la misma respuesta
+  TEST_ASSERT_FLOAT_WITHIN(5.0f, 1500, p.f.rpm);
+  TEST_ASSERT_FLOAT_WITHIN(5.0f, 1500, p.q.rpm);
+  TEST_ASSERT_FLOAT_WITHIN(0.1f, 0, p.maxPwmDiff);
+  TEST_ASSERT_FLOAT_WITHIN(0.5f, 0, p.maxRpmDiff);
+}
+
+// Setpoint fuera de alcance (K·255 = 2550 RPM): la salida queda saturada y el
+// integrador no se carga; al bajar el setpoint sale de la saturación enseguida
+void test_saturation_recovery() {
+  Pair p;
+  p.run(3000, 400);
+  TEST_ASSERT_FLOAT_WITHIN(0.01f, PWM_MAX, p.f.pwm);
+  TEST_ASSERT_FLOAT_WITHIN(0.01f, PWM_MAX, p.q.pwm);
+  // Con el integrador cargado seguiría saturada: a los 0.5 s ya tiene que estar encima
+  p.run(1000, 100);
+  TEST_ASSERT_FLOAT_WITHIN(20.0f, 1000, p.f.rpm);
+  TEST_ASSERT_FLOAT_WITHIN(20.0f, 1000, p.q.rpm);
+  p.run(1000, 300);
+  TEST_ASSERT_FLOAT_WITHIN(5.0f, 1000, p.f.rpm);
+  TEST_ASSERT_FLOAT_WITHIN(5.0f, 1000, p.q.rpm);
+  TEST_ASSERT_FLOAT_WITHIN(0.1f, 0, p.maxPwmDiff);
+  TEST_ASSERT_FLOAT_WITHIN(0.5f, 0, p.maxRpmDiff);
+}
+
+// En régimen, setGainsBumpless no mueve la salida del tick siguiente
+void test_bumpless_gain_change() {
+  Pair p;
+  p.run(1200, 400);
+  float beforeF = p.f.pwm, beforeQ = p.q.pwm;
+  p.f.pid.setGainsBumpless(KP * 2, KI / 2, KD * 3);
+  p.q.pid.setGainsBumpless(KP * 2, KI / 2, KD * 3);
+  p.run(1200, 1);
+  TEST_ASSERT_FLOAT_WITHIN(0.5f, beforeF, p.f.pwm);
+  TEST_ASSERT_FLOAT_WITHIN(0.5f, beforeQ, p.q.pwm);
+  p.run(1200, 400);
+  TEST_ASSERT_FLOAT_WITHIN(5.0f, 1200, p.f.rpm);
+  TEST_ASSERT_FLOAT_WITHIN(5.0f, 1200, p.q.rpm);
+  TEST_ASSERT_FLOAT_WITHIN(0.1f, 0, p.maxPwmDiff);
+}
+
+int main(int, char**) {
+  UNITY_BEGIN();
+  RUN_TEST(test_setpoint_step);
+  RUN_TEST(test_saturation_recovery);
+  RUN_TEST(test_bumpless_gain_change);
+  return UNITY_END();
+}
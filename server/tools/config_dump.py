@@ -0,0 +1,235 @@
+"""Decodifica la configuración guardada del robot desde un volcado de memoria.
+
+Nano: volcado completo de la EEPROM (1024 bytes), por ejemplo
+    avrdude -p m328p -c arduino -P /dev/ttyUSB0 -U eeprom:r:eeprom.bin:r
+ESP32: la partición nvs (ver esp32/partitions.csv)
+    esptool.py read_flash 0x9000 0x6000 nvs.bin
+
+Uso:
+    python config_dump.py eeprom.bin
+    python config_dump.py --nvs nvs.bin
+
+Lista cada copia encontrada (slot, esquema, secuencia, CRC) y los campos de la
+vigente. Entiende el esquema 2 (ConfigHeader + CRC-32) y el 1 sin cabecera.
+Los layouts son los de RobotConfig en include/config.h de cada placa.
+"""
+import struct
+import sys
+import zlib
+
+CONFIG_MAGIC = 0x47464352
+CONFIG_V1_CHECKSUM = 1234567892
+EEPROM_CONFIG_SLOTS = 3
+EEPROM_CONFIG_SLOT_SIZE = 160
+NVS_NAMESPACE = 'robot_config'
+NVS_KEY = 'config'
+
+# (nombre, formato struct, cantidad). 'E' = enum OperationMode, 'F' = FeaturesConfig (9 bits + ventanas)
+_FIELDS = [('lineKp', 'f', 1), ('lineKi', 'f', 1), ('lineKd', 'f', 1),
+           ('leftKp', 'f', 1), ('leftKi', 'f', 1), ('leftKd', 'f', 1),
+           ('rightKp', 'f', 1), ('rightKi', 'f', 1), ('rightKd', 'f', 1),
+           ('basePwm', 'h', 1), ('wheelDiameter', 'f', 1), ('wheelDistance', 'f', 1),
+           ('sensorMin', 'h', 'N'), ('sensorMax', 'h', 'N'),
+           ('rcDeadzone', 'h', 1), ('rcMaxThrottle', 'h', 1), ('rcMaxSteering', 'h', 1),
+           ('cascadeMode', '?', 1), ('telemetry', 'B', 1), ('features', 'F', 1),
+           ('operationMode', 'E', 1), ('baseRPM', 'f', 1), ('maxPwm', 'h', 1), ('maxRpm', 'f', 1),
+           ('pulsesPerRevolution', 'h', 1), ('loopLineMs', 'H', 1), ('loopSpeedMs', 'H', 1),
+           ('telemetryIntervalMs', 'I', 1), ('robotWeight', 'f', 1)]
+
+# Nano: sin alineación, enum de 2 bytes. ESP32: alineación natural, enum de 4 bytes.
+BOARDS = {
+    'nano': {'sensors': 8, 'enum': 'h', 'align': False, 'extra': [],
+             'appended': [('%sBiquad%s' % (sig, f), fmt, 1) for sig in ('pos', 'deriv', 'rpm')
+                       for f, fmt in (('Type', 'B'), ('FcDeciHz', 'H'), ('QCenti', 'H'))]
+                       + [('estimatorEnabled', 'B', 1), ('estimatorAlphaQ15', 'H', 1),
+                          ('estimatorBetaQ16', 'H', 1), ('estimatorGammaQ24', 'H', 1),
+                          ('speedFeedforward', '?', 1)],
+             'header': '<IHHIH'},
+    'esp32': {'sensors': 16, 'enum': 'i', 'align': True, 'extra': [('controlRateHz', 'H', 1)],
+              'header': '<IHHIH2x'},
+}
+FEATURE_NAMES = ['medianFilter', 'movingAverage', 'kalmanFilter', 'hysteresis', 'deadZone',
+                 'lowPass', 'dynamicLinePid', 'speedProfiling', 'turnDirection']
+
+
+def layout(board, version):
+    """Lista de (nombre, offset, formato, cantidad) y tamaño total de RobotConfig."""
+    spec = BOARDS[board]
+    fields = _FIELDS + spec['extra']
+    if version == 1:
+        fields = fields + [('checksum', 'I', 1)]
+    else:
+        # Campos agregados al final sin subir el esquema; decode() corta según el largo
+        fields = fields + spec.get('appended', [])
+    out, off, max_align = [], 0, 1
+    for name, fmt, count in fields:
+        count = spec['sensors'] if count == 'N' else count
+        fmt = {'E': spec['enum'], 'F': '2s'}.get(fmt, fmt)
+        size = struct.calcsize('<' + fmt)
+        align = 1 if fmt == '2s' or not spec['align'] else size
+        max_align = max(max_align, align)
+        off = (off + align - 1) // align * align
+        out.append((name, off, fmt, count))
+        off += size * count
+    return out, (off + max_align - 1) // max_align * max_align
+
+
+def decode(board, version, data):
+    fields, size = layout(board, version)
+    values = {}
+    for name, off, fmt, count in fields:
+        if off + struct.calcsize('<' + fmt) * count > len(data):
+            break
+        vals = struct.unpack_from('<' + fmt * count, data, off)
+        if fmt == '2s':
+            bits = vals[0][0] | vals[0][1] << 8
+            values[name] = {n: (bits >> i) & 1 for i, n in enumerate(FEATURE_NAMES)}
+            # Bits 9-14: ventanas guardadas como diferencia con 3 (ver FeaturesConfig)
+            values[name]['medianWindow'] = 3 + 2 * ((bits >> 9) & 7)
+            values[name]['averageWindow'] = 3 + ((bits >> 12) & 7)
+        else:
+            values[name] = list(vals) if count > 1 else vals[0]
+    return values
+
+
+def print_config(values):
+    for name, value in values.items():
+        if isinstance(value, float):
+            value = '%.6g' % value
+        print('  %-20s %s' % (name, value))
+
+
+def check_copy(board, header, payload):
+    """Devuelve (válida, motivo) para una copia con cabecera."""
+    magic, version, length, crc, _ = header
+    if magic != CONFIG_MAGIC:
+        return False, 'sin magic'
+    if length > len(payload):
+        return False, 'largo %d fuera de rango' % length
+    if zlib.crc32(payload[:length]) & 0xFFFFFFFF != crc:
+        return False, 'CRC inválido'
+    return True, 'v%d, %d bytes' % (version, length)
+
+
+def newer(a, b):
+    """Comparación circular de secuencias, igual que EEPROMManager::load()."""
+    d = (a - b) & 0xFFFF
+    return 0 < d < 0x8000
+
+
+def dump_eeprom(data):
+    board = 'nano'
+    hdr = struct.Struct(BOARDS[board]['header'])
+    best = None
+    for s in range(EEPROM_CONFIG_SLOTS):
+        base = s * EEPROM_CONFIG_SLOT_SIZE
+        header = hdr.unpack_from(data, base)
+        payload = data[base + hdr.size:base + EEPROM_CONFIG_SLOT_SIZE]
+        ok, why = check_copy(board, header, payload)
+        print('slot %d: %s%s' % (s, why, ', seq %d' % header[4] if ok else ''))
+        if ok and (best is None or newer(header[4], best[0][4])):
+            best = (header, payload)
+    if best:
+        header, payload = best
+        print('Vigente: seq %d, esquema v%d' % (header[4], header[1]))
+        print_config(decode(board, header[1], payload[:header[2]]))
+        return
+    # Esquema 1: slots {seq:u16, config} o una sola copia al principio
+    _, v1_size = layout(board, 1)
+    stride = 2 + v1_size
+    candidates = []
+    for s in range(EEPROM_CONFIG_SLOTS):
+        seq, = struct.unpack_from('<H', data, s * stride)
+        if struct.unpack_from('<I', data, s * stride + stride - 4)[0] == CONFIG_V1_CHECKSUM:
+            candidates.append((seq, data[s * stride + 2:s * stride + stride]))
+    if not candidates and struct.unpack_from('<I', data, v1_size - 4)[0] == CONFIG_V1_CHECKSUM:
+        candidates.append((0, data[:v1_size]))
+    if not candidates:
+        print('Sin configuración válida (el robot arranca con defaults)')
+        return
+    seq, payload = candidates[0]
+    for c in candidates[1:]:
+        if newer(c[0], seq):
+            seq, payload = c
+    print('Esquema 1 sin cabecera (se migra en el próximo arranque), seq %d' % seq)
+    print_config(decode(board, 1, payload))
+
+
+def nvs_blob(data, namespace, key):
+    """Reensambla un blob de una partición NVS (páginas de 4 KB, entradas de 32 bytes)."""
+    pages = [data[i:i + 4096] for i in range(0, len(data), 4096)]
+    entries = []
+    for page in pages:
+        state, = struct.unpack_from('<I', page, 0)
+        if state not in (0xFFFFFFFE, 0xFFFFFFFC):  # activa o llena
+            continue
+        bitmap = page[32:64]
+        i = 0
+        while i < 126:
+            if (bitmap[i // 4] >> (i % 4 * 2)) & 3 != 2:  # 0b10 = escrita
+                i += 1
+                continue
+            raw = page[64 + i * 32:64 + (i + 1) * 32]
+            ns, typ, span, chunk = raw[0], raw[1], raw[2], raw[3]
+            name = raw[8:24].split(b'\0')[0].decode('ascii', 'replace')
+            body = page[64 + (i + 1) * 32:64 + (i + span) * 32]
+            entries.append((ns, typ, chunk, name, raw[24:32], body))
+            i += max(span, 1)
+    ns_index = next((e[4][0] for e in entries if e[0] == 0 and e[1] == 0x01 and e[3] == namespace), None)
+    if ns_index is None:
+        return None
+    mine = [e for e in entries if e[0] == ns_index and e[3] == key]
+    index = next((e for e in mine if e[1] == 0x48), None)  # BLOB_IDX
+    if index is not None:
+        size, count, start = struct.unpack_from('<IBB', index[4])
+        chunks = {e[2]: e for e in mine if e[1] == 0x42}  # BLOB_DATA
+        blob = b''
+        for c in range(start, start + count):
+            if c not in chunks:
+                return None
+            length, = struct.unpack_from('<H', chunks[c][4])
+            blob += chunks[c][5][:length]
+        return blob[:size]
+    legacy = next((e for e in mine if e[1] == 0x41), None)  # blob de formato viejo
+    if legacy is not None:
+        length, = struct.unpack_from('<H', legacy[4])
+        return legacy[5][:length]
+    return None
+
+
+def dump_nvs(data):
+    board = 'esp32'
+    blob = nvs_blob(data, NVS_NAMESPACE, NVS_KEY)
+    if blob is None:
+        print('No hay clave "%s" en el namespace "%s"' % (NVS_KEY, NVS_NAMESPACE))
+        return
+    hdr = struct.Struct(BOARDS[board]['header'])
+    _, v1_size = layout(board, 1)
+    if len(blob) >= hdr.size and struct.unpack_from('<I', blob)[0] == CONFIG_MAGIC:
+        header = hdr.unpack_from(blob)
+        ok, why = check_copy(board, header, blob[hdr.size:])
+        print('Blob de %d bytes: %s' % (len(blob), why))
+        if ok:
+            print_config(decode(board, header[1], blob[hdr.size:hdr.size + header[2]]))
+    elif len(blob) == v1_size:
+        print('Esquema 1 sin cabecera (se migra en el próximo arranque)')
+        print_config(decode(board, 1, blob))
+    else:
+        print('Blob de %d bytes no reconocido' % len(blob))
+
+
+def main():
+    args = sys.argv[1:]
+    if not args:
+        print(__doc__)
+        return
+    if args[0] == '--nvs':
+        with open(args[1], 'rb') as f:
+            dump_nvs(f.read())
+    else:
+        with open(args[0], 'rb') as f:
+            dump_eeprom(f.read())
+
+
+if __name__ == '__main__':
+    main()
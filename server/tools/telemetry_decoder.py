@@ -0,0 +1,577 @@
+"""Decodificador de la telemetría binaria del robot (`set telemetry 2` o `3`).
+
+Trama: 0x00 | COBS(tipo:u8 | seq:u16 | payload | crc16:u16) | 0x00, little-endian.
+Ver include/protocol.h para el formato y las escalas de cada campo.
+Las líneas de texto (type:1/2/3) que llegan entre tramas se imprimen tal cual.
+En modo delta (`set telemetry 3`) las tramas 0x06 se reconstruyen sobre la última
+clave; tras un hueco en seq se descartan hasta la próxima clave.
+
+Uso:
+    python telemetry_decoder.py /dev/ttyUSB0 [baudrate] [suscripción ...]
+    python telemetry_decoder.py /dev/ttyUSB0 115200 "line 1" "qtr 10"
+    python telemetry_decoder.py /dev/ttyUSB0 115200 --delta "line 1" "left 1"
+    python telemetry_decoder.py /dev/ttyUSB0 115200 --dump vuelta.csv
+    python telemetry_decoder.py /dev/ttyUSB0 115200 --runlog 3 vuelta3.csv   (ESP32)
+    python telemetry_decoder.py /dev/ttyUSB0 115200 --baud 1000000 --delta "line 1"
+    python telemetry_decoder.py /dev/ttyUSB0 115200 --rc-latency 200
+    python telemetry_decoder.py /dev/ttyUSB0 115200 --push config.txt
+`--push` manda un comando por línea del archivo en lotes `@<seq> cmd;cmd` sin esperar
+cada eco (ventana de RX_WINDOW bytes sin confirmar) y lista los que el robot rechazó.
+`--rc-latency` manda tramas RC binarias (throttle 0) y mide ida y vuelta hasta ver
+su seq en la telemetría; el robot reporta además recepción -> PWM (rcLatencyUs).
+`--baud` negocia la velocidad con `set baud` + `baud ok` antes del resto (solo por cable).
+"""
+import struct
+import sys
+
+FRAME_TELEMETRY = 0x01
+FRAME_RECORDER_HEADER = 0x02
+FRAME_RECORDER_SAMPLES = 0x03
+FRAME_RUNLOG_CHUNK = 0x04
+FRAME_RUNLOG_END = 0x05
+FRAME_TELEMETRY_DELTA = 0x06
+
+# Grabador de vuelo (`dump log`): RecorderHeader y RecorderSample de include/protocol.h
+RECORDER_HEADER = struct.Struct('<BHHHHB')
+RECORDER_SAMPLE = struct.Struct('<Hhhhhhhhhbb')
+RECORDER_FIELDS = ['tick', 'linePos', 'lineIntegral', 'lineDeriv', 'linePidOut',
+                   'lTargetRpm', 'rTargetRpm', 'lRpm', 'rRpm', 'lPwm', 'rPwm']
+RECORDER_SCALES = [1, None, 1, 1, 10, 8, 8, 8, 8, 0.5, 0.5]
+TRIGGER_NAMES = {0: 'ninguno', 1: 'comando', 2: 'línea perdida', 4: 'cambio de estado', 8: 'desvío'}
+assert RECORDER_SAMPLE.size == 20
+# El Nano graba sin tick y con las RPM en un byte (RPM / 32); tick queda como índice
+RECORDER_SAMPLE_NANO = struct.Struct('<hhhhbbbbbb')
+RECORDER_SCALES_NANO = [None, 1, 1, 10, 1 / 32, 1 / 32, 1 / 32, 1 / 32, 0.5, 0.5]
+assert RECORDER_SAMPLE_NANO.size == 14
+
+# Registro de vueltas del ESP32 (`log read <id>`), ver esp32/include/runlog.h
+RUNLOG_SECTOR_HEADER = struct.Struct('<IIHH')
+RUNLOG_MAGIC = 0x474F4C52
+RUNLOG_REC_KEY = 0x01
+RUNLOG_REC_DELTA = 0x02
+RUNLOG_POS_SCALE = 1000
+
+# Grupos en el orden de TelemetryGroupId; cada campo es (nombre, formato struct, escala)
+TELEMETRY_GROUPS = [
+    ('sys', [('uptime', 'I', 1), ('loopTime', 'H', 1), ('battery', 'H', 1000),
+             ('curvature', 'h', 1), ('sensorState', 'B', 1), ('txDropped', 'H', 1),
+             ('profile', 'B', 1)]),
+    ('line', [('linePos', 'h', 1), ('lineError', 'h', 1), ('lineIntegral', 'h', 1),
+              ('lineDeriv', 'h', 1), ('linePidOut', 'h', 10)]),
+    ('left', [('lRpm', 'h', 8), ('lTargetRpm', 'h', 8), ('lError', 'h', 8), ('lIntegral', 'h', 1),
+              ('lDeriv', 'h', 1), ('lPidOut', 'h', 10), ('lSpeed', 'h', 1),
+              ('encL', 'i', 1), ('encLBackward', 'i', 1)]),
+    ('right', [('rRpm', 'h', 8), ('rTargetRpm', 'h', 8), ('rError', 'h', 8), ('rIntegral', 'h', 1),
+               ('rDeriv', 'h', 1), ('rPidOut', 'h', 10), ('rSpeed', 'h', 1),
+               ('encR', 'i', 1), ('encRBackward', 'i', 1)]),
+    ('speed', [('leftSpeedCms', 'h', 100), ('rightSpeedCms', 'h', 100)]),
+    ('qtr', [('s%d' % i, 'H', 1) for i in range(8)]),
+    ('rc', [('rcSeq', 'B', 1), ('rcLatencyUs', 'H', 1), ('rcErrors', 'H', 1)]),
+]
+assert sum(struct.calcsize('<' + ''.join(f for _, f, _ in fields))
+           for _, fields in TELEMETRY_GROUPS) == 93
+
+RC_FRAME_SYNC = 0xA5
+
+
+def crc16_ccitt(data):
+    crc = 0xFFFF
+    for b in data:
+        crc ^= b << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else (crc << 1)
+            crc &= 0xFFFF
+    return crc
+
+
+def cobs_decode(data):
+    out = bytearray()
+    i = 0
+    while i < len(data):
+        code = data[i]
+        if code == 0 or i + code > len(data) + 1:
+            return None
+        out += data[i + 1:i + code]
+        i += code
+        if code < 0xFF and i < len(data):
+            out.append(0)
+    return bytes(out)
+
+
+def get_varint(data, pos):
+    """Devuelve (valor, nueva posición) o (None, pos) si el varint está cortado."""
+    value, shift = 0, 0
+    while pos < len(data) and shift < 35:
+        b = data[pos]
+        pos += 1
+        value |= (b & 0x7F) << shift
+        if not b & 0x80:
+            return value, pos
+        shift += 7
+    return None, pos
+
+
+def zigzag_decode(v):
+    return (v >> 1) ^ -(v & 1)
+
+
+def wrap16(v, signed):
+    v &= 0xFFFF
+    return v - 0x10000 if signed and v & 0x8000 else v
+
+
+def decode_runlog_sector(data):
+    """Decodifica un sector del registro. Devuelve (cabecera, [tuplas crudas de RecorderSample])."""
+    if len(data) < RUNLOG_SECTOR_HEADER.size:
+        return None, []
+    magic, seq, run_id, period = RUNLOG_SECTOR_HEADER.unpack_from(data)
+    if magic != RUNLOG_MAGIC:
+        return None, []
+    header = {'seq': seq, 'runId': run_id, 'periodUs': period}
+    samples, last = [], None
+    pos = RUNLOG_SECTOR_HEADER.size
+    while pos < len(data):
+        tag = data[pos]
+        pos += 1
+        if tag == RUNLOG_REC_KEY and pos + RECORDER_SAMPLE.size <= len(data):
+            last = list(RECORDER_SAMPLE.unpack_from(data, pos))
+            pos += RECORDER_SAMPLE.size
+        elif tag == RUNLOG_REC_DELTA and last is not None:
+            values = []
+            for i in range(len(RECORDER_FIELDS)):
+                v, pos = get_varint(data, pos)
+                if v is None:
+                    return header, samples
+                values.append(v)
+            # tick es u16; pwm es int8 pero la diferencia viaja como int16
+            last = [wrap16(prev + zigzag_decode(d), i != 0) for i, (prev, d) in enumerate(zip(last, values))]
+        else:
+            break
+        samples.append(tuple(last))
+    return header, samples
+
+
+def rc_frame(seq, throttle, steering):
+    """Trama RC binaria: 0xA5 | seq:u8 | throttle:i16 | steering:i16 | crc16:u16 (RPM).
+
+    El robot solo reconoce el 0xA5 al principio de una línea: mandarla entre líneas completas.
+    """
+    body = struct.pack('<Bhh', seq & 0xFF, int(throttle), int(steering))
+    return bytes([RC_FRAME_SYNC]) + body + struct.pack('<H', crc16_ccitt(body))
+
+
+def parse_frame(chunk):
+    """Devuelve (tipo, seq, payload) o None si el bloque no es una trama válida."""
+    raw = cobs_decode(chunk)
+    if raw is None or len(raw) < 5:
+        return None
+    body, crc = raw[:-2], struct.unpack('<H', raw[-2:])[0]
+    if crc16_ccitt(body) != crc:
+        return None
+    return body[0], struct.unpack('<H', body[1:3])[0], body[3:]
+
+
+def decode_telemetry_raw(payload):
+    """Payload = máscara:u8 + grupos marcados. Devuelve (máscara, {grupo: [valores crudos]})."""
+    mask, pos = payload[0], 1
+    groups = {}
+    for g, (_, fields) in enumerate(TELEMETRY_GROUPS):
+        if not mask & (1 << g):
+            continue
+        fmt = '<' + ''.join(f for _, f, _ in fields)
+        size = struct.calcsize(fmt)
+        if pos + size > len(payload):
+            return None
+        groups[g] = list(struct.unpack_from(fmt, payload, pos))
+        pos += size
+    return mask, groups
+
+
+def apply_telemetry_delta(payload, ref):
+    """Suma los deltas de FRAME_TELEMETRY_DELTA a `ref` ({grupo: valores}). Devuelve
+    (máscara, grupos) o None si falta la referencia de algún grupo o la trama está cortada."""
+    mask = payload[0]
+    count = sum(len(fields) for g, (_, fields) in enumerate(TELEMETRY_GROUPS) if mask & (1 << g))
+    bitmap = int.from_bytes(payload[1:1 + (count + 7) // 8], 'little')
+    pos, bit = 1 + (count + 7) // 8, 0
+    groups = {}
+    for g, (_, fields) in enumerate(TELEMETRY_GROUPS):
+        if not mask & (1 << g):
+            continue
+        if g not in ref:
+            return None
+        values = []
+        for (_, fmt, _), prev in zip(fields, ref[g]):
+            zz = 0
+            if bitmap >> bit & 1:
+                zz, pos = get_varint(payload, pos)
+                if zz is None:
+                    return None
+            bit += 1
+            bits = struct.calcsize(fmt) * 8
+            v = (prev + zigzag_decode(zz)) & ((1 << bits) - 1)
+            if fmt.islower() and v >> (bits - 1):
+                v -= 1 << bits
+            values.append(v)
+        groups[g] = values
+    return mask, groups
+
+
+def scale_telemetry(mask, groups):
+    data = {'groups': [name for g, (name, _) in enumerate(TELEMETRY_GROUPS) if mask & (1 << g)]}
+    for g, values in groups.items():
+        for (name, _, scale), v in zip(TELEMETRY_GROUPS[g][1], values):
+            data[name] = v / scale if scale != 1 else v
+    return data
+
+
+def decode_telemetry(payload):
+    """Payload = máscara:u8 + grupos marcados. Devuelve dict solo con esos campos."""
+    raw = decode_telemetry_raw(payload)
+    return scale_telemetry(*raw) if raw else None
+
+
+def decode_recorder_header(payload):
+    reason, samples, trigger, period, pos_scale, size = RECORDER_HEADER.unpack(payload[:RECORDER_HEADER.size])
+    return {'reason': TRIGGER_NAMES.get(reason, reason), 'samples': samples,
+            'triggerIndex': trigger, 'periodUs': period, 'posScale': pos_scale, 'sampleSize': size}
+
+
+def decode_recorder_samples(payload, pos_scale=1, sample_size=RECORDER_SAMPLE.size):
+    """Devuelve (índice de la primera muestra, lista de dicts)."""
+    first = struct.unpack_from('<H', payload)[0]
+    nano = sample_size == RECORDER_SAMPLE_NANO.size
+    layout, fields, scales = ((RECORDER_SAMPLE_NANO, RECORDER_FIELDS[1:], RECORDER_SCALES_NANO) if nano
+                              else (RECORDER_SAMPLE, RECORDER_FIELDS, RECORDER_SCALES))
+    samples = []
+    for off in range(2, len(payload) - layout.size + 1, layout.size):
+        values = layout.unpack_from(payload, off)
+        sample = {'tick': first + len(samples)} if nano else {}
+        for name, scale, v in zip(fields, scales, values):
+            scale = pos_scale if scale is None else scale
+            sample[name] = v / scale if scale != 1 else v
+        samples.append(sample)
+    return first, samples
+
+
+class StreamDecoder:
+    """Separa tramas binarias y texto en un flujo de bytes."""
+
+    def __init__(self):
+        self.buffer = bytearray()
+        self.last_seq = None
+        self.lost = 0
+        self.pos_scale = 1
+        self.sample_size = RECORDER_SAMPLE.size
+        self.delta_ref = {}      # Último valor crudo de cada grupo (modo delta)
+        self.delta_skipped = 0   # Tramas delta sin referencia (esperando clave)
+
+    def feed(self, data):
+        """Generador de ('telemetry', dict), ('recorder_header', dict),
+        ('recorder_samples', (índice, [dict])) y ('text', str)."""
+        self.buffer += data
+        while True:
+            end = self.buffer.find(b'\x00')
+            if end < 0:
+                break
+            chunk = bytes(self.buffer[:end])
+            del self.buffer[:end + 1]
+            if not chunk:
+                continue
+            frame = parse_frame(chunk)
+            if frame is None:
+                for line in chunk.decode('utf-8', 'replace').splitlines():
+                    if line.strip():
+                        yield 'text', line.strip()
+                continue
+            ftype, seq, payload = frame
+            if self.last_seq is not None:
+                gap = (seq - self.last_seq - 1) & 0xFFFF
+                if gap:
+                    self.lost += gap
+                    self.delta_ref = {}
+            self.last_seq = seq
+            if ftype in (FRAME_TELEMETRY, FRAME_TELEMETRY_DELTA) and payload:
+                if ftype == FRAME_TELEMETRY:
+                    raw = decode_telemetry_raw(payload)
+                    # Igual que el robot: la clave deja como referencia solo sus grupos
+                    if raw:
+                        self.delta_ref = dict(raw[1])
+                else:
+                    raw = apply_telemetry_delta(payload, self.delta_ref)
+                    if raw:
+                        self.delta_ref.update(raw[1])
+                    else:
+                        self.delta_skipped += 1
+                if raw is not None:
+                    data = scale_telemetry(*raw)
+                    data['seq'] = seq
+                    yield 'telemetry', data
+            elif ftype == FRAME_RECORDER_HEADER:
+                header = decode_recorder_header(payload)
+                self.pos_scale = header['posScale'] or 1
+                self.sample_size = header['sampleSize']
+                yield 'recorder_header', header
+            elif ftype == FRAME_RECORDER_SAMPLES:
+                yield 'recorder_samples', decode_recorder_samples(payload, self.pos_scale, self.sample_size)
+            elif ftype == FRAME_RUNLOG_CHUNK and len(payload) >= 8:
+                run_id, sector_seq, offset = struct.unpack_from('<HIH', payload)
+                yield 'runlog_chunk', (run_id, sector_seq, offset, payload[8:])
+            elif ftype == FRAME_RUNLOG_END and len(payload) >= 4:
+                yield 'runlog_end', struct.unpack_from('<HH', payload)
+
+
+def dump_log(ser, path):
+    """Pide `dump log` y guarda las muestras en CSV (columna trigger=1 en la del disparo)."""
+    import csv
+    import time
+    ser.write(b'dump log\n')
+    decoder = StreamDecoder()
+    header, rows = None, {}
+    deadline = time.time() + 10
+    while time.time() < deadline:
+        for kind, value in decoder.feed(ser.read(512)):
+            if kind == 'recorder_header':
+                header, rows = value, {}
+                print('Cabecera:', header)
+            elif kind == 'recorder_samples':
+                first, samples = value
+                for i, sample in enumerate(samples):
+                    rows[first + i] = sample
+            elif kind == 'text':
+                print(value)
+        if header and len(rows) >= header['samples']:
+            break
+    if not header:
+        print('Sin respuesta del robot')
+        return
+    with open(path, 'w', newline='') as f:
+        writer = csv.writer(f)
+        writer.writerow(['index', 'time_ms', 'trigger'] + RECORDER_FIELDS)
+        for i in sorted(rows):
+            t = (i - header['triggerIndex']) * header['periodUs'] / 1000.0
+            writer.writerow([i, t, int(i == header['triggerIndex'])] +
+                            [rows[i][k] for k in RECORDER_FIELDS])
+    print('%d/%d muestras en %s (perdidas en el enlace: %d)' % (len(rows), header['samples'], path, decoder.lost))
+
+
+def read_runlog(ser, run_id, path):
+    """Pide `log read <id>` al ESP32 y guarda la vuelta en CSV."""
+    import csv
+    import time
+    ser.write(('log read %d\n' % run_id).encode())
+    decoder = StreamDecoder()
+    sectors, done = {}, None
+    deadline = time.time() + 60
+    while time.time() < deadline and done is None:
+        for kind, value in decoder.feed(ser.read(512)):
+            if kind == 'runlog_chunk':
+                rid, seq, offset, data = value
+                buf = sectors.setdefault(seq, bytearray())
+                if offset == len(buf):
+                    buf += data
+            elif kind == 'runlog_end':
+                done = value
+            elif kind == 'text':
+                print(value)
+    if done is None:
+        print('Sin respuesta del robot')
+        return
+    rows, period = [], None
+    for seq in sorted(sectors):
+        header, samples = decode_runlog_sector(bytes(sectors[seq]))
+        if header is None:
+            print('Sector %d inválido' % seq)
+            continue
+        period = header['periodUs']
+        rows += samples
+    with open(path, 'w', newline='') as f:
+        writer = csv.writer(f)
+        writer.writerow(['index', 'time_ms'] + RECORDER_FIELDS)
+        for i, values in enumerate(rows):
+            sample = []
+            for scale, v in zip(RECORDER_SCALES, values):
+                scale = RUNLOG_POS_SCALE if scale is None else scale
+                sample.append(v / scale if scale != 1 else v)
+            writer.writerow([i, i * (period or 0) / 1000.0] + sample)
+    print('Vuelta %d: %d/%d sectores, %d muestras en %s (perdidas en el enlace: %d)'
+          % (run_id, len(sectors), done[1], len(rows), path, decoder.lost))
+
+
+def negotiate_baud(ser, rate, timeout=1.0):
+    """Sube el puerto a `rate`: el robot responde a la velocidad vieja, conmuta y
+    espera `baud ok` a la nueva; si no llega, vuelve solo. Devuelve True si quedó."""
+    import time
+    old = ser.baudrate
+    ser.write(b'set baud %d\n' % rate)
+    ser.flush()
+    time.sleep(0.2)  # ack a la velocidad vieja
+    ser.reset_input_buffer()
+    ser.baudrate = rate
+    time.sleep(0.05)
+    ser.write(b'baud ok\n')
+    decoder = StreamDecoder()
+    deadline = time.time() + timeout
+    while time.time() < deadline:
+        for kind, value in decoder.feed(ser.read(256)):
+            if kind == 'text' and 'Baud:' in value:
+                return True
+    ser.baudrate = old
+    return False
+
+
+RX_WINDOW = 64        # buffer RX del HardwareSerial del Nano
+BATCH_MAX = 16        # COMMAND_BATCH_MAX en include/config.h
+
+
+def pack_batches(commands, limit=RX_WINDOW):
+    """Agrupa comandos en líneas `cmd;cmd;...` de hasta `limit` bytes con el prefijo."""
+    batches, current = [], []
+    for cmd in commands:
+        line_len = len(';'.join(current + [cmd])) + len('@65535 \n')
+        if current and (line_len > limit or len(current) == BATCH_MAX):
+            batches.append(current)
+            current = []
+        current.append(cmd)
+    if current:
+        batches.append(current)
+    return batches
+
+
+def push_config(ser, commands, timeout=2.0):
+    """Envía los comandos en lotes secuenciados, con varias líneas en vuelo mientras
+    quepan en el buffer RX del robot. Devuelve la lista de comandos rechazados."""
+    import time
+    pending = list(enumerate(pack_batches(commands)))
+    next_seq = len(pending)
+    in_flight = {}  # seq -> (comandos, bytes)
+    rejected = []
+    decoder = StreamDecoder()
+    deadline = time.time() + timeout
+    while pending or in_flight:
+        while pending:
+            seq, batch = pending[0]
+            line = ('@%d %s\n' % (seq, ';'.join(batch))).encode()
+            if in_flight and sum(n for _, n in in_flight.values()) + len(line) > RX_WINDOW:
+                break
+            ser.write(line)
+            in_flight[seq] = (batch, len(line))
+            pending.pop(0)
+        for kind, value in decoder.feed(ser.read(256)):
+            if kind != 'text' or 'acks:' not in value:
+                continue
+            seq, count, mask = value.split('acks:')[1].strip().split(',')
+            batch, _ = in_flight.pop(int(seq), ([], 0))
+            count, mask = int(count), int(mask, 16)
+            rejected += [c for i, c in enumerate(batch[:count]) if not mask >> i & 1]
+            if count < len(batch):
+                # Lote truncado en el robot: el resto vuelve a la cola con seq nuevo
+                pending.append((next_seq, batch[count:]))
+                next_seq += 1
+            deadline = time.time() + timeout
+        if time.time() > deadline:
+            for batch, _ in in_flight.values():
+                rejected += batch
+            break
+    return rejected
+
+
+def measure_rc_latency(ser, count):
+    """Necesita `set mode 2`. Con el grupo rc en cada tick, mide el tiempo desde que se
+    escribe la trama hasta que su seq vuelve en la telemetría."""
+    import time
+    ser.write(b'set telemetry 2\n')
+    ser.write(b'subscribe rc 1\n')
+    decoder = StreamDecoder()
+    round_trips, on_robot = [], []
+    for i in range(count):
+        seq = i & 0xFF
+        sent = time.time()
+        ser.write(rc_frame(seq, 0, 0))
+        deadline = sent + 0.5
+        while time.time() < deadline:
+            done = False
+            for kind, value in decoder.feed(ser.read(64)):
+                if kind == 'telemetry' and value.get('rcSeq') == seq:
+                    round_trips.append((time.time() - sent) * 1000)
+                    on_robot.append(value['rcLatencyUs'] / 1000.0)
+                    done = True
+            if done:
+                break
+        time.sleep(0.02)
+    ser.write(b'subscribe none\n')
+    if not round_trips:
+        print('Sin eco de rcSeq (¿modo remoto? `set mode 2`)')
+        return
+    round_trips.sort()
+    on_robot.sort()
+    print('%d/%d tramas. Ida y vuelta ms: mediana %.2f, p95 %.2f. Recepción->PWM ms: mediana %.2f, máx %.2f'
+          % (len(round_trips), count, round_trips[len(round_trips) // 2],
+             round_trips[int(len(round_trips) * 0.95)], on_robot[len(on_robot) // 2], on_robot[-1]))
+
+
+def main():
+    import serial
+    args = sys.argv[1:]
+    rate = None
+    if '--baud' in args:
+        i = args.index('--baud')
+        rate = int(args[i + 1])
+        del args[i:i + 2]
+    sys.argv[1:] = args
+    port = sys.argv[1] if len(sys.argv) > 1 else '/dev/ttyUSB0'
+    baud = int(sys.argv[2]) if len(sys.argv) > 2 else 115200
+    ser = serial.Serial(port, baud, timeout=0.1)
+    if rate and rate != baud:
+        if not negotiate_baud(ser, rate):
+            print('El robot no confirmó %d baud, sigue en %d' % (rate, baud))
+        else:
+            print('Puerto a %d baud' % rate)
+    if len(sys.argv) > 3 and sys.argv[3] == '--dump':
+        dump_log(ser, sys.argv[4] if len(sys.argv) > 4 else 'flight_log.csv')
+        ser.close()
+        return
+    if len(sys.argv) > 3 and sys.argv[3] == '--rc-latency':
+        measure_rc_latency(ser, int(sys.argv[4]) if len(sys.argv) > 4 else 100)
+        ser.close()
+        return
+    if len(sys.argv) > 4 and sys.argv[3] == '--push':
+        with open(sys.argv[4]) as f:
+            commands = [l.strip() for l in f if l.strip() and not l.startswith('#')]
+        rejected = push_config(ser, commands)
+        print('%d comandos, %d rechazados' % (len(commands), len(rejected)))
+        for cmd in rejected:
+            print('  ' + cmd)
+        ser.close()
+        return
+    if len(sys.argv) > 4 and sys.argv[3] == '--runlog':
+        run_id = int(sys.argv[4])
+        read_runlog(ser, run_id, sys.argv[5] if len(sys.argv) > 5 else 'run_%d.csv' % run_id)
+        ser.close()
+        return
+    subs = sys.argv[3:]
+    mode = 2
+    if subs and subs[0] == '--delta':
+        subs, mode = subs[1:], 3
+    ser.write(b'set telemetry %d\n' % mode)
+    for sub in subs:
+        ser.write(('subscribe %s\n' % sub).encode())
+    decoder = StreamDecoder()
+    try:
+        while True:
+            for kind, value in decoder.feed(ser.read(512)):
+                if kind == 'telemetry':
+                    fields = ' '.join('%s=%s' % (k, v) for k, v in value.items()
+                                      if k not in ('seq', 'groups'))
+                    print('#%d [%s] %s (perdidas: %d)' % (value['seq'], ','.join(value['groups']),
+                                                          fields, decoder.lost))
+                else:
+                    print(value)
+    except KeyboardInterrupt:
+        ser.write(b'subscribe none\n')
+        ser.write(b'set telemetry 0\n')
+        ser.close()
+
+
+if __name__ == '__main__':
+    main()